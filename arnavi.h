@@ -89,4 +89,9 @@ typedef struct {
 #pragma pack( pop )
 // sizeof(ARNAVI_RECORD_HEADER) = 7
 
+// состояние соединения (terminal_session_create)
+typedef struct {
+    uint32_t	uiPrevProbeg;	// предыдущее значение пробега
+} ARNAVI_SESSION;
+
 #endif
@@ -31,10 +31,11 @@
    parcel - the raw data from socket
    parcel_size - it length
    answer - pointer to ST_ANSWER structure (de.h)
+   session - decoder state of the connection (see de.h)
 */
-void terminal_decode(char *parcel, int parcel_size, ST_ANSWER *answer, ST_WORKER *worker)
+void terminal_decode(char *parcel, int parcel_size, ST_ANSWER *answer, ST_WORKER *worker, void *session)
 {
-	static __thread uint32_t uiPrevProbeg = 0;
+	ARNAVI_SESSION *as = (ARNAVI_SESSION *)session;
 	ARNAVI_HEADER *arnavi_header;
 	ARNAVI_RECORD_HEADER *record_header;
 	unsigned int iTemp, iDataSize, iDataReaded, iBuffPosition;
@@ -44,7 +45,7 @@ void terminal_decode(char *parcel, int parcel_size, ST_ANSWER *answer, ST_WORKER
 	struct tm tm_data;
 	ST_RECORD *record = NULL;
 
-	if( !parcel || parcel_size <= 0 || !answer )
+	if( !parcel || parcel_size <= 0 || !answer || !as )
 		return;
 
 	iBuffPosition = 0;
@@ -111,7 +112,7 @@ void terminal_decode(char *parcel, int parcel_size, ST_ANSWER *answer, ST_WORKER
 			iDataSize = record_header->SIZE;
 			iDataReaded = 0;
 
-			record = &answer->records[answer->count];
+			record = record_reset(&answer->records[answer->count]);
 			strcpy(record->imei, answer->lastpoint.imei);
 			strcpy(record->tracker, answer->lastpoint.tracker);
 			strcpy(record->hard, answer->lastpoint.hard);
@@ -309,9 +310,9 @@ void terminal_decode(char *parcel, int parcel_size, ST_ANSWER *answer, ST_WORKER
 
 					// my cpecific: probeg in meters from prev. mark
 					uiTemp = 10 * (*(uint32_t *)&parcel[iBuffPosition + 1]);
-					if( uiPrevProbeg && uiPrevProbeg <= uiTemp )
-						record->probeg = uiTemp - uiPrevProbeg;
-					uiPrevProbeg = uiTemp;
+					if( as->uiPrevProbeg && as->uiPrevProbeg <= uiTemp )
+						record->probeg = uiTemp - as->uiPrevProbeg;
+					as->uiPrevProbeg = uiTemp;
 
 					break;
 				case 151:	// Bit 0-15 - hdop, multiplied by 100, Bit 16-31 - reserved
@@ -385,14 +386,68 @@ void terminal_decode(char *parcel, int parcel_size, ST_ANSWER *answer, ST_WORKER
 //------------------------------------------------------------------------------
 
 
+/*
+   create decoder state of the connection (see de.h)
+   return pointer to ARNAVI_SESSION structure or NULL if error
+*/
+void *terminal_session_create(void)
+{
+	return calloc(1, sizeof(ARNAVI_SESSION));
+}
+//------------------------------------------------------------------------------
+
+// free decoder state of the connection
+void terminal_session_destroy(void *session)
+{
+	free(session);
+}
+//------------------------------------------------------------------------------
+
+/*
+   frame length function (see de.h)
+   buf - the raw data from socket
+   len - it length
+   return length of the frame, 0 if unknown yet or BAD_OBJ if not recognized
+*/
+int terminal_frame_length(char *buf, int len)
+{
+	unsigned int iBuffPosition;
+
+	if( !buf || len <= 0 )
+		return 0;
+
+	switch((uint8_t)buf[0]) {
+	case ARNAVI_ID_HEADER:
+		return sizeof(ARNAVI_HEADER);
+	case ARNAVI_ID_PACKAGE:	// 0x5B, parcel number, records, 0x5D
+
+		iBuffPosition = 2;
+		while( iBuffPosition < len ) {
+			if( (uint8_t)buf[iBuffPosition] == 0x5D )	// end of package
+				return iBuffPosition + 1;
+
+			if( iBuffPosition + sizeof(ARNAVI_RECORD_HEADER) > len )	// record header not received yet
+				return 0;
+
+			iBuffPosition += (sizeof(ARNAVI_RECORD_HEADER) + ((ARNAVI_RECORD_HEADER *)&buf[iBuffPosition])->SIZE + 1/*CRC*/);
+		}	// while( iBuffPosition < len )
+
+		return 0;
+	}	// switch((uint8_t)buf[0])
+
+	return BAD_OBJ;
+}
+//------------------------------------------------------------------------------
+
 /* encode function
    records - pointer to array of ST_RECORD struct.
    reccount - number of struct in array, and returning
    buffer - buffer for encoded data
    bufsize - size of buffer
+   session - encoder state of the connection (see de.h)
    return size of data in the buffer for encoded data
 */
-int terminal_encode(ST_RECORD *records, int reccount, char *buffer, int bufsize)
+int terminal_encode(ST_RECORD *records, int reccount, char *buffer, int bufsize, void *session)
 {
 	int top = 0;
 	return top;
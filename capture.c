@@ -0,0 +1,297 @@
+/*
+    capture.c
+    recorder of the raw parcels of the terminals & answers
+    (log_all, log_imei) instead of file per parcel (log2file)
+    note:
+    1. Workers write parcel with header (ST_CAPTURE_ENTRY: direction,
+    listener, imei, time, terminal address) into ring buffer (ring.c),
+    if it is full, parcel dropped & counted, workers never wait disk.
+    2. Capture thread writes batch of the parcels into segment file
+    <seq>.cap (seq - 16 hex digits) by one writev call & index entries
+    (ST_CAPTURE_INDEX: time, offset, size, imei) into <seq>.idx,
+    so parcels of the terminal found without reading of the segments.
+    3. Segment closed after capture_segment bytes, only last
+    capture_files segments kept, older removed.
+*/
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <sys/syscall.h>	/* syscall */
+#include <stdlib.h> /* malloc */
+#include <string.h> /* memcpy */
+#include <errno.h>  /* errno */
+#include <unistd.h> /* close */
+#include <fcntl.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/time.h>   /* gettimeofday */
+#include <sys/stat.h>
+#include <sys/uio.h>    /* writev */
+#include "glonassd.h"
+#include "capture.h"
+#include "ring.h"
+#include "logger.h"
+
+#define CAPTURE_MAGIC (0x50414343)  // "CCAP"
+
+// ring buffer from workers to capture thread, created once & not freed
+static ST_RING *capture_ring = NULL;
+
+/*
+    utilite functions
+*/
+
+// file name of the segment or index: ext - "cap" | "idx"
+static char *capture_name(uint64_t seq, const char *ext, char *name)
+{
+    snprintf(name, FILENAME_MAX, "%.4060s/%016llx.%s", stConfigServer.capture, (unsigned long long)seq, ext);
+    return name;
+}
+//------------------------------------------------------------------------------
+
+// remove segment & index
+static void capture_remove(uint64_t seq)
+{
+    char name[FILENAME_MAX];
+
+    unlink(capture_name(seq, "cap", name));
+    unlink(capture_name(seq, "idx", name));
+}
+//------------------------------------------------------------------------------
+
+/*
+    last segment of the previous run, older segments removed
+    return number of the last segment or 0 if not found
+*/
+static uint64_t capture_scan(unsigned int files)
+{
+    DIR *dir;
+    struct dirent *entry;
+    unsigned long long seq, min_seq = 0, max_seq = 0;
+
+    if( mkdir(stConfigServer.capture, S_IRWXU) && errno != EEXIST ) {
+        logging("capture: mkdir(%s) error %d: %s\n", stConfigServer.capture, errno, strerror(errno));
+        return 0;
+    }
+
+    dir = opendir(stConfigServer.capture);
+    if( !dir ) {
+        logging("capture: opendir(%s) error %d: %s\n", stConfigServer.capture, errno, strerror(errno));
+        return 0;
+    }
+
+    while( (entry = readdir(dir)) ) {
+        if( strlen(entry->d_name) != 20 || strcmp(&entry->d_name[16], ".cap") || sscanf(entry->d_name, "%16llx", &seq) != 1 )
+            continue;
+        if( !min_seq || seq < min_seq )
+            min_seq = seq;
+        if( seq > max_seq )
+            max_seq = seq;
+    }
+    closedir(dir);
+
+    // new segment max_seq + 1 will be created
+    for(seq = min_seq; seq && seq + files <= max_seq + 1; seq++)
+        capture_remove(seq);
+
+    return max_seq;
+}
+//------------------------------------------------------------------------------
+
+/*
+    main functions
+*/
+
+/*
+    create ring buffer to capture thread once, size not changed by reconfigure
+    size - size of the ring buffer in bytes
+    return 1 if success or 0 if error
+*/
+int capture_create(size_t size)
+{
+    if( !capture_ring )
+        capture_ring = ring_create(size ? size : CAPTURE_QUEUE_SIZE);
+    return capture_ring != NULL;
+}
+//------------------------------------------------------------------------------
+
+/*
+    write parcel into ring buffer of the capture thread, any thread
+    direction - CAPTURE_IN | CAPTURE_OUT
+    listener, port - listener (protocol) of the terminal
+    imei - imei of the terminal or NULL
+    peer - address of the terminal or NULL
+    parcel - data, size - size of the data
+*/
+void capture_write(int direction, const char *listener, int port, const char *imei, struct sockaddr_in *peer, char *parcel, size_t size)
+{
+    ST_CAPTURE_ENTRY *entry;
+    struct timeval tv;
+    uint64_t ticket;
+
+    if( !capture_ring || !parcel || !size )
+        return;
+
+    // ring full: parcel dropped, counted by ring
+    entry = (ST_CAPTURE_ENTRY *)ring_reserve(capture_ring, sizeof(ST_CAPTURE_ENTRY) + size, &ticket);
+    if( !entry )
+        return;
+
+    gettimeofday(&tv, NULL);
+    memset(entry, 0, sizeof(ST_CAPTURE_ENTRY));
+    entry->magic = CAPTURE_MAGIC;
+    entry->size = size;
+    entry->time = (int64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+    if( peer ) {
+        entry->peer_ip = peer->sin_addr.s_addr;
+        entry->peer_port = ntohs(peer->sin_port);
+    }
+    entry->port = port;
+    entry->direction = direction;
+    if( listener )
+        strncpy(entry->listener, listener, CAPTURE_NAME_SIZE - 1);
+    if( imei )
+        strncpy(entry->imei, imei, SIZE_TRACKER_FIELD - 1);
+    memcpy(entry + 1, parcel, size);
+
+    ring_commit(capture_ring, ticket);
+}
+//------------------------------------------------------------------------------
+
+/*
+    capture thread function
+    started from func. setup in glonassd.c, if capture_create success
+*/
+void *capture_thread_func(void *arg)
+{
+    static __thread struct iovec iov[RING_BATCH];
+    static __thread ST_CAPTURE_INDEX index[RING_BATCH];
+    static __thread uint64_t seq;
+    static __thread int fd_cap, fd_idx;
+    static __thread off_t pos;
+    ST_CAPTURE_ENTRY *entry;
+    char name[FILENAME_MAX];
+    unsigned int count, files, i;
+    unsigned long long overflows;
+    size_t size, segment;
+    ssize_t written;
+    time_t last_check = 0, now;
+    int cancel_state;
+
+    // close current segment
+    void capture_close(void) {
+        if( fd_cap != BAD_OBJ )
+            close(fd_cap);
+        if( fd_idx != BAD_OBJ )
+            close(fd_idx);
+        fd_cap = fd_idx = BAD_OBJ;
+    }
+
+    // next segment, older than capture_files removed
+    int capture_next(void) {
+        capture_close();
+        seq++;
+        if( seq > files )
+            capture_remove(seq - files);
+
+        pos = 0;
+        fd_cap = open(capture_name(seq, "cap", name), O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, S_IRUSR | S_IWUSR | S_IRGRP);
+        if( fd_cap == BAD_OBJ ) {
+            logging("capture[%ld]: open(%s) error %d: %s\n", syscall(SYS_gettid), name, errno, strerror(errno));
+            return 0;
+        }
+        fd_idx = open(capture_name(seq, "idx", name), O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, S_IRUSR | S_IWUSR | S_IRGRP);
+        if( fd_idx == BAD_OBJ ) {
+            logging("capture[%ld]: open(%s) error %d: %s\n", syscall(SYS_gettid), name, errno, strerror(errno));
+            capture_close();
+            return 0;
+        }
+        return 1;
+    }
+
+    /*
+        write batch of the parcels from ring buffer into segment
+        return number of the parcels
+    */
+    unsigned int capture_batch(void) {
+        count = 0;
+        while( count < RING_BATCH && (entry = (ST_CAPTURE_ENTRY *)ring_read(capture_ring, &size)) ) {
+            if( size < sizeof(ST_CAPTURE_ENTRY) || entry->magic != CAPTURE_MAGIC )
+                continue;
+
+            iov[count].iov_base = entry;
+            iov[count].iov_len = size;
+            index[count].time = entry->time;
+            index[count].size = entry->size;
+            index[count].port = entry->port;
+            index[count].direction = entry->direction;
+            memcpy(index[count].imei, entry->imei, SIZE_TRACKER_FIELD);
+            count++;
+        }
+
+        if( count && (fd_cap != BAD_OBJ || capture_next()) ) {
+            for(i = 0; i < count; i++) {
+                index[i].offset = pos;
+                pos += iov[i].iov_len;
+            }
+
+            written = writev(fd_cap, iov, count);
+            if( written < 0 )
+                logging("capture[%ld]: writev error %d: %s\n", syscall(SYS_gettid), errno, strerror(errno));
+            else if( write(fd_idx, index, count * sizeof(ST_CAPTURE_INDEX)) < 0 )
+                logging("capture[%ld]: write index error %d: %s\n", syscall(SYS_gettid), errno, strerror(errno));
+
+            if( written < 0 || pos >= (off_t)segment )
+                capture_next();
+        }
+
+        ring_release(capture_ring);
+        return count;
+    }
+
+    // eror handler:
+    void exit_capture(void * arg) {
+        // save parcels from ring buffer
+        while( capture_batch() );
+        capture_close();
+        logging("capture[%ld] destroyed\n", syscall(SYS_gettid));
+    }
+
+    fd_cap = fd_idx = BAD_OBJ;
+    files = stConfigServer.capture_files > 0 ? stConfigServer.capture_files : CAPTURE_FILES;
+    segment = stConfigServer.capture_segment ? stConfigServer.capture_segment : CAPTURE_SEGMENT_SIZE;
+    seq = capture_scan(files);
+
+    // install eror handler:
+    pthread_cleanup_push(exit_capture, arg);
+
+    logging("capture[%ld] started, directory %s\n", syscall(SYS_gettid), stConfigServer.capture);
+
+    while( 1 ) {
+        pthread_testcancel();
+
+        // parcels must not be written twice
+        pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &cancel_state);
+        count = capture_batch();
+        pthread_setcancelstate(cancel_state, NULL);
+
+        if( !count )
+            ring_wait(capture_ring, 1000);
+
+        now = time(NULL);
+        if( now != last_check ) {
+            last_check = now;
+            overflows = ring_overflows(capture_ring);
+            if( overflows )
+                logging("capture[%ld]: ring buffer full, %llu parcels lost\n", syscall(SYS_gettid), overflows);
+        }
+    }	// while( 1 )
+
+    // clear error handler with run it (0 - not run, 1 - run)
+    pthread_cleanup_pop(1);
+
+    return NULL;
+}
+//------------------------------------------------------------------------------
@@ -0,0 +1,51 @@
+/*
+    capture.h
+    recorder of the raw parcels of the terminals & answers
+    (log_all, log_imei) into segment files with index, see capture.c
+*/
+#ifndef __CAPTURE__
+#define __CAPTURE__
+
+#include <stdint.h>
+#include <netinet/in.h> /* sockaddr_in */
+#include "de.h"         /* SIZE_TRACKER_FIELD */
+
+#define CAPTURE_IN (0)      // parcel from terminal
+#define CAPTURE_OUT (1)     // answer to terminal
+#define CAPTURE_QUEUE_SIZE (16*1024*1024)       // default size of the ring buffer to capture thread
+#define CAPTURE_SEGMENT_SIZE (64*1024*1024)     // default size of the segment file
+#define CAPTURE_FILES (16)                      // default number of the segment files kept
+#define CAPTURE_NAME_SIZE (16)                  // max. size of the listener name in header
+
+#pragma pack( push, 1 )
+// header of the parcel in segment file <seq>.cap, then parcel
+typedef struct {
+    uint32_t magic;         // CAPTURE_MAGIC
+    uint32_t size;          // size of the parcel, bytes
+    int64_t time;           // time of the parcel, microseconds since epoch
+    uint32_t peer_ip;       // IPv4 address of the terminal, network byte order
+    uint16_t peer_port;     // port of the terminal
+    uint16_t port;          // port of the listener
+    uint8_t direction;      // CAPTURE_IN | CAPTURE_OUT
+    char listener[CAPTURE_NAME_SIZE];   // name of the listener (protocol)
+    char imei[SIZE_TRACKER_FIELD];      // imei of the terminal, empty if not known yet
+} ST_CAPTURE_ENTRY;
+
+// entry of the index file <seq>.idx, one per parcel in segment <seq>.cap
+typedef struct {
+    int64_t time;           // time of the parcel, microseconds since epoch
+    uint64_t offset;        // offset of the ST_CAPTURE_ENTRY in segment
+    uint32_t size;          // size of the parcel, bytes
+    uint16_t port;          // port of the listener
+    uint8_t direction;      // CAPTURE_IN | CAPTURE_OUT
+    char imei[SIZE_TRACKER_FIELD];
+} ST_CAPTURE_INDEX;
+#pragma pack( pop )
+
+int capture_create(size_t size);
+// any thread
+void capture_write(int direction, const char *listener, int port, const char *imei, struct sockaddr_in *peer, char *parcel, size_t size);
+// capture thread
+void *capture_thread_func(void *arg);
+
+#endif
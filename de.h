@@ -9,6 +9,7 @@
 
 #include <stdio.h>  /* snprintf, FILENAME_MAX */
 #include <stdlib.h> /* malloc */
+#include <stddef.h> /* offsetof */
 #include <string.h> /* memset */
 #include <errno.h>  /* errno */
 #include <time.h>   /* localtime */
@@ -80,8 +81,8 @@ typedef struct {
    field error not used
    fiels size = length of the answer to terminal in bytes or 0 if no answer
    field count = count decoded records or 0
-   field answer: answer to terminal, bytes
-   field records: array of decoded records from terminal
+   field answer: answer to terminal, bytes, only answer->size bytes valid
+   field records: array of decoded records from terminal, not cleared (see record_reset)
    field lastpoint: last decoded record
 */
 typedef struct {
@@ -94,4 +95,66 @@ typedef struct {
 } ST_ANSWER;
 // sizeof(ST_ANSWER)=11056
 
+/*
+   clear record before decoding into it
+   caller (worker) not clear records of the answer, decoder must call this function
+   for every new record; field message cleared as empty string only
+   return record
+*/
+static inline ST_RECORD *record_reset(ST_RECORD *record)
+{
+    memset(record, 0, offsetof(ST_RECORD, message));
+    record->message[0] = 0;
+    return record;
+}
+
+/*
+   clear answer before decoding, but save lastpoint
+   only counters cleared, field answer is valid for answer->size bytes
+*/
+static inline void answer_reset(ST_ANSWER *answer)
+{
+    answer->error = 0;
+    answer->size = 0;
+    answer->count = 0;
+    answer->answer[0] = 0;
+}
+
+/*
+   optional function of the decoder shared library, splits TCP stream into frames
+   buf - the raw data from socket (begin of the frame)
+   len - it length
+   return:
+   > 0 - length of the frame in bytes, may be greater than len (frame incomplete, wait the rest)
+   0 - length of the frame unknown yet, wait more data
+   BAD_OBJ - data not recognized, passed to terminal_decode as is
+   if library exports this function, terminal_decode called for every whole frame
+*/
+int terminal_frame_length(char *buf, int len);
+
+/*
+   optional functions of the decoder shared library, state of the decoder/encoder
+   per connection (terminal or forwarder), instead of static variables
+   terminal_session_create - called when connection started,
+   return state or NULL if error (connection refused)
+   terminal_session_destroy - called when connection closed, free state
+   state passed to terminal_decode & terminal_encode as last parameter (session),
+   if library not exports this functions, session is NULL
+*/
+void *terminal_session_create(void);
+void terminal_session_destroy(void *session);
+
+/*
+   optional function of the encoder shared library, packet encoded by one forwarder
+   sent by other forwarders of the same protocol without encode:
+   buffer - copy of the packet, encoded by terminal_encode with another session
+   size - size of the packet
+   session - encoder state of the connection (see terminal_session_create)
+   number of the packet, records & checksums in buffer replaced for this connection,
+   session updated as terminal_encode does it
+   return size of the packet or 0 if packet not recognized (forwarder encodes it)
+   if library exports terminal_session_create, but not this function, packet not shared
+*/
+int terminal_restamp(char *buffer, int size, void *session);
+
 #endif
\ No newline at end of file
@@ -13,6 +13,7 @@
 #include <string.h> /* memset */
 #include <errno.h>  /* errno */
 #include <stdint.h> /* uint8_t, etc... */
+#include <stddef.h> /* offsetof */
 #include "glonassd.h"
 #include "de.h"     // ST_ANSWER
 #include "lib.h"    // MIN, MAX, BETWEEN, CRC, etc...
@@ -27,10 +28,11 @@
    parcel - the raw data from socket
    parcel_size - it length
    answer - pointer to ST_ANSWER structure (de.h)
+   session - decoder state of the connection (see de.h)
 
    реализовано только самое необходимое для приема навигационных данных и датчиков
 */
-void terminal_decode(char *parcel, int parcel_size, ST_ANSWER *answer, ST_WORKER *worker)
+void terminal_decode(char *parcel, int parcel_size, ST_ANSWER *answer, ST_WORKER *worker, void *session)
 {
 	int parcel_pointer = 0, sdr_readed = 0, sdr_count = 0, srd_count = 0;
 	EGTS_PACKET_HEADER *pak_head;
@@ -39,17 +41,17 @@ void terminal_decode(char *parcel, int parcel_size, ST_ANSWER *answer, ST_WORKER
 	ST_RECORD *record = NULL;
     uint8_t service, result;
 
-	if( !parcel || parcel_size <= 0 || !answer )
+	if( !parcel || parcel_size <= 0 || !answer || !session )
 		return;
 
 	// создаем ответ на пакет
-	answer->size = packet_create(answer->answer, EGTS_PT_RESPONSE, worker);
+	answer->size = packet_create(answer->answer, EGTS_PT_RESPONSE, worker, session);
 
     again:
 
     // разбираем заголовок пакета
 	pak_head = (EGTS_PACKET_HEADER *)&parcel[parcel_pointer];
-	if( Parse_EGTS_PACKET_HEADER(answer, &parcel[parcel_pointer], parcel_size, worker) ) {
+	if( Parse_EGTS_PACKET_HEADER(answer, &parcel[parcel_pointer], parcel_size, worker, session) ) {
 		answer->size += packet_finalize(answer->answer, answer->size, worker);
 		return;
 	}
@@ -114,14 +116,14 @@ void terminal_decode(char *parcel, int parcel_size, ST_ANSWER *answer, ST_WORKER
 		if( !rec_head->RL ) {	// EGTS_PC_INVDATALEN
             if( answer->count || answer->size ) { // успели расшифровать несколько записей
                 // хрен с ней, отправим EGTS_PC_OK, а то шлют бесконечно эту битую запись
-                answer->size += responce_add_teledata_result(answer->answer, answer->size, EGTS_TELEDATA_SERVICE, rec_head->RN, EGTS_PC_OK);
+                answer->size += responce_add_teledata_result(answer->answer, answer->size, EGTS_TELEDATA_SERVICE, rec_head->RN, EGTS_PC_OK, session);
 
                 if( worker && (worker->listener->log_all || worker->listener->log_err) ) {
                     logging("terminal_decode[%s:%d]: SDR:EGTS_PC_INVDATALEN error, RESPONSE: EGTS_PC_OK\n", worker->listener->name, worker->listener->port);
                 }
             }
             else {
-    			answer->size += responce_add_teledata_result(answer->answer, answer->size, EGTS_TELEDATA_SERVICE, rec_head->RN, EGTS_PC_INVDATALEN);
+    			answer->size += responce_add_teledata_result(answer->answer, answer->size, EGTS_TELEDATA_SERVICE, rec_head->RN, EGTS_PC_INVDATALEN, session);
                 if( worker && (worker->listener->log_all || worker->listener->log_err) ) {
                     logging("terminal_decode[%s:%d]: SDR:EGTS_PC_INVDATALEN error, RESPONSE: EGTS_PC_INVDATALEN\n", worker->listener->name, worker->listener->port);
                 }
@@ -151,7 +153,7 @@ void terminal_decode(char *parcel, int parcel_size, ST_ANSWER *answer, ST_WORKER
                     logging("terminal_decode[%s:%d]: SRD:EGTS_PC_INVDATALEN error, RESPONSE: EGTS_PC_INVDATALEN\n", worker->listener->name, worker->listener->port);
                 }
 
-				answer->size += responce_add_teledata_result(answer->answer, answer->size, EGTS_TELEDATA_SERVICE, rec_head->RN, EGTS_PC_INVDATALEN);
+				answer->size += responce_add_teledata_result(answer->answer, answer->size, EGTS_TELEDATA_SERVICE, rec_head->RN, EGTS_PC_INVDATALEN, session);
 				answer->size += packet_finalize(answer->answer, answer->size, worker);
 				return;
 			}
@@ -202,7 +204,7 @@ void terminal_decode(char *parcel, int parcel_size, ST_ANSWER *answer, ST_WORKER
                 }
 
                 // разбираем данные
-                record = &answer->records[answer->count];
+                record = record_reset(&answer->records[answer->count]);
 				if( Parse_EGTS_SR_POS_DATA( (EGTS_SR_POS_DATA_RECORD *)&parcel[parcel_pointer], record, answer, worker ) ) {
 					memcpy(&answer->lastpoint, record, sizeof(ST_RECORD));
     				if( answer->count < MAX_RECORDS - 1 )
@@ -297,7 +299,7 @@ void terminal_decode(char *parcel, int parcel_size, ST_ANSWER *answer, ST_WORKER
             logging("terminal_decode[%s:%d]: END SUBRECORDS: %d readed\n", worker->listener->name, worker->listener->port, srd_count);
         }
 
-        answer->size += responce_add_teledata_result(answer->answer, answer->size, service, rec_head->RN, result);
+        answer->size += responce_add_teledata_result(answer->answer, answer->size, service, rec_head->RN, result, session);
         if( worker && worker->listener->log_all ) {
             logging("terminal_decode[%s:%d]: SDR %d readed, RESPONSE ADD EGTS_PC_OK\n", worker->listener->name, worker->listener->port, rec_head->RN);
         }
@@ -331,9 +333,8 @@ void terminal_decode(char *parcel, int parcel_size, ST_ANSWER *answer, ST_WORKER
    buffer - укакзатель на буфер, в котором формируется пакет
    pt - Тип пакета Транспортного Уровня
 */
-int packet_create(char *buffer, uint8_t pt, ST_WORKER *worker)
+int packet_create(char *buffer, uint8_t pt, ST_WORKER *worker, EGTS_SESSION *session)
 {
-	static unsigned short int PaketNumber = 0;	// packet number, joint for encode & decode
 	EGTS_PACKET_HEADER *pak_head = (EGTS_PACKET_HEADER *)buffer;
 	pak_head->PRV = 1;
 	pak_head->SKID = 0;
@@ -341,11 +342,11 @@ int packet_create(char *buffer, uint8_t pt, ST_WORKER *worker)
 	pak_head->HL = sizeof(EGTS_PACKET_HEADER);	// 11
 	pak_head->HE = 0;
 	pak_head->FDL = 0;
-	pak_head->PID = PaketNumber++;
+	pak_head->PID = session->PaketNumber++;
 	pak_head->PT = pt;	// Тип пакета Транспортного Уровня
 	//pak_head->HCS = CRC8((unsigned char *)pak_head, pak_head->HL-1); // see packet_finalize
 
-    //logging("packet_create, PaketNumber=%d, pak_head->PT=%d\n", PaketNumber, pak_head->PT);
+    //logging("packet_create, PaketNumber=%d, pak_head->PT=%d\n", session->PaketNumber, pak_head->PT);
 
 	return pak_head->HL;
 }
@@ -371,13 +372,12 @@ int responce_add_header(char *buffer, int pointer, uint16_t pid, uint8_t pr)
 crn - № SDR записи, не порядковый, а присланный, на которую формируется ответ
 rst - результат обработки записи
 */
-int responce_add_teledata_result(char *buffer, int pointer, uint8_t service, uint16_t crn, uint8_t rst)
+int responce_add_teledata_result(char *buffer, int pointer, uint8_t service, uint16_t crn, uint8_t rst, EGTS_SESSION *session)
 {
-    static int RECNUM = 0;
     int size = 0;
 
     if( service == EGTS_AUTH_SERVICE ){
-        RECNUM = 1;
+        session->RECNUM = 1;
     }
 
     if( sizeof(EGTS_TELEDATA_RESULT_HEADER) +
@@ -387,7 +387,7 @@ int responce_add_teledata_result(char *buffer, int pointer, uint8_t service, uin
         // заголовок записи
         EGTS_TELEDATA_RESULT_HEADER *rh = (EGTS_TELEDATA_RESULT_HEADER *)&buffer[pointer];
         rh->RL = sizeof(EGTS_SUBRECORD_HEADER) + sizeof(EGTS_SR_RECORD_RESPONSE_RECORD);
-        rh->RN = RECNUM;   // номер записи от 0 до 65535, цикл
+        rh->RN = session->RECNUM;   // номер записи от 0 до 65535, цикл
         rh->RFL = 64;       // RSOD=1
         rh->SST = service;
         rh->RST = service;
@@ -407,10 +407,10 @@ int responce_add_teledata_result(char *buffer, int pointer, uint8_t service, uin
     	EGTS_PACKET_HEADER *pak_head = (EGTS_PACKET_HEADER *)buffer;
     	pak_head->FDL += size;
 
-        if( ++RECNUM > 65535 )
-            RECNUM = 0;
+        if( ++session->RECNUM > 65535 )
+            session->RECNUM = 0;
 
-        //logging("RESPONSE_RECORD %d: CRN=%d RST=%d\n", RECNUM, crn, rst);
+        //logging("RESPONSE_RECORD %d: CRN=%d RST=%d\n", session->RECNUM, crn, rst);
     }
     else {
         // if(log_err)
@@ -511,37 +511,37 @@ unsigned short CRC16EGTS(unsigned char * pcBlock, unsigned short len)
 }
 //------------------------------------------------------------------------------
 
-int Parse_EGTS_PACKET_HEADER(ST_ANSWER *answer, char *pc, int parcel_size, ST_WORKER *worker)
+int Parse_EGTS_PACKET_HEADER(ST_ANSWER *answer, char *pc, int parcel_size, ST_WORKER *worker, EGTS_SESSION *session)
 {
     int retval = 0;
 	EGTS_PACKET_HEADER *ph = (EGTS_PACKET_HEADER *)pc;
 
 	if( ph->PRV != 1 /*|| (ph->PRF & 192)*/ ) {
-		answer->size += responce_add_teledata_result(answer->answer, answer->size, EGTS_TELEDATA_SERVICE, ph->PID, EGTS_PC_UNS_PROTOCOL);
+		answer->size += responce_add_teledata_result(answer->answer, answer->size, EGTS_TELEDATA_SERVICE, ph->PID, EGTS_PC_UNS_PROTOCOL, session);
 		retval = 1;
         //log2file("/home/locman/glonassd/logs/UNS_PROTOCOL", pc, parcel_size);
 	}
 
 	if( retval && ph->HL != 11 && ph->HL != 16 ) {
-		answer->size += responce_add_teledata_result(answer->answer, answer->size, EGTS_TELEDATA_SERVICE, ph->PID, EGTS_PC_INC_HEADERFORM);
+		answer->size += responce_add_teledata_result(answer->answer, answer->size, EGTS_TELEDATA_SERVICE, ph->PID, EGTS_PC_INC_HEADERFORM, session);
 		retval = 2;
         //log2file("/home/locman/glonassd/logs/INC_HEADERFORM", pc, parcel_size);
 	}
 
     if( retval && CRC8EGTS((unsigned char *)ph, ph->HL-1) != ph->HCS ) {
-		answer->size += responce_add_teledata_result(answer->answer, answer->size, EGTS_TELEDATA_SERVICE, ph->PID, EGTS_PC_HEADERCRC_ERROR);
+		answer->size += responce_add_teledata_result(answer->answer, answer->size, EGTS_TELEDATA_SERVICE, ph->PID, EGTS_PC_HEADERCRC_ERROR, session);
 		retval = 3;
         //log2file("/home/locman/glonassd/logs/HEADERCRC_ERROR", pc, parcel_size);
 	}
 
 	if( retval && (B5 & ph->PRF) ) {
-		answer->size += responce_add_teledata_result(answer->answer, answer->size, EGTS_TELEDATA_SERVICE, ph->PID, EGTS_PC_TTLEXPIRED);
+		answer->size += responce_add_teledata_result(answer->answer, answer->size, EGTS_TELEDATA_SERVICE, ph->PID, EGTS_PC_TTLEXPIRED, session);
 		retval = 4;
         //log2file("/home/locman/glonassd/logs/TTLEXPIRED", pc, parcel_size);
 	}
 
 	if( retval && !ph->FDL ) {
-		answer->size += responce_add_teledata_result(answer->answer, answer->size, EGTS_TELEDATA_SERVICE, ph->PID, EGTS_PC_OK);
+		answer->size += responce_add_teledata_result(answer->answer, answer->size, EGTS_TELEDATA_SERVICE, ph->PID, EGTS_PC_OK, session);
 		retval = 5;
         //log2file("/home/locman/glonassd/logs/EGTS_PC_OK", pc, parcel_size);
 	}
@@ -549,21 +549,21 @@ int Parse_EGTS_PACKET_HEADER(ST_ANSWER *answer, char *pc, int parcel_size, ST_WO
 	// проверяем CRC16
 	unsigned short *SFRCS = (unsigned short *)&pc[ph->HL + ph->FDL];
 	if( retval && *SFRCS != CRC16EGTS( (unsigned char *)&pc[ph->HL], ph->FDL) ) {
-		answer->size += responce_add_teledata_result(answer->answer, answer->size, EGTS_TELEDATA_SERVICE, ph->PID, EGTS_PC_DATACRC_ERROR);
+		answer->size += responce_add_teledata_result(answer->answer, answer->size, EGTS_TELEDATA_SERVICE, ph->PID, EGTS_PC_DATACRC_ERROR, session);
 		retval = 6;
         //log2file("/home/locman/glonassd/logs/DATACRC_ERROR", pc, parcel_size);
 	}
 
 	// проверяем шифрование данных
 	if( retval && (ph->PRF & 24) ) {
-		answer->size += responce_add_teledata_result(answer->answer, answer->size, EGTS_TELEDATA_SERVICE, ph->PID, EGTS_PC_DECRYPT_ERROR);
+		answer->size += responce_add_teledata_result(answer->answer, answer->size, EGTS_TELEDATA_SERVICE, ph->PID, EGTS_PC_DECRYPT_ERROR, session);
 		retval = 7;
         //log2file("/home/locman/glonassd/logs/DECRYPT_ERROR", pc, parcel_size);
 	}
 
 	// проверяем сжатие данных
 	if( retval && (ph->PRF & B2) ) {
-		answer->size += responce_add_teledata_result(answer->answer, answer->size, EGTS_TELEDATA_SERVICE, ph->PID, EGTS_PC_INC_DATAFORM);
+		answer->size += responce_add_teledata_result(answer->answer, answer->size, EGTS_TELEDATA_SERVICE, ph->PID, EGTS_PC_INC_DATAFORM, session);
 		retval = 8;
         //log2file("/home/locman/glonassd/logs/INC_DATAFORM", pc, parcel_size);
 	}
@@ -1058,21 +1058,69 @@ int responce_add_subrecord_EGTS_SR_COMMAND_DATA(char *buffer, int pointer, EGTS_
 
 
 
+/*
+   create decoder/encoder state of the connection (see de.h)
+   return pointer to EGTS_SESSION structure or NULL if error
+*/
+void *terminal_session_create(void)
+{
+	return calloc(1, sizeof(EGTS_SESSION));
+}
+//------------------------------------------------------------------------------
+
+// free decoder/encoder state of the connection
+void terminal_session_destroy(void *session)
+{
+	free(session);
+}
+//------------------------------------------------------------------------------
+
+/*
+   frame length function (see de.h)
+   buf - the raw data from socket
+   len - it length
+   return length of the frame, 0 if unknown yet or BAD_OBJ if not recognized
+*/
+int terminal_frame_length(char *buf, int len)
+{
+	EGTS_PACKET_HEADER *ph = (EGTS_PACKET_HEADER *)buf;
+
+	if( !buf || len <= 0 )
+		return 0;
+
+	if( ph->PRV != 1 )	// not EGTS transport packet
+		return BAD_OBJ;
+
+	if( len < (int)offsetof(EGTS_PACKET_HEADER, PID) )	// HL & FDL not received yet
+		return 0;
+
+	if( ph->HL < (int)sizeof(EGTS_PACKET_HEADER) )
+		return BAD_OBJ;
+
+	// header, SFRD & SFRCS (2 bytes CRC16 if SFRD not empty)
+	return ph->HL + ph->FDL + (ph->FDL ? sizeof(uint16_t) : 0);
+}
+//------------------------------------------------------------------------------
+
 /* encode function
    records - pointer to array of ST_RECORD struct.
    reccount - number of struct in array, and returning (negative if authentificate required)
    buffer - buffer for encoded data
    bufsize - size of buffer
+   session - encoder state of the connection (see de.h)
    return size of data in the buffer for encoded data
 */
-int terminal_encode(ST_RECORD *records, int reccount, char *buffer, int bufsize)
+int terminal_encode(ST_RECORD *records, int reccount, char *buffer, int bufsize, void *session)
 {
 	EGTS_RECORD_HEADER *record_header = NULL;
 	EGTS_SUBRECORD_HEADER *subrecord_header = NULL;
 	int i, top = 0, recsize = 0;
 
+	if( !session )
+		return 0;
+
 	// create egts packet header
-	top = packet_create(buffer, EGTS_PT_APPDATA, NULL);
+	top = packet_create(buffer, EGTS_PT_APPDATA, NULL, session);
 
     // for the "egts with authorization" protocol option
 	if( reccount < 0 ) {	// not logged to remote server
@@ -1081,7 +1129,7 @@ int terminal_encode(ST_RECORD *records, int reccount, char *buffer, int bufsize)
 		// EGTS_AUTH_SERVICE
 		// add record (SDR) EGTS_RECORD_HEADER
 		record_header = (EGTS_RECORD_HEADER *)&buffer[top];
-		top = packet_add_record_header(buffer, top, EGTS_AUTH_SERVICE, EGTS_AUTH_SERVICE);
+		top = packet_add_record_header(buffer, top, EGTS_AUTH_SERVICE, EGTS_AUTH_SERVICE, session);
 
 		// add subrecord header (SRD) EGTS_SR_TERM_IDENTITY
 		subrecord_header = (EGTS_SUBRECORD_HEADER *)&buffer[top];
@@ -1109,7 +1157,7 @@ int terminal_encode(ST_RECORD *records, int reccount, char *buffer, int bufsize)
 
 		// add record (SDR) EGTS_RECORD_HEADER
 		record_header = (EGTS_RECORD_HEADER *)&buffer[top];
-		top = packet_add_record_header(buffer, top, EGTS_TELEDATA_SERVICE, EGTS_TELEDATA_SERVICE);
+		top = packet_add_record_header(buffer, top, EGTS_TELEDATA_SERVICE, EGTS_TELEDATA_SERVICE, session);
 
         // for the "egts without authorization" protocol option
         // add subrecord header (SRD) EGTS_SR_TERM_IDENTITY
@@ -1156,6 +1204,56 @@ int terminal_encode(ST_RECORD *records, int reccount, char *buffer, int bufsize)
 }
 //------------------------------------------------------------------------------
 
+/*
+   restamp function (see de.h)
+   buffer - packet of terminal_encode, encoded with another session
+   size - size of the packet
+   session - encoder state of the connection
+   PID of the packet & RN of the records replaced by numbers of this session,
+   CRC16 of the data & CRC8 of the header recalculated
+   return size of the packet or 0 if packet not recognized
+*/
+int terminal_restamp(char *buffer, int size, void *session)
+{
+	EGTS_PACKET_HEADER *pak_head = (EGTS_PACKET_HEADER *)buffer;
+	EGTS_SESSION *egts_session = (EGTS_SESSION *)session;
+	int position, rh_size;
+	uint16_t rl;
+	uint8_t rfl;
+
+	if( !buffer || !session || size < (int)sizeof(EGTS_PACKET_HEADER) )
+		return 0;
+	if( pak_head->PRV != 1 || pak_head->HL != sizeof(EGTS_PACKET_HEADER) || pak_head->HL + pak_head->FDL + (int)sizeof(uint16_t) != size )
+		return 0;
+
+	// check records first, session not changed if packet damaged
+	for(position = pak_head->HL; position < pak_head->HL + pak_head->FDL; position += rh_size + rl) {
+		if( position + 5 > pak_head->HL + pak_head->FDL )
+			return 0;
+
+		rl = *(uint16_t *)&buffer[position];	// RL
+		rfl = (uint8_t)buffer[position + 4];	// RFL
+		rh_size = 5 + ((rfl & B0) ? 4 : 0) + ((rfl & B1) ? 4 : 0) + ((rfl & B2) ? 4 : 0) + 2;	// RL, RN, RFL, OID, EVID, TM, SST, RST
+	}
+	if( position != pak_head->HL + pak_head->FDL )
+		return 0;
+
+	pak_head->PID = egts_session->PaketNumber++;
+
+	for(position = pak_head->HL; position < pak_head->HL + pak_head->FDL; position += rh_size + rl) {
+		rl = *(uint16_t *)&buffer[position];
+		rfl = (uint8_t)buffer[position + 4];
+		rh_size = 5 + ((rfl & B0) ? 4 : 0) + ((rfl & B1) ? 4 : 0) + ((rfl & B2) ? 4 : 0) + 2;
+
+		*(uint16_t *)&buffer[position + 2] = egts_session->RecordNumber++;	// RN
+	}
+
+	packet_finalize(buffer, pak_head->HL + pak_head->FDL, NULL);
+
+	return size;
+}
+//------------------------------------------------------------------------------
+
 
 /* добавление в егтс пакет записи EGTS_RECORD_HEADER (SDR)
    packet - указатель на буфер формирования пакета
@@ -1164,11 +1262,10 @@ int terminal_encode(ST_RECORD *records, int reccount, char *buffer, int bufsize)
    rst - идентификатор тип Сервиса-получателя
    возвращает новый размер данных в буфере
 */
-static int packet_add_record_header(char *packet, int position, uint8_t sst, uint8_t rst)
+static int packet_add_record_header(char *packet, int position, uint8_t sst, uint8_t rst, EGTS_SESSION *session)
 {
 	EGTS_PACKET_HEADER *packet_header = (EGTS_PACKET_HEADER *)packet;
 	EGTS_RECORD_HEADER *record_header = (EGTS_RECORD_HEADER *)&packet[position];
-	static unsigned short int RecordNumber = 0;	// record number for EGTS_RECORD_HEADER
 	int new_size, rh_size;
 	uint8_t *psst, *prst, rfl;
 	uint32_t *poid, *pevid, *ptm;
@@ -1193,7 +1290,7 @@ static int packet_add_record_header(char *packet, int position, uint8_t sst, uin
 	new_size += sizeof(uint8_t);	// RST
 
 	record_header->RL = 0;		// размер данных из поля RD
-	record_header->RN = RecordNumber++;		// номер записи от 0 до 65535
+	record_header->RN = session->RecordNumber++;		// номер записи от 0 до 65535
 	/* дождавшись ответа EGTS_PC_OK с CRN == record_header->RN
 	   надо внести IMEI в массив terminals
 	   а можно и не ждать ответа, а тупо внести
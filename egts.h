@@ -707,19 +707,26 @@ const unsigned short Crc16Table[256] = {
 };
 
 
+// состояние соединения (terminal_session_create), номера пакетов и записей
+typedef struct {
+    uint16_t PaketNumber;   // packet number, joint for encode & decode
+    uint16_t RecordNumber;  // record number for EGTS_RECORD_HEADER (encode)
+    int RECNUM;             // record number for EGTS_SR_RECORD_RESPONSE (decode)
+} EGTS_SESSION;
+
 // функции общие для encode/decode
-int packet_create(char *buffer, uint8_t pt, ST_WORKER *worker);
+int packet_create(char *buffer, uint8_t pt, ST_WORKER *worker, EGTS_SESSION *session);
 int packet_finalize(char *buffer, int pointer, ST_WORKER *worker);
 
 // функции для decode
 int responce_add_header(char *buffer, int pointer, uint16_t pid, uint8_t pr);
 int responce_add_record(char *buffer, int pointer, uint16_t crn, uint8_t rst);
-int responce_add_teledata_result(char *buffer, int pointer, uint8_t service, uint16_t crn, uint8_t rst);
+int responce_add_teledata_result(char *buffer, int pointer, uint8_t service, uint16_t crn, uint8_t rst, EGTS_SESSION *session);
 int responce_add_result(char *buffer, int pointer, uint8_t rcd);
 int responce_add_subrecord_EGTS_SR_COMMAND_DATA(char *buffer, int pointer, EGTS_SR_COMMAND_DATA_RECORD *cmdrec, uint8_t ct_cct);
 unsigned char CRC8EGTS(unsigned char *lpBlock, unsigned char len);
 unsigned short CRC16EGTS(unsigned char * pcBlock, unsigned short len);
-int Parse_EGTS_PACKET_HEADER(ST_ANSWER *answer, char *pc, int parcel_size, ST_WORKER *worker);
+int Parse_EGTS_PACKET_HEADER(ST_ANSWER *answer, char *pc, int parcel_size, ST_WORKER *worker, EGTS_SESSION *session);
 int Parse_EGTS_RECORD_HEADER(EGTS_RECORD_HEADER *rec_head, EGTS_RECORD_HEADER *st_header, ST_ANSWER *answer, ST_WORKER *worker);
 int Parse_EGTS_SR_TERM_IDENTITY(EGTS_SR_TERM_IDENTITY_RECORD *record, ST_ANSWER *answer, ST_WORKER *worker);
 int Parse_EGTS_SR_POS_DATA(EGTS_SR_POS_DATA_RECORD *posdata, ST_RECORD *record, ST_ANSWER *answer, ST_WORKER *worker);
@@ -729,7 +736,7 @@ int Parse_EGTS_SR_COMMAND_DATA(ST_RECORD *record, ST_ANSWER *answer, EGTS_SR_COM
 int Parse_EGTS_SR_STATE_DATA(EGTS_SR_STATE_DATA_RECORD *statedata, ST_RECORD *record);
 
 // функции для encode
-static int packet_add_record_header(char *packet, int position, uint8_t sst, uint8_t rst);
+static int packet_add_record_header(char *packet, int position, uint8_t sst, uint8_t rst, EGTS_SESSION *session);
 static int packet_add_subrecord_header(char *packet, int position, EGTS_RECORD_HEADER *record_header, uint8_t srt);
 static int packet_add_subrecord_EGTS_SR_TERM_IDENTITY(char *packet, int position, EGTS_RECORD_HEADER *record_header, EGTS_SUBRECORD_HEADER *subrecord_header, char *imei);
 static int packet_add_subrecord_EGTS_SR_POS_DATA_RECORD(char *packet, int position, EGTS_RECORD_HEADER *record_header, EGTS_SUBRECORD_HEADER *subrecord_header, ST_RECORD *record);
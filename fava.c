@@ -24,12 +24,13 @@
    parcel - the raw data from socket
    parcel_size - it length
    answer - pointer to ST_ANSWER structure
+   session - decoder state of the connection (see de.h)
 */
-void terminal_decode(char *parcel, int parcel_size, ST_ANSWER *answer, ST_WORKER *worker)
+void terminal_decode(char *parcel, int parcel_size, ST_ANSWER *answer, ST_WORKER *worker, void *session)
 {
     ST_RECORD *record = NULL;
     int iTemp, rec_ok;
-    char *cPart, cTemp[SOCKET_BUF_SIZE];    // используется и для приема ответов на команды
+    char *cPart, *saveptr, cTemp[SOCKET_BUF_SIZE];    // используется и для приема ответов на команды
     struct tm tm_data;
     time_t ulliTmp;
 
@@ -40,7 +41,7 @@ void terminal_decode(char *parcel, int parcel_size, ST_ANSWER *answer, ST_WORKER
     //  0        1          2           3      4     5      6  7  8   9 10 11 12 13 14
     // "^353958060415983;1440351467;55.4604883;N;65.3381217;E;50;141;1.0;0;0;0;0;0.0\n"
     // "^353958060415983;1473500096;55.4608500;N;65.3397000;E;116;80;0.0;5;0;15;5;0"
-    cPart = strtok(parcel, "\n");
+    cPart = strtok_r(parcel, "\n", &saveptr);
 
     rec_ok = 1; // первую запись всегда создаем
     while( cPart ) {
@@ -48,7 +49,7 @@ void terminal_decode(char *parcel, int parcel_size, ST_ANSWER *answer, ST_WORKER
         if( rec_ok ) {
             if( answer->count < MAX_RECORDS - 1 )
                 answer->count++;
-            record = &answer->records[answer->count - 1];
+            record = record_reset(&answer->records[answer->count - 1]);
             rec_ok = 0;
         }    // if( rec_ok )
 
@@ -113,7 +114,7 @@ void terminal_decode(char *parcel, int parcel_size, ST_ANSWER *answer, ST_WORKER
             answer->count = 0;
         }
 
-        cPart = strtok(NULL, "\n");
+        cPart = strtok_r(NULL, "\n", &saveptr);
     }    // while( cPart )
 
     if( answer->count ) {
@@ -129,9 +130,10 @@ void terminal_decode(char *parcel, int parcel_size, ST_ANSWER *answer, ST_WORKER
    reccount - number of struct in array, and returning
    buffer - buffer for encoded data
    bufsize - size of buffer
+   session - encoder state of the connection (see de.h)
    return size of data in the buffer for encoded data
 */
-int terminal_encode(ST_RECORD *records, int reccount, char *buffer, int bufsize)
+int terminal_encode(ST_RECORD *records, int reccount, char *buffer, int bufsize, void *session)
 {
     int top = 0;
     return top;
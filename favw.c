@@ -24,11 +24,12 @@
    parcel - the raw data from socket
    parcel_size - it length
    answer - pointer to ST_ANSWER structure
+   session - decoder state of the connection (see de.h)
 */
-void terminal_decode(char *parcel, int parcel_size, ST_ANSWER *answer, ST_WORKER *worker)
+void terminal_decode(char *parcel, int parcel_size, ST_ANSWER *answer, ST_WORKER *worker, void *session)
 {
 	ST_RECORD *record = NULL;
-	char *cPart, cTime[10], cDate[10], cValid;
+	char *cPart, *saveptr, cTime[10], cDate[10], cValid;
 	int iTemp, rec_ok;
 	struct tm tm_data;
 	time_t ulliTmp;
@@ -38,7 +39,7 @@ void terminal_decode(char *parcel, int parcel_size, ST_ANSWER *answer, ST_WORKER
 
 	//  0        1          2   3     4     5      6     7  8   9    10  11 12 13
 	// "*123456789012345,090524,A,5527.6548,N,06520.3713,E,0.3,351,160115,7,2,104,0,1.2,0.3,0040,0.5*123456789012345,090525,A,5527.6547,N,06520.3712,E,0.3,351,160115,6,2,104*123456789012345,090526,A,5527.6547,N,06520.3712,E,0.0,351,160115,6,2,104*123456789012345,090528,A,5527.6547,N,06520.3712,E,0.0,351,160115,6,2,104*123456789012345,090529,A,5527.6547,N,06520.3714,E,0.1,351,160115,6,2,104*123456789012345,090530,A,5527.6545,N,06520.3713,E,0.0,351,160115,6,2,104*123456789012345,090531,A,5527.6544,N,06520.3713,E,0.3,351,160115,6,2,104*123456789012345,090532,A,5527.6544,N,06520.3713,E,0.0,351,160115,7,2,104*123456789012345,090534,A,5527.6544,N,06520.3713,E,0.0,351,160115,5,4,104"
-	cPart = strtok(&parcel[1], "*");
+	cPart = strtok_r(&parcel[1], "*", &saveptr);
 
 	rec_ok = 1; // первую запись всегда создаем
 	while( cPart ) {
@@ -46,7 +47,7 @@ void terminal_decode(char *parcel, int parcel_size, ST_ANSWER *answer, ST_WORKER
 		if( rec_ok ) {
 			if( answer->count < MAX_RECORDS - 1 )
 				answer->count++;
-			record = &answer->records[answer->count - 1];
+			record = record_reset(&answer->records[answer->count - 1]);
 			rec_ok = 0;
 		}	// if( rec_ok )
 
@@ -112,7 +113,7 @@ void terminal_decode(char *parcel, int parcel_size, ST_ANSWER *answer, ST_WORKER
             memcpy(&answer->lastpoint, record, sizeof(ST_RECORD));
 		}	// if(iTemp == 13 || iTemp == 18)
 
-		cPart = strtok(NULL, "*");
+		cPart = strtok_r(NULL, "*", &saveptr);
 	}	// while( cPart )
 
 }
@@ -124,9 +125,10 @@ void terminal_decode(char *parcel, int parcel_size, ST_ANSWER *answer, ST_WORKER
    reccount - number of struct in array, and returning
    buffer - buffer for encoded data
    bufsize - size of buffer
+   session - encoder state of the connection (see de.h)
    return size of data in the buffer for encoded data
 */
-int terminal_encode(ST_RECORD *records, int reccount, char *buffer, int bufsize)
+int terminal_encode(ST_RECORD *records, int reccount, char *buffer, int bufsize, void *session)
 {
 	int top = 0;
 	return top;
@@ -23,6 +23,7 @@
 #include <unistd.h> /* close, fork */
 #include <errno.h>  /* errno */
 #include <pthread.h> /* syslog */
+#include <sched.h>	/* sched_yield */
 #include <time.h>
 #include <syslog.h>
 #include <sys/types.h>
@@ -30,10 +31,14 @@
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <fcntl.h>
+#include <dirent.h>
 #include "glonassd.h"
 #include "forwarder.h"
+#include "spool.h"
+#include "route.h"
 #include "lib.h"
 #include "de.h"
+#include "record.h"
 #include "logger.h"
 
 /*
@@ -47,29 +52,53 @@
 static __thread unsigned long long int disconnect_time = 0;	// time in seconds when out socket disconnected
 static __thread int out_connected = 0;						// out connection established flag
 static __thread int log_server_answer = 0;					// flag for log remote server to file
-static __thread int files_saved = 0;					    // count of saved (not passed) parcels
+static __thread uint32_t logged_conn = 1;					// number of the connection to remote server, see terimal_logged
+static __thread int coalesced = 0;							// number of the records in config->records waiting encode, see coalesce_flush
+static __thread int coalesce_login = 0;						// terminal of the any coalesced record not authentificated on remote server
+static __thread unsigned long long int coalesce_start = 0;	// time of the first coalesced record, milliseconds
+static __thread size_t resend_pos = 0;						// bytes of the first journal parcel sent to remote server, see data_resend
+
+// ring buffers from workers to forwarders by name of the forwarder,
+// created once & not freed, so workers may keep it after reconfigure
+typedef struct ST_FORWARD_RING {
+	char name[STRLEN];
+	ST_RING *ring;
+	struct ST_FORWARD_RING *next;
+} ST_FORWARD_RING;
+static ST_FORWARD_RING *forward_rings = NULL;	// main thread only
 
 /*
     utility functions
 */
 
+// monotonic time in milliseconds
+static unsigned long long int milliseconds(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long int)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+//------------------------------------------------------------------------------
+
+// max. number of the coalesced records, 1 - coalescing off
+static inline int coalesce_max(ST_FORWARDER *config)
+{
+	if( config->coalesce_records <= 0 )
+		return 1;
+	return config->coalesce_records < FORWARD_COALESCE_MAX ? config->coalesce_records : FORWARD_COALESCE_MAX;
+}
+//------------------------------------------------------------------------------
+
 /*
 reset the registered flag to "no" for all terminals
 called when disconnecting a socket from a remote server
+terminal registered if ST_ROUTE.logged equal to number of the connection
 */
-static void terimal_reset_logged(char *forward_name)
+static void terimal_reset_logged(void)
 {
-	unsigned int i;
-
-	for(i = 0; i < stForwarders.listcount; ++i) {
-		if( forward_name[0] == stForwarders.terminals[i].forward[0] )
-		{
-			if( !strcmp(forward_name, stForwarders.terminals[i].forward) )
-			{
-				stForwarders.terminals[i].logged = 0;
-			}
-		}
-	}	// for(i = 0; i < stForwarders.listcount; i++)
+	if( !++logged_conn )
+		logged_conn = 1;
 }
 //------------------------------------------------------------------------------
 
@@ -79,20 +108,20 @@ always set the registered flag to "yes"
 */
 static int terimal_logged(char *imei, char *forward_name)
 {
-	unsigned int i, retval = 1;
+	ST_ROUTES *routes;
+	ST_ROUTE *route;
+	unsigned int probe = 0, epoch;
+	int retval = 1;
 
 	if( imei ){
-		for(i = 0; i < stForwarders.listcount; ++i) {
-			if( forward_name[0] == stForwarders.terminals[i].forward[0] && imei[0] == stForwarders.terminals[i].imei[0] )
-			{
-				if( !strcmp(forward_name, stForwarders.terminals[i].forward) && !strcmp(imei, stForwarders.terminals[i].imei) )
-				{
-					retval = stForwarders.terminals[i].logged;
-					stForwarders.terminals[i].logged = 1;
-					break;
-				}
+		routes = route_enter(&epoch);
+		while( (route = route_next(routes, imei, &probe)) ) {
+			if( !strcmp(forward_name, routes->forwards[route->forward].name) ) {
+				retval = (__atomic_exchange_n(&route->logged, logged_conn, __ATOMIC_ACQ_REL) == logged_conn);
+				break;
 			}
-		}	// for(i = 0; i < stForwarders.listcount; i++)
+		}
+		route_leave(epoch);
 	}	// if( imei )
 
 	return retval;
@@ -100,57 +129,79 @@ static int terimal_logged(char *imei, char *forward_name)
 //------------------------------------------------------------------------------
 
 /*
-    save the forwarding data to a file (!!! data encoded according to the required protocol !!!)
+    save the forwarding data to journal (!!! data encoded according to the required protocol !!!)
     config - config of the forwarder
     imei - IMEI saved terminal
-    content_size - size of data
+    content_size - size of data in config->buffers[OUT_WRBUF]
+    return 1 if saved or 0 if error
 */
 static int data_save(ST_FORWARDER *config, char *imei, ssize_t content_size)
 {
-	int fHandle;
-	time_t t;
+	ST_FORWARD_MSG *msg = (ST_FORWARD_MSG *)config->buffers[IN_WRBUF];
+
+	if( content_size <= 0 || content_size > SOCKET_BUF_SIZE - sizeof(ST_FORWARD_MSG) ) {
+		if( config->debug )
+			logging("forwarder[%s][%ld]: data_save: content_size=%ld\n", config->name, syscall(SYS_gettid), content_size);
+		return 0;
+	}
+
+	// header & data, msg->encode = 0
+	memset(msg, 0, sizeof(ST_FORWARD_MSG));
+	if( imei && imei[0] )
+		memcpy(msg->imei, imei, SIZE_TRACKER_FIELD);
+	msg->len = content_size;
+	memcpy(&config->buffers[IN_WRBUF][sizeof(ST_FORWARD_MSG)], config->buffers[OUT_WRBUF], content_size);
+
+	if( !spool_write(config->journal, config->buffers[IN_WRBUF], sizeof(ST_FORWARD_MSG) + content_size) ) {
+		logging("forwarder[%s][%ld]: data_save: %ld bytes lost\n", config->name, syscall(SYS_gettid), content_size);
+		return 0;
+	}
+
+	if( config->debug )
+		logging("forwarder[%s][%ld]: data_save: written %ld bytes to journal\n", config->name, syscall(SYS_gettid), content_size);
+
+	return 1;
+}
+//---------------------------------------------------------------------------
+
+/*
+    move parcels, saved to files <name>_<time>.bin by previous versions,
+    from forward_files directory into journal
+*/
+static void data_import(ST_FORWARDER *config)
+{
+	DIR *dir;
+	struct dirent *entry;
 	char fName[FILENAME_MAX];
-	ST_FORWARD_MSG msg;
-    int cnt_files = 0;
-
-	if( config->buffers[OUT_WRBUF] && content_size ) {
-		time(&t);
-		snprintf(fName, FILENAME_MAX, "%s/%s_%llu.bin",
-				 stConfigServer.forward_files,
-				 config->name,
-				 (unsigned long long)t);
-
-		if( (fHandle = open(fName, O_CREAT | O_WRONLY | O_NOATIME | O_TRUNC, S_IRWXU | S_IRGRP | S_IROTH)) != -1 ) {
-			// create header
-			memset(&msg, 0, sizeof(ST_FORWARD_MSG));	// msg.encode = 0
-			if(imei && imei[0]) {
-				memcpy(msg.imei, imei, SIZE_TRACKER_FIELD);
-			}
-			msg.len = content_size;
-			// write header
-			if( !write(fHandle, &msg, sizeof(ST_FORWARD_MSG)) ) {}
-			// write data
-			if( !write(fHandle, config->buffers[OUT_WRBUF], content_size) ){}
-            else {
-                ++cnt_files;
-            }
+	size_t name_len = strlen(config->name);
+	ssize_t bytes_read;
+	unsigned int count = 0;
+	int fHandle;
+
+	dir = opendir(stConfigServer.forward_files);
+	if( !dir )
+		return;
 
-			close(fHandle);
+	while( (entry = readdir(dir)) != NULL ) {
+		if( strncmp(entry->d_name, config->name, name_len) || entry->d_name[name_len] != '_' || !strstr(entry->d_name, ".bin") )
+			continue;
 
-			if( config->debug ) {
-				logging("forwarder[%s][%ld]: data_save: written %ld bytes to file\n", config->name, syscall(SYS_gettid), content_size);
-            }
-		}
-		else if( stConfigServer.log_enable && config->debug ) {
-			logging("forwarder[%s][%ld]: data_save: open(%s) error %d: %s\n", config->name, syscall(SYS_gettid), fName, errno, strerror(errno));
-        }
+		snprintf(fName, FILENAME_MAX, "%.3800s/%.250s", stConfigServer.forward_files, entry->d_name);
+		if( (fHandle = open(fName, O_RDONLY | O_NOATIME)) == -1 )
+			continue;
 
-	}	// if( config->buffers[OUT_WRBUF] && content_size )
-	else if( config->debug ) {
-		logging("forwarder[%s][%ld]: data_save: config->buffers[OUT_WRBUF] is NULL or content_size=%ld\n", config->name, syscall(SYS_gettid), content_size);
-    }
+		bytes_read = read(fHandle, config->buffers[IN_WRBUF], SOCKET_BUF_SIZE);
+		close(fHandle);
+
+		if( bytes_read > (ssize_t)sizeof(ST_FORWARD_MSG) && spool_write(config->journal, config->buffers[IN_WRBUF], bytes_read) ) {
+			unlink(fName);
+			count++;
+		}
+	}	// while( (entry = readdir(dir)) != NULL )
+	closedir(dir);
 
-    return cnt_files;
+	if( count )
+		logging("forwarder[%s][%ld]: %u saved files moved to journal\n", config->name, syscall(SYS_gettid), count);
 }
 //---------------------------------------------------------------------------
 
@@ -238,11 +289,12 @@ static int set_out_socket(ST_FORWARDER *config, int create)
 	}	// if( create )
 	else {	// destroy socket
 		out_connected = 0;	// reset connetion established flag
+		resend_pos = 0;		// partially sent parcel sent again from begin on new connection
 		shutdown(config->sockets[OUT_SOCKET], SHUT_RDWR);
 		close(config->sockets[OUT_SOCKET]);
 		config->sockets[OUT_SOCKET] = BAD_OBJ;
 
-		terimal_reset_logged(config->name);
+		terimal_reset_logged();
 	}
 
 	return( create ? (config->sockets[OUT_SOCKET] != BAD_OBJ) : 1);
@@ -250,69 +302,84 @@ static int set_out_socket(ST_FORWARDER *config, int create)
 //------------------------------------------------------------------------------
 
 /*
-    process terminal data
-    bufer - ST_FORWARD_MSG*
-    size - length of the bufer
+    send saved parcels from journal to remote server,
+    not more than RING_BATCH parcels, parcel removed from journal only if sent completely,
+    if partially sent, the rest of parcel sent on next call (resend_pos)
+    return number of the sent parcels
 */
-static void process_terminal(ST_FORWARDER *config, char *bufer, ssize_t size)
+static unsigned int data_resend(ST_FORWARDER *config)
 {
 	ST_FORWARD_MSG *msg;
-	ssize_t data_len = 0, sended = 0;
-	char l2fname[FILENAME_MAX];		// terminal log file name
+	char *data;
+	size_t size;
+	ssize_t sended;
+	unsigned int count = 0;
+
+	while( out_connected && count < RING_BATCH && (data = spool_read(config->journal, &size)) ) {
+		msg = (ST_FORWARD_MSG *)data;
+		if( size <= sizeof(ST_FORWARD_MSG) || msg->len != size - sizeof(ST_FORWARD_MSG) || resend_pos >= msg->len ) {	// damaged
+			spool_commit(config->journal);
+			resend_pos = 0;
+			continue;
+		}
 
-	if( !bufer ){
-		if( config->debug ) {
-			logging("forwarder[%s][%ld]: process_terminal %s: bufer is NULL\n", config->name, syscall(SYS_gettid), msg->imei);
-        }
-		return;
-	}
+		sended = send(config->sockets[OUT_SOCKET], &data[sizeof(ST_FORWARD_MSG) + resend_pos], msg->len - resend_pos, MSG_DONTWAIT | MSG_NOSIGNAL);
+		if( sended < 0 && (errno == EAGAIN || errno == EWOULDBLOCK) )
+			break;	// socket buffer full, wait writable socket
 
-	if( !size ){
-		if( config->debug ) {
-			logging("forwarder[%s][%ld]: process_terminal %s: size = 0\n", config->name, syscall(SYS_gettid), msg->imei);
-        }
-		return;
-	}
+		if( sended <= 0 ) {	// socket error or disconnect
+			logging("forwarder[%s][%ld]: data_resend: send() error %d: %s\n", config->name, syscall(SYS_gettid), errno, strerror(errno));
+			set_out_socket(config, 0);
+			break;
+		}
 
-	msg = (ST_FORWARD_MSG *)bufer;
-	if( !msg->len ){
-		if( config->debug ) {
-			logging("forwarder[%s][%ld]: process_terminal %s: msg->len = 0\n", config->name, syscall(SYS_gettid), msg->imei);
-        }
-		return;
-	}
+		resend_pos += sended;
+		if( resend_pos < msg->len ) {	// socket buffer full, wait writable socket
+			if( config->debug )
+				logging("forwarder[%s][%ld]: data_resend %s: sended %zu bytes of %d\n", config->name, syscall(SYS_gettid), msg->imei, resend_pos, msg->len);
+			break;
+		}
 
-	if( msg->encode ) {	// encode need, data = ST_RECORD*, msg->len = number of the records in data
-		/* check: terminal authentificated or no on remote server,
-		if no (ST_FORWARD_TERMINAL[imei][config->name].logged == 0) then set msg->len = -1 * msg->len
-		else msg->len not change
-		*/
-		if( !terimal_logged(msg->imei, config->name) )
-			msg->len *= -1;
-
-		pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);	// do not disturb :)
-		data_len = config->terminal_encode((ST_RECORD*)&bufer[sizeof(ST_FORWARD_MSG)], msg->len, config->buffers[OUT_WRBUF], SOCKET_BUF_SIZE);
-		pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);  // can disturb :)
-	}
-	else {	// data = raw terminal data, msg->len = data size
-		// copy data part to out buffer
-		memcpy(config->buffers[OUT_WRBUF], &bufer[sizeof(ST_FORWARD_MSG)], msg->len);
-		data_len = msg->len;
-	}	// else if(msg->encode)
+		spool_commit(config->journal);
+		resend_pos = 0;
+		count++;
+	}	// while( out_connected
+
+	if( count && config->debug )
+		logging("forwarder[%s][%ld]: %u saved parcels sended\n", config->name, syscall(SYS_gettid), count);
+
+	return count;
+}
+//---------------------------------------------------------------------------
+
+/*
+    send packet from config->buffers[OUT_WRBUF] to remote server or save it to journal,
+    partially sent packet saved to journal too, the rest of it sent by data_resend
+    imei - terminal of the packet for logs
+    data_len - size of the packet
+*/
+static void data_send(ST_FORWARDER *config, char *imei, ssize_t data_len)
+{
+	ssize_t sended = 0;
+	char l2fname[FILENAME_MAX];		// terminal log file name
 
 	if( data_len ) {
-		if( out_connected ) {
-			sended = send(config->sockets[OUT_SOCKET], config->buffers[OUT_WRBUF], data_len, 0);
-			if( sended <= 0 ) {	// socket error or disconnect
+		// while journal not empty, parcel saved after it to keep order
+		if( out_connected && !spool_pending(config->journal) ) {
+			sended = send(config->sockets[OUT_SOCKET], config->buffers[OUT_WRBUF], data_len, MSG_NOSIGNAL);
+			if( sended < 0 && (errno == EAGAIN || errno == EWOULDBLOCK) ) {
+				// socket buffer full, parcel saved & sent by data_resend
+			}
+			else if( sended <= 0 ) {	// socket error or disconnect
 				logging("forwarder[%s][%ld]: process_terminal: send() error %d: %s\n", config->name, syscall(SYS_gettid), errno, strerror(errno));
 				set_out_socket(config, 0);	// disconnect outer socket
 			}	// if( sended <= 0 )
 			else {
 
 				// log terminal message to remote server
-				if( stConfigServer.log_imei[0] && stConfigServer.log_imei[0] == msg->imei[0] ){
-					if( !strcmp(stConfigServer.log_imei, msg->imei) ){
-						snprintf(l2fname, FILENAME_MAX, "%s/logs/%s_%s_parcel", stParams.start_path, msg->imei, config->name);
+				if( stConfigServer.log_imei[0] && stConfigServer.log_imei[0] == imei[0] ){
+					if( !strcmp(stConfigServer.log_imei, imei) ){
+						snprintf(l2fname, FILENAME_MAX, "%s/logs/%s_%s_parcel", stParams.start_path, imei, config->name);
 						log2file(l2fname, config->buffers[OUT_WRBUF], data_len);
 						// flag for log remote server answer to file,
 						// if forwarder protocol EGTS, then flag = EGTS_RECORD_HEADER.RN (record number)
@@ -321,63 +388,261 @@ static void process_terminal(ST_FORWARDER *config, char *bufer, ssize_t size)
 							log_server_answer = *(uint16_t*)&config->buffers[OUT_WRBUF][13];	// EGTS_RECORD_HEADER.RN
 						else
 							log_server_answer = 1;
-					}	// if( !strcmp(stConfigServer.log_imei, msg->imei) )
+					}	// if( !strcmp(stConfigServer.log_imei, imei) )
 				}	// if( stConfigServer.log_imei[0]
 
 				if( config->debug ) {
-					logging("forwarder[%s][%ld]: process_terminal %s: sended %ld bytes to remote server\n", config->name, syscall(SYS_gettid), msg->imei, sended);
+					logging("forwarder[%s][%ld]: process_terminal %s: sended %ld bytes to remote server\n", config->name, syscall(SYS_gettid), imei, sended);
                 }
 			}	// else if( sended <= 0 )
 		}	// if( out_connected )
 
-		if( sended <= 0 )	// save buffer to file for send later
-			files_saved += data_save(config, msg->imei, data_len);
+		if( sended <= 0 ) {	// save buffer to journal for send later
+			data_save(config, imei, data_len);
+		}
+		else if( sended < data_len ) {	// journal is empty, the rest of packet sent first by data_resend
+			if( config->debug )
+				logging("forwarder[%s][%ld]: process_terminal %s: sended %ld bytes of %ld\n", config->name, syscall(SYS_gettid), imei, sended, data_len);
+
+			if( data_save(config, imei, data_len) )
+				resend_pos = sended;
+			else	// the rest of packet lost, remote server must not receive broken packet
+				set_out_socket(config, 0);
+		}
 
 	}	// if( data_len )
 	else if( config->debug ) {
-		logging("forwarder[%s][%ld]: process_terminal %s: data_len=%ld\n", config->name, syscall(SYS_gettid), msg->imei, data_len);
+		logging("forwarder[%s][%ld]: process_terminal %s: data_len=%ld\n", config->name, syscall(SYS_gettid), imei, data_len);
     }
 }
 //------------------------------------------------------------------------------
 
-// set up inner listener socket
-static int set_listen_socket(ST_FORWARDER *config)
+/*
+    encode coalesced records of the any terminals into one packet & send it,
+    called when coalesce_records or coalesce_ms reached, before raw parcel & on exit
+*/
+static void coalesce_flush(ST_FORWARDER *config)
 {
-	// create socket
-	config->sockets[IN_SOCKET] = socket(AF_UNIX, SOCK_DGRAM, 0);
-	if( config->sockets[IN_SOCKET] < 0 ) {
-		logging("forwarder[%s][%ld]: listen socket() error %d: %s\n", config->name, syscall(SYS_gettid), errno, strerror(errno));
-		return 0;
+	ssize_t data_len;
+	char *imei;
+	int i, cancel_state;
+
+	if( !coalesced )
+		return;
+
+	// terminal of the packet for logs: log_imei if coalesced, else first
+	imei = config->records[0].imei;
+	for(i = 0; stConfigServer.log_imei[0] && i < coalesced; i++) {
+		if( !strcmp(stConfigServer.log_imei, config->records[i].imei) ) {
+			imei = config->records[i].imei;
+			break;
+		}
+	}
+
+	// negative number of the records: terminal not authentificated on remote server
+	pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &cancel_state);	// do not disturb :)
+	data_len = config->terminal_encode(config->records, coalesce_login ? -coalesced : coalesced, config->buffers[OUT_WRBUF], SOCKET_BUF_SIZE, config->session);
+	pthread_setcancelstate(cancel_state, NULL);  // can disturb :)
+
+	if( config->debug && coalesced > 1 )
+		logging("forwarder[%s][%ld]: %d coalesced records encoded into %ld bytes\n", config->name, syscall(SYS_gettid), coalesced, data_len);
+
+	coalesced = coalesce_login = 0;
+	data_send(config, imei, data_len);
+}
+//------------------------------------------------------------------------------
+
+/*
+    unpack records after coalesced
+    packed - packed records (record.h)
+    size - size of the packed records
+    count - number of the records
+    return number of the unpacked records
+*/
+static int records_unpack(ST_FORWARDER *config, char *packed, size_t size, int count)
+{
+	size_t pos = 0, packed_size;
+	int unpacked;
+
+	for(unpacked = 0; unpacked < count && coalesced + unpacked < FORWARD_COALESCE_MAX && pos < size; unpacked++) {
+		packed_size = record_unpack(&packed[pos], size - pos, &config->records[coalesced + unpacked]);
+		if( !packed_size )
+			break;
+		pos += packed_size;
 	}
 
-	// set non-blocking mode
-	if( fcntl(config->sockets[IN_SOCKET], F_SETFL, O_NONBLOCK) < 0 ) {
-		logging("forwarder[%s][%ld]: fcntl(IN_SOCKET, O_NONBLOCK) error %d: %s\n", config->name, syscall(SYS_gettid), errno, strerror(errno));
-		close(config->sockets[IN_SOCKET]);
-		config->sockets[IN_SOCKET] = -1;
+	return unpacked;
+}
+//------------------------------------------------------------------------------
+
+/*
+    add records of the terminal to coalesced & send packet, if it full
+    packed - packed records (record.h)
+    size - size of the packed records
+    count - number of the records
+    logged - terminal authentificated on remote server
+*/
+static void records_process(ST_FORWARDER *config, char *imei, char *packed, size_t size, int count, int logged)
+{
+	/* records of the parcel not fit into packet or terminal not authentificated:
+	send coalesced records, encoder authentificates terminal of the first record only
+	*/
+	if( coalesced + count > coalesce_max(config) || !logged )
+		coalesce_flush(config);
+
+	count = records_unpack(config, packed, size, count);
+	if( !count ){
+		if( config->debug ) {
+			logging("forwarder[%s][%ld]: process_terminal %s: records not unpacked\n", config->name, syscall(SYS_gettid), imei);
+		}
+		return;
+	}
+
+	/* if terminal not authentificated on remote server
+	(ST_FORWARD_TERMINAL[imei][config->name].logged == 0) then number of the records
+	passed to encoder is negative
+	*/
+	if( !logged )
+		coalesce_login = 1;
+
+	if( !coalesced )
+		coalesce_start = milliseconds();
+	coalesced += count;
+
+	// packet full or coalescing off
+	if( coalesced >= coalesce_max(config) )
+		coalesce_flush(config);
+}
+//------------------------------------------------------------------------------
+
+/*
+    send records, encoded once for forwarders of the same protocol:
+    first forwarder encodes records & keeps copy of the packet,
+    others copy packet & restamp it for own connection (terminal_restamp)
+    return 1 if packet sent or 0 if records must be encoded by this forwarder
+*/
+static int shared_process(ST_FORWARDER *config, char *imei, ST_FORWARD_SHARED *shared, int count, int logged)
+{
+	ssize_t data_len = 0;
+	int state = FORWARD_SHARED_NEW, cancel_state;
+
+	// packet of the authentificated terminal only, not coalesced
+	if( !logged || coalesced || coalesce_max(config) > 1 || (config->terminal_session_create && !config->terminal_restamp) )
 		return 0;
+
+	pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &cancel_state);	// do not disturb, others wait packet
+
+	if( __atomic_compare_exchange_n(&shared->state, &state, FORWARD_SHARED_ENCODING, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE) ) {
+		// first forwarder: encode records with own session
+		count = records_unpack(config, shared->packed, shared->packed_size, count);
+		if( count )
+			data_len = config->terminal_encode(config->records, count, config->buffers[OUT_WRBUF], SOCKET_BUF_SIZE, config->session);
+
+		if( data_len > 0 && (shared->encoded = (char *)malloc(data_len)) ) {
+			memcpy(shared->encoded, config->buffers[OUT_WRBUF], data_len);
+			shared->encoded_len = data_len;
+			__atomic_store_n(&shared->state, FORWARD_SHARED_ENCODED, __ATOMIC_RELEASE);
+		}
+		else {
+			__atomic_store_n(&shared->state, FORWARD_SHARED_FAILED, __ATOMIC_RELEASE);
+		}
+		pthread_setcancelstate(cancel_state, NULL);
+
+		if( data_len <= 0 )
+			return 0;
+	}
+	else {
+		// packet encoded by other forwarder just now
+		while( (state = __atomic_load_n(&shared->state, __ATOMIC_ACQUIRE)) == FORWARD_SHARED_ENCODING )
+			sched_yield();
+
+		if( state == FORWARD_SHARED_ENCODED ) {
+			memcpy(config->buffers[OUT_WRBUF], shared->encoded, shared->encoded_len);
+			data_len = config->terminal_restamp ? config->terminal_restamp(config->buffers[OUT_WRBUF], shared->encoded_len, config->session) : shared->encoded_len;
+		}
+		pthread_setcancelstate(cancel_state, NULL);
+
+		if( data_len <= 0 )
+			return 0;
+
+		if( config->debug )
+			logging("forwarder[%s][%ld]: process_terminal %s: %d records encoded by other forwarder\n", config->name, syscall(SYS_gettid), imei, count);
+	}
+
+	data_send(config, imei, data_len);
+	return 1;
+}
+//------------------------------------------------------------------------------
+
+/*
+    process terminal data
+    bufer - ST_FORWARD_MSG*
+    size - length of the bufer
+*/
+static void process_terminal(ST_FORWARDER *config, char *bufer, ssize_t size)
+{
+	ST_FORWARD_MSG *msg;
+	ST_FORWARD_SHARED *shared;
+	int logged;
+
+	if( !bufer ){
+		if( config->debug ) {
+			logging("forwarder[%s][%ld]: process_terminal: bufer is NULL\n", config->name, syscall(SYS_gettid));
+        }
+		return;
 	}
 
-	// bind socket
-	memset(&config->addr_un, 0, sizeof(struct sockaddr_un));
-	config->addr_un.sun_family = AF_UNIX;
-	snprintf(config->addr_un.sun_path, 108, "/%s", config->name);	// http://man7.org/linux/man-pages/man7/unix.7.html
-	unlink(config->addr_un.sun_path);	// if exists because crash
-	if( bind(config->sockets[IN_SOCKET], (struct sockaddr *)&config->addr_un, sizeof(struct sockaddr_un)) < 0 ) {
-		logging("forwarder[%s][%ld]: bind(%s) error %d: %s\n", config->name, syscall(SYS_gettid), config->addr_un.sun_path, errno, strerror(errno));
-		close(config->sockets[IN_SOCKET]);
-		config->sockets[IN_SOCKET] = -1;
+	if( !size ){
+		if( config->debug ) {
+			logging("forwarder[%s][%ld]: process_terminal: size = 0\n", config->name, syscall(SYS_gettid));
+        }
+		return;
+	}
+
+	msg = (ST_FORWARD_MSG *)bufer;
+
+	if( msg->encode == FORWARD_ENCODE_SHARED ) {	// data = pointer to records, encoded once for forwarders of the same protocol
+		if( size < (ssize_t)(sizeof(ST_FORWARD_MSG) + sizeof(shared)) )
+			return;
+		memcpy(&shared, &bufer[sizeof(ST_FORWARD_MSG)], sizeof(shared));
+
+		logged = terimal_logged(msg->imei, config->name);
+		if( msg->len && !shared_process(config, msg->imei, shared, msg->len, logged) )
+			records_process(config, msg->imei, shared->packed, shared->packed_size, msg->len, logged);
+
+		forward_shared_release(shared);
+		return;
 	}
 
-	return(config->sockets[IN_SOCKET] != -1);
+	if( !msg->len ){
+		if( config->debug ) {
+			logging("forwarder[%s][%ld]: process_terminal %s: msg->len = 0\n", config->name, syscall(SYS_gettid), msg->imei);
+        }
+		return;
+	}
+
+	if( msg->encode ) {	// encode need, data = packed records, msg->len = number of the records in data
+		// check: terminal authentificated or no on remote server
+		records_process(config, msg->imei, &bufer[sizeof(ST_FORWARD_MSG)], size - sizeof(ST_FORWARD_MSG), msg->len, terimal_logged(msg->imei, config->name));
+	}
+	else {	// data = raw terminal data, msg->len = data size
+		// coalesced records first to keep order
+		coalesce_flush(config);
+
+		// copy data part to out buffer
+		memcpy(config->buffers[OUT_WRBUF], &bufer[sizeof(ST_FORWARD_MSG)], msg->len);
+		data_send(config, msg->imei, msg->len);
+	}	// else if(msg->encode)
 }
 //------------------------------------------------------------------------------
 
 
+
 // wait sockets activity
 static int wait_sockets(ST_FORWARDER *config)
 {
 	unsigned int cnt;
+	unsigned long long int wait_ms;
 	struct timeval tv;
 
 	// test out socket and reconnect if disconnected
@@ -387,21 +652,135 @@ static int wait_sockets(ST_FORWARDER *config)
 
 	FD_ZERO(&config->fdset[0]);	// read
 	FD_ZERO(&config->fdset[1]);	// write
-	FD_SET(config->sockets[IN_SOCKET], &config->fdset[0]);
+	FD_SET(config->sockets[IN_SOCKET], &config->fdset[0]);	// parcels from workers
 
 	if( config->sockets[OUT_SOCKET] != BAD_OBJ ) {
-		if( out_connected )
+		if( out_connected ) {
 			FD_SET(config->sockets[OUT_SOCKET], &config->fdset[0]);	// read
+			if( spool_pending(config->journal) )
+				FD_SET(config->sockets[OUT_SOCKET], &config->fdset[1]);	// write saved parcels
+		}
 		else
 			FD_SET(config->sockets[OUT_SOCKET], &config->fdset[1]);	// write
 	}
 
-	tv.tv_sec = stConfigServer.forward_timeout;
+	// not wait if ring buffer has parcels, coalesced records wait not more than coalesce_ms
 	tv.tv_usec = 0;
+	if( ring_sleep(config->ring) ) {
+		tv.tv_sec = 0;
+	}
+	else if( coalesced ) {
+		wait_ms = coalesce_start + config->coalesce_ms - milliseconds();
+		if( (long long int)wait_ms < 0 || wait_ms > (unsigned long long int)config->coalesce_ms )
+			wait_ms = 0;
+		tv.tv_sec = wait_ms / 1000;
+		tv.tv_usec = (wait_ms % 1000) * 1000;
+	}
+	else {
+		tv.tv_sec = stConfigServer.forward_timeout;
+	}
 
 	cnt = config->sockets[OUT_SOCKET] > config->sockets[IN_SOCKET] ? config->sockets[OUT_SOCKET] : config->sockets[IN_SOCKET];
 
-	return select(cnt + 1, &config->fdset[0], &config->fdset[1], NULL, &tv);
+	cnt = select(cnt + 1, &config->fdset[0], &config->fdset[1], NULL, &tv);
+	ring_awake(config->ring);
+
+	return cnt;
+}
+//------------------------------------------------------------------------------
+
+/*
+    process parcels from workers, not more than RING_BATCH
+    return number of the parcels
+*/
+static unsigned int workers_batch(ST_FORWARDER *config)
+{
+	char *parcel;
+	size_t size;
+	unsigned int count = 0;
+
+	while( count < RING_BATCH && (parcel = ring_read(config->ring, &size)) ) {
+		process_terminal(config, parcel, size);
+		count++;
+	}
+	ring_release(config->ring);
+
+	return count;
+}
+//------------------------------------------------------------------------------
+
+/*
+    ring buffer from workers to forwarder, main thread only,
+    created at first call & not freed, size not changed by reconfigure
+    name - name of the forwarder
+    size - size of the ring buffer in bytes
+    return pointer to ring buffer or NULL if error
+*/
+ST_RING *forwarder_ring(const char *name, size_t size)
+{
+	ST_FORWARD_RING *fr;
+
+	for(fr = forward_rings; fr; fr = fr->next) {
+		if( !strcmp(fr->name, name) )
+			return fr->ring;
+	}
+
+	fr = (ST_FORWARD_RING *)calloc(1, sizeof(ST_FORWARD_RING));
+	if( !fr )
+		return NULL;
+
+	fr->ring = ring_create(size ? size : FORWARD_QUEUE_SIZE);
+	if( !fr->ring || ring_eventfd(fr->ring) < 0 ) {
+		logging("forwarder[%s]: ring buffer of %zu bytes not created\n", name, size);
+		ring_destroy(fr->ring);
+		free(fr);
+		return NULL;
+	}
+
+	snprintf(fr->name, STRLEN, "%s", name);
+	fr->next = forward_rings;
+	forward_rings = fr;
+
+	return fr->ring;
+}
+//------------------------------------------------------------------------------
+
+/*
+    records encoded once for forwarders of the same protocol, worker thread
+    packed - packed records (record.h)
+    packed_size - size of the packed records
+    refs - number of the forwarders
+    return pointer to ST_FORWARD_SHARED or NULL if error
+*/
+ST_FORWARD_SHARED *forward_shared_create(char *packed, size_t packed_size, int refs)
+{
+	ST_FORWARD_SHARED *shared;
+
+	if( !packed || !packed_size || refs <= 0 )
+		return NULL;
+
+	shared = (ST_FORWARD_SHARED *)malloc(sizeof(ST_FORWARD_SHARED) + packed_size);
+	if( !shared )
+		return NULL;
+
+	shared->refs = refs;
+	shared->state = FORWARD_SHARED_NEW;
+	shared->encoded = NULL;
+	shared->encoded_len = 0;
+	shared->packed_size = packed_size;
+	memcpy(shared->packed, packed, packed_size);
+
+	return shared;
+}
+//------------------------------------------------------------------------------
+
+// release records by forwarder (or worker, if not sent), freed by last
+void forward_shared_release(ST_FORWARD_SHARED *shared)
+{
+	if( shared && !__atomic_sub_fetch(&shared->refs, 1, __ATOMIC_ACQ_REL) ) {
+		free(shared->encoded);
+		free(shared);
+	}
 }
 //------------------------------------------------------------------------------
 
@@ -413,17 +792,22 @@ void *forwarder_thread(void *st_forwarder)
 {
 	static __thread ST_FORWARDER *config;				// configuration
 	static __thread ST_ANSWER answer;
-	static __thread int i, fHandle, so_error;
+	static __thread int so_error;
 	static __thread socklen_t so_error_len = sizeof(int);
 	static __thread ssize_t tmp, bytes_read = 0;
 	static __thread char fName[FILENAME_MAX];
-	static __thread struct dirent *result;
+	static __thread time_t now, last_check = 0;
+	static __thread uint64_t overflows;
 
 	// eror handler:
 	void exit_forwarder_thread(void * arg) {
 		unsigned int i;
 
-		// clear sockets
+		// coalesced records sent or saved to journal
+		coalesce_flush(config);
+
+		// clear sockets, eventfd of the ring closed by ring
+		config->sockets[IN_SOCKET] = BAD_OBJ;
 		for(i = 0; i < CNT_SOCKETS; i++ ) {
 			if( config->sockets[i] != BAD_OBJ ) {
 				shutdown(config->sockets[i], SHUT_RDWR);
@@ -432,16 +816,18 @@ void *forwarder_thread(void *st_forwarder)
 			}
 		}
 
-		/*  When no longer required, the socket pathname,
-		    should be deleted using unlink(2) or remove(3)
-		*/
-		if( strlen(config->addr_un.sun_path) )
-			unlink(config->addr_un.sun_path);
+		if( config->journal ) {
+			spool_close(config->journal);
+			config->journal = NULL;
+		}
 
-		if( config->data_dir )
-			closedir(config->data_dir);
+		terimal_reset_logged();
 
-		terimal_reset_logged(config->name);
+		// decoder/encoder state
+		if( config->session && config->terminal_session_destroy ) {
+			config->terminal_session_destroy(config->session);
+			config->session = NULL;
+		}
 
 		logging("forwarder[%s][%ld] destroyed\n", config->name, syscall(SYS_gettid));
 	}	// exit_forwarder_thread
@@ -459,9 +845,19 @@ void *forwarder_thread(void *st_forwarder)
 		return NULL;
 	}
 
-	// set inner listener socket
-	config->sockets[IN_SOCKET] = BAD_OBJ;
-	if( !set_listen_socket(config) ) {
+	// journal of the saved parcels: forward_files/<name>
+	snprintf(fName, FILENAME_MAX, "%.3800s/%.250s", stConfigServer.forward_files, config->name);
+	config->journal = spool_open(fName, 0);
+	if( !config->journal )
+		logging("forwarder[%s][%ld]: spool_open(%s) error, parcels not saved\n", config->name, syscall(SYS_gettid), fName);
+	else
+		data_import(config);
+
+	// parcels from workers: ring buffer, created by forwarders_start
+	config->sockets[OUT_SOCKET] = BAD_OBJ;
+	config->sockets[IN_SOCKET] = config->ring ? ring_eventfd(config->ring) : BAD_OBJ;
+	if( config->sockets[IN_SOCKET] == BAD_OBJ ) {
+		logging("forwarder[%s][%ld]: ring buffer not exists\n", config->name, syscall(SYS_gettid));
 		exit_forwarder_thread(NULL);
 		return NULL;
 	}
@@ -470,6 +866,17 @@ void *forwarder_thread(void *st_forwarder)
 	config->sockets[OUT_SOCKET] = BAD_OBJ;
 	set_out_socket(config, 1);	// if not connected, will retry
 
+	// decoder/encoder state of the connection to server, freed by exit_forwarder_thread
+	config->session = NULL;
+	if( config->terminal_session_create ) {
+		config->session = config->terminal_session_create();
+		if( !config->session ) {
+			logging("forwarder[%s][%ld]: terminal_session_create() error\n", config->name, syscall(SYS_gettid));
+			exit_forwarder_thread(NULL);
+			return NULL;
+		}
+	}
+
 	memset(&answer, 0, sizeof(ST_ANSWER));
 
 	logging("forwarder[%s][%ld] started\n", config->name, syscall(SYS_gettid));
@@ -488,83 +895,13 @@ void *forwarder_thread(void *st_forwarder)
 			exit_forwarder_thread(NULL);
 			return NULL;
 
-		case 0:	// timeout
-
-			/* read saved parcels and send to destination */
-			if( files_saved && out_connected && config->data_dir ) {
-				rewinddir(config->data_dir);	// resets the position of the directory stream to the beginning of the directory
-				i = 0;	// number of files to read
-
-				// iterate files in directory
-				while( (result = readdir(config->data_dir)) != NULL ) { // CPU usage increase
-					// is file name OK & contain this forwarder name & contain ".bin"?
-					if( strlen(result->d_name)
-							&& strstr(result->d_name, config->name)
-							&& strstr(result->d_name, ".bin") ) {
-
-						// generate full file name
-						snprintf(fName, FILENAME_MAX, "%s/%s", stConfigServer.forward_files, result->d_name);
-
-                        /*
-                        if( config->debug ){
-            				logging("forwarder[%s][%ld]: read file %s\n", config->name, syscall(SYS_gettid), result->d_name);
-                        }
-                        */
-
-						// open file for read
-						if( (fHandle = open(fName, O_RDONLY | O_NOATIME)) != -1 ) {
-
-							bytes_read = read(fHandle, config->buffers[IN_RDBUF], SOCKET_BUF_SIZE);
-							if( bytes_read > 0 ) {
-								process_terminal(config, config->buffers[IN_RDBUF], bytes_read);
-                            }
-                            /*
-    						else if( config->debug ) {
-    							logging("forwarder[%s][%ld]: file is empty\n", config->name, syscall(SYS_gettid));
-                            }
-                            */
-
-							close(fHandle);
-
-							if( config->debug ){
-								logging("forwarder[%s][%ld]: send saved file %s\n", config->name, syscall(SYS_gettid), result->d_name);
-                            }
-						}	// if( (fHandle = open(fName
-						else if( config->debug ) {
-							logging("forwarder[%s][%ld]: read file %s error: %d: %s\n", config->name, syscall(SYS_gettid), result->d_name, errno, strerror(errno));
-                        }
-
-						// delete file
-						unlink(fName);
-
-						if( ++i >= CNT_FILES_SEND )
-							break;	// max files reached, cancel
-					}	// if( strlen(result->d_name) &&
-				}	// while( (result = readdir(config->data_dir)) != NULL )
-
-                if( i < files_saved )
-                    files_saved -= i;
-                else
-                    files_saved = 0;
-
-                if( config->debug ){
-                    logging("forwarder[%s][%ld]: %d files processed\n", config->name, syscall(SYS_gettid), i);
-                }
-
-			}	// if( out_connected && config->data_dir )
-			else if( !config->data_dir && config->debug ){
-				logging("forwarder[%s][%ld]: directory '%s' is bad\n", config->name, syscall(SYS_gettid), stConfigServer.forward_files);
-			}	// else if( data_dir )
-            else if( !out_connected && config->debug ){
-				logging("forwarder[%s][%ld]: not connected to %s:%d\n", config->name, syscall(SYS_gettid), config->server, config->port);
-            }
-
+		case 0:	// timeout or ring buffer has parcels
 			break;
 		default:	// number of ready file descriptors
 
 			// OUT_SOCKET
 
-			if( FD_ISSET(config->sockets[OUT_SOCKET], &config->fdset[1]) ) {
+			if( !out_connected && FD_ISSET(config->sockets[OUT_SOCKET], &config->fdset[1]) ) {
 				// connection to remote server complete
 
 				if( !getsockopt(config->sockets[OUT_SOCKET], SOL_SOCKET, SO_ERROR, &so_error, &so_error_len) )
@@ -605,8 +942,9 @@ void *forwarder_thread(void *st_forwarder)
 
 						// decode server answer
 						if( config->terminal_decode ) {
+							answer_reset(&answer);
 							pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);	// do not disturb :)
-							config->terminal_decode(config->buffers[OUT_RDBUF], bytes_read, &answer, NULL);
+							config->terminal_decode(config->buffers[OUT_RDBUF], bytes_read, &answer, NULL, config->session);
 							pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);  // can disturb :)
 						}	// if( config->terminal_decode )
 
@@ -645,19 +983,34 @@ void *forwarder_thread(void *st_forwarder)
 			}	// if( FD_ISSET(config->sockets[OUT_SOCKET], &config->fdset[0]) )
 
 
-			// IN_SOCKET
+		}	// switch( wait_sockets(config) )
 
-			if( FD_ISSET(config->sockets[IN_SOCKET], &config->fdset[0]) ) {
-				// messages from workers
-				memset(config->buffers[IN_RDBUF], 0, SOCKET_BUF_SIZE);
-				bytes_read = recv(config->sockets[IN_SOCKET], config->buffers[IN_RDBUF], SOCKET_BUF_SIZE, 0);
-				if( bytes_read > 0 )
-					process_terminal(config, config->buffers[IN_RDBUF], bytes_read);
-				// else worker terminated
+		// parcels from workers
+		workers_batch(config);
 
-			}	// if( FD_ISSET(config->sockets[IN_SOCKET], &config->fdset[0]) )
+		// coalesced records waited coalesce_ms or not more records in ring buffer
+		if( coalesced && (!config->coalesce_ms || milliseconds() - coalesce_start >= (unsigned long long int)config->coalesce_ms) )
+			coalesce_flush(config);
 
-		}	// switch( wait_sockets(config) )
+		// send saved parcels while remote server accept it
+		if( out_connected && spool_pending(config->journal) )
+			data_resend(config);
+
+		now = time(NULL);
+		if( now != last_check ) {
+			last_check = now;
+
+			// flush journal to disk
+			spool_sync(config->journal, 0);
+
+			overflows = ring_overflows(config->ring);
+			if( overflows )
+				logging("forwarder[%s][%ld]: ring buffer full, %llu parcels lost\n", config->name, syscall(SYS_gettid), (unsigned long long)overflows);
+
+			if( config->debug ) {
+				logging("forwarder[%s][%ld]: queue %zu bytes%s\n", config->name, syscall(SYS_gettid), ring_used(config->ring), out_connected ? "" : ", not connected");
+			}
+		}	// if( now != last_check )
 
 	}	// while(1)
 
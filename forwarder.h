@@ -3,11 +3,11 @@
 
 #define _GNU_SOURCE
 #include <sys/select.h>
-#include <sys/un.h>
-#include <dirent.h>
 #include "de.h"
+#include "ring.h"
+#include "spool.h"
 
-#define IN_SOCKET   0
+#define IN_SOCKET   0   // eventfd of the ring buffer from workers, owned by ring
 #define OUT_SOCKET  1
 #define CNT_SOCKETS 2
 
@@ -16,8 +16,19 @@
 #define OUT_RDBUF	2
 #define OUT_WRBUF	3
 #define CNT_SOCBUF  4
-// max number of saved parcels to send
-#define CNT_FILES_SEND (10)
+// default size of the ring buffer from workers to forwarder
+#define FORWARD_QUEUE_SIZE (4*1024*1024)
+// max. size of the data of the message from worker (after ST_FORWARD_MSG)
+#define FORWARD_MSG_SIZE (SOCKET_BUF_SIZE - sizeof(ST_FORWARD_MSG))
+// max. number of the records coalesced into one encoded packet
+#define FORWARD_COALESCE_MAX (4*MAX_RECORDS)
+// ST_FORWARD_MSG.encode: records encoded once for all forwarders of the same protocol
+#define FORWARD_ENCODE_SHARED (2)
+// ST_FORWARD_SHARED.state
+#define FORWARD_SHARED_NEW      (0)
+#define FORWARD_SHARED_ENCODING (1)
+#define FORWARD_SHARED_ENCODED  (2)
+#define FORWARD_SHARED_FAILED   (3)
 
 // configuration of the forward server
 typedef struct {
@@ -28,14 +39,21 @@ typedef struct {
     char server[STRLEN];	// IP or DNS-name of the servfer to
     char app[STRLEN];		// hight-level protocol of the messages
     int debug;              // debug messages enable
+    int coalesce_records;   // max. number of the records of the any terminals in one encoded packet, 0 - packet per parcel
+    int coalesce_ms;        // max. time of the records coalescing, milliseconds, 0 - records from ring buffer only
     void *library_handle;	// handle to shared library of protocol encode/decode
-    void (*terminal_decode)(char*, int, ST_ANSWER*, void*);        // pointer to decode terminal message function
-    int (*terminal_encode)(ST_RECORD*, int, char*, int);    // pointer to encode terminal message function
+    void (*terminal_decode)(char*, int, ST_ANSWER*, void*, void*);        // pointer to decode terminal message function
+    int (*terminal_encode)(ST_RECORD*, int, char*, int, void*);    // pointer to encode terminal message function
+    void *(*terminal_session_create)(void);    // pointer to create decoder state function or NULL (see de.h)
+    void (*terminal_session_destroy)(void*);   // pointer to free decoder state function or NULL
+    int (*terminal_restamp)(char*, int, void*);    // pointer to restamp shared packet function or NULL (see de.h)
+    void *session;          // decoder/encoder state of the connection to server
     int sockets[CNT_SOCKETS];		    // sockets
     fd_set fdset[2];	// pull of the sockets
-    struct sockaddr_un addr_un;			// unix socket struct
+    ST_RING *ring;          // parcels from workers, see forwarder_ring
     char buffers[CNT_SOCBUF][SOCKET_BUF_SIZE];	// read & write buffers for sockets
-	DIR *data_dir;              // saved files directory
+    ST_RECORD records[FORWARD_COALESCE_MAX];	// records from workers, unpacked for encode
+    ST_SPOOL *journal;          // not sended parcels, forward_files/<name>
 } ST_FORWARDER;
 
 // forwarding terminals list
@@ -58,10 +76,28 @@ extern ST_FORWARDERS stForwarders;		// glonassd.c
 typedef struct {
     char imei[SIZE_TRACKER_FIELD];	// ID of the terminal
     int encode;	// encode need flag
-    int len;		// data length
-    // char data[len];	// data
+    int len;		// data length (encode = 0) or number of the records (encode != 0)
+    // char data[];	// raw data, packed records (record.h) or pointer to ST_FORWARD_SHARED
 } ST_FORWARD_MSG;
 
+/*
+records of the message, encoded once for all forwarders of the same protocol:
+created by worker, pointer sent to each forwarder (encode = FORWARD_ENCODE_SHARED),
+first forwarder encodes records, others copy the packet & restamp it (terminal_restamp),
+freed by last forwarder
+*/
+typedef struct {
+    volatile int refs;      // number of the forwarders, not processed it yet
+    volatile int state;     // FORWARD_SHARED_NEW ... FORWARD_SHARED_FAILED
+    char *encoded;          // packet, encoded by first forwarder
+    int encoded_len;        // size of the packet
+    size_t packed_size;     // size of the packed records
+    char packed[];          // packed records (record.h)
+} ST_FORWARD_SHARED;
+
+ST_RING *forwarder_ring(const char *name, size_t size);
+ST_FORWARD_SHARED *forward_shared_create(char *packed, size_t packed_size, int refs);
+void forward_shared_release(ST_FORWARD_SHARED *shared);
 void *forwarder_thread(void *st_forwarder);
 
 #endif
@@ -34,6 +34,13 @@ typedef struct {
 } ST_COMMAND;
 #pragma pack( pop )
 
+// состояние соединения (terminal_session_create): посылка, пришедшая частями
+typedef struct {
+    char data[SOCKET_BUF_SIZE];    // буфер для хранения посылки
+    unsigned int part_size;        // принято байт посылки
+    unsigned int packet_len;       // длинна посылки
+} GALILEO_SESSION;
+
 // Ответная структура имеет точно такой же формат.
 // Все поля при работе с командами обязательны!
 // Верификация команды проходит, если совпадает тег IMEI либо тег ID.
@@ -221,13 +228,13 @@ __attribute__ ((constructor)) static void unload(void)
    parcel - the raw data from socket
    parcel_size - it length
    answer - pointer to ST_ANSWER structure
+   session - decoder state of the connection (see de.h)
 */
-void terminal_decode(char *parcel, int parcel_size, ST_ANSWER *answer, ST_WORKER *worker)
+void terminal_decode(char *parcel, int parcel_size, ST_ANSWER *answer, ST_WORKER *worker, void *session)
 {
-    static char data[SOCKET_BUF_SIZE]= {0};    // буфер для хранения посылки
-    static unsigned int part_size = 0;
-    static unsigned int packet_len = 0;
+    GALILEO_SESSION *gs = (GALILEO_SESSION *)session;
     ST_COMMAND *galileo_cmd = NULL;
+    char *data;    // packet: parcel if it is whole, else collected in gs->data
     ST_RECORD *record = NULL;
     unsigned int tag, i = 0, rec_ok = 0, cur_tag = 0;
     struct tm tm_data = {0};
@@ -235,8 +242,9 @@ void terminal_decode(char *parcel, int parcel_size, ST_ANSWER *answer, ST_WORKER
     void *tpp = NULL;    // for prevent error: dereferencing type-punned pointer will break strict-aliasing rules
     char buf[30];
 
-    if( !parcel || parcel_size <= 0 || !answer )
+    if( !parcel || parcel_size <= 0 || !answer || !gs )
         return;
+    data = gs->data;
 
     //log2file("/var/www/locman.org/tmp/gcc/galileo_in_", parcel, parcel_size);
     //---------------------------------------------------------------------
@@ -244,8 +252,9 @@ void terminal_decode(char *parcel, int parcel_size, ST_ANSWER *answer, ST_WORKER
     ST_RECORD *new_record(void) {
         if( answer->count < MAX_RECORDS - 1 )
             ++answer->count;
-        snprintf(answer->records[answer->count - 1].tracker, SIZE_TRACKER_FIELD, "galileo");
-        return &answer->records[answer->count - 1];
+        ST_RECORD *rec = record_reset(&answer->records[answer->count - 1]);
+        snprintf(rec->tracker, SIZE_TRACKER_FIELD, "galileo");
+        return rec;
     }
     //---------------------
 
@@ -264,12 +273,15 @@ void terminal_decode(char *parcel, int parcel_size, ST_ANSWER *answer, ST_WORKER
       ) {
         // начало посылки найдено
         // получаем длинну посылки
-        packet_len = (32767 & (*(unsigned short int*)&parcel[i+1]));
+        gs->packet_len = (32767 & (*(unsigned short int*)&parcel[i+1]));
 
-        // копируем её в буфер
-        memset(&data, 0, SOCKET_BUF_SIZE);
-        memcpy(&data, parcel, parcel_size);
-        part_size = parcel_size;
+        // целая посылка (см. terminal_frame_length) разбирается прямо из parcel,
+        // первая часть посылки копируется в буфер
+        if( (unsigned int)parcel_size >= gs->packet_len + 5 )
+            data = parcel;
+        else
+            memcpy(gs->data, parcel, parcel_size);
+        gs->part_size = parcel_size;
 
     }    // if( parcel[i] == 1
     else if( parcel[i] == 2 && parcel_size == 3 ) {
@@ -278,16 +290,16 @@ void terminal_decode(char *parcel, int parcel_size, ST_ANSWER *answer, ST_WORKER
     }    // else if( parcel[i] == 2
     else {    // пришла следующая часть посылки
 
-        if( part_size ) {    // есть первая часть посылки
-            if(part_size + parcel_size <= SOCKET_BUF_SIZE) {    // add part of the parcel to buffer
-                memcpy(&data[part_size], parcel, parcel_size);
-                part_size += parcel_size;
+        if( gs->part_size ) {    // есть первая часть посылки
+            if(gs->part_size + parcel_size <= SOCKET_BUF_SIZE) {    // add part of the parcel to buffer
+                memcpy(&gs->data[gs->part_size], parcel, parcel_size);
+                gs->part_size += parcel_size;
             } else {    // full parcel is too long
-                memcpy(&data[part_size], parcel, parcel_size - (SOCKET_BUF_SIZE - part_size));
-                part_size += (SOCKET_BUF_SIZE - part_size);
+                memcpy(&gs->data[gs->part_size], parcel, SOCKET_BUF_SIZE - gs->part_size);
+                gs->part_size += (SOCKET_BUF_SIZE - gs->part_size);
             }
-        }    // if( part_size )
-        else {    // нет первой части посылки, part_size == 0
+        }    // if( gs->part_size )
+        else {    // нет первой части посылки, gs->part_size == 0
             if( answer->lastpoint.imei[0] ) {    // есть IMEI
                 // попробуем найти записи в посылке
                 for(i = 0; i < parcel_size - 2; i++) {
@@ -296,28 +308,28 @@ void terminal_decode(char *parcel, int parcel_size, ST_ANSWER *answer, ST_WORKER
                             && parcel[i + 1] == answer->lastpoint.imei[1] ) {
                         // с большой вероятностью мы нашли imei
                         i -= 4;    // имитируем начало пакета: 3 байта заголовка перед тегом 3 (imei)
-                        packet_len = parcel_size - i;
-                        if( packet_len > 0 ) {
-                            memcpy(&data[part_size], &parcel[i], packet_len);
-                            part_size = packet_len + 10;    //
+                        gs->packet_len = parcel_size - i;
+                        if( gs->packet_len > 0 ) {
+                            memcpy(&gs->data[gs->part_size], &parcel[i], gs->packet_len);
+                            gs->part_size = gs->packet_len + 10;    //
                             break;
                         }
                     }
                 }    // for(i = 0;
             }    // if( answer->lastpoint->imei[0] )
-        }    // else if( part_size )
+        }    // else if( gs->part_size )
 
     }    // else if( parcel[i] == 1
 
-    if( part_size - 5 < packet_len ) {    // это только часть всей посылки
+    if( gs->part_size - 5 < gs->packet_len ) {    // это только часть всей посылки
         //logging("terminal_decode[galileo]: wait\n");
         return;    // и выходим, будем ждать остаток
     }
 
     //logging("terminal_decode[galileo]: work\n");
-    //logging("terminal_decode[galileo]: CRC=%u\n", *(unsigned short *)&data[part_size-sizeof(unsigned short)]);
+    //logging("terminal_decode[galileo]: CRC=%u\n", *(unsigned short *)&gs->data[gs->part_size-sizeof(unsigned short)]);
 
-    if( packet_len > 0 ) {
+    if( gs->packet_len > 0 ) {
         record = new_record();
         i = 3;    // пропускаем 2 байта длинны записи
     } else {
@@ -331,7 +343,7 @@ void terminal_decode(char *parcel, int parcel_size, ST_ANSWER *answer, ST_WORKER
 
     rec_ok = 0;    // сбрасываем флаг распознанной записи
 
-    while(i < packet_len + 3) {
+    while(i < gs->packet_len + 3) {
 
         tag = data[i];
 
@@ -658,17 +670,17 @@ void terminal_decode(char *parcel, int parcel_size, ST_ANSWER *answer, ST_WORKER
             break;
         default:    // не обрабатываемый или неизвестный тег
 
-            i = packet_len + 3;    // break cycle
+            i = gs->packet_len + 3;    // break cycle
 
         }    // switch(tag)
-    }    // while(i < packet_len + 3)
+    }    // while(i < gs->packet_len + 3)
 
 
     // response
     if( answer->count || rec_ok ) {
         answer->answer[0] = 2;    // response code
         // copy CRC of the packet
-        memcpy(&answer->answer[1], &data[3 + packet_len], 2);
+        memcpy(&answer->answer[1], &data[3 + gs->packet_len], 2);
         answer->size = 3;
 
         if( record )
@@ -689,11 +701,54 @@ void terminal_decode(char *parcel, int parcel_size, ST_ANSWER *answer, ST_WORKER
         }
     }    // if( answer->count || rec_ok )
 
-    part_size = packet_len = 0;
-    memset(&data, 0, SOCKET_BUF_SIZE);
+    // clear only used part of the buffer
+    if( data == gs->data )
+        memset(gs->data, 0, gs->part_size < SOCKET_BUF_SIZE ? gs->part_size : SOCKET_BUF_SIZE);
+    gs->part_size = gs->packet_len = 0;
+}
+//------------------------------------------------------------------------------
+
+
+/*
+   create decoder state of the connection (see de.h)
+   return pointer to GALILEO_SESSION structure or NULL if error
+*/
+void *terminal_session_create(void)
+{
+    return calloc(1, sizeof(GALILEO_SESSION));
+}
+//------------------------------------------------------------------------------
+
+// free decoder state of the connection
+void terminal_session_destroy(void *session)
+{
+    free(session);
 }
 //------------------------------------------------------------------------------
 
+/*
+   frame length function (see de.h)
+   buf - the raw data from socket
+   len - it length
+   return length of the frame, 0 if unknown yet or BAD_OBJ if not recognized
+*/
+int terminal_frame_length(char *buf, int len)
+{
+    if( !buf || len <= 0 )
+        return 0;
+
+    switch( buf[0] ) {
+    case 1:    // packet: 1 byte header, 2 bytes length, data, 2 bytes CRC
+        if( len < 3 )
+            return 0;
+        return 3 + (32767 & (*(unsigned short int*)&buf[1])) + 2;
+    case 2:    // respond from server (e.g forwarder): 1 byte header, 2 bytes CRC
+        return 3;
+    }
+
+    return BAD_OBJ;
+}
+//------------------------------------------------------------------------------
 
 /*
    encode function
@@ -701,9 +756,10 @@ void terminal_decode(char *parcel, int parcel_size, ST_ANSWER *answer, ST_WORKER
    reccount - number of struct in array, and returning
    buffer - buffer for encoded data
    bufsize - size of buffer
+   session - encoder state of the connection (see de.h)
    return size of data in the buffer for encoded data
 */
-int terminal_encode(ST_RECORD *records, int reccount, char *buffer, int bufsize)
+int terminal_encode(ST_RECORD *records, int reccount, char *buffer, int bufsize, void *session)
 {
 	int i, top = 0;
 	struct tm tm_data;
@@ -787,3 +843,14 @@ int terminal_encode(ST_RECORD *records, int reccount, char *buffer, int bufsize)
 	return top;
 }
 //------------------------------------------------------------------------------
+
+/*
+   restamp function (see de.h)
+   packet of terminal_encode not depends on session, sent as is
+   return size of the packet
+*/
+int terminal_restamp(char *buffer, int size, void *session)
+{
+    return buffer ? size : 0;
+}
+//------------------------------------------------------------------------------
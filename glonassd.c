@@ -91,11 +91,17 @@
 #include <pthread.h>
 #include <sys/time.h>
 #include <sys/resource.h>
+#include <sys/stat.h>   /* mkdir */
 #include "glonassd.h"
 #include "todaemon.h"
 #include "worker.h"
+#include "reactor.h"
 #include "forwarder.h"
+#include "route.h"
+#include "ring.h"
+#include "spool.h"
 #include "logger.h"
+#include "capture.h"
 #include "lib.h"
 
 // globals
@@ -111,11 +117,18 @@ void (*timer_function_pointer)(union sigval) = NULL;  // timer routine address
 long GMT_diff = 0;	// difference between local time & GMT time
 pthread_attr_t worker_thread_attr;	// thread attributes
 int attr_init = 0;                  // flag: 0 - thread attributes initialized, != 0 - not initialized
+ST_RING *db_rings[DB_SINKS_MAX][DB_THREADS_MAX];  // records from workers to database threads (db_queue = ring)
+unsigned int db_shards = 0;         // number of the rings of each database library, 0 if db_queue = mq
+unsigned int db_sinks = 0;          // number of the database libraries with rings
+ST_SPOOL *db_spools[DB_SINKS_MAX];  // spools of the messages to database, if queue full or database down
 
 // locals
-static void *db_library_handle = NULL;
-static pthread_t db_thread = 0;
+static void *db_library_handle[DB_SINKS_MAX];
+static pthread_t db_thread[DB_SINKS_MAX][DB_THREADS_MAX];
+static ST_DB_SHARD db_shard[DB_SINKS_MAX][DB_THREADS_MAX];  // arguments of the database threads
+static unsigned int db_threads[DB_SINKS_MAX];  // number of the started database threads of each library
 static pthread_t log_thread = 0;
+static pthread_t capture_thread = 0;
 static struct pollfd *pollset = NULL;	// pull of the listener's sockets
 static int pollcnt = 0;	// number of the polled sockets
 
@@ -182,73 +195,110 @@ static int parceParams(int argc, char* argv[])
 
 /*
     database threads start/stop rutine & database timer function pointer initialize
-    start - 1-start, 0-stop database thread
+    threads started for each database library (db_type), timers use the first one
+    start - 1-start, 0-stop database threads
 */
 static int database_setup(unsigned int start)
 {
     void *(*db_thread_func)(void *); // pointer to database thread function
     char *cerror, lib_path[FILENAME_MAX];
     int thread_ok;
+    unsigned int i, sink;
+    ST_DB_SHARD *arg;
 
     if( start ) {
 
-        memset(lib_path, 0, FILENAME_MAX);
-        snprintf(lib_path, FILENAME_MAX, "%.4060s/%.30s.so", stParams.start_path, stConfigServer.db_type);
-
-        db_library_handle = dlopen(lib_path, RTLD_LAZY);
-        if( !db_library_handle ) {
-            logging("database_setup: dlopen(%s) error: %s\n", lib_path, dlerror());
+        if( !stConfigServer.db_sinks ) {
+            logging("database_setup: db_type not set\n");
             return 0;
         }
 
-        // get pointer to database thread function
-        dlerror();	// Clear any existing error
-        db_thread_func = dlsym(db_library_handle, "db_thread");
-        cerror = dlerror();
-        if( cerror != NULL ) {
-            logging("database_setup: dlsym(\"db_thread\") error: %s\n", cerror);
-            database_setup(0);
-            return 0;
-        }
+        for(sink = 0; sink < (unsigned int)stConfigServer.db_sinks; sink++) {
 
-        // get pointer to timer thread function
-        timer_function_pointer = dlsym(db_library_handle, "timer_function");
-        cerror = dlerror();
-        if( cerror != NULL ) {
-            timer_function_pointer = NULL;
-            logging("database_setup: dlsym(\"timer_function\") error: %s\n", cerror);
-        }
+            memset(lib_path, 0, FILENAME_MAX);
+            snprintf(lib_path, FILENAME_MAX, "%.4060s/%.30s.so", stParams.start_path, stConfigServer.db_sink[sink].db_type);
 
-        // start database thread
-        if( attr_init )
-            thread_ok = pthread_create(&db_thread, &worker_thread_attr, db_thread_func, &stConfigServer);
-        else
-            thread_ok = pthread_create(&db_thread, NULL, db_thread_func, &stConfigServer);
+            db_library_handle[sink] = dlopen(lib_path, RTLD_LAZY);
+            if( !db_library_handle[sink] ) {
+                logging("database_setup: dlopen(%s) error: %s\n", lib_path, dlerror());
+                database_setup(0);
+                return 0;
+            }
 
-        if( thread_ok ) {	// error
-            logging("database_setup: pthread_create error %d: %s\n", errno, strerror(errno));
-            database_setup(0);
-            return 0;
-        }
+            // get pointer to database thread function
+            dlerror();	// Clear any existing error
+            db_thread_func = dlsym(db_library_handle[sink], "db_thread");
+            cerror = dlerror();
+            if( cerror != NULL ) {
+                logging("database_setup: %s: dlsym(\"db_thread\") error: %s\n", stConfigServer.db_sink[sink].db_type, cerror);
+                database_setup(0);
+                return 0;
+            }
 
-        // return database thread working status
-        return ( pthread_tryjoin_np(db_thread, NULL) == EBUSY );
+            // get pointer to timer thread function
+            if( !sink ) {
+                timer_function_pointer = dlsym(db_library_handle[sink], "timer_function");
+                cerror = dlerror();
+                if( cerror != NULL ) {
+                    timer_function_pointer = NULL;
+                    logging("database_setup: dlsym(\"timer_function\") error: %s\n", cerror);
+                }
+            }
+
+            // start database threads, one per ring buffer or one for message queue
+            for(db_threads[sink] = 0; db_threads[sink] < (db_shards ? db_shards : 1); db_threads[sink]++) {
+                arg = &db_shard[sink][db_threads[sink]];
+                arg->shard = db_threads[sink];
+                arg->ring = db_rings[sink][db_threads[sink]];
+                arg->spool = db_spools[sink];
+                arg->sink = &stConfigServer.db_sink[sink];
+
+                if( attr_init )
+                    thread_ok = pthread_create(&db_thread[sink][db_threads[sink]], &worker_thread_attr, db_thread_func, arg);
+                else
+                    thread_ok = pthread_create(&db_thread[sink][db_threads[sink]], NULL, db_thread_func, arg);
+
+                if( thread_ok ) {	// error
+                    logging("database_setup: pthread_create error %d: %s\n", errno, strerror(errno));
+                    database_setup(0);
+                    return 0;
+                }
+            }
+        }   // for(sink
+
+        // return database threads working status
+        for(sink = 0; sink < DB_SINKS_MAX; sink++) {
+            for(i = 0; i < db_threads[sink]; i++) {
+                if( pthread_tryjoin_np(db_thread[sink][i], NULL) != EBUSY ) {
+                    db_thread[sink][i] = 0;
+                    database_setup(0);
+                    return 0;
+                }
+            }
+        }
+        return 1;
 
     }	// if( start )
     else {
 
-        // stop database thread
-        if( db_thread ) {
-            pthread_cancel(db_thread);
-            pthread_join(db_thread, NULL);
-            db_thread = 0;
-        }
+        for(sink = 0; sink < DB_SINKS_MAX; sink++) {
+            // stop database threads
+            for(i = 0; i < db_threads[sink]; i++) {
+                if( db_thread[sink][i] ) {
+                    pthread_cancel(db_thread[sink][i]);
+                    pthread_join(db_thread[sink][i], NULL);
+                    db_thread[sink][i] = 0;
+                }
+            }
+            db_threads[sink] = 0;
 
-        // unload library
-        if( db_library_handle ) {
-            dlclose(db_library_handle);
-            db_library_handle = NULL;
+            // unload library
+            if( db_library_handle[sink] ) {
+                dlclose(db_library_handle[sink]);
+                db_library_handle[sink] = NULL;
+            }
         }
+        timer_function_pointer = NULL;
 
     } // else if( start )
 
@@ -262,6 +312,9 @@ static int setup(char *config_path)
 {
     struct timespec waittime;
     int thread_error;
+    unsigned int i, j, shard;
+    char spool_path[FILENAME_MAX];
+    ST_SPOOL *old_spools[DB_SINKS_MAX];
 
     memset(&waittime, 0, sizeof(struct timespec));
     memset(&stListeners, 0, sizeof(ST_LISTENERS));
@@ -291,6 +344,106 @@ static int setup(char *config_path)
     waittime.tv_sec = 1;
     pthread_timedjoin_np(log_thread, NULL, &waittime);
 
+    // capture thread, if parcels of the terminals logged
+    for(i = 0; !stConfigServer.log_imei[0] && i < (unsigned int)stListeners.count && !stListeners.listener[i].log_all; i++);
+    if( stConfigServer.log_imei[0] || i < (unsigned int)stListeners.count ) {
+        if( !capture_create(stConfigServer.capture_queue_size) )
+            logging("setup: ring_create(%zu) error, parcels not captured\n", stConfigServer.capture_queue_size);
+        else if( pthread_create(&capture_thread, attr_init ? &worker_thread_attr : NULL, capture_thread_func, NULL) ) {
+            logging("setup: capture thread start error %d: %s\n", errno, strerror(errno));
+            capture_thread = 0;
+        }
+    }
+
+    /*
+        ring buffers for records created once & not freed, because
+        workers (threads not joined) may use it until process exit,
+        size & number of the database threads not changed by reconfigure,
+        rings of the database library created when it first appears in db_type
+    */
+    if( stConfigServer.db_queue == DB_QUEUE_RING && !db_shards ) {
+        if( stConfigServer.db_threads < 1 )
+            stConfigServer.db_threads = 1;
+        else if( stConfigServer.db_threads > DB_THREADS_MAX )
+            stConfigServer.db_threads = DB_THREADS_MAX;
+
+        while( db_shards < (unsigned int)stConfigServer.db_threads ) {
+            db_rings[0][db_shards] = ring_create(stConfigServer.db_queue_size);
+            if( !db_rings[0][db_shards] ) {
+                logging("setup: ring_create(%zu) error, %u database threads\n", stConfigServer.db_queue_size, db_shards);
+                break;
+            }
+            db_shards++;
+        }
+
+        if( !db_shards ) {
+            logging("setup: ring_create(%zu) error, use db_queue = mq\n", stConfigServer.db_queue_size);
+            stConfigServer.db_queue = DB_QUEUE_MQ;
+        }
+    }
+    else if( stConfigServer.db_queue == DB_QUEUE_MQ && stConfigServer.db_threads > 1 ) {
+        logging("setup: db_queue = mq, db_threads = %d ignored, one database thread\n", stConfigServer.db_threads);
+    }
+
+    if( db_shards ) {
+        for(i = 1; i < (unsigned int)stConfigServer.db_sinks; i++) {
+            for(shard = 0; shard < db_shards && db_rings[i][shard]; shard++);
+            for(; shard < db_shards; shard++) {
+                db_rings[i][shard] = ring_create(stConfigServer.db_queue_size);
+                if( !db_rings[i][shard] )
+                    break;
+            }
+
+            if( shard < db_shards ) {
+                logging("setup: ring_create(%zu) error, database %s not used\n", stConfigServer.db_queue_size, stConfigServer.db_sink[i].db_type);
+                stConfigServer.db_sinks = i;
+            }
+        }
+        db_sinks = stConfigServer.db_sinks;
+    }
+    else if( stConfigServer.db_sinks > 1 ) {
+        logging("setup: db_queue = mq, database %s only\n", stConfigServer.db_sink[0].db_type);
+        stConfigServer.db_sinks = 1;
+    }
+
+    /*
+        spools kept by reconfigure, spool of the database library found by it directory,
+        each database library has own subdirectory if db_type is list,
+        so records of one library never replayed into another after db_type changed
+    */
+    memcpy(old_spools, db_spools, sizeof(db_spools));
+    memset(db_spools, 0, sizeof(db_spools));
+
+    for(i = 0; stConfigServer.db_spool[0] && i < (unsigned int)stConfigServer.db_sinks; i++) {
+        if( stConfigServer.db_sinks > 1 ) {
+            if( mkdir(stConfigServer.db_spool, S_IRWXU) && errno != EEXIST )
+                logging("setup: mkdir(%s) error %d: %s\n", stConfigServer.db_spool, errno, strerror(errno));
+            snprintf(spool_path, FILENAME_MAX, "%.3800s/%.200s", stConfigServer.db_spool, stConfigServer.db_sink[i].db_type);
+        }
+        else
+            snprintf(spool_path, FILENAME_MAX, "%s", stConfigServer.db_spool);
+
+        for(j = 0; j < DB_SINKS_MAX; j++) {
+            if( old_spools[j] && !strcmp(old_spools[j]->path, spool_path) ) {
+                db_spools[i] = old_spools[j];
+                old_spools[j] = NULL;
+                break;
+            }
+        }
+
+        if( !db_spools[i] ) {
+            db_spools[i] = spool_open(spool_path, stConfigServer.db_spool_segment);
+            if( !db_spools[i] )
+                logging("setup: spool_open(%s) error, spool not used\n", spool_path);
+        }
+    }
+
+    // database library removed from db_type or spool directory changed
+    for(j = 0; j < DB_SINKS_MAX; j++) {
+        if( old_spools[j] )
+            spool_close(old_spools[j]);
+    }
+
     return database_setup(1);
 }
 //------------------------------------------------------------------------------
@@ -298,7 +451,10 @@ static int setup(char *config_path)
 // stopping & free resources
 int cleanup(void)
 {
+    unsigned int i;
+
     timers_stop();
+    reactors_stop();
     listeners_stop();
     forwarders_stop();
 
@@ -310,6 +466,17 @@ int cleanup(void)
 
     database_setup(0);
 
+    // database threads may spool messages on exit
+    for(i = 0; i < DB_SINKS_MAX; i++)
+        spool_sync(db_spools[i], 1);
+
+    // stop capture, before logger
+    if( capture_thread ) {
+        pthread_cancel(capture_thread);
+        pthread_join(capture_thread, NULL);
+        capture_thread = 0;
+    }
+
     // stop logger
     if( log_thread ) {
         pthread_cancel(log_thread);
@@ -436,12 +603,90 @@ static int library_load(char *protocol, void **lib_handle, void **f_decode, void
 }
 //------------------------------------------------------------------------------
 
-// startup listeners
-static int listeners_start()
+/*
+    get optional function of the terminals protocols shared library (see de.h)
+    lib_handle - library handle
+    name - name of the function
+    return pointer to function or NULL if library not exports it
+*/
+static void *library_symbol(void *lib_handle, const char *name)
 {
-    unsigned int i;
+    void *symbol;
+
+    dlerror();	// Clear any existing error
+    symbol = dlsym(lib_handle, name);
+    if( dlerror() != NULL )
+        return NULL;
+
+    return symbol;
+}
+//------------------------------------------------------------------------------
+
+/*
+    create, bind & listen socket for listener
+    listener - pointer to ST_LISTENER structure (glonassd.h)
+    return socket or BAD_OBJ if error
+*/
+int listener_open(ST_LISTENER *listener)
+{
+    int sock;
     struct sockaddr_in in_addr;
 
+    // create listener socket
+    sock = socket(AF_INET, listener->protocol, 0);
+    if( sock < 0 ) {
+        logging("listener[%s]: socket() error %d: %s\n", listener->name, errno, strerror(errno));
+        return BAD_OBJ;
+    }
+
+    /*
+        After listener stop, if client connected and hold connect,
+        socket switch to TIME_WAIT mode and restart listener with
+        bind() raise error: "Address already in use" (errno = 98)
+        Block error with: SO_REUSEADDR & SO_REUSEPORT
+        SO_REUSEPORT also allow many sockets on one port (io_reuseport = 1),
+        kernel distribute connections between them
+    */
+    if (setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &(int) {1}, sizeof(int)) < 0)
+        logging("listener[%s]: setsockopt(SO_REUSEADDR) error %d: %s\n", listener->name, errno, strerror(errno));
+
+#ifdef SO_REUSEPORT
+    if (setsockopt(sock, SOL_SOCKET, SO_REUSEPORT, &(int) {1}, sizeof(int)) < 0)
+        logging("listener %s: setsockopt(SO_REUSEPORT) error %d: %s\n", listener->name, errno, strerror(errno));
+#endif
+
+    // bind socket to address & port
+    memset(&in_addr, 0, sizeof(struct sockaddr_in));
+    in_addr.sin_family = AF_INET;
+    inet_aton(stConfigServer.listen, &in_addr.sin_addr);
+    in_addr.sin_port = htons(listener->port);
+
+    if( bind(sock, (struct sockaddr *)&in_addr, sizeof(struct sockaddr_in)) < 0 ) {
+        logging("listener[%s]: bind() error %d: %s\n", listener->name, errno, strerror(errno));
+        close(sock);
+        return BAD_OBJ;
+    }
+
+    // listen terminals, second param. - listener queue size
+    if( listen(sock, stConfigServer.socket_queue) < 0 ) {
+        logging("listener[%s]: listen() error %d: %s\n", listener->name, errno, strerror(errno));
+        close(sock);
+        return BAD_OBJ;
+    }
+
+    return sock;
+}
+//------------------------------------------------------------------------------
+
+/*
+    startup listeners
+    if io_reuseport, sockets created by event loops (reactor.c), only libraries loaded here
+    return number of started listeners
+*/
+static int listeners_start()
+{
+    unsigned int i, cnt = 0;
+
     // preventive clear pollfd structure
     pollcnt = 0;
     if( pollset ) {
@@ -457,6 +702,8 @@ static int listeners_start()
     // iterate listeners
     for(i = 0; i < stListeners.count; i++) {
 
+        stListeners.listener[i].socket = BAD_OBJ;
+
         // start service if enabled
         if( stListeners.listener[i].enabled ) {
 
@@ -465,49 +712,31 @@ static int listeners_start()
             // load library for listener's worker
             if( library_load(stListeners.listener[i].name, &stListeners.listener[i].library_handle, (void*)&stListeners.listener[i].terminal_decode, (void*)&stListeners.listener[i].terminal_encode) ) {
 
-                // create listener socket
-                stListeners.listener[i].socket = socket(AF_INET, stListeners.listener[i].protocol, 0);
-                if( stListeners.listener[i].socket < 0 ) {
-                    logging("listener[%s]: socket() error %d: %s\n", stListeners.listener[i].name, errno, strerror(errno));
-                    continue;	// next listener
+                // not exported by library: terminal_decode gets data as received
+                stListeners.listener[i].terminal_frame_length = library_symbol(stListeners.listener[i].library_handle, "terminal_frame_length");
+                // not exported by library: session is NULL
+                stListeners.listener[i].terminal_session_create = library_symbol(stListeners.listener[i].library_handle, "terminal_session_create");
+                stListeners.listener[i].terminal_session_destroy = library_symbol(stListeners.listener[i].library_handle, "terminal_session_destroy");
+
+                // event loops pass to terminal_decode data as received, framing is required
+                stListeners.listener[i].io_model = stConfigServer.io_model;
+                if( stConfigServer.io_model != IO_MODEL_THREAD && !stListeners.listener[i].terminal_frame_length ) {
+                    stListeners.listener[i].io_model = IO_MODEL_THREAD;
+                    logging("listener[%s]: library not exports terminal_frame_length, terminals served by threads\n", stListeners.listener[i].name);
                 }
 
-                /*
-                    After listener stop, if client connected and hold connect,
-                    socket switch to TIME_WAIT mode and restart listener with
-                    bind() raise error: "Address already in use" (errno = 98)
-                    Block error with: SO_REUSEADDR & SO_REUSEPORT
-                */
-                if (setsockopt(stListeners.listener[i].socket, SOL_SOCKET, SO_REUSEADDR, &(int) {1}, sizeof(int)) < 0)
-                    logging("listener[%s]: setsockopt(SO_REUSEADDR) error %d: %s\n", stListeners.listener[i].name, errno, strerror(errno));
-
-#ifdef SO_REUSEPORT
-                if (setsockopt(stListeners.listener[i].socket, SOL_SOCKET, SO_REUSEPORT, &(int) {1}, sizeof(int)) < 0)
-                    logging("listener %s: setsockopt(SO_REUSEPORT) error %d: %s\n", stListeners.listener[i].name, errno, strerror(errno));
-#endif
-
-                // bind socket to address & port
-                memset(&in_addr, 0, sizeof(struct sockaddr_in));
-                in_addr.sin_family = AF_INET;
-                inet_aton(stConfigServer.listen, &in_addr.sin_addr);
-                in_addr.sin_port = htons(stListeners.listener[i].port);
-
-                if( bind(stListeners.listener[i].socket, (struct sockaddr *)&in_addr, sizeof(struct sockaddr_in)) < 0 ) {
-                    logging("listener[%s]: bind() error %d: %s\n", stListeners.listener[i].name, errno, strerror(errno));
-                    close(stListeners.listener[i].socket);
-                    stListeners.listener[i].socket = BAD_OBJ;
+                if( stListeners.listener[i].io_model != IO_MODEL_THREAD && stConfigServer.io_reuseport ) {
+                    ++cnt;
+                    logging("listener[%s] on port %d served by event loops\n", stListeners.listener[i].name, stListeners.listener[i].port);
                     continue;
                 }
 
-                // listen terminals, second param. - listener queue size
-                if( listen(stListeners.listener[i].socket, stConfigServer.socket_queue) < 0 ) {
-                    logging("listener[%s]: listen() error %d: %s\n", stListeners.listener[i].name, errno, strerror(errno));
-                    close(stListeners.listener[i].socket);
-                    stListeners.listener[i].socket = BAD_OBJ;
-                    continue;
-                }
+                stListeners.listener[i].socket = listener_open(&stListeners.listener[i]);
+                if( stListeners.listener[i].socket == BAD_OBJ )
+                    continue;	// next listener
 
                 ++pollcnt;	// number of started listeners (and polled sockets)
+                ++cnt;
 
                 // set up pollfd structure
                 pollset = (struct pollfd *)realloc(pollset, pollcnt * sizeof(struct pollfd));
@@ -522,7 +751,7 @@ static int listeners_start()
 
     }	// for(i = 0; i < stListeners.count; i++)
 
-    return pollcnt;
+    return cnt;
 }
 //------------------------------------------------------------------------------
 
@@ -559,7 +788,6 @@ static int forwarders_start()
 {
     unsigned int i = 0, cnt = 0;
     int thread_ok;
-    long name_max, len;
 
     // iterate forwarders
     for(i = 0; i < stForwarders.count; i++) {
@@ -574,12 +802,14 @@ static int forwarders_start()
         // load library for encode/decode functions
         if( library_load(stForwarders.forwarder[i].app, &stForwarders.forwarder[i].library_handle, (void*)&stForwarders.forwarder[i].terminal_decode, (void*)&stForwarders.forwarder[i].terminal_encode) ) {
 
-            // open saved files directory
-            stForwarders.forwarder[i].data_dir = opendir(stConfigServer.forward_files);	// use malloc internally
-            name_max = pathconf(stConfigServer.forward_files, _PC_NAME_MAX);
-            if (name_max == -1)         /* Limit not defined, or error */
-                name_max = FILENAME_MAX;         /* Take a guess */
-            len = offsetof(struct dirent, d_name) + name_max + 1;
+            stForwarders.forwarder[i].terminal_session_create = library_symbol(stForwarders.forwarder[i].library_handle, "terminal_session_create");
+            stForwarders.forwarder[i].terminal_session_destroy = library_symbol(stForwarders.forwarder[i].library_handle, "terminal_session_destroy");
+            stForwarders.forwarder[i].terminal_restamp = library_symbol(stForwarders.forwarder[i].library_handle, "terminal_restamp");
+
+            // parcels from workers, the same ring buffer after reconfigure
+            stForwarders.forwarder[i].ring = forwarder_ring(stForwarders.forwarder[i].name, stConfigServer.forward_queue_size);
+            if( !stForwarders.forwarder[i].ring )
+                continue;
 
             // start forwarder in separate thread, passing point to his config (last parameter)
             if( attr_init )
@@ -587,8 +817,10 @@ static int forwarders_start()
             else
                 thread_ok = pthread_create(&stForwarders.forwarder[i].thread, NULL, forwarder_thread, &stForwarders.forwarder[i]);
 
-            if( thread_ok )	// error
+            if( thread_ok ) {	// error
                 logging("forwarder[%s]: error %d: %s\n", stForwarders.forwarder[i].name, errno, strerror(errno));
+                stForwarders.forwarder[i].ring = NULL;	// not routed
+            }
             else
                 ++cnt;
 
@@ -596,6 +828,12 @@ static int forwarders_start()
 
     }	// for(i = 0; i < stForwarders.count; i++)
 
+    // hash index of the forwarding terminals, replace previous
+    if( stForwarders.count )
+        logging("forwarders: %d routes of %d terminals loaded\n", route_load(), stForwarders.listcount);
+    else
+        route_unload();
+
     return( cnt == stForwarders.count );
 }
 //------------------------------------------------------------------------------
@@ -834,7 +1072,7 @@ int main(int argc, char* argv[])
             cleanup();          // do first
             reconfigure = 0;    // do second
 
-            if( setup(stParams.config_path) && listeners_start() ) {
+            if( setup(stParams.config_path) && listeners_start() && reactors_start() ) {
                 timers_start();
                 forwarders_start();
             }
@@ -893,20 +1131,26 @@ int main(int argc, char* argv[])
                                 worker_config->listener = &stListeners.listener[j];
                                 strncpy(worker_config->ip, inet_ntoa(worker_config->client_addr.sin_addr), SIZE_TRACKER_FIELD);
 
-                                // start worker thread
-                                if( attr_init )
-                                    thread_error = pthread_create(&worker_config->thread, &worker_thread_attr, worker_thread, worker_config);
-                                else
-                                    thread_error = pthread_create(&worker_config->thread, NULL, worker_thread, worker_config);
-
-                                if( thread_error ) {   // error :(
-                                    free(worker_config);
-                                    logging("glonassd[%d]: listener[%s] pthread_create() error %d: %s\n", (int)getpid(), stListeners.listener[j].name, errno, strerror(errno));
-                                }	// if( pthread_create(
-                                else {
-                                    if( pthread_detach(worker_config->thread) )
-                                        logging("glonassd[%d]: listener[%s] pthread_detach(%lld) error %d: %s\n", (int)getpid(), stListeners.listener[j].name, worker_config->thread, errno, strerror(errno));
+                                if( stListeners.listener[j].io_model != IO_MODEL_THREAD ) {
+                                    // pass terminal to event loop
+                                    reactor_attach(worker_config);
                                 }
+                                else {
+                                    // start worker thread
+                                    if( attr_init )
+                                        thread_error = pthread_create(&worker_config->thread, &worker_thread_attr, worker_thread, worker_config);
+                                    else
+                                        thread_error = pthread_create(&worker_config->thread, NULL, worker_thread, worker_config);
+
+                                    if( thread_error ) {   // error :(
+                                        free(worker_config);
+                                        logging("glonassd[%d]: listener[%s] pthread_create() error %d: %s\n", (int)getpid(), stListeners.listener[j].name, errno, strerror(errno));
+                                    }	// if( pthread_create(
+                                    else {
+                                        if( pthread_detach(worker_config->thread) )
+                                            logging("glonassd[%d]: listener[%s] pthread_detach(%lld) error %d: %s\n", (int)getpid(), stListeners.listener[j].name, worker_config->thread, errno, strerror(errno));
+                                    }
+                                }	// else if( stListeners.listener[j].io_model != IO_MODEL_THREAD )
                             }	// else if( worker_config->client_socket < 0 )
 
                             break;	// fired socket located and treated, break search
@@ -929,6 +1173,7 @@ int main(int argc, char* argv[])
     */
     logging("glonassd[%d] stopped, exit_code=%d\n", (int)getpid(), exit_code);
     cleanup();
+    route_unload();
     syslog(LOG_NOTICE, "glonassd[%d] stopped, exit_code=%d\n", (int)getpid(), exit_code);
     printf("glonassd[%d] stopped, exit_code=%d\n", (int)getpid(), exit_code);
 
@@ -7,6 +7,8 @@
 #include <time.h>
 #include <pthread.h>
 #include "de.h"
+#include "ring.h"
+#include "spool.h"
 
 //#define __DEBUG__ (1)
 
@@ -16,6 +18,16 @@
 #define DIRECTION_OUT 1
 #define QUEUE_WORKER "/que_worker"  // http://linux.die.net/man/7/mq_overview
 
+// terminals serving model
+#define IO_MODEL_THREAD 0   // thread per terminal (worker.c)
+#define IO_MODEL_EPOLL 1    // event loops (reactor.c)
+#define IO_MODEL_URING 2    // event loops with io_uring (uring.c), epoll if not supported
+
+// transport of the records from workers to database thread
+#define DB_QUEUE_RING 0     // in-process ring buffer (ring.c)
+#define DB_QUEUE_MQ 1       // POSIX message queue QUEUE_WORKER
+#define DB_QUEUE_SIZE (64 * 1024 * 1024)    // default size of the ring buffer, bytes
+
 // startup parameters
 typedef struct {
 	char start_path[FILENAME_MAX];
@@ -38,6 +50,17 @@ typedef struct {
 } ST_TIMER;
 #define TIMERS_MAX 3	// max. timers count
 
+// database library (one of db_type) & connection parameters
+typedef struct {
+	char db_type[STRLEN];           // database type (pg/rds/oracle), name of the library
+	char db_host[STRLEN];
+	int db_port;
+	char db_name[STRLEN];
+	char db_schema[STRLEN];
+	char db_user[STRLEN];
+	char db_pass[STRLEN];
+} ST_DB_SINK;
+
 /*
     main configuration structure
     ATTENTION: if change, recompile all, include *.so (pg, galileo, etc...)
@@ -46,24 +69,56 @@ typedef struct {
 	char listen[INET_ADDRSTRLEN];   // IP-address for listen the gps/glonass terminals
 	char transmit[INET_ADDRSTRLEN];	// IP-address for retransmin signals of the terminals
 	int log_enable;                 // flag: 0-disable, >0-enable logging & loglevel
-	size_t log_maxsize;             // max size of log file in bytes
+	size_t log_maxsize;             // max size of log file in bytes, rotated if bigger
+	int log_rotate;                 // max age of log file in seconds, rotated if older, 0 - by size only
+	int log_files;                  // number of the rotated log files (log_file.1 ... log_file.N)
+	int log_compress;               // flag: 1 - rotated log files compressed (log_file.1.gz)
 	char log_file[FILENAME_MAX];    // name log file
 	char log_imei[SIZE_TRACKER_FIELD];    // logged imei
-	char db_type[STRLEN];           // database type (pg/mysql/oracle etc)
+	char capture[FILENAME_MAX];     // directory of the captured parcels (log_all, log_imei)
+	size_t capture_queue_size;      // size of the ring buffer to capture thread in bytes
+	size_t capture_segment;         // size of the capture segment file in bytes
+	int capture_files;              // number of the capture segment files kept
+	char db_type[STRLEN];           // database types (pg/mysql/oracle etc), comma separated list
 	char db_host[STRLEN];           // database host
 	int db_port;                    // database port
 	char db_name[STRLEN];           // database name
 	char db_schema[STRLEN];         // database schema name
 	char db_user[STRLEN];           // database user
 	char db_pass[STRLEN];           // database user's password
+	ST_DB_SINK db_sink[DB_SINKS_MAX];   // database libraries from db_type, each written with all records
+	int db_sinks;                   // number of the database libraries
+	int db_queue;                   // records transport: DB_QUEUE_RING | DB_QUEUE_MQ
+	size_t db_queue_size;           // size of the ring buffer of each database thread in bytes (db_queue = ring)
+	int db_threads;                 // number of the database threads (db_queue = ring), records of the terminal written by one thread
+	char db_spool[FILENAME_MAX];    // directory of the spool for messages to database, empty - not used
+	size_t db_spool_segment;        // size of the spool segment file in bytes
+	int db_batch;                   // max. records in one batch of database library (pg: COPY, oracle: array DML), 0 - write each record
+	int db_batch_wait;              // max. time of the record in batch, milliseconds
+	int db_pipeline;                // max. inserts in flight of database library (pg: pipeline mode), 0 - wait each insert
+	char db_stream[STRLEN];         // REDIS: stream of the records (XADD), empty - not used
+	int db_stream_maxlen;           // REDIS: approximate max. number of the records in stream
+	char db_geo[STRLEN];            // REDIS: geospatial set of the last positions (GEOADD), empty - not used
 	int socket_queue;               // listener's socket queue size
 	int socket_timeout;             // listener's socket timeout in seconds (max 600)
 	int forward_timeout;            // forwarder's socket timeout in seconds (1-5)
 	int forward_wait;	            // time between reconnect to server after connection lost
 	char forward_files[FILENAME_MAX];    // forwarders files directory
+	size_t forward_queue_size;      // size of the ring buffer from workers to each forwarder in bytes
 	ST_TIMER timers[TIMERS_MAX];    // timers structure
+	int io_model;                   // terminals serving model: IO_MODEL_THREAD | IO_MODEL_EPOLL | IO_MODEL_URING
+	int io_threads;                 // number of the event loops, 0 - number of CPU
+	int io_reuseport;               // flag: 1 - each event loop pinned to CPU & has own listener sockets (SO_REUSEPORT)
 } ST_CONFIG_SERVER;
 
+// argument of the database thread (db_thread of the database library)
+typedef struct {
+	unsigned int shard;     // number of the thread, 0 .. db_shards - 1
+	ST_RING *ring;          // ring buffer of the thread, NULL if db_queue = mq
+	ST_SPOOL *spool;        // spool of the database library, NULL if db_spool not set
+	ST_DB_SINK *sink;       // database library & connection parameters
+} ST_DB_SHARD;
+
 // listener structure
 typedef struct {
 	char name[STRLEN];
@@ -74,8 +129,12 @@ typedef struct {
 	int log_all;
 	int log_err;
 	void *library_handle;	// handle to shared library
-	void (*terminal_decode)(char*, int, ST_ANSWER*, void*);	// pointer to decode terminal message function
+	void (*terminal_decode)(char*, int, ST_ANSWER*, void*, void*);	// pointer to decode terminal message function
 	int (*terminal_encode)(ST_RECORD*, int, char*, int, void*); // pointer to encode terminal message function
+	int (*terminal_frame_length)(char*, int);	// pointer to frame length function or NULL (see de.h)
+	void *(*terminal_session_create)(void);	// pointer to create decoder state function or NULL (see de.h)
+	void (*terminal_session_destroy)(void*);	// pointer to free decoder state function or NULL
+	int io_model;		// IO_MODEL_THREAD if library not exports terminal_frame_length, else stConfigServer.io_model
 } ST_LISTENER;
 
 // list of the listeners
@@ -99,5 +158,6 @@ extern int attr_init;                   // glonassd.c
     functions
 */
 int cleanup(void);                 // glonassd.c
+int listener_open(ST_LISTENER *listener);  // glonassd.c
 
 #endif
@@ -60,8 +60,9 @@ static uint8_t decodeFUL(ST_RECORD *record, char *chank);
    parcel - the raw data from socket
    parcel_size - it length
    answer - pointer to ST_ANSWER structure
+   session - decoder state of the connection (see de.h)
 */
-void terminal_decode(char *parcel, int parcel_size, ST_ANSWER *answer, ST_WORKER *worker)
+void terminal_decode(char *parcel, int parcel_size, ST_ANSWER *answer, ST_WORKER *worker, void *session)
 {
 	if( !parcel || parcel_size <= 0 || !answer )
 		return;
@@ -112,7 +113,7 @@ static void terminal_decode_txt(char *parcel, int parcel_size, ST_ANSWER *answer
             // it's data
             if( record_ok > 0 && answer->count < MAX_RECORDS - 1 )
             	answer->count++;
-            record = &answer->records[answer->count - 1];
+            record = record_reset(&answer->records[answer->count - 1]);
 
             saveptr2 = NULL;
             for(part_num = 0, cPart = strtok_r(cPaket, delim_part, &saveptr2); cPart; part_num++, cPart = strtok_r(NULL, delim_part, &saveptr2)) {
@@ -346,7 +347,7 @@ static void terminal_decode_bin(char *parcel, int parcel_size, ST_ANSWER *answer
             	answer->count++;
                 record_ok = 0;
             }
-            record = &answer->records[answer->count - 1];
+            record = record_reset(&answer->records[answer->count - 1]);
         }
         else {
             break;
@@ -580,9 +581,10 @@ static void terminal_decode_bin(char *parcel, int parcel_size, ST_ANSWER *answer
    reccount - number of struct in array, and returning
    buffer - buffer for encoded data
    bufsize - size of buffer
+   session - encoder state of the connection (see de.h)
    return size of data in the buffer for encoded data
 */
-int terminal_encode(ST_RECORD *records, int reccount, char *buffer, int bufsize)
+int terminal_encode(ST_RECORD *records, int reccount, char *buffer, int bufsize, void *session)
 {
     int top = 0;
     return top;
@@ -25,11 +25,12 @@
    parcel - the raw data from socket
    parcel_size - it length
    answer - pointer to ST_ANSWER structure
+   session - decoder state of the connection (see de.h)
 */
-void terminal_decode(char *parcel, int parcel_size, ST_ANSWER *answer, ST_WORKER *worker)
+void terminal_decode(char *parcel, int parcel_size, ST_ANSWER *answer, ST_WORKER *worker, void *session)
 {
 	ST_RECORD *record = NULL;
-	char *cRec, cMode[16], cDateTime[11], cTime[11], cLon, cLat, cSignal, cValid;
+	char *cRec, *saveptr, cMode[16], cDateTime[11], cTime[11], cLon, cLat, cSignal, cValid;
 	double dLon, dLat, dSpeed, diftime;
 	int iTemp, iAnswerSize;
 	struct tm tm_data;
@@ -75,7 +76,7 @@ void terminal_decode(char *parcel, int parcel_size, ST_ANSWER *answer, ST_WORKER
 		// imei:359586015829802,help me,0809231429,13554900601,F,062947.294,A,2234.4026,N,11354.3277,E,0.00,;
 		// imei:359586015829802,help me,000000000,13554900601,L,;
 
-		cRec = strtok(parcel, ";");
+		cRec = strtok_r(parcel, ";", &saveptr);
 		while( cRec ) {
 			memset(cMode, 0, 16);
 
@@ -100,7 +101,7 @@ void terminal_decode(char *parcel, int parcel_size, ST_ANSWER *answer, ST_WORKER
 
 				if( answer->count < MAX_RECORDS - 1 )
 					answer->count++;
-				record = &answer->records[answer->count - 1];
+				record = record_reset(&answer->records[answer->count - 1]);
 
 				snprintf(record->tracker, SIZE_TRACKER_FIELD, "GPS103");
 				snprintf(record->hard, SIZE_TRACKER_FIELD, "%d", 1);
@@ -158,7 +159,7 @@ void terminal_decode(char *parcel, int parcel_size, ST_ANSWER *answer, ST_WORKER
 
 			}	// switch(iTemp)
 
-			cRec = strtok(NULL, ";");
+			cRec = strtok_r(NULL, ";", &saveptr);
 		}	// while( cRec )
 
 	}	// switch(parcel[0])
@@ -173,9 +174,10 @@ void terminal_decode(char *parcel, int parcel_size, ST_ANSWER *answer, ST_WORKER
    reccount - number of struct in array, and returning
    buffer - buffer for encoded data
    bufsize - size of buffer
+   session - encoder state of the connection (see de.h)
    return size of data in the buffer for encoded data
 */
-int terminal_encode(ST_RECORD *records, int reccount, char *buffer, int bufsize)
+int terminal_encode(ST_RECORD *records, int reccount, char *buffer, int bufsize, void *session)
 {
 	int top = 0;
 	return top;
@@ -127,6 +127,29 @@ unsigned char CRC8(unsigned char *puchMsg, unsigned short usDataLen)
 //------------------------------------------------------------------------------
 
 
+/*
+   CRC32 (IEEE 802.3, as zlib crc32), nibble table
+   crc - previous value for continue calculation or 0
+*/
+unsigned int CRC32(unsigned int crc, unsigned char *buf, size_t len)
+{
+	static const unsigned int table[16] = {
+		0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC, 0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+		0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C, 0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C
+	};
+
+	crc = ~crc;
+	while( len-- ) {
+		crc ^= *buf++;
+		crc = (crc >> 4) ^ table[crc & 0x0F];
+		crc = (crc >> 4) ^ table[crc & 0x0F];
+	}
+
+	return ~crc;
+}
+//------------------------------------------------------------------------------
+
+
 // rounding real numbers, steals from the Internet
 double Round(double Value, int SignNumber)
 {
@@ -19,6 +19,7 @@
 
 unsigned short CRC16( unsigned char *puchMsg, unsigned short usDataLen);
 unsigned char CRC8(unsigned char *puchMsg, unsigned short usDataLen);
+unsigned int CRC32(unsigned int crc, unsigned char *buf, size_t len);
 size_t base64_encode(unsigned char const* bytes_to_encode, unsigned char *ret, unsigned int retsize);
 size_t base64_decode(unsigned char const *encoded_string, unsigned char *ret, unsigned int retsize);
 double Round(double Value, int SignNumber);
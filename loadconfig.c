@@ -12,6 +12,8 @@
 #include <errno.h>  /* errno */
 #include "glonassd.h"
 #include "forwarder.h"
+#include "spool.h"
+#include "capture.h"
 #include "lib.h"
 
 // load list of the forwarding terminals
@@ -126,11 +128,155 @@ void fill_timer(ST_TIMER *st_timer, char *params)
 }
 //------------------------------------------------------------------------------
 
+// size in bytes with optional suffix k, m, g: "64m"
+static size_t size_value(char *value)
+{
+	long size = 0;
+	char c = 0;
+
+	if( sscanf(value, "%ld%c", &size, &c) < 1 || size < 0 )
+		return 0;
+
+	switch(c) {
+	case 'k':
+	case 'K':
+		return (size_t)size * 1024;
+	case 'm':
+	case 'M':
+		return (size_t)size * (1024 * 1024);
+	case 'g':
+	case 'G':
+		return (size_t)size * (1024 * 1024 * 1024);
+	}	// switch(c)
+
+	return (size_t)size;
+}
+//------------------------------------------------------------------------------
+
+// time in seconds with optional suffix m, h, d: "24h"
+static int time_value(char *value)
+{
+	int time = 0;
+	char c = 0;
+
+	if( sscanf(value, "%d%c", &time, &c) < 1 || time < 0 )
+		return 0;
+
+	switch(c) {
+	case 'm':
+	case 'M':
+		return time * 60;
+	case 'h':
+	case 'H':
+		return time * 3600;
+	case 'd':
+	case 'D':
+		return time * 86400;
+	}	// switch(c)
+
+	return time;
+}
+//------------------------------------------------------------------------------
+
+// connection parameters of the database libraries from "<db_type>.db_*" params
+static ST_DB_SINK db_sink_params[DB_SINKS_MAX];
+static int db_sink_params_count = 0;
+
+// parameters of the database library db_type (len chars), NULL if too many libraries
+static ST_DB_SINK *sink_params(char *db_type, size_t len)
+{
+	int i;
+
+	if( len >= STRLEN )
+		return NULL;
+
+	for(i = 0; i < db_sink_params_count; i++) {
+		if( strlen(db_sink_params[i].db_type) == len && strncmp(db_sink_params[i].db_type, db_type, len) == 0 )
+			return &db_sink_params[i];
+	}
+
+	if( db_sink_params_count >= DB_SINKS_MAX )
+		return NULL;
+
+	memset(&db_sink_params[db_sink_params_count], 0, sizeof(ST_DB_SINK));
+	memcpy(db_sink_params[db_sink_params_count].db_type, db_type, len);
+	return &db_sink_params[db_sink_params_count++];
+}
+//------------------------------------------------------------------------------
+
+// set connection parameter of the database library
+static void set_sink_param(ST_DB_SINK *sink, char *param, char *value)
+{
+	if( strcmp(param, "db_host") == 0 )
+		snprintf(sink->db_host, STRLEN, "%s", value);
+	else if( strcmp(param, "db_port") == 0 ) {
+		if( strlen(value) )
+			sink->db_port = abs(atoi(value));
+	}
+	else if( strcmp(param, "db_name") == 0 )
+		snprintf(sink->db_name, STRLEN, "%s", value);
+	else if( strcmp(param, "db_schema") == 0 )
+		snprintf(sink->db_schema, STRLEN, "%s", value);
+	else if( strcmp(param, "db_user") == 0 )
+		snprintf(sink->db_user, STRLEN, "%s", value);
+	else if( strcmp(param, "db_pass") == 0 )
+		snprintf(sink->db_pass, STRLEN, "%s", value);
+	else
+		syslog(LOG_NOTICE, "loadConfig: Error in config file, unknown param %s of database %s", param, sink->db_type);
+}
+//------------------------------------------------------------------------------
+
+/*
+   fill database libraries (stConfigServer.db_sink) from list db_type = pg,rds
+   parameters not set by "<db_type>.db_*" taken from common db_host, db_port etc.
+*/
+static void set_sinks(void)
+{
+	char types[STRLEN], *type, *saveptr = NULL;
+	ST_DB_SINK *sink, *params;
+	int i;
+
+	snprintf(types, STRLEN, "%s", stConfigServer.db_type);
+	for(type = strtok_r(types, ",", &saveptr); type; type = strtok_r(NULL, ",", &saveptr)) {
+		if( stConfigServer.db_sinks >= DB_SINKS_MAX ) {
+			syslog(LOG_NOTICE, "loadConfig: db_type: too many databases, max. %d, %s ignored", DB_SINKS_MAX, type);
+			continue;
+		}
+
+		sink = &stConfigServer.db_sink[stConfigServer.db_sinks++];
+		params = NULL;
+		for(i = 0; i < db_sink_params_count; i++) {
+			if( strcmp(db_sink_params[i].db_type, type) == 0 )
+				params = &db_sink_params[i];
+		}
+
+		if( params )
+			memcpy(sink, params, sizeof(ST_DB_SINK));
+		else
+			snprintf(sink->db_type, STRLEN, "%s", type);
+
+		if( !sink->db_host[0] )
+			memcpy(sink->db_host, stConfigServer.db_host, STRLEN);
+		if( !sink->db_port )
+			sink->db_port = stConfigServer.db_port;
+		if( !sink->db_name[0] )
+			memcpy(sink->db_name, stConfigServer.db_name, STRLEN);
+		if( !sink->db_schema[0] )
+			memcpy(sink->db_schema, stConfigServer.db_schema, STRLEN);
+		if( !sink->db_user[0] )
+			memcpy(sink->db_user, stConfigServer.db_user, STRLEN);
+		if( !sink->db_pass[0] )
+			memcpy(sink->db_pass, stConfigServer.db_pass, STRLEN);
+	}
+}
+//------------------------------------------------------------------------------
+
 // fill daemon config structure ST_CONFIG_SERVER (glonassd.h)
 int set_config(char *section, char *param, char *value)
 {
-	char c;
+	char *dot;
 	int i;
+	ST_DB_SINK *sink;
 
 	if( !section || !strlen(section) /*|| !param || !strlen(param)*/ )
 		return 0;
@@ -159,23 +305,53 @@ int set_config(char *section, char *param, char *value)
 					stConfigServer.log_enable = atoi(value);
 			}
 
+			if( strcmp(param, "capture") == 0 && strlen(value) > 0 ) {
+				snprintf(stConfigServer.capture, FILENAME_MAX, "%s", value);
+			}
+
+			if( strcmp(param, "capture_queue_size") == 0 ) {
+				if( strlen(value) )
+					stConfigServer.capture_queue_size = size_value(value);
+			}
+
+			if( strcmp(param, "capture_segment") == 0 ) {
+				if( strlen(value) )
+					stConfigServer.capture_segment = size_value(value);
+			}
+
+			if( strcmp(param, "capture_files") == 0 ) {
+				if( strlen(value) )
+					stConfigServer.capture_files = abs(atoi(value));
+			}
+
 			if( strcmp(param, "log_maxsize") == 0 ) {
-				if( sscanf(value, "%ld%c", &stConfigServer.log_maxsize, &c) == 2 ) {
-					switch(c) {
-					case 'k':
-					case 'K':
-						stConfigServer.log_maxsize *= 1024;
-						break;
-					case 'm':
-					case 'M':
-						stConfigServer.log_maxsize *= (1024 * 1024);
-						break;
-					case 'g':
-					case 'G':
-						stConfigServer.log_maxsize *= (1024 * 1024 * 1024);
-					}	// switch(c)
-				}	// if( sscanf(value, "%d%c"
-			}	// f( strcmp(param, "log_maxsize") == 0 )
+				if( strlen(value) )
+					stConfigServer.log_maxsize = size_value(value);
+			}
+
+			if( strcmp(param, "log_rotate") == 0 ) {
+				if( strlen(value) )
+					stConfigServer.log_rotate = time_value(value);
+			}
+
+			if( strcmp(param, "log_files") == 0 ) {
+				if( strlen(value) )
+					stConfigServer.log_files = abs(atoi(value));
+			}
+
+			if( strcmp(param, "log_compress") == 0 ) {
+				if( strlen(value) )
+					stConfigServer.log_compress = atoi(value);
+			}
+
+			// parameters of one of the database libraries: pg.db_host = ...
+			if( (dot = strchr(param, '.')) && dot > param ) {
+				sink = sink_params(param, dot - param);
+				if( sink )
+					set_sink_param(sink, dot + 1, value);
+				else
+					syslog(LOG_NOTICE, "loadConfig: Error in config file: too many databases, param %s ignored", param);
+			}
 
 			if( strcmp(param, "db_type") == 0 ) {
 				snprintf(stConfigServer.db_type, STRLEN, "%s", value);
@@ -206,6 +382,60 @@ int set_config(char *section, char *param, char *value)
 				snprintf(stConfigServer.db_pass, STRLEN, "%s", value);
 			}
 
+			if( strcmp(param, "db_queue") == 0 ) {
+				if( strcmp(value, "mq") == 0 )
+					stConfigServer.db_queue = DB_QUEUE_MQ;
+				else
+					stConfigServer.db_queue = DB_QUEUE_RING;
+			}
+
+			if( strcmp(param, "db_queue_size") == 0 ) {
+				if( strlen(value) )
+					stConfigServer.db_queue_size = size_value(value);
+			}
+
+			if( strcmp(param, "db_threads") == 0 ) {
+				if( strlen(value) )
+					stConfigServer.db_threads = abs(atoi(value));
+			}
+
+			if( strcmp(param, "db_spool") == 0 ) {
+				snprintf(stConfigServer.db_spool, FILENAME_MAX, "%s", value);
+			}
+
+			if( strcmp(param, "db_spool_segment") == 0 ) {
+				if( strlen(value) )
+					stConfigServer.db_spool_segment = size_value(value);
+			}
+
+			if( strcmp(param, "db_batch") == 0 ) {
+				if( strlen(value) )
+					stConfigServer.db_batch = abs(atoi(value));
+			}
+
+			if( strcmp(param, "db_batch_wait") == 0 ) {
+				if( strlen(value) )
+					stConfigServer.db_batch_wait = abs(atoi(value));
+			}
+
+			if( strcmp(param, "db_pipeline") == 0 ) {
+				if( strlen(value) )
+					stConfigServer.db_pipeline = abs(atoi(value));
+			}
+
+			if( strcmp(param, "db_stream") == 0 ) {
+				snprintf(stConfigServer.db_stream, STRLEN, "%s", value);
+			}
+
+			if( strcmp(param, "db_stream_maxlen") == 0 ) {
+				if( strlen(value) )
+					stConfigServer.db_stream_maxlen = abs(atoi(value));
+			}
+
+			if( strcmp(param, "db_geo") == 0 ) {
+				snprintf(stConfigServer.db_geo, STRLEN, "%s", value);
+			}
+
 			if( strcmp(param, "socket_queue") == 0 ) {
 				if( strlen(value) )
 					stConfigServer.socket_queue = abs(atoi(value));
@@ -230,6 +460,30 @@ int set_config(char *section, char *param, char *value)
 				snprintf(stConfigServer.forward_files, FILENAME_MAX, "%s", value);
 			}
 
+			if( strcmp(param, "forward_queue_size") == 0 ) {
+				if( strlen(value) )
+					stConfigServer.forward_queue_size = size_value(value);
+			}
+
+			if( strcmp(param, "io_model") == 0 ) {
+				if( strcmp(value, "epoll") == 0 )
+					stConfigServer.io_model = IO_MODEL_EPOLL;
+				else if( strcmp(value, "uring") == 0 )
+					stConfigServer.io_model = IO_MODEL_URING;
+				else
+					stConfigServer.io_model = IO_MODEL_THREAD;
+			}
+
+			if( strcmp(param, "io_threads") == 0 ) {
+				if( strlen(value) )
+					stConfigServer.io_threads = abs(atoi(value));
+			}
+
+			if( strcmp(param, "io_reuseport") == 0 ) {
+				if( strlen(value) )
+					stConfigServer.io_reuseport = abs(atoi(value));
+			}
+
 			if( strcmp(param, "timer") == 0 && strlen(value) ) {
 				for(i = 0; i < TIMERS_MAX; i++) {
 					if( !strlen(stConfigServer.timers[i].script_path) ) {
@@ -255,12 +509,18 @@ int set_config(char *section, char *param, char *value)
 				i = stForwarders.count - 1;
 				memset(&stForwarders.forwarder[i], 0, sizeof(ST_FORWARDER));
 				snprintf(stForwarders.forwarder[i].name, STRLEN, "%s", param);
-				sscanf(value, "%15[^,],%5d,%1d,%15[^,],%d",
+				sscanf(value, "%15[^,],%5d,%1d,%15[^,],%d,%d,%d",
 						 stForwarders.forwarder[i].server,
 						 &stForwarders.forwarder[i].port,
 						 &stForwarders.forwarder[i].protocol,
 						 stForwarders.forwarder[i].app,
-                         &stForwarders.forwarder[i].debug);
+                         &stForwarders.forwarder[i].debug,
+						 &stForwarders.forwarder[i].coalesce_records,
+						 &stForwarders.forwarder[i].coalesce_ms);
+				if( stForwarders.forwarder[i].coalesce_records < 0 )
+					stForwarders.forwarder[i].coalesce_records = 0;
+				if( stForwarders.forwarder[i].coalesce_ms < 0 )
+					stForwarders.forwarder[i].coalesce_ms = 0;
 				if(stForwarders.forwarder[i].protocol == 0)
 					stForwarders.forwarder[i].protocol = SOCK_STREAM;
 				else
@@ -349,15 +609,29 @@ int loadConfig(char *cPathToFile)
 	memset(&stConfigServer, 0, sizeof(ST_CONFIG_SERVER));
 	// set defaults
 	stConfigServer.log_maxsize = 1024 * 1024;
+	stConfigServer.log_files = 1;
 	memset(stConfigServer.log_file, 0, FILENAME_MAX);
 	strcpy(stConfigServer.log_file, "/var/log/glonassd.log");
 	snprintf(stConfigServer.forward_files, FILENAME_MAX, "%s", stParams.start_path);
+	snprintf(stConfigServer.capture, FILENAME_MAX, "%.4060s/logs/capture", stParams.start_path);
+	stConfigServer.capture_queue_size = CAPTURE_QUEUE_SIZE;
+	stConfigServer.capture_segment = CAPTURE_SEGMENT_SIZE;
+	stConfigServer.capture_files = CAPTURE_FILES;
 	stConfigServer.socket_queue = 50;
 	stConfigServer.socket_timeout = 600;
 	stConfigServer.db_port = 0;
+	stConfigServer.db_queue_size = DB_QUEUE_SIZE;
+	stConfigServer.db_threads = 1;
+	stConfigServer.db_spool_segment = SPOOL_SEGMENT_SIZE;
+	stConfigServer.db_batch = 0;
+	stConfigServer.db_batch_wait = 100;
+	stConfigServer.db_pipeline = 0;
+	stConfigServer.db_stream_maxlen = 100000;
 	stConfigServer.log_enable = 1;
 	stConfigServer.forward_timeout = 1;
 	stConfigServer.forward_wait = 30;
+	stConfigServer.forward_queue_size = FORWARD_QUEUE_SIZE;
+	db_sink_params_count = 0;
 
 	iRetval = 1;
 	i = 0;
@@ -406,6 +680,9 @@ int loadConfig(char *cPathToFile)
 	free(cValue);
 
 	fclose(fHandle);
+
+	set_sinks();
+
 	return iRetval;
 }	// loadConfig
 //------------------------------------------------------------------------------
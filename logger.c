@@ -1,64 +1,528 @@
 /*
    logger.c
    daemons's logger
+   note:
+   1. Each thread writes messages into own buffer (ST_LOG_BUF), one producer
+   & one consumer, so logging() has no locks & no system calls.
+   2. Logger thread drains buffers of all threads & writes messages into
+   log file by writev, many messages per system call.
+   3. Buffer of the thread created small (LOG_BUF_MIN), because thread
+   per terminal logs a few messages, if it full, thread moves to
+   new buffer of the double size (up to LOG_BUF_SIZE), old buffer
+   retired. If buffer of LOG_BUF_SIZE is full, message dropped & counted,
+   logger writes number of the dropped messages.
+   4. Buffer of the finished thread (or retired by thread) freed by logger,
+   when its messages written into log file.
+   5. Logger rotates log file by size (log_maxsize) & time (log_rotate):
+   log_file -> log_file.1 -> ... -> log_file.N (log_files), rotated file
+   compressed into log_file.1.gz by separate thread (log_compress).
 */
 
 #ifndef _GNU_SOURCE
 #define _GNU_SOURCE
 #endif
 #include <sys/syscall.h>	/* syscall */
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
 #include <syslog.h>
 #include <pthread.h>
+#include <semaphore.h>
 #include <stdarg.h>
+#include <time.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/uio.h>	/* writev */
 #include <fcntl.h>
-#include <fcntl.h>        /* mq_open, O_* constants */
 #include <unistd.h>		/* sleep */
-#include <sys/time.h>
-#include <sys/resource.h>
-#include <mqueue.h>
+#include <zlib.h>		/* gzopen */
 #include "glonassd.h"
 #include "logger.h"
 #include "de.h"
 #include "lib.h"
 
+// header of the message in log buffer, then text of the message
+typedef struct {
+	int64_t time;		// time of the message
+	uint32_t size;		// size of the text, LOG_PAD - the rest of the buffer skipped
+	uint32_t reserved;
+} ST_LOG_ENTRY;
+#define LOG_PAD (0xFFFFFFFFu)
+// size of the message in buffer, aligned to header
+#define LOG_ENTRY_SIZE(len) ((sizeof(ST_LOG_ENTRY) + (len) + sizeof(ST_LOG_ENTRY) - 1) & ~(sizeof(ST_LOG_ENTRY) - 1))
+// max. messages in one writev, 2 iovec per message (time, text)
+#define LOG_IOV (256)
+// size of the time of the message: "dd.mm.yy hh:mm:ss "
+#define LOG_TIME_SIZE (18)
+
+// log buffer of the thread
+typedef struct log_buf {
+	volatile uint64_t head;		// bytes written by thread
+	volatile uint64_t tail;		// bytes written into log file by logger
+	volatile uint64_t dropped;	// messages not written, buffer was full
+	volatile int retired;		// thread finished or moved to new buffer, buffer freed by logger
+	struct log_buf *next;		// list of the buffers, unlinked by logger only
+	struct log_buf *prev;		// previous buffer of the thread, written first, NULL when freed
+	struct log_buf *successor;	// new buffer of the thread, if this retired by it
+	uint64_t size;				// size of the data, power of 2
+	char data[];
+} ST_LOG_BUF;
+
+// messages of the buffer written into log file, see log_write
+typedef struct {
+	ST_LOG_BUF *buf;
+	uint64_t tail;
+} ST_LOG_DONE;
+
+static ST_LOG_BUF *log_bufs = NULL;	// buffers of all threads
+static pthread_key_t log_key;			// retire buffer on thread exit
+static pthread_once_t log_once = PTHREAD_ONCE_INIT;
+static sem_t log_wakeup;				// posted by thread, if logger sleeping
+static volatile int log_sleeping = 0;
+static volatile int log_running = 0;	// logger thread works
+static __thread ST_LOG_BUF *log_buf = NULL;
+// logger thread only
+static size_t log_size = 0;				// size of the log file
+static time_t log_opened = 0;			// time of the log file start
+static volatile int log_compressing = 0;	// compression thread works
 
 static void writelog(int fHandle, char *msg_buf, int buf_size);
-static void setfilesize(char *log_file, size_t log_maxsize);
+
+// wake up logger, if it sleeping
+static void log_notify(void)
+{
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if( __atomic_load_n(&log_sleeping, __ATOMIC_RELAXED) && __atomic_exchange_n(&log_sleeping, 0, __ATOMIC_ACQ_REL) )
+		sem_post(&log_wakeup);
+}
+//------------------------------------------------------------------------------
+
+// thread exit or new buffer: logger writes the rest of messages & frees buffer (see log_free)
+static void log_buf_retire(void *buf)
+{
+	__atomic_store_n(&((ST_LOG_BUF *)buf)->retired, 1, __ATOMIC_RELEASE);
+	log_notify();
+}
+//------------------------------------------------------------------------------
+
+static void log_init(void)
+{
+	pthread_key_create(&log_key, log_buf_retire);
+	sem_init(&log_wakeup, 0, 0);
+}
+//------------------------------------------------------------------------------
+
+/*
+   create buffer of the thread, return NULL if error
+   prev - full buffer of the thread, it retired & written into log file first
+*/
+static ST_LOG_BUF *log_buf_get(ST_LOG_BUF *prev)
+{
+	ST_LOG_BUF *buf;
+	uint64_t size = prev ? 2 * prev->size : LOG_BUF_MIN;
+
+	pthread_once(&log_once, log_init);
+
+	buf = (ST_LOG_BUF *)calloc(1, sizeof(ST_LOG_BUF) + size);
+	if( !buf )
+		return NULL;
+	buf->size = size;
+
+	if( prev ) {
+		buf->prev = prev;
+		prev->successor = buf;
+	}
+
+	// threads only add buffers to the head of the list
+	buf->next = __atomic_load_n(&log_bufs, __ATOMIC_RELAXED);
+	while( !__atomic_compare_exchange_n(&log_bufs, &buf->next, buf, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED) );
+
+	pthread_setspecific(log_key, buf);
+
+	if( prev )
+		log_buf_retire(prev);
+
+	return buf;
+}
+//------------------------------------------------------------------------------
 
 // logging
 void logging(char *template, ...)
 {
-	static __thread va_list ptr;
-	static __thread int len = 0;
-	static __thread char message[LOG_MSG_SIZE]= {0};
-	static __thread int no_queue = 0;
-	static __thread mqd_t log_queue = 0;
+	va_list ptr;
+	ST_LOG_ENTRY *entry;
+	ST_LOG_BUF *buf;
+	uint64_t head, tail, idx, pad;
+	char *text, message[LOG_MSG_SIZE];
+	int len;
+
+	// logger not started, as before
+	if( !log_running || (!log_buf && !(log_buf = log_buf_get(NULL))) ) {
+		va_start(ptr, template);
+		vsnprintf(message, LOG_MSG_SIZE, template, ptr);
+		va_end(ptr);
+
+		syslog(LOG_NOTICE, "%s", message);
+		if( !stParams.daemon )
+			fprintf(stderr, "%s\n", message);
+		return;
+	}
+
+	// reserve place for the longest message, head changed by this thread only
+	head = log_buf->head;
+	tail = __atomic_load_n(&log_buf->tail, __ATOMIC_ACQUIRE);
+	idx = head & (log_buf->size - 1);
+	pad = (idx + LOG_ENTRY_SIZE(LOG_MSG_SIZE) > log_buf->size) ? log_buf->size - idx : 0;
+
+	if( head + pad + LOG_ENTRY_SIZE(LOG_MSG_SIZE) - tail > log_buf->size ) {	// buffer is full
+		if( log_buf->size < LOG_BUF_SIZE && (buf = log_buf_get(log_buf)) ) {
+			// new buffer of the double size
+			log_buf = buf;
+			head = idx = pad = 0;
+		}
+		else {
+			__atomic_add_fetch(&log_buf->dropped, 1, __ATOMIC_RELAXED);
+			return;
+		}
+	}
+
+	if( pad ) {	// skip the end of the buffer
+		((ST_LOG_ENTRY *)&log_buf->data[idx])->size = LOG_PAD;
+		idx = 0;
+	}
+
+	entry = (ST_LOG_ENTRY *)&log_buf->data[idx];
+	text = (char *)(entry + 1);
 
 	va_start(ptr, template);
-	memset(message, 0, LOG_MSG_SIZE);
-	len = vsnprintf(message, LOG_MSG_SIZE, template, ptr);
+	len = vsnprintf(text, LOG_MSG_SIZE, template, ptr);
 	va_end(ptr);
 
-	log_queue = mq_open(QUEUE_LOGGER, O_WRONLY | O_NONBLOCK);
-	if( log_queue < 0 ) {
-		//syslog(LOG_NOTICE, "logging: mq_open(%s) error %d: %s\n", QUEUE_LOGGER, errno, strerror(errno));
-		syslog(LOG_NOTICE, "%s", message);
+	if( len <= 0 )
+		return;
+	if( len >= LOG_MSG_SIZE )
+		len = LOG_MSG_SIZE - 1;
+	if( text[len - 1] != 10 )
+		text[len++] = 10;
+
+	if( !stParams.daemon )
+		fprintf(stderr, "%.*s", len, text);
+
+	entry->time = time(NULL);
+	entry->size = len;
+	__atomic_store_n(&log_buf->head, head + pad + LOG_ENTRY_SIZE(len), __ATOMIC_RELEASE);
+
+	log_notify();
+}
+//------------------------------------------------------------------------------
+
+// return 1 if any buffer has messages
+static int log_pending(void)
+{
+	ST_LOG_BUF *buf;
+
+	for(buf = __atomic_load_n(&log_bufs, __ATOMIC_ACQUIRE); buf; buf = buf->next) {
+		if( __atomic_load_n(&buf->head, __ATOMIC_ACQUIRE) != buf->tail )
+			return 1;
+	}
+	return 0;
+}
+//------------------------------------------------------------------------------
+
+/*
+   free buffers of the finished threads, which messages written into log file,
+   logger thread only: it the only reader of the list & it unlinks buffers
+*/
+static void log_free(void)
+{
+	ST_LOG_BUF *buf, *next, *prev = NULL, *expected;
+
+	for(buf = __atomic_load_n(&log_bufs, __ATOMIC_ACQUIRE); buf; buf = next) {
+		next = buf->next;
+
+		if( !__atomic_load_n(&buf->retired, __ATOMIC_ACQUIRE)
+				|| __atomic_load_n(&buf->head, __ATOMIC_ACQUIRE) != buf->tail
+				|| __atomic_load_n(&buf->dropped, __ATOMIC_RELAXED) ) {
+			prev = buf;
+			continue;
+		}
+
+		if( prev ) {
+			prev->next = next;
+		}
+		else {
+			expected = buf;
+			if( !__atomic_compare_exchange_n(&log_bufs, &expected, next, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE) ) {
+				// new buffers added before it
+				for(prev = expected; prev->next != buf; prev = prev->next);
+				prev->next = next;
+			}
+		}
+		// messages of the new buffer of the thread may be written now
+		if( buf->successor )
+			buf->successor->prev = NULL;
+		free(buf);
 	}
-    else {
-		if( mq_send(log_queue, (const char *)message, len, 0) < 0 ) {
-			//syslog(LOG_NOTICE, "logging: mq_send(log_queue) error %d: %s\n", errno, strerror(errno));
-			syslog(LOG_NOTICE, "%s", message);
+}
+//------------------------------------------------------------------------------
+
+// write collected messages into log file & release it in buffers
+static void log_write(int fHandle, struct iovec *iov, int iovcnt, ST_LOG_DONE *done, int ndone)
+{
+	ssize_t written;
+	int i;
+
+	if( iovcnt ) {
+		if( fHandle != BAD_OBJ ) {
+			written = writev(fHandle, iov, iovcnt);
+			if( written < 1 )
+				syslog(LOG_NOTICE, "logger[%ld]: writev(%d) error %d: %s\n", syscall(SYS_gettid), iovcnt, errno, strerror(errno));
+			else
+				log_size += written;
+		}
+		else {
+			for(i = 0; i < iovcnt; i += 2)
+				syslog(LOG_NOTICE, "%.*s%.*s", (int)iov[i].iov_len, (char *)iov[i].iov_base, (int)iov[i + 1].iov_len, (char *)iov[i + 1].iov_base);
 		}
-		mq_close(log_queue);
 	}
 
-    if( !stParams.daemon )
-        fprintf(stderr, "%s\n", message);
+	for(i = 0; i < ndone; i++)
+		__atomic_store_n(&done[i].buf->tail, done[i].tail, __ATOMIC_RELEASE);
+}
+//------------------------------------------------------------------------------
+
+/*
+   write messages of all buffers into log file
+   return number of the written messages
+*/
+static unsigned int log_drain(int fHandle)
+{
+	static struct iovec iov[LOG_IOV * 2];
+	static ST_LOG_DONE done[LOG_IOV];
+	static char times[LOG_IOV][32];
+	ST_LOG_BUF *buf;
+	ST_LOG_ENTRY *entry;
+	uint64_t head, tail, start, dropped = 0;
+	unsigned int count = 0;
+	int iovcnt = 0, ndone = 0, ntimes = 0, cancel_state;
+	int64_t last_time = -1;
+	time_t t;
+	struct tm local;
+	char msg_buf[LOG_MSG_SIZE];
+
+	// messages must not be written twice
+	pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &cancel_state);
+
+	for(buf = __atomic_load_n(&log_bufs, __ATOMIC_ACQUIRE); buf; buf = buf->next) {
+		if( __atomic_load_n(&buf->dropped, __ATOMIC_RELAXED) )
+			dropped += __atomic_exchange_n(&buf->dropped, 0, __ATOMIC_RELAXED);
+
+		// previous buffer of the thread not written yet, keep order of the messages
+		if( buf->prev )
+			continue;
+
+		start = tail = buf->tail;
+		head = __atomic_load_n(&buf->head, __ATOMIC_ACQUIRE);
+
+		while( tail < head ) {
+			entry = (ST_LOG_ENTRY *)&buf->data[tail & (buf->size - 1)];
+			if( entry->size == LOG_PAD ) {	// skip the end of the buffer
+				tail += buf->size - (tail & (buf->size - 1));
+				continue;
+			}
+
+			if( iovcnt == LOG_IOV * 2 ) {	// write collected
+				if( tail != start ) {
+					done[ndone].buf = buf;
+					done[ndone++].tail = tail;
+				}
+				log_write(fHandle, iov, iovcnt, done, ndone);
+				iovcnt = ndone = ntimes = 0;
+				last_time = -1;
+				start = tail;
+			}
+
+			if( entry->time != last_time ) {
+				last_time = entry->time;
+				t = (time_t)last_time;
+				localtime_r(&t, &local);
+				// "dd.mm.yy hh:mm:ss " as writelog, LOG_TIME_SIZE bytes
+				strftime(times[ntimes++], sizeof(times[0]), "%d.%m.%y %H:%M:%S ", &local);
+			}
+			iov[iovcnt].iov_base = times[ntimes - 1];
+			iov[iovcnt++].iov_len = LOG_TIME_SIZE;
+			iov[iovcnt].iov_base = (char *)(entry + 1);
+			iov[iovcnt++].iov_len = entry->size;
+
+			tail += LOG_ENTRY_SIZE(entry->size);
+			count++;
+		}	// while( tail < head )
+
+		if( tail != start ) {	// not more than LOG_IOV buffers, each has message
+			done[ndone].buf = buf;
+			done[ndone++].tail = tail;
+		}
+	}	// for(buf
+
+	log_write(fHandle, iov, iovcnt, done, ndone);
+
+	if( dropped )
+		writelog(fHandle, msg_buf, snprintf(msg_buf, LOG_MSG_SIZE, "logger[%ld]: log buffer full, %llu messages dropped\n", syscall(SYS_gettid), (unsigned long long)dropped));
+
+	pthread_setcancelstate(cancel_state, NULL);
+
+	return count;
+}
+//------------------------------------------------------------------------------
+
+// name of the generation of the log file: log_file.N or log_file.N.gz
+static void log_name(char *name, unsigned int generation, const char *ext)
+{
+	if( generation )
+		snprintf(name, FILENAME_MAX, "%.4060s.%u%s", stConfigServer.log_file, generation, ext);
+	else
+		snprintf(name, FILENAME_MAX, "%s", stConfigServer.log_file);
+}
+//------------------------------------------------------------------------------
+
+/*
+   compression thread: log_file.1 -> log_file.1.gz, log_file.1 deleted
+   arg - name of the file, freed by thread
+*/
+static void *log_compress_thread(void *arg)
+{
+	char *path = (char *)arg, gz_path[FILENAME_MAX], *buf;
+	int fd;
+	ssize_t size = 0;
+	gzFile gz;
+
+	snprintf(gz_path, FILENAME_MAX, "%.4080s.gz.tmp", path);
+	buf = (char *)malloc(LOG_BUF_SIZE);
+	fd = open(path, O_RDONLY);
+	gz = gzopen(gz_path, "wb6");
+
+	if( buf && fd != BAD_OBJ && gz ) {
+		while( (size = read(fd, buf, LOG_BUF_SIZE)) > 0 ) {
+			if( gzwrite(gz, buf, size) != size ) {
+				size = -1;
+				break;
+			}
+		}
+	}
+	else {
+		size = -1;
+	}
+
+	if( gz && gzclose(gz) != Z_OK )
+		size = -1;
+	if( fd != BAD_OBJ )
+		close(fd);
+
+	if( size < 0 ) {
+		logging("logger[%ld]: compress %s error\n", syscall(SYS_gettid), path);
+		unlink(gz_path);
+	}
+	else {
+		// log_file.1.gz.tmp -> log_file.1.gz
+		gz_path[strlen(gz_path) - 4] = 0;
+		snprintf(buf, LOG_BUF_SIZE, "%s.tmp", gz_path);
+		if( rename(buf, gz_path) )
+			logging("logger[%ld]: rename(%s) error %d: %s\n", syscall(SYS_gettid), gz_path, errno, strerror(errno));
+		else
+			unlink(path);
+	}
+
+	free(buf);
+	free(path);
+	__atomic_store_n(&log_compressing, 0, __ATOMIC_RELEASE);
+	return NULL;
+}
+//------------------------------------------------------------------------------
+
+// open log file, return handle or BAD_OBJ if error
+static int log_open(void)
+{
+	struct stat filestat;
+	int fHandle = open(stConfigServer.log_file,
+							O_APPEND | O_CREAT | O_RDWR,
+							S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+
+	if( fHandle == BAD_OBJ ) {
+		syslog(LOG_NOTICE, "logger[%ld]: open(%s) error %d: %s\n", syscall(SYS_gettid), stConfigServer.log_file, errno, strerror(errno));
+		return BAD_OBJ;
+	}
+
+	log_size = fstat(fHandle, &filestat) ? 0 : filestat.st_size;
+	log_opened = time(NULL);
+	return fHandle;
+}
+//------------------------------------------------------------------------------
+
+/*
+   rotate log file, if it too big or too old
+   fHandle - handle of the log file, reopened after rotation
+*/
+static void log_rotate(int *fHandle)
+{
+	char name[FILENAME_MAX], new_name[FILENAME_MAX], *path;
+	unsigned int generation, generations;
+	pthread_attr_t attr;
+	pthread_t thread;
+
+	if( *fHandle == BAD_OBJ )
+		return;
+	if( !(stConfigServer.log_maxsize && log_size >= stConfigServer.log_maxsize) &&
+			!(stConfigServer.log_rotate && time(NULL) - log_opened >= stConfigServer.log_rotate) )
+		return;
+
+	// wait previous compression, log_file.1 not renamed
+	if( __atomic_load_n(&log_compressing, __ATOMIC_ACQUIRE) )
+		return;
+
+	generations = stConfigServer.log_files > 0 ? stConfigServer.log_files : 1;
+
+	// delete the oldest & shift others: log_file.1 -> log_file.2 ...
+	log_name(name, generations, "");
+	unlink(name);
+	log_name(name, generations, ".gz");
+	unlink(name);
+	for(generation = generations - 1; generation > 0; generation--) {
+		log_name(name, generation, "");
+		log_name(new_name, generation + 1, "");
+		rename(name, new_name);
+		log_name(name, generation, ".gz");
+		log_name(new_name, generation + 1, ".gz");
+		rename(name, new_name);
+	}
+
+	// log_file -> log_file.1
+	log_name(new_name, 1, "");
+	if( rename(stConfigServer.log_file, new_name) ) {
+		syslog(LOG_NOTICE, "logger[%ld]: rename(%s, %s) error %d: %s\n", syscall(SYS_gettid), stConfigServer.log_file, new_name, errno, strerror(errno));
+		log_opened = time(NULL);	// not try every message
+		return;
+	}
+
+	close(*fHandle);
+	*fHandle = log_open();
+
+	if( !stConfigServer.log_compress )
+		return;
+
+	path = strdup(new_name);
+	if( !path )
+		return;
+
+	__atomic_store_n(&log_compressing, 1, __ATOMIC_RELEASE);
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	if( pthread_create(&thread, &attr, log_compress_thread, path) ) {
+		syslog(LOG_NOTICE, "logger[%ld]: pthread_create error %d: %s\n", syscall(SYS_gettid), errno, strerror(errno));
+		__atomic_store_n(&log_compressing, 0, __ATOMIC_RELEASE);
+		free(path);
+	}
+	pthread_attr_destroy(&attr);
 }
 //------------------------------------------------------------------------------
 
@@ -66,31 +530,19 @@ void logging(char *template, ...)
 void *log_thread_func(void *arg)
 {
 	int fHandle = BAD_OBJ;
-	mqd_t queue_log = BAD_OBJ;	// Posix IPC queue of messages from workers
 	char msg_buf[LOG_MSG_SIZE];
-	struct mq_attr queue_attr;
 	ssize_t msg_size;
-	struct rlimit rlim;
+	struct timespec ts;
+	unsigned int count;
 
 	// eror handler:
 	void exit_logger(void * arg) {
 
-		if( queue_log != BAD_OBJ ) {
-
-			// save messages from queue
-			if( mq_getattr(queue_log, &queue_attr) == 0 && queue_attr.mq_curmsgs > 0 ) {
-				memset(msg_buf, 0, LOG_MSG_SIZE);
-
-				while( (msg_size = mq_receive(queue_log, msg_buf, LOG_MSG_SIZE, NULL)) > 0 ) {
-					writelog(fHandle, msg_buf, msg_size);
-					memset(msg_buf, 0, LOG_MSG_SIZE);
-				}   // while
-			}   // if
-
-			// destroy queue
-			mq_close(queue_log);
-			mq_unlink(QUEUE_LOGGER);
-		}   // if( queue_log != BAD_OBJ )
+		// next messages to syslog, save messages from buffers
+		__atomic_store_n(&log_running, 0, __ATOMIC_SEQ_CST);
+		do {	// new buffers of the threads written after previous
+			log_free();
+		} while( log_drain(fHandle) );
 
 		msg_size = snprintf(msg_buf, LOG_MSG_SIZE, "logger[%ld] destroyed\n", syscall(SYS_gettid));
 		writelog(fHandle, msg_buf, msg_size);
@@ -102,49 +554,13 @@ void *log_thread_func(void *arg)
 	// install eror handler:
 	pthread_cleanup_push(exit_logger, arg);
 
+	pthread_once(&log_once, log_init);
 
-	// calculate messages queue size
-	memset(&queue_attr, 0, sizeof(struct mq_attr));
-	// Max. message size (bytes)
-	queue_attr.mq_msgsize = LOG_MSG_SIZE;
-
-	// get limit to queue size in bytes
-	// calc Max. # of messages on queue
-	if( !getrlimit(RLIMIT_MSGQUEUE, &rlim) ){
-	    /*
-        attr->mq_maxmsg must be less than or equal to the msg_max limit,
-        attr->mq_msgsize must be less than or equal to the msgsize_max limit
-        */
-	    queue_attr.mq_maxmsg = (long) min(rlim.rlim_cur, rlim.rlim_max) / queue_attr.mq_msgsize / 1000;
-    }
-    else {
-	    queue_attr.mq_maxmsg = (long) 819200 / queue_attr.mq_msgsize;
-    }
-
-	// create messages queue
-	//mq_unlink(QUEUE_LOGGER);
-	queue_log = mq_open(QUEUE_LOGGER, O_RDONLY | O_CREAT, S_IWGRP | S_IWUSR, &queue_attr);
-	if( queue_log < 0 ) {
-		syslog(LOG_NOTICE, "logger[%ld]: mq_open(%s) error %d: %s\n", syscall(SYS_gettid), QUEUE_LOGGER, errno, strerror(errno));
-		exit_logger(arg);
-		return NULL;
-	}
-
-	// control log-file size
-	setfilesize(stConfigServer.log_file, stConfigServer.log_maxsize);
-
-	// open log-file
-	if( (fHandle = open(stConfigServer.log_file,
-							  O_APPEND | O_CREAT | O_RDWR,
-							  S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH)) == BAD_OBJ ) {
-		syslog(LOG_NOTICE, "logger[%ld]: open(%s) error %d: %s\n", syscall(SYS_gettid), stConfigServer.log_file, errno, strerror(errno));
-		/*
-		   exit_logger(arg);
-		   return NULL;
+	// open log-file, if error - logging to syslog
+	fHandle = log_open();
+	log_rotate(&fHandle);
 
-		   logging to syslog
-		*/
-	}
+	__atomic_store_n(&log_running, 1, __ATOMIC_SEQ_CST);
 
 	logging("\n");
 	logging("glonassd[%ld] started", getpid());
@@ -154,11 +570,26 @@ void *log_thread_func(void *arg)
 	while( 1 ) {
 		pthread_testcancel();
 
-		memset(msg_buf, 0, LOG_MSG_SIZE);
-		msg_size = mq_receive(queue_log, msg_buf, LOG_MSG_SIZE, NULL);
-		if( msg_size > 0 )
-			writelog(fHandle, msg_buf, msg_size);
+		count = log_drain(fHandle);
+		log_free();
+		log_rotate(&fHandle);
+		if( count )
+			continue;
+
+		// buffers are empty, sleep until message
+		__atomic_store_n(&log_sleeping, 1, __ATOMIC_SEQ_CST);
+
+		// message may be written before sleeping flag set
+		if( log_pending() ) {
+			__atomic_store_n(&log_sleeping, 0, __ATOMIC_RELAXED);
+			continue;
+		}
+
+		clock_gettime(CLOCK_REALTIME, &ts);
+		ts.tv_sec++;
+		sem_timedwait(&log_wakeup, &ts);
 
+		__atomic_store_n(&log_sleeping, 0, __ATOMIC_RELAXED);
 	}	// while( 1 )
 
 
@@ -197,7 +628,10 @@ static void writelog(int fHandle, char *logmsg, int len)
 
 	if( loglen > 0 ) {
 		if( fHandle != BAD_OBJ ) {
-			if( write(fHandle, buf, loglen) < 1 ) {
+			if( write(fHandle, buf, loglen) == loglen ) {
+				log_size += loglen;
+			}
+			else {
 				syslog(LOG_NOTICE, "logger[%ld]: write(%d) error %d: %s\n", syscall(SYS_gettid), loglen, errno, strerror(errno));
 				syslog(LOG_NOTICE, "%s", buf);
 			}
@@ -208,29 +642,3 @@ static void writelog(int fHandle, char *logmsg, int len)
 	}   // if( loglen > 0 )
 }
 //------------------------------------------------------------------------------
-
-static void setfilesize(char *log_file, size_t log_maxsize)
-{
-	struct stat filestat;
-	char buf[FILENAME_MAX];
-
-	if( !stat(log_file, &filestat) ) {
-		if( filestat.st_size >= log_maxsize ) {
-			// create old-file-name
-			memset(buf, 0, FILENAME_MAX);
-			snprintf(buf, FILENAME_MAX, "%s.old", log_file);
-			// delete old file with old-file-name & rename current file to old-file-name
-			unlink(buf);
-			if( rename(log_file, buf) ) {
-				syslog(LOG_NOTICE, "logger[%ld]: rename(%s, %s) error %d: %s\n", syscall(SYS_gettid), log_file, buf, errno, strerror(errno));
-				if( unlink(log_file) )
-					syslog(LOG_NOTICE, "logger[%ld]: unlink(%s) error %d: %s\n", syscall(SYS_gettid), log_file, errno, strerror(errno));
-			}
-		}   // if( filestat.st_size >= log_maxsize )
-	}   // if( !stat(log_file, &filestat) )
-	else {
-		if( errno != 2 )	//  No such file or directory (after delete file, ex.)
-			syslog(LOG_NOTICE, "logger[%ld]: stat(%s) error %d: %s\n", syscall(SYS_gettid), log_file, errno, strerror(errno));
-	}
-}
-//------------------------------------------------------------------------------
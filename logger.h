@@ -1,8 +1,9 @@
 #ifndef __LOGGER__
 #define __LOGGER__
 
-#define QUEUE_LOGGER "/que_logger"
 #define LOG_MSG_SIZE 512
+#define LOG_BUF_SIZE (64 * 1024)    // max. size of the log buffer of each thread, bytes
+#define LOG_BUF_MIN (2 * 1024)      // size of the new log buffer of the thread, doubled if full
 
 extern void logging(char *template, ...);
 void *log_thread_func(void *logmsg);
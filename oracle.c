@@ -56,6 +56,9 @@
 #include <ctype.h>
 #include "glonassd.h"
 #include "de.h"
+#include "record.h"
+#include "ring.h"
+#include "spool.h"
 #include "logger.h"
 
 #ifdef _MSC_VER
@@ -70,6 +73,63 @@
 #endif
 
 #define MAX_SQL_SIZE 4096
+#define INSERT_PARAMS_COUNT 26
+#define BATCH_MAX 10000		// max. db_batch
+
+// ring buffer of the database thread (db_rings[sink][shard]), NULL if db_queue = mq
+static __thread ST_RING *db_ring;
+// spool of the database library (db_spools[sink]), NULL if db_spool not set
+static __thread ST_SPOOL *db_spool;
+// database library & connection parameters of the thread (one of db_type)
+static __thread ST_DB_SINK *db_sink;
+
+// parameters of the insert (oracle.sql), :1 .. :26, as bound by write_data_to_db
+static const struct {
+	const char *name;
+	dpiOracleTypeNum oracle_type;
+	dpiNativeTypeNum native_type;
+	uint32_t size;		// max. bytes of the string
+} batch_params[INSERT_PARAMS_COUNT] = {
+	{"DDATA", DPI_ORACLE_TYPE_TIMESTAMP, DPI_NATIVE_TYPE_TIMESTAMP, 0},
+	{"NTIME", DPI_ORACLE_TYPE_NUMBER, DPI_NATIVE_TYPE_INT64, 0},
+	{"CID", DPI_ORACLE_TYPE_VARCHAR, DPI_NATIVE_TYPE_BYTES, SIZE_TRACKER_FIELD},
+	{"NNUM", DPI_ORACLE_TYPE_NUMBER, DPI_NATIVE_TYPE_INT64, 0},
+	{"CLATITUDE", DPI_ORACLE_TYPE_VARCHAR, DPI_NATIVE_TYPE_BYTES, 10},
+	{"CNS", DPI_ORACLE_TYPE_VARCHAR, DPI_NATIVE_TYPE_BYTES, 1},
+	{"CLONGTITUDE", DPI_ORACLE_TYPE_VARCHAR, DPI_NATIVE_TYPE_BYTES, 10},
+	{"CEW", DPI_ORACLE_TYPE_VARCHAR, DPI_NATIVE_TYPE_BYTES, 1},
+	{"CCURSE", DPI_ORACLE_TYPE_VARCHAR, DPI_NATIVE_TYPE_BYTES, 3},
+	{"CSPEED", DPI_ORACLE_TYPE_VARCHAR, DPI_NATIVE_TYPE_BYTES, 3},
+	{"CFUEL", DPI_ORACLE_TYPE_VARCHAR, DPI_NATIVE_TYPE_BYTES, 3},
+	{"CDATAVALID", DPI_ORACLE_TYPE_VARCHAR, DPI_NATIVE_TYPE_BYTES, 1},
+	{"CNAPR", DPI_ORACLE_TYPE_VARCHAR, DPI_NATIVE_TYPE_BYTES, 3},
+	{"CBAT", DPI_ORACLE_TYPE_VARCHAR, DPI_NATIVE_TYPE_BYTES, 3},
+	{"CTEMPER", DPI_ORACLE_TYPE_VARCHAR, DPI_NATIVE_TYPE_BYTES, 3},
+	{"CZAJ", DPI_ORACLE_TYPE_VARCHAR, DPI_NATIVE_TYPE_BYTES, 1},
+	{"CSATEL", DPI_ORACLE_TYPE_VARCHAR, DPI_NATIVE_TYPE_BYTES, 2},
+	{"CPROBEG", DPI_ORACLE_TYPE_VARCHAR, DPI_NATIVE_TYPE_BYTES, 10},
+	{"CIN0", DPI_ORACLE_TYPE_VARCHAR, DPI_NATIVE_TYPE_BYTES, 10},
+	{"CIN1", DPI_ORACLE_TYPE_VARCHAR, DPI_NATIVE_TYPE_BYTES, 10},
+	{"CIN2", DPI_ORACLE_TYPE_VARCHAR, DPI_NATIVE_TYPE_BYTES, 10},
+	{"CIN3", DPI_ORACLE_TYPE_VARCHAR, DPI_NATIVE_TYPE_BYTES, 10},
+	{"CIN4", DPI_ORACLE_TYPE_VARCHAR, DPI_NATIVE_TYPE_BYTES, 10},
+	{"CIN5", DPI_ORACLE_TYPE_VARCHAR, DPI_NATIVE_TYPE_BYTES, 10},
+	{"CIN6", DPI_ORACLE_TYPE_VARCHAR, DPI_NATIVE_TYPE_BYTES, 10},
+	{"CIN7", DPI_ORACLE_TYPE_VARCHAR, DPI_NATIVE_TYPE_BYTES, 10}
+};
+
+// array DML (db_batch > 0), see batch_flush
+typedef struct {
+	dpiStmt *stmt;				// insert statement, prepared once per connection
+	dpiVar *var[INSERT_PARAMS_COUNT];	// bind arrays of db_batch rows
+	dpiData *data[INSERT_PARAMS_COUNT];
+	int prepared;				// 0 - not yet, 1 - prepared, -1 - error, insert records by one
+	char *packed;				// packed records of the batch (record.h), for spool
+	size_t packed_size;
+	unsigned int count;			// number of the records in batch
+	unsigned long long first;	// time of the first record in batch, milliseconds
+} ST_BATCH;
+static __thread ST_BATCH batch;
 
 /*
    load_file:
@@ -142,6 +202,31 @@ void db_log_error(dpiContext *gContext, const char *message)
 //------------------------------------------------------------------------------
 
 
+/*
+   batch_close:
+   release statement & bind arrays of the batch, records of the batch dropped
+*/
+static void batch_close(void)
+{
+	int i;
+
+	for(i = 0; i < INSERT_PARAMS_COUNT; i++) {
+		if( batch.var[i] )
+			dpiVar_release(batch.var[i]);
+		batch.var[i] = NULL;
+		batch.data[i] = NULL;
+	}
+
+	if( batch.stmt )
+		dpiStmt_release(batch.stmt);
+	batch.stmt = NULL;
+
+	batch.prepared = 0;
+	batch.packed_size = 0;
+	batch.count = 0;
+}
+//------------------------------------------------------------------------------
+
 /*
    db_connect:
    connection to / disconnection from database
@@ -170,11 +255,11 @@ static int db_connect(int connect, dpiConn **connection, dpiContext **gContext)
             // create a standalone connection
             if ( *gContext ) {
                 // https://oracle.github.io/odpi/doc/functions/dpiConn.html#c.dpiConn_create
-                logging("database thread[%ld]: Attempt connect to %s\n", syscall(SYS_gettid), stConfigServer.db_name);
+                logging("database thread[%ld]: Attempt connect to %s\n", syscall(SYS_gettid), db_sink->db_name);
                 if (dpiConn_create(*gContext,
-                                    stConfigServer.db_user, strlen(stConfigServer.db_user),
-                                    stConfigServer.db_pass, strlen(stConfigServer.db_pass),
-                                    stConfigServer.db_name, strlen(stConfigServer.db_name),
+                                    db_sink->db_user, strlen(db_sink->db_user),
+                                    db_sink->db_pass, strlen(db_sink->db_pass),
+                                    db_sink->db_name, strlen(db_sink->db_name),
                                     NULL, NULL, connection) < 0)
                 {
                     db_log_error(*gContext, "Unable to create connection");
@@ -189,6 +274,7 @@ static int db_connect(int connect, dpiConn **connection, dpiContext **gContext)
 	else {	// disconnect from database
 
 		if( *connection ) {
+            batch_close();	// statement of the connection
             dpiConn_release(*connection);
 			*connection = NULL;
             if( *gContext ){
@@ -405,49 +491,49 @@ static int write_data_to_db(dpiConn *connection, dpiContext *gContext, char *msg
   		goto the_end;
     }
 
-    snprintf(tmp, 11, "%d", record->ainputs[0]);            // :20 10+1   CIN1
+    snprintf(tmp, 11, "%d", record->ainputs[1]);            // :20 10+1   CIN1
     dpiData_setBytes(&strCIN1, tmp, strlen(tmp));
     if (dpiStmt_bindValueByPos(stmt, 20, DPI_NATIVE_TYPE_BYTES, &strCIN1) < 0){
         db_log_error(gContext, "CIN1");
   		goto the_end;
     }
 
-    snprintf(tmp, 11, "%d", record->ainputs[0]);            // :21 10+1   CIN2
+    snprintf(tmp, 11, "%d", record->ainputs[2]);            // :21 10+1   CIN2
     dpiData_setBytes(&strCIN2, tmp, strlen(tmp));
     if (dpiStmt_bindValueByPos(stmt, 21, DPI_NATIVE_TYPE_BYTES, &strCIN2) < 0){
         db_log_error(gContext, "CIN2");
   		goto the_end;
     }
 
-    snprintf(tmp, 11, "%d", record->ainputs[0]);            // :22 10+1   CIN3
+    snprintf(tmp, 11, "%d", record->ainputs[3]);            // :22 10+1   CIN3
     dpiData_setBytes(&strCIN3, tmp, strlen(tmp));
     if (dpiStmt_bindValueByPos(stmt, 22, DPI_NATIVE_TYPE_BYTES, &strCIN3) < 0){
         db_log_error(gContext, "CIN3");
   		goto the_end;
     }
 
-    snprintf(tmp, 11, "%d", record->ainputs[0]);            // :23 10+1   CIN4
+    snprintf(tmp, 11, "%d", record->ainputs[4]);            // :23 10+1   CIN4
     dpiData_setBytes(&strCIN4, tmp, strlen(tmp));
     if (dpiStmt_bindValueByPos(stmt, 23, DPI_NATIVE_TYPE_BYTES, &strCIN4) < 0){
         db_log_error(gContext, "CIN4");
   		goto the_end;
     }
 
-    snprintf(tmp, 11, "%d", record->ainputs[0]);            // :24 10+1   CIN5
+    snprintf(tmp, 11, "%d", record->ainputs[5]);            // :24 10+1   CIN5
     dpiData_setBytes(&strCIN5, tmp, strlen(tmp));
     if (dpiStmt_bindValueByPos(stmt, 24, DPI_NATIVE_TYPE_BYTES, &strCIN5) < 0){
         db_log_error(gContext, "CIN5");
   		goto the_end;
     }
 
-    snprintf(tmp, 11, "%d", record->ainputs[0]);            // :25 10+1   CIN6
+    snprintf(tmp, 11, "%d", record->ainputs[6]);            // :25 10+1   CIN6
     dpiData_setBytes(&strCIN6, tmp, strlen(tmp));
     if (dpiStmt_bindValueByPos(stmt, 25, DPI_NATIVE_TYPE_BYTES, &strCIN6) < 0){
         db_log_error(gContext, "CIN6");
   		goto the_end;
     }
 
-    snprintf(tmp, 11, "%d", record->ainputs[0]);            // :26 10+1   CIN7
+    snprintf(tmp, 11, "%d", record->ainputs[7]);            // :26 10+1   CIN7
     dpiData_setBytes(&strCIN7, tmp, strlen(tmp));
     if (dpiStmt_bindValueByPos(stmt, 26, DPI_NATIVE_TYPE_BYTES, &strCIN7) < 0){
         db_log_error(gContext, "CIN7");
@@ -478,6 +564,385 @@ static int write_data_to_db(dpiConn *connection, dpiContext *gContext, char *msg
 }
 //------------------------------------------------------------------------------
 
+// milliseconds of the monotonic clock
+static unsigned long long msec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+//------------------------------------------------------------------------------
+
+/*
+   spool_packed:
+   write packed records (record.h) to spool by messages not more than SPOOL_MSG_MAX bytes
+   spool - spool or NULL, if records must not be kept
+*/
+static void spool_packed(ST_SPOOL *spool, char *packed, size_t size)
+{
+	size_t pos = 0, len = 0, record_size;
+
+	if( !spool )
+		return;
+
+	while( pos + len < size ) {
+		record_size = ((ST_RECORD_PACKED *)&packed[pos + len])->size;
+		if( len && len + record_size > SPOOL_MSG_MAX ) {
+			spool_write(spool, &packed[pos], len);
+			pos += len;
+			len = 0;
+		}
+		len += record_size;
+	}
+
+	if( len )
+		spool_write(spool, &packed[pos], len);
+}
+//------------------------------------------------------------------------------
+
+/*
+   batch_prepare:
+   prepare insert statement & bind arrays of db_batch rows, once per connection
+   return 1 if success or 0 if error (records will be inserted by one)
+*/
+static int batch_prepare(dpiConn *connection, dpiContext *gContext, char *sql_insert_point)
+{
+	int i;
+
+	if( batch.prepared )
+		return batch.prepared > 0;
+
+	batch.prepared = -1;
+
+	if( dpiConn_prepareStmt(connection, 0, sql_insert_point, strlen(sql_insert_point), NULL, 0, &batch.stmt) < 0 ) {
+		db_log_error(gContext, "batch: dpiConn_prepareStmt");
+		batch.stmt = NULL;
+		return 0;
+	}
+
+	for(i = 0; i < INSERT_PARAMS_COUNT; i++) {
+		// https://oracle.github.io/odpi/doc/functions/dpiConn.html#c.dpiConn_newVar
+		if( dpiConn_newVar(connection, batch_params[i].oracle_type, batch_params[i].native_type,
+							stConfigServer.db_batch, batch_params[i].size, 1, 0, NULL,
+							&batch.var[i], &batch.data[i]) < 0
+				|| dpiStmt_bindByPos(batch.stmt, i + 1, batch.var[i]) < 0 ) {
+			db_log_error(gContext, batch_params[i].name);
+			logging("database thread[%ld]: array DML not prepared, records will be inserted by one\n", syscall(SYS_gettid));
+			batch_close();
+			batch.prepared = -1;
+			return 0;
+		}
+	}
+
+	batch.prepared = 1;
+	return 1;
+}
+//------------------------------------------------------------------------------
+
+/*
+   batch_row:
+   write record into row of the bind arrays, values as in write_data_to_db
+   return 1 if success or 0 if error
+*/
+static int batch_row(ST_RECORD *record, uint32_t row)
+{
+	struct tm tm_data;
+	char text[INSERT_PARAMS_COUNT][SIZE_TRACKER_FIELD];
+	int i;
+
+	gmtime_r(&record->data, &tm_data);
+	dpiData_setTimestamp(&batch.data[0][row],
+							tm_data.tm_year + 1900, tm_data.tm_mon + 1, tm_data.tm_mday,
+							tm_data.tm_hour, tm_data.tm_min, tm_data.tm_sec,
+							0, 0, 0);						// :1 DDATA
+	dpiData_setInt64(&batch.data[1][row], record->time);	// :2 NTIME
+	dpiData_setInt64(&batch.data[3][row], record->recnum);	// :4 NNUM
+
+	snprintf(text[2], SIZE_TRACKER_FIELD, "%s", record->imei);		// :3 CID
+	snprintf(text[4], 11, "%03.07lf", record->lat);				// :5 CLATITUDE
+	snprintf(text[5], 2, "%c", record->clat);					// :6 CNS
+	snprintf(text[6], 11, "%03.07lf", record->lon);				// :7 CLONGTITUDE
+	snprintf(text[7], 2, "%c", record->clon);					// :8 CEW
+	snprintf(text[8], 4, "%d", record->curs);					// :9 CCURSE
+	snprintf(text[9], 4, "%03.0lf", record->speed);				// :10 CSPEED
+	snprintf(text[10], 4, "%d", record->fuel[0]);				// :11 CFUEL
+	snprintf(text[11], 2, "%c", record->valid ? 'V' : ' ');		// :12 CDATAVALID
+	snprintf(text[12], 4, "%02.0lf", record->vbort);			// :13 CNAPR
+	snprintf(text[13], 4, "%02.0lf", record->vbatt);			// :14 CBAT
+	snprintf(text[14], 4, "%d", record->temperature);			// :15 CTEMPER
+	snprintf(text[15], 2, "%d", record->zaj);					// :16 CZAJ
+	snprintf(text[16], 3, "%d", record->satellites);			// :17 CSATEL
+	snprintf(text[17], 11, "%04.0lf", record->probeg);			// :18 CPROBEG
+	for(i = 0; i < 8; i++)
+		snprintf(text[18 + i], 11, "%d", record->ainputs[i]);	// :19 - :26 CIN0 - CIN7
+
+	for(i = 0; i < INSERT_PARAMS_COUNT; i++) {
+		if( batch_params[i].native_type == DPI_NATIVE_TYPE_BYTES
+				&& dpiVar_setFromBytes(batch.var[i], row, text[i], strlen(text[i])) < 0 )
+			return 0;
+	}
+
+	return 1;
+}
+//------------------------------------------------------------------------------
+
+/*
+   db_lost:
+   test database connection after error, error of the call logged before
+   return 1 if connection lost or 0 if connection alive (error of the data)
+*/
+static int db_lost(dpiConn *connection)
+{
+	return dpiConn_ping(connection) != DPI_SUCCESS;
+}
+//------------------------------------------------------------------------------
+
+/*
+   batch_by_one:
+   insert records of the failed batch one by one & commit,
+   record with error of the data logged & skipped, so batch not spooled again & again
+   packed - records of the batch, packed_size - size of the records
+   spool - spool (db_spool) or NULL, if records must not be kept
+   return 1 if success or -1 if database connection lost (the rest records spooled)
+*/
+static int batch_by_one(dpiConn *connection, dpiContext *gContext, size_t packed_size, ST_SPOOL *spool)
+{
+	ST_RECORD record;
+	size_t pos = 0, size;
+	unsigned int skipped = 0;
+
+	dpiConn_rollback(connection);
+
+	while( pos < packed_size && (size = record_unpack(&batch.packed[pos], packed_size - pos, &record)) > 0 ) {
+		if( !batch_row(&record, 0) || dpiStmt_executeMany(batch.stmt, DPI_MODE_EXEC_DEFAULT, 1) < 0 ) {
+			db_log_error(gContext, "batch: dpiStmt_executeMany(1)");
+			if( db_lost(connection) ) {
+				// records before this not committed
+				spool_packed(spool, batch.packed, packed_size);
+				return -1;
+			}
+			skipped++;
+		}
+		pos += size;
+	}
+
+	if( dpiConn_commit(connection) != DPI_SUCCESS ) {
+		db_log_error(gContext, "dpiConn_commit");
+		if( db_lost(connection) ) {
+			spool_packed(spool, batch.packed, packed_size);
+			return -1;
+		}
+		logging("database thread[%ld]: batch not committed, records skipped\n", syscall(SYS_gettid));
+		return 1;
+	}
+
+	if( skipped )
+		logging("database thread[%ld]: %u records with errors skipped\n", syscall(SYS_gettid), skipped);
+
+	return 1;
+}
+//------------------------------------------------------------------------------
+
+/*
+   batch_flush:
+   insert batch of the records by one call (array DML) & commit it,
+   rows with errors (DPI_MODE_EXEC_BATCH_ERRORS) logged & skipped, the rest inserted,
+   if insert or commit failed & database connection lost, records of the batch written to spool,
+   else records inserted one by one (batch_by_one)
+   spool - spool (db_spool) or NULL, if records must not be kept
+   return 1 if success or -1 if database connection lost
+*/
+static int batch_flush(dpiConn *connection, dpiContext *gContext, ST_SPOOL *spool)
+{
+	dpiErrorInfo *errors;
+	uint32_t error_count = 0;
+	unsigned int count = batch.count;
+	size_t packed_size = batch.packed_size;
+
+	if( !count )
+		return 1;
+
+	batch.packed_size = batch.count = 0;
+
+	// https://oracle.github.io/odpi/doc/functions/dpiStmt.html#c.dpiStmt_executeMany
+	if( dpiStmt_executeMany(batch.stmt, DPI_MODE_EXEC_BATCH_ERRORS, count) < 0 ) {
+		db_log_error(gContext, "dpiStmt_executeMany");
+		if( !db_lost(connection) )
+			return batch_by_one(connection, gContext, packed_size, spool);
+		spool_packed(spool, batch.packed, packed_size);
+		return -1;
+	}
+
+	if( dpiStmt_getBatchErrorCount(batch.stmt, &error_count) == DPI_SUCCESS && error_count ) {
+		errors = (dpiErrorInfo *)malloc(error_count * sizeof(dpiErrorInfo));
+		if( errors && dpiStmt_getBatchErrors(batch.stmt, error_count, errors) == DPI_SUCCESS )
+			logging("database thread[%ld]: %u of %u records not inserted, first error (record %u): %.*s\n", syscall(SYS_gettid), error_count, count, errors[0].offset, (int)errors[0].messageLength, errors[0].message);
+		else
+			logging("database thread[%ld]: %u of %u records not inserted\n", syscall(SYS_gettid), error_count, count);
+		free(errors);
+	}
+
+	if( dpiConn_commit(connection) != DPI_SUCCESS ) {
+		db_log_error(gContext, "dpiConn_commit");
+		if( !db_lost(connection) )
+			return batch_by_one(connection, gContext, packed_size, spool);
+		spool_packed(spool, batch.packed, packed_size);
+		return -1;
+	}
+
+	return 1;
+}
+//------------------------------------------------------------------------------
+
+/*
+   batch_add:
+   add record to batch, write batch if it is full
+   packed - the same record in packed form (record.h)
+   return 1 if success, 0 if record not added or -1 if database connection lost
+*/
+static int batch_add(dpiConn *connection, dpiContext *gContext, ST_RECORD *record, char *packed, size_t packed_size, ST_SPOOL *spool)
+{
+	if( !batch_row(record, batch.count) ) {
+		db_log_error(gContext, "batch: dpiVar_setFromBytes");
+		return 0;
+	}
+
+	if( !batch.count )
+		batch.first = msec();
+
+	memcpy(&batch.packed[batch.packed_size], packed, packed_size);
+	batch.packed_size += packed_size;
+
+	if( ++batch.count >= (unsigned int)stConfigServer.db_batch )
+		return batch_flush(connection, gContext, spool);
+
+	return 1;
+}
+//------------------------------------------------------------------------------
+
+/*
+   batch_wait:
+   return milliseconds until batch must be written or max_wait, if batch is empty
+*/
+static int batch_wait(int max_wait)
+{
+	unsigned long long passed;
+
+	if( !batch.count )
+		return max_wait;
+
+	passed = msec() - batch.first;
+	if( passed >= (unsigned long long)stConfigServer.db_batch_wait )
+		return 0;
+
+	passed = stConfigServer.db_batch_wait - passed;
+	return passed < (unsigned long long)max_wait ? (int)passed : max_wait;
+}
+//------------------------------------------------------------------------------
+
+/*
+   write_message_to_db:
+   unpack records of the queue message (record.h) and write it to database
+   (by array DML if db_batch > 0, else by one)
+   params:
+   msg - packed records
+   msg_size - size of the msg
+   spool - spool (db_spool) for records, if database connection lost, or NULL
+   return 1 if success, 0 if error or -1 if database connection lost
+*/
+static int write_message_to_db(dpiConn *connection, dpiContext *gContext, char *msg, ssize_t msg_size, char *sql_insert_point, ST_SPOOL *spool)
+{
+    ST_RECORD record;
+    ssize_t pos = 0;
+    size_t packed_size;
+    int retval = 1;
+
+    while( pos < msg_size && (packed_size = record_unpack(&msg[pos], msg_size - pos, &record)) > 0 ) {
+        if( batch.packed && batch_prepare(connection, gContext, sql_insert_point) ) {
+            switch( batch_add(connection, gContext, &record, &msg[pos], packed_size, spool) ) {
+            case -1:    // record spooled with batch
+                spool_packed(spool, &msg[pos + packed_size], msg_size - pos - packed_size);
+                return -1;
+            case 0:
+                retval = 0;
+            }
+        }
+        else {
+            switch( write_data_to_db(connection, gContext, (char *)&record, sql_insert_point) ) {
+            case -1:
+                spool_packed(spool, &msg[pos], msg_size - pos);
+                return -1;
+            case 0:
+                retval = 0;
+            }
+        }
+        pos += packed_size;
+    }
+
+    return retval;
+}
+//------------------------------------------------------------------------------
+
+/*
+   write_ring_to_db:
+   write messages from ring buffer (db_queue = ring) to database,
+   read not more than RING_BATCH messages & release it at once
+   if database connection lost, the rest of messages goes to spool (db_spool)
+   wait - max. time of waiting messages, if ring buffer is empty, milliseconds
+   return number of the read messages or -1 if database connection lost
+*/
+static int write_ring_to_db(dpiConn *connection, dpiContext *gContext, char *sql_insert_point, int wait)
+{
+    char *msg;
+    size_t msg_size;
+    int count = 0;
+
+    while( count < RING_BATCH && (msg = ring_read(db_ring, &msg_size)) ) {
+        count++;
+        if( write_message_to_db(connection, gContext, msg, msg_size, sql_insert_point, db_spool) < 0 ) {
+            spool_ring(db_spool, db_ring);
+            return -1;
+        }
+    }
+    ring_release(db_ring);
+
+    if( !count && wait )
+        ring_wait(db_ring, wait);
+
+    return count;
+}
+//------------------------------------------------------------------------------
+
+/*
+   write_spool_to_db:
+   replay not more than RING_BATCH messages of the spool (db_spool) to database,
+   message removed from spool only if database connection not lost,
+   so batch (db_batch) written for each message
+   return number of the written messages or -1 if database connection lost
+*/
+static int write_spool_to_db(dpiConn *connection, dpiContext *gContext, char *sql_insert_point)
+{
+    char *msg;
+    size_t msg_size;
+    int count = 0;
+
+    // new records of the batch may be spooled, not replayed
+    if( batch_flush(connection, gContext, db_spool) < 0 )
+        return -1;
+
+    while( count < RING_BATCH && (msg = spool_read(db_spool, &msg_size)) ) {
+        if( write_message_to_db(connection, gContext, msg, msg_size, sql_insert_point, NULL) < 0
+                || batch_flush(connection, gContext, NULL) < 0 )
+            return -1;	// replay this message after reconnect
+        spool_commit(db_spool);
+        count++;
+    }
+
+    return count;
+}
+//------------------------------------------------------------------------------
+
 /*
    Main functions
 */
@@ -486,10 +951,12 @@ static int write_data_to_db(dpiConn *connection, dpiContext *gContext, char *msg
    db_thread
    works in separate thread
    started from func. database_setup in glonassd.c
-   arg - pointer to main configuration structure (stConfigServer)
+   arg - pointer to ST_DB_SHARD structure (glonassd.h): number, ring buffer, spool
+   & connection parameters of the thread, spool replayed by the thread 0 only
 */
 void *db_thread(void *arg)
 {
+	ST_DB_SHARD *shard = (ST_DB_SHARD *)arg;
     static __thread dpiContext *gContext = NULL;
 	static __thread dpiConn *db_connection = NULL;
 	static __thread char sql_insert_point[MAX_SQL_SIZE];	// text of inserting sql
@@ -499,10 +966,29 @@ void *db_thread(void *arg)
 	static __thread struct rlimit rlim;
 	static __thread ssize_t msg_size;
 	static __thread size_t buf_size;
+	static __thread int replayed;
+	static __thread int wait;
+	static __thread struct timespec timeout;
+	static __thread time_t overflow_check;
+	static __thread unsigned long long overflows;
 
 	// error handler:
 	void exit_db(void * arg) {
 
+		// save messages from ring buffer
+		if( db_ring ) {
+			while( db_connection ) {
+				int written = write_ring_to_db(db_connection, gContext, sql_insert_point, 0);
+				if( written < 0 ) {
+					db_connect(0, &db_connection, &gContext);
+					db_connection = NULL;
+				}
+				else if( !written )
+					break;
+			}
+			spool_ring(db_spool, db_ring);	// database lost
+		}
+
 		// destroy queue
 		if( queue_workers != -1 ) {
 			// save messages from queue
@@ -511,7 +997,7 @@ void *db_thread(void *arg)
 
 				while( (msg_size = mq_receive(queue_workers, msg_buf, buf_size, NULL)) > 0 ) {
 					if( db_connection ){
-						if( write_data_to_db(db_connection, gContext, msg_buf, sql_insert_point) < 0 ){
+						if( write_message_to_db(db_connection, gContext, msg_buf, msg_size, sql_insert_point, db_spool) < 0 ){
                     		db_connect(0, &db_connection, &gContext);
                             db_connection = NULL;
 						}
@@ -532,88 +1018,141 @@ void *db_thread(void *arg)
 			mq_unlink(QUEUE_WORKER);
 		}   // if( queue_workers != -1 )
 
+		// write the rest of the batch
+		if( db_connection )
+			batch_flush(db_connection, gContext, db_spool);
+
 		// disconnect from database
         if( db_connection ){
     		db_connect(0, &db_connection, &gContext);
         }
 
+		// free batch
+		free(batch.packed);
+		batch.packed = NULL;
+
 		logging("database thread[%ld] destroyed\n", syscall(SYS_gettid));
 	}   // exit_db
 
+	db_ring = shard->ring;
+	db_spool = shard->spool;
+	db_sink = shard->sink;
+
 	// install error handler:
 	pthread_cleanup_push(exit_db, arg);
 
 	// load insert sql from file, temporary using msg_buf
 	memset(msg_buf, 0, SOCKET_BUF_SIZE);
-	snprintf(msg_buf, SOCKET_BUF_SIZE, "%.4075s/%.15s.sql", stParams.start_path, stConfigServer.db_type);
+	snprintf(msg_buf, SOCKET_BUF_SIZE, "%.4075s/%.15s.sql", stParams.start_path, db_sink->db_type);
 	if( !load_file(msg_buf, sql_insert_point, MAX_SQL_SIZE) || !strlen(sql_insert_point) ) {
 		exit_db(arg);
 		return NULL;
 	}
 
-	// create messages queue
-	memset(&queue_attr, 0, sizeof(struct mq_attr));
-
-	/* test system limit of the length of messages queue RLIMIT_MSGQUEUE
-	   by default 819200 bytes
-	   setup RLIMIT_MSGQUEUE size in /etc/security/limits.conf as:
-		hard	msgqueue	1342177280
-	   and reboot;
-	   see limits as:
-	   ulimit -a
-	   "POSIX message queues"
-	*/
-
-	/* Max. message size (bytes) */
-	queue_attr.mq_msgsize = sizeof(ST_RECORD);
-
-	// get RLIMIT_MSGQUEUE and calculate actual size of queue
-	if( getrlimit(RLIMIT_MSGQUEUE, &rlim) == 0 ) {
-		if( rlim.rlim_cur != rlim.rlim_max ) {	// increase RLIMIT_MSGQUEUE error
-			rlim.rlim_cur = rlim.rlim_max;
-			// calculate actual size of queue
-			if( setrlimit(RLIMIT_MSGQUEUE, &rlim) == 0 )
-				queue_attr.mq_maxmsg = (long)(rlim.rlim_max / queue_attr.mq_msgsize / 10);
-			else
-				queue_attr.mq_maxmsg = (long)(rlim.rlim_cur / queue_attr.mq_msgsize / 10);
-		} else
-			queue_attr.mq_maxmsg = (long)(rlim.rlim_cur / queue_attr.mq_msgsize / 10);
-	} else {
-		logging("database thread[%ld]: getrlimit() error %d: %s\n", syscall(SYS_gettid), errno, strerror(errno));
-		queue_attr.mq_maxmsg = (long)(819200 / queue_attr.mq_msgsize / 10);     /* Max. # of messages on queue */
+	// batch of the records for array DML, if not allocated - insert records by one
+	if( stConfigServer.db_batch > 0 ) {
+		if( stConfigServer.db_batch > BATCH_MAX )
+			stConfigServer.db_batch = BATCH_MAX;
+
+		batch.packed = (char *)malloc(stConfigServer.db_batch * RECORD_PACKED_MAX);
+		if( !batch.packed )
+			logging("database thread[%ld]: malloc() error, records will be inserted by one\n", syscall(SYS_gettid));
 	}
 
-	// calculate buffer size for messages
-	buf_size = queue_attr.mq_msgsize + 1;
+	// create messages queue, if ring buffer not used (db_queue = mq)
+	if( !db_ring ) {
+		memset(&queue_attr, 0, sizeof(struct mq_attr));
+
+		/* test system limit of the length of messages queue RLIMIT_MSGQUEUE
+		   by default 819200 bytes
+		   setup RLIMIT_MSGQUEUE size in /etc/security/limits.conf as:
+			hard	msgqueue	1342177280
+		   and reboot;
+		   see limits as:
+		   ulimit -a
+		   "POSIX message queues"
+		*/
+
+		/* Max. message size (bytes) */
+		queue_attr.mq_msgsize = RECORD_PACKED_MAX;	// packed records (record.h)
+
+		// get RLIMIT_MSGQUEUE and calculate actual size of queue
+		if( getrlimit(RLIMIT_MSGQUEUE, &rlim) == 0 ) {
+			if( rlim.rlim_cur != rlim.rlim_max ) {	// increase RLIMIT_MSGQUEUE error
+				rlim.rlim_cur = rlim.rlim_max;
+				// calculate actual size of queue
+				if( setrlimit(RLIMIT_MSGQUEUE, &rlim) == 0 )
+					queue_attr.mq_maxmsg = (long)(rlim.rlim_max / queue_attr.mq_msgsize / 10);
+				else
+					queue_attr.mq_maxmsg = (long)(rlim.rlim_cur / queue_attr.mq_msgsize / 10);
+			} else
+				queue_attr.mq_maxmsg = (long)(rlim.rlim_cur / queue_attr.mq_msgsize / 10);
+		} else {
+			logging("database thread[%ld]: getrlimit() error %d: %s\n", syscall(SYS_gettid), errno, strerror(errno));
+			queue_attr.mq_maxmsg = (long)(819200 / queue_attr.mq_msgsize / 10);     /* Max. # of messages on queue */
+		}
 
-	queue_workers = mq_open(QUEUE_WORKER, O_RDONLY | O_CREAT, S_IRUSR | S_IWUSR, &queue_attr);
-	if( queue_workers < 0 ) {
-		logging("database thread[%ld]: mq_open() error %d: %s\n", syscall(SYS_gettid), errno, strerror(errno));
-		logging("Try this:\n");
-		logging("Setup 'POSIX message queues' size in /etc/security/limits.conf as:\n");
-		logging("*\thard\tmsgqueue\t%ld", (long)(65536 * queue_attr.mq_msgsize * 10));
-		logging("See 'POSIX message queues' size as: ulimit -a");
-		exit_db(arg);
-		return NULL;
-	}
+		// calculate buffer size for messages
+		buf_size = queue_attr.mq_msgsize + 1;
+
+		queue_workers = mq_open(QUEUE_WORKER, O_RDONLY | O_CREAT, S_IRUSR | S_IWUSR, &queue_attr);
+		if( queue_workers < 0 ) {
+			logging("database thread[%ld]: mq_open() error %d: %s\n", syscall(SYS_gettid), errno, strerror(errno));
+			logging("Try this:\n");
+			logging("Setup 'POSIX message queues' size in /etc/security/limits.conf as:\n");
+			logging("*\thard\tmsgqueue\t%ld", (long)(65536 * queue_attr.mq_msgsize * 10));
+			logging("See 'POSIX message queues' size as: ulimit -a");
+			exit_db(arg);
+			return NULL;
+		}
+
+		// queue may exist with messages of the previous size, receive by actual size
+		if( mq_getattr(queue_workers, &queue_attr) == 0 && queue_attr.mq_msgsize < SOCKET_BUF_SIZE )
+			buf_size = queue_attr.mq_msgsize + 1;
+	}	// if( !db_ring )
 
-	logging("database thread[%ld] started, queue size %ld msgs\n", syscall(SYS_gettid), (long)queue_attr.mq_maxmsg);
+	if( db_ring )
+		logging("database thread %u[%ld] started, ring buffer %lu bytes\n", shard->shard, syscall(SYS_gettid), (unsigned long)(db_ring->cells * RING_CELL_SIZE));
+	else
+		logging("database thread[%ld] started, queue size %ld msgs\n", syscall(SYS_gettid), (long)queue_attr.mq_maxmsg);
 
 	// try to connect to database
 	if( !db_connect(2, &db_connection, &gContext) ) {
-		logging("database thread[%ld]: Can't connect to database %s on host %s:%d.", syscall(SYS_gettid), stConfigServer.db_name, stConfigServer.db_host, stConfigServer.db_port);
+		logging("database thread[%ld]: Can't connect to database %s on host %s:%d.", syscall(SYS_gettid), db_sink->db_name, db_sink->db_host, db_sink->db_port);
 	} else {
-		logging("database thread[%ld]: Connected to database %s on host %s:%d.", syscall(SYS_gettid), stConfigServer.db_name, stConfigServer.db_host, stConfigServer.db_port);
+		logging("database thread[%ld]: Connected to database %s on host %s:%d.", syscall(SYS_gettid), db_sink->db_name, db_sink->db_host, db_sink->db_port);
 	}
 
     // wait messages
 	while( 1 ) {
 		pthread_testcancel();
 
-        if( db_connection ) {
-			msg_size = mq_receive(queue_workers, msg_buf, buf_size, NULL);
+		// messages of the spool first, not wait new messages while it replayed
+		replayed = (shard->shard == 0 && db_connection && spool_pending(db_spool)) ? write_spool_to_db(db_connection, gContext, sql_insert_point) : 0;
+		if( replayed < 0 ) {
+			// disconnect from database
+			db_connect(0, &db_connection, &gContext);
+			db_connection = NULL;
+		}
+
+		// wait new messages not longer than the batch may wait
+		wait = replayed ? 0 : batch_wait(1000);
+
+        if( db_connection && db_ring ) {
+			if( write_ring_to_db(db_connection, gContext, sql_insert_point, wait) < 0 ) {	// write messages to database
+				// disconnect from database
+				db_connect(0, &db_connection, &gContext);
+				db_connection = NULL;
+			}
+		}   // if( db_connection && db_ring )
+        else if( db_connection ) {
+			clock_gettime(CLOCK_REALTIME, &timeout);
+			timeout.tv_nsec += wait * 1000000L;
+			timeout.tv_sec += timeout.tv_nsec / 1000000000L;
+			timeout.tv_nsec %= 1000000000L;
+			msg_size = mq_timedreceive(queue_workers, msg_buf, buf_size, NULL, &timeout);
 			if( msg_size > 0 ){
-				if( write_data_to_db(db_connection, gContext, msg_buf, sql_insert_point) < 0 ){	// write message to database
+				if( write_message_to_db(db_connection, gContext, msg_buf, msg_size, sql_insert_point, db_spool) < 0 ){	// write message to database
             		// disconnect from database
             		db_connect(0, &db_connection, &gContext);
                     db_connection = NULL;
@@ -621,10 +1160,29 @@ void *db_thread(void *arg)
             }   // if( msg_size > 0 )
 		}   // if( db_connection )
         else {
+			// keep messages in spool while database is down
+			spool_ring(db_spool, db_ring);
+			spool_sync(db_spool, 1);
 			sleep(3);	// wait
 			if( db_connect(2, &db_connection, &gContext) )	// try again
-				logging("database thread[%ld]: Connect to database %s on host %s:%d.", syscall(SYS_gettid), stConfigServer.db_name, stConfigServer.db_host, stConfigServer.db_port);
+				logging("database thread[%ld]: Connect to database %s on host %s:%d.", syscall(SYS_gettid), db_sink->db_name, db_sink->db_host, db_sink->db_port);
 		}   // else if( db_connection )
+
+		// batch is waiting too long
+		if( db_connection && !batch_wait(1000) && batch_flush(db_connection, gContext, db_spool) < 0 ) {
+			// disconnect from database
+			db_connect(0, &db_connection, &gContext);
+			db_connection = NULL;
+		}
+
+		spool_sync(db_spool, 0);
+
+		// backpressure: workers not written into ring buffer, once per second
+		if( db_ring && overflow_check != time(NULL) ) {
+			overflow_check = time(NULL);
+			if( (overflows = ring_overflows(db_ring)) )
+				logging("database thread %u[%ld]: ring buffer full, %llu messages %s, used %zu bytes\n", shard->shard, syscall(SYS_gettid), overflows, db_spool ? "spooled" : "lost", ring_used(db_ring));
+		}
 	}	// while( 1 )
 
 	// clear error handler with run it (0 - not run, 1 - run)
@@ -663,6 +1221,9 @@ void *timer_function(void *ptr)
 		pthread_detach(pthread_self());
 	}	// exit_timerfunc
 
+	// timers use the first database library
+	db_sink = &stConfigServer.db_sink[0];
+
 	// install error handler:
 	pthread_cleanup_push(exit_timerfunc, ptr);
 
@@ -42,6 +42,9 @@
    http://www.redov.ru/kompyutery_i_internet/unix_vzaimodeistvie_processov/p3.php#metkadoc75
    http://rjaan.narod.ru/docs/using_sql-types_with_c-apps.html
    http://www.postgresonline.com/journal/archives/3-Converting-from-Unix-Timestamp-to-PostgreSQL-Timestamp-or-Date.html
+   https://www.postgresql.org/docs/current/sql-copy.html (Binary Format)
+   https://www.postgresql.org/docs/current/libpq-copy.html
+   https://www.postgresql.org/docs/current/libpq-pipeline-mode.html
 */
 
 #ifndef _GNU_SOURCE
@@ -61,54 +64,115 @@
 #include <fcntl.h>          /* mq_open, O_* constants */
 #include <semaphore.h>
 #include <sys/resource.h>	/* setrlimit */
+#include <endian.h>			/* htobe64 */
+#include <arpa/inet.h>		/* htonl */
+#include <math.h>			/* floor */
 #include <libpq-fe.h>
 #include "glonassd.h"
 #include "de.h"
+#include "record.h"
+#include "ring.h"
+#include "spool.h"
 #include "logger.h"
 
 // Definitions
 #define MAX_SQL_SIZE 4096
 #define INSERT_PARAMS_COUNT 34
+#define COPY_BATCH_MAX 10000		// max. db_batch
+#define COPY_HEADER "PGCOPY\n\377\r\n\0\0\0\0\0\0\0\0\0"	// signature, flags, header extension length
+#define COPY_HEADER_SIZE (19)
+// max. size of the row in COPY binary format: fields count, fields lengths, numbers, strings
+#define COPY_ROW_MAX (sizeof(int16_t) + INSERT_PARAMS_COUNT * sizeof(int32_t) + INSERT_PARAMS_COUNT * sizeof(int64_t) + SIZE_TRACKER_FIELD + SIZE_MESSAGE_FIELD)
+#define TZ_CACHE_SIZE 64			// hours with UTC offset of the database session
+#define INSERT_STATEMENT "glonassd_insert"	// name of the prepared pg.sql
+#define PIPELINE_MAX 10000			// max. db_pipeline
 
 // Locals
-// params for inserting sql
-static __thread char *paramValues[INSERT_PARAMS_COUNT]= {
-	(char*)1,
-	(char*)1,
-	(char*)1,
-	(char*)1,
-	(char*)1,   // 5
-	(char*)1,
-	(char*)1,
-	(char*)1,
-	(char*)1,
-	(char*)1,   // 10
-	(char*)1,
-	(char*)1,
-	(char*)1,
-	(char*)1,
-	(char*)1,   // 15
-	(char*)1,
-	(char*)1,
-	(char*)1,
-	(char*)1,
-	(char*)1,   // 20
-	(char*)1,
-	(char*)1,
-	(char*)1,
-	(char*)1,
-	(char*)1,   // 25
-	(char*)1,
-	(char*)1,
-	(char*)1,
-	(char*)1,
-	(char*)1,   // 30
-	(char*)1,
-	(char*)1,
-	(char*)1,
-	(char*)1    // 34
+// params for inserting sql, binary format: numbers in paramNumbers (network byte order), strings in record
+static __thread char *paramValues[INSERT_PARAMS_COUNT];
+static __thread int paramLengths[INSERT_PARAMS_COUNT];
+static __thread int paramFormats[INSERT_PARAMS_COUNT];
+static __thread int64_t paramNumbers[INSERT_PARAMS_COUNT];
+
+// types of the params of pg.sql (pg_type.oid)
+#define OID_INT8 (20)
+#define OID_INT4 (23)
+#define OID_FLOAT8 (701)
+#define OID_VARCHAR (1043)
+static const Oid paramTypes[INSERT_PARAMS_COUNT] = {
+	OID_INT8,		// $1 data
+	OID_INT4,		// time
+	OID_VARCHAR,	// $3 imei
+	OID_INT4,		// status
+	OID_FLOAT8,		// $5 lon
+	OID_VARCHAR,	// clon
+	OID_FLOAT8,		// $7 lat
+	OID_VARCHAR,	// clat
+	OID_INT4,		// $9 height
+	OID_FLOAT8,		// speed
+	OID_INT4,		// $11 curs
+	OID_INT4,		// satellites
+	OID_INT4,		// $13 valid
+	OID_INT4,		// recnum
+	OID_FLOAT8,		// $15 vbort
+	OID_FLOAT8,		// vbatt
+	OID_INT4,		// $17 temperature
+	OID_INT4,		// hdop
+	OID_INT4,		// $19 outputs
+	OID_INT4,		// inputs
+	OID_INT4,		// $21 ainputs[0]
+	OID_INT4,
+	OID_INT4,		// $23
+	OID_INT4,
+	OID_INT4,		// $25
+	OID_INT4,
+	OID_INT4,		// $27
+	OID_INT4,		// ainputs[7]
+	OID_INT4,		// $29 fuel[0]
+	OID_INT4,		// fuel[1]
+	OID_FLOAT8,		// $31 probeg
+	OID_INT4,		// zaj
+	OID_INT4,		// $33 alarm
+	OID_VARCHAR		// message
 };
 
+// batch of the records for COPY (db_batch > 0), see copy_add
+typedef struct {
+	char *buf;					// COPY data: header, rows, trailer
+	size_t size;				// size of the data in buf
+	char *packed;				// packed records of the batch (record.h), for row inserts or spool
+	size_t packed_size;
+	unsigned int count;			// number of the records in batch
+	unsigned long long first;	// time of the first record in batch, milliseconds
+} ST_COPY;
+static __thread ST_COPY copy;
+static __thread char copy_sql[MAX_SQL_SIZE];	// text of COPY command (pg_copy.sql)
+
+// inserts in flight (db_pipeline > 0), see pipeline_send
+typedef struct {
+	char *packed;			// packed records (record.h) in flight, slots of RECORD_PACKED_MAX bytes, for spool
+	unsigned int slots;		// number of the slots, db_pipeline
+	unsigned int head;		// slot of the oldest record in flight
+	unsigned int count;		// number of the records in flight
+} ST_PIPELINE;
+static __thread ST_PIPELINE pipeline;
+
+// pg.sql prepared for connection: 0 - not yet, 1 - prepared, -1 - error, use PQexecParams
+static __thread int prepared;
+
+// UTC offset of the database session by hours, see local_offset
+static __thread struct {
+	long long hour;		// UTC hour + 1, 0 - empty
+	int offset;			// seconds
+} tz_cache[TZ_CACHE_SIZE];
+
+// ring buffer of the database thread (db_rings[sink][shard]), NULL if db_queue = mq
+static __thread ST_RING *db_ring;
+// spool of the database library (db_spools[sink]), NULL if db_spool not set
+static __thread ST_SPOOL *db_spool;
+// database library & connection parameters of the thread (one of db_type)
+static __thread ST_DB_SINK *db_sink;
+
 /*
    Secondary functions
 */
@@ -178,11 +242,11 @@ static int db_connect(int connect, PGconn **connection)
 			memset(conninfo, 0, FILENAME_MAX);
 			snprintf(conninfo, FILENAME_MAX,
 						"host=%s port=%d dbname=%s user=%s password=%s connect_timeout=%d application_name=glonassd sslmode=disable",
-						stConfigServer.db_host,
-						stConfigServer.db_port,
-						stConfigServer.db_name,
-						stConfigServer.db_user,
-						stConfigServer.db_pass,
+						db_sink->db_host,
+						db_sink->db_port,
+						db_sink->db_name,
+						db_sink->db_user,
+						db_sink->db_pass,
 						5);	// connect_timeout
 
 			*connection = PQconnectdb(conninfo);
@@ -192,11 +256,14 @@ static int db_connect(int connect, PGconn **connection)
 			PQreset(*connection);
 		}
 
+		// prepared statements lost with connection
+		prepared = 0;
+
 		if( PQstatus(*connection) == CONNECTION_OK ) {
 
-			if( strlen(stConfigServer.db_schema) ) {
+			if( strlen(db_sink->db_schema) ) {
 
-				snprintf(conninfo, FILENAME_MAX, "set search_path to %s;", stConfigServer.db_schema);
+				snprintf(conninfo, FILENAME_MAX, "set search_path to %s;", db_sink->db_schema);
 
 				db_result = PQexec(*connection, conninfo);
 				resultStatus = PQresultStatus(db_result);
@@ -223,6 +290,116 @@ static int db_connect(int connect, PGconn **connection)
 }
 //------------------------------------------------------------------------------
 
+// rounding as in text params of the pg.sql before
+static inline double round_to(double v, double scale)
+{
+	return floor(v * scale + 0.5) / scale;
+}
+//------------------------------------------------------------------------------
+
+// params of the pg.sql in binary format
+static inline void param_int4(int i, int32_t v)
+{
+	uint32_t n = htonl((uint32_t)v);
+	memcpy(&paramNumbers[i], &n, sizeof(n));
+	paramValues[i] = (char *)&paramNumbers[i];
+	paramLengths[i] = sizeof(n);
+}
+
+static inline void param_int8(int i, int64_t v)
+{
+	paramNumbers[i] = (int64_t)htobe64((uint64_t)v);
+	paramValues[i] = (char *)&paramNumbers[i];
+	paramLengths[i] = sizeof(int64_t);
+}
+
+static inline void param_float8(int i, double v)
+{
+	uint64_t n;
+	memcpy(&n, &v, sizeof(n));
+	param_int8(i, (int64_t)n);
+}
+
+static inline void param_text(int i, char *v, size_t max)
+{
+	paramValues[i] = v;
+	paramLengths[i] = strnlen(v, max - 1);
+}
+
+static inline void param_char(int i, char v)
+{
+	paramNumbers[i] = 0;
+	*(char *)&paramNumbers[i] = v;
+	paramValues[i] = (char *)&paramNumbers[i];
+	paramLengths[i] = v ? 1 : 0;
+}
+//------------------------------------------------------------------------------
+
+/*
+   record_params:
+   fill params of the pg.sql by record, strings not copied,
+   so record must not be changed until params sent
+*/
+static void record_params(ST_RECORD *record)
+{
+	int i;
+
+	param_int8(0, record->data);					// $1
+	param_int4(1, record->time);
+	param_text(2, record->imei, SIZE_TRACKER_FIELD);	// $3
+	param_int4(3, record->status);
+	param_float8(4, round_to(record->lon, 1e7));	// $5
+	param_char(5, record->clon);
+	param_float8(6, round_to(record->lat, 1e7));	// $7
+	param_char(7, record->clat);
+	param_int4(8, record->height);					// $9
+	param_float8(9, round_to(record->speed, 10));
+	param_int4(10, record->curs);					// $11
+	param_int4(11, record->satellites);
+	param_int4(12, record->valid);					// $13
+	param_int4(13, record->recnum);
+	param_float8(14, round_to(record->vbort, 10));	// $15
+	param_float8(15, round_to(record->vbatt, 10));
+	param_int4(16, record->temperature);			// $17
+	param_int4(17, record->hdop);
+	param_int4(18, record->outputs);				// $19
+	param_int4(19, record->inputs);
+	for(i = 0; i < 8; i++)
+		param_int4(20 + i, record->ainputs[i]);		// $21 - $28
+	param_int4(28, record->fuel[0]);				// $29
+	param_int4(29, record->fuel[1]);
+	param_float8(30, round_to(record->probeg, 1e3));	// $31
+	param_int4(31, record->zaj);
+	param_int4(32, record->alarm);					// $33
+	param_text(33, record->message, SIZE_MESSAGE_FIELD);
+}
+//------------------------------------------------------------------------------
+
+/*
+   prepare_insert:
+   prepare pg.sql once for connection, so it not parsed & planned for each record
+   return 1 if prepared or 0 if not (PQexecParams used)
+*/
+static int prepare_insert(PGconn *connection, char *sql_insert_point)
+{
+	PGresult *res;
+
+	if( !prepared ) {
+		res = PQprepare(connection, INSERT_STATEMENT, sql_insert_point, INSERT_PARAMS_COUNT, paramTypes);
+		if( PQresultStatus(res) == PGRES_COMMAND_OK ) {
+			prepared = 1;
+		}
+		else {
+			prepared = -1;
+			logging("database thread[%ld]: PQprepare() error: %s\n", syscall(SYS_gettid), PQerrorMessage(connection));
+		}
+		PQclear(res);
+	}
+
+	return prepared > 0;
+}
+//------------------------------------------------------------------------------
+
 /*
    write_data_to_db:
    record encoded gps/glonass terminal message to database
@@ -234,54 +411,28 @@ static int write_data_to_db(PGconn *connection, char *msg, char *sql_insert_poin
 {
 	PGresult *res;
 	ExecStatusType pqstatus;
-	ST_RECORD *record;
 
 	if( !connection || !msg || !sql_insert_point )
 		return 0;
 
-	record = (ST_RECORD *)msg;
-	snprintf(paramValues[0], SIZE_TRACKER_FIELD, "%lld", (long long)record->data); // $1
-	snprintf(paramValues[1], SIZE_TRACKER_FIELD, "%d", record->time);
-	snprintf(paramValues[2], SIZE_TRACKER_FIELD, "%s", record->imei);			   // $3
-	snprintf(paramValues[3], SIZE_TRACKER_FIELD, "%d", record->status);
-	snprintf(paramValues[4], SIZE_TRACKER_FIELD, "%03.07lf", record->lon);         // $5
-	snprintf(paramValues[5], SIZE_TRACKER_FIELD, "%c", record->clon);
-	snprintf(paramValues[6], SIZE_TRACKER_FIELD, "%03.07lf", record->lat);         // $7
-	snprintf(paramValues[7], SIZE_TRACKER_FIELD, "%c", record->clat);
-	snprintf(paramValues[8], SIZE_TRACKER_FIELD, "%d", record->height);            // $9
-	snprintf(paramValues[9], SIZE_TRACKER_FIELD, "%03.01lf", record->speed);
-	snprintf(paramValues[10], SIZE_TRACKER_FIELD, "%d", record->curs);             // $11
-	snprintf(paramValues[11], SIZE_TRACKER_FIELD, "%d", record->satellites);
-	snprintf(paramValues[12], SIZE_TRACKER_FIELD, "%d", record->valid);            // $13
-	snprintf(paramValues[13], SIZE_TRACKER_FIELD, "%d", record->recnum);
-	snprintf(paramValues[14], SIZE_TRACKER_FIELD, "%02.01lf", record->vbort);      // $15
-	snprintf(paramValues[15], SIZE_TRACKER_FIELD, "%02.01lf", record->vbatt);
-	snprintf(paramValues[16], SIZE_TRACKER_FIELD, "%d", record->temperature);      // $17
-	snprintf(paramValues[17], SIZE_TRACKER_FIELD, "%d", record->hdop);
-	snprintf(paramValues[18], SIZE_TRACKER_FIELD, "%d", record->outputs);          // $19
-	snprintf(paramValues[19], SIZE_TRACKER_FIELD, "%d", record->inputs);
-	snprintf(paramValues[20], SIZE_TRACKER_FIELD, "%d", record->ainputs[0]);       // $21
-	snprintf(paramValues[21], SIZE_TRACKER_FIELD, "%d", record->ainputs[1]);
-	snprintf(paramValues[22], SIZE_TRACKER_FIELD, "%d", record->ainputs[2]);       // $23
-	snprintf(paramValues[23], SIZE_TRACKER_FIELD, "%d", record->ainputs[3]);
-	snprintf(paramValues[24], SIZE_TRACKER_FIELD, "%d", record->ainputs[4]);       // $25
-	snprintf(paramValues[25], SIZE_TRACKER_FIELD, "%d", record->ainputs[5]);
-	snprintf(paramValues[26], SIZE_TRACKER_FIELD, "%d", record->ainputs[6]);       // $27
-	snprintf(paramValues[27], SIZE_TRACKER_FIELD, "%d", record->ainputs[7]);
-	snprintf(paramValues[28], SIZE_TRACKER_FIELD, "%d", record->fuel[0]);          // $29
-	snprintf(paramValues[29], SIZE_TRACKER_FIELD, "%d", record->fuel[1]);
-	snprintf(paramValues[30], SIZE_TRACKER_FIELD, "%04.03lf", record->probeg);     // $31
-	snprintf(paramValues[31], SIZE_TRACKER_FIELD, "%d", record->zaj);
-	snprintf(paramValues[32], SIZE_TRACKER_FIELD, "%d", record->alarm);            // $33
-	snprintf(paramValues[33], SIZE_MESSAGE_FIELD, "%s", record->message);		   // $34
-
-	res = PQexecParams(connection,          // PGconn *conn,
+	record_params((ST_RECORD *)msg);
+
+	if( prepare_insert(connection, sql_insert_point) )
+		res = PQexecPrepared(connection,	// PGconn *conn,
+						INSERT_STATEMENT,		// const char *stmtName,
+						INSERT_PARAMS_COUNT,	// int nParams,
+						(const char* const*)paramValues,
+						paramLengths,          // const int *paramLengths,
+						paramFormats,          // const int *paramFormats,
+						1);                    // int resultFormat: 1-ask for binary results
+	else
+		res = PQexecParams(connection,          // PGconn *conn,
                         sql_insert_point,      // const char *command,
                         INSERT_PARAMS_COUNT,   // int nParams,
-                        NULL,                  // const Oid *paramTypes
+                        paramTypes,            // const Oid *paramTypes
                         (const char* const*)paramValues,
-                        NULL,                  // const int *paramLengths,
-                        NULL,                  // const int *paramFormats,
+                        paramLengths,          // const int *paramLengths,
+                        paramFormats,          // const int *paramFormats,
                         1);                    // int resultFormat: 1-ask for binary results
 
 	pqstatus = PQresultStatus(res);
@@ -296,6 +447,569 @@ static int write_data_to_db(PGconn *connection, char *msg, char *sql_insert_poin
 }
 //------------------------------------------------------------------------------
 
+// milliseconds of the monotonic clock
+static unsigned long long msec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+//------------------------------------------------------------------------------
+
+/*
+   spool_packed:
+   write packed records (record.h) to spool by messages not more than SPOOL_MSG_MAX bytes
+   spool - spool or NULL, if records must not be kept
+*/
+static void spool_packed(ST_SPOOL *spool, char *packed, size_t size)
+{
+	size_t pos = 0, len = 0, record_size;
+
+	if( !spool )
+		return;
+
+	while( pos + len < size ) {
+		record_size = ((ST_RECORD_PACKED *)&packed[pos + len])->size;
+		if( len && len + record_size > SPOOL_MSG_MAX ) {
+			spool_write(spool, &packed[pos], len);
+			pos += len;
+			len = 0;
+		}
+		len += record_size;
+	}
+
+	if( len )
+		spool_write(spool, &packed[pos], len);
+}
+//------------------------------------------------------------------------------
+
+/*
+   local_offset:
+   ddata is "timestamp without time zone" = to_timestamp(utc) in time zone of the database session,
+   so get UTC offset of the session for hour of the utc from database & cache it
+   return offset in seconds
+*/
+static int local_offset(PGconn *connection, time_t utc)
+{
+	static const char *sql = "SELECT extract(epoch FROM to_timestamp($1::bigint)::timestamp)::bigint - $1::bigint";
+	long long hour = (long long)utc / 3600 + 1;
+	int idx = (int)(hour % TZ_CACHE_SIZE);
+	char value[SIZE_TRACKER_FIELD];
+	const char *values[1] = { value };
+	PGresult *res;
+
+	if( tz_cache[idx].hour == hour )
+		return tz_cache[idx].offset;
+
+	snprintf(value, SIZE_TRACKER_FIELD, "%lld", (long long)utc);
+	res = PQexecParams(connection, sql, 1, NULL, values, NULL, NULL, 0);
+	if( PQresultStatus(res) == PGRES_TUPLES_OK && PQntuples(res) == 1 ) {
+		tz_cache[idx].hour = hour;
+		tz_cache[idx].offset = atoi(PQgetvalue(res, 0, 0));
+	}
+	else {
+		logging("database thread[%ld]: local_offset() error: %s\n", syscall(SYS_gettid), PQerrorMessage(connection));
+	}
+	PQclear(res);
+
+	return tz_cache[idx].hour == hour ? tz_cache[idx].offset : 0;
+}
+//------------------------------------------------------------------------------
+
+// fields of the row in COPY binary format, network byte order
+static inline char *copy_int4(char *p, int32_t v)
+{
+	uint32_t len = htonl(sizeof(int32_t)), n = htonl((uint32_t)v);
+	memcpy(p, &len, sizeof(len));
+	memcpy(p + sizeof(len), &n, sizeof(n));
+	return p + sizeof(len) + sizeof(n);
+}
+
+static inline char *copy_int8(char *p, int64_t v)
+{
+	uint32_t len = htonl(sizeof(int64_t));
+	uint64_t n = htobe64((uint64_t)v);
+	memcpy(p, &len, sizeof(len));
+	memcpy(p + sizeof(len), &n, sizeof(n));
+	return p + sizeof(len) + sizeof(n);
+}
+
+static inline char *copy_float4(char *p, float v)
+{
+	uint32_t n;
+	memcpy(&n, &v, sizeof(n));
+	return copy_int4(p, (int32_t)n);
+}
+
+static inline char *copy_float8(char *p, double v)
+{
+	uint64_t n;
+	memcpy(&n, &v, sizeof(n));
+	return copy_int8(p, (int64_t)n);
+}
+
+static inline char *copy_text(char *p, const char *v, size_t max)
+{
+	uint32_t len = strnlen(v, max - 1), n = htonl(len);
+	memcpy(p, &n, sizeof(n));
+	memcpy(p + sizeof(n), v, len);
+	return p + sizeof(n) + len;
+}
+//------------------------------------------------------------------------------
+
+/*
+   copy_row:
+   record to row of the COPY binary format, columns as in pg.sql & pg_copy.sql
+   row - buffer not less than COPY_ROW_MAX bytes
+   return size of the row
+*/
+static size_t copy_row(PGconn *connection, ST_RECORD *record, char *row)
+{
+	// 946684800 - 2000-01-01 00:00:00 UTC, PostgreSQL epoch
+	int64_t ddata = ((int64_t)record->data + local_offset(connection, (time_t)record->data) - 946684800LL) * 1000000LL;
+	uint16_t fields = htons(INSERT_PARAMS_COUNT);
+	char c[2] = {0, 0}, *p = row;
+	int i;
+
+	memcpy(p, &fields, sizeof(fields));
+	p += sizeof(fields);
+
+	p = copy_int8(p, ddata);						// ddata
+	p = copy_int4(p, record->time);					// ntime
+	p = copy_text(p, record->imei, SIZE_TRACKER_FIELD);	// cimei
+	p = copy_int4(p, record->status);				// nstatus
+	p = copy_float8(p, round_to(record->lon, 1e7));	// nlongitude
+	c[0] = record->clon;
+	p = copy_text(p, c, sizeof(c));					// cew
+	p = copy_float8(p, round_to(record->lat, 1e7));	// nlatitude
+	c[0] = record->clat;
+	p = copy_text(p, c, sizeof(c));					// cns
+	p = copy_float4(p, record->height);				// naltitude
+	p = copy_float4(p, round_to(record->speed, 10));	// nspeed
+	p = copy_int4(p, record->curs);					// nheading
+	p = copy_int4(p, record->satellites);			// nsat
+	p = copy_int4(p, record->valid);				// nvalid
+	p = copy_int4(p, record->recnum);				// nnum
+	p = copy_float4(p, round_to(record->vbort, 10));	// nvbort
+	p = copy_float4(p, round_to(record->vbatt, 10));	// nvbat
+	p = copy_float4(p, record->temperature);		// ntmp
+	p = copy_float4(p, record->hdop);				// nhdop
+	p = copy_int4(p, record->outputs);				// nout
+	p = copy_int4(p, record->inputs);				// ninp
+	for(i = 0; i < 8; i++)
+		p = copy_float4(p, record->ainputs[i]);		// nin0 - nin7
+	p = copy_float4(p, record->fuel[0]);			// nfuel1
+	p = copy_float4(p, record->fuel[1]);			// nfuel2
+	p = copy_float4(p, round_to(record->probeg, 1e3));	// nprobeg
+	p = copy_int4(p, record->zaj);					// nzaj
+	p = copy_int4(p, record->alarm);				// nalarm
+	p = copy_text(p, record->message, SIZE_MESSAGE_FIELD);	// cmessage
+
+	return p - row;
+}
+//------------------------------------------------------------------------------
+
+// start new batch
+static void copy_reset(void)
+{
+	copy.size = COPY_HEADER_SIZE;
+	copy.packed_size = 0;
+	copy.count = 0;
+}
+//------------------------------------------------------------------------------
+
+/*
+   copy_flush:
+   write batch of the records to database by COPY ... FROM STDIN (FORMAT binary),
+   if COPY failed, write records by one (write_data_to_db), so only bad records lost,
+   if database connection lost, records of the batch written to spool
+   spool - spool (db_spool) or NULL, if records must not be kept
+   return 1 if success or -1 if database connection lost
+*/
+static int copy_flush(PGconn *connection, char *sql_insert_point, ST_SPOOL *spool)
+{
+	ST_RECORD record;
+	PGresult *res;
+	ExecStatusType pqstatus = PGRES_FATAL_ERROR;
+	const char *datetimes;
+	size_t pos = 0, packed_size;
+	int retval = 1;
+
+	if( !copy.count )
+		return 1;
+
+	// trailer
+	copy.buf[copy.size++] = 0xFF;
+	copy.buf[copy.size++] = 0xFF;
+
+	// timestamp sent as int64, since PostgreSQL 10 always
+	datetimes = PQparameterStatus(connection, "integer_datetimes");
+	if( datetimes && strcmp(datetimes, "on") == 0 ) {
+		res = PQexec(connection, copy_sql);
+		pqstatus = PQresultStatus(res);
+		PQclear(res);
+
+		if( pqstatus == PGRES_COPY_IN ) {
+			if( PQputCopyData(connection, copy.buf, copy.size) == 1 )
+				PQputCopyEnd(connection, NULL);
+			else
+				PQputCopyEnd(connection, "PQputCopyData error");
+
+			// result of the COPY, then NULL
+			pqstatus = PGRES_FATAL_ERROR;
+			if( (res = PQgetResult(connection)) ) {
+				pqstatus = PQresultStatus(res);
+				PQclear(res);
+				while( (res = PQgetResult(connection)) )
+					PQclear(res);
+			}
+		}	// if( pqstatus == PGRES_COPY_IN )
+	}	// if( datetimes && strcmp(datetimes, "on") == 0 )
+
+	if( pqstatus != PGRES_COMMAND_OK ) {
+		if( PQstatus(connection) == CONNECTION_OK ) {
+			logging("database thread[%ld]: COPY of %u records error: %s\n", syscall(SYS_gettid), copy.count, PQerrorMessage(connection));
+
+			// write records by one
+			while( pos < copy.packed_size && (packed_size = record_unpack(&copy.packed[pos], copy.packed_size - pos, &record)) > 0 ) {
+				if( !write_data_to_db(connection, (char *)&record, sql_insert_point) && PQstatus(connection) != CONNECTION_OK )
+					break;
+				pos += packed_size;
+			}
+		}
+
+		if( PQstatus(connection) != CONNECTION_OK ) {
+			spool_packed(spool, &copy.packed[pos], copy.packed_size - pos);
+			retval = -1;
+		}
+	}	// if( pqstatus != PGRES_COMMAND_OK )
+
+	copy_reset();
+	return retval;
+}
+//------------------------------------------------------------------------------
+
+/*
+   copy_add:
+   add record to batch, write batch if it is full
+   packed - the same record in packed form (record.h)
+   return 1 if success or -1 if database connection lost
+*/
+static int copy_add(PGconn *connection, ST_RECORD *record, char *packed, size_t packed_size, char *sql_insert_point, ST_SPOOL *spool)
+{
+	if( !copy.count )
+		copy.first = msec();
+
+	copy.size += copy_row(connection, record, &copy.buf[copy.size]);
+	memcpy(&copy.packed[copy.packed_size], packed, packed_size);
+	copy.packed_size += packed_size;
+
+	if( ++copy.count >= (unsigned int)stConfigServer.db_batch )
+		return copy_flush(connection, sql_insert_point, spool);
+
+	return 1;
+}
+//------------------------------------------------------------------------------
+
+/*
+   copy_wait:
+   return milliseconds until batch must be written or max_wait, if batch is empty
+*/
+static int copy_wait(int max_wait)
+{
+	unsigned long long passed;
+
+	if( !copy.count )
+		return max_wait;
+
+	passed = msec() - copy.first;
+	if( passed >= (unsigned long long)stConfigServer.db_batch_wait )
+		return 0;
+
+	passed = stConfigServer.db_batch_wait - passed;
+	return passed < (unsigned long long)max_wait ? (int)passed : max_wait;
+}
+//------------------------------------------------------------------------------
+
+// records in flight to spool (db_spool), results of the inserts not known
+static void pipeline_spool(ST_SPOOL *spool)
+{
+	while( pipeline.count ) {
+		spool_packed(spool, &pipeline.packed[pipeline.head * RECORD_PACKED_MAX], ((ST_RECORD_PACKED *)&pipeline.packed[pipeline.head * RECORD_PACKED_MAX])->size);
+		pipeline.head = (pipeline.head + 1) % pipeline.slots;
+		pipeline.count--;
+	}
+	pipeline.head = 0;
+}
+//------------------------------------------------------------------------------
+
+/*
+   pipeline_results:
+   read results of the inserts in flight,
+   wait results while more than max records in flight
+   spool - spool (db_spool) or NULL, if records in flight must not be kept
+   return 1 if success or -1 if database connection lost (records in flight spooled)
+*/
+static int pipeline_results(PGconn *connection, unsigned int max, ST_SPOOL *spool)
+{
+	PGresult *res;
+	ExecStatusType pqstatus;
+	int nulls = 0;
+
+	while( pipeline.count ) {
+
+		if( pipeline.count <= max ) {	// not wait
+			if( !PQconsumeInput(connection) )
+				break;	// connection lost
+			if( PQisBusy(connection) )
+				return 1;
+		}
+
+		// results of the record: result of the insert, NULL, PGRES_PIPELINE_SYNC
+		res = PQgetResult(connection);
+		if( !res ) {
+			if( ++nulls > 1 || PQstatus(connection) != CONNECTION_OK )
+				break;
+			continue;
+		}
+		nulls = 0;
+
+		pqstatus = PQresultStatus(res);
+		switch( pqstatus ) {
+		case PGRES_PIPELINE_SYNC:	// record done
+			pipeline.head = (pipeline.head + 1) % pipeline.slots;
+			pipeline.count--;
+			break;
+		case PGRES_COMMAND_OK:
+		case PGRES_TUPLES_OK:
+			break;
+		default:
+			logging("database thread[%ld]: pipeline insert error: %s\n", syscall(SYS_gettid), PQresultErrorMessage(res));
+		}
+		PQclear(res);
+
+		if( PQstatus(connection) != CONNECTION_OK )
+			break;
+	}	// while( pipeline.count )
+
+	if( !pipeline.count )
+		return 1;
+
+	// connection lost, keep records in flight
+	pipeline_spool(spool);
+	return -1;
+}
+//------------------------------------------------------------------------------
+
+/*
+   pipeline_flush:
+   wait results of all inserts in flight & leave pipeline mode
+   return 1 if success or -1 if database connection lost
+*/
+static int pipeline_flush(PGconn *connection, ST_SPOOL *spool)
+{
+	int retval = 1;
+
+	if( !pipeline.packed )
+		return 1;
+
+	if( pipeline.count )
+		retval = pipeline_results(connection, 0, spool);
+
+	if( PQpipelineStatus(connection) != PQ_PIPELINE_OFF )
+		PQexitPipelineMode(connection);
+
+	return retval;
+}
+//------------------------------------------------------------------------------
+
+/*
+   pipeline_send:
+   send insert of the record (prepared pg.sql) without waiting of the result,
+   each insert followed by sync, so error of the one record not abort others
+   packed - the same record in packed form (record.h), kept until result received
+   return 1 if record taken or -1 if database connection lost & record not taken
+*/
+static int pipeline_send(PGconn *connection, ST_RECORD *record, char *packed, size_t packed_size, char *sql_insert_point, ST_SPOOL *spool)
+{
+	unsigned int slot;
+	int sent;
+
+	// free slot
+	if( pipeline.count >= pipeline.slots && pipeline_results(connection, pipeline.slots - 1, spool) < 0 )
+		return -1;
+
+	// prepare outside of the pipeline
+	if( !prepared && pipeline_flush(connection, spool) < 0 )
+		return -1;
+	prepare_insert(connection, sql_insert_point);
+
+	if( PQpipelineStatus(connection) == PQ_PIPELINE_OFF && !PQenterPipelineMode(connection) ) {
+		logging("database thread[%ld]: PQenterPipelineMode() error: %s\n", syscall(SYS_gettid), PQerrorMessage(connection));
+		if( !write_data_to_db(connection, (char *)record, sql_insert_point) && PQstatus(connection) != CONNECTION_OK )
+			return -1;
+		return 1;
+	}
+
+	slot = (pipeline.head + pipeline.count) % pipeline.slots;
+	memcpy(&pipeline.packed[slot * RECORD_PACKED_MAX], packed, packed_size);
+	pipeline.count++;
+
+	record_params(record);
+	if( prepared > 0 )
+		sent = PQsendQueryPrepared(connection, INSERT_STATEMENT, INSERT_PARAMS_COUNT, (const char* const*)paramValues, paramLengths, paramFormats, 0);
+	else
+		sent = PQsendQueryParams(connection, sql_insert_point, INSERT_PARAMS_COUNT, paramTypes, (const char* const*)paramValues, paramLengths, paramFormats, 0);
+
+	if( !sent ) {	// record not in pipeline
+		pipeline.count--;
+		if( PQstatus(connection) != CONNECTION_OK ) {
+			pipeline_results(connection, pipeline.slots, spool);	// records in flight spooled
+			return -1;	// record spooled by caller
+		}
+
+		// write record without pipeline
+		logging("database thread[%ld]: PQsendQueryPrepared() error: %s\n", syscall(SYS_gettid), PQerrorMessage(connection));
+		if( pipeline_flush(connection, spool) < 0 )
+			return -1;
+		if( !write_data_to_db(connection, (char *)record, sql_insert_point) && PQstatus(connection) != CONNECTION_OK )
+			return -1;
+		return 1;
+	}	// if( !sent )
+
+	if( !PQpipelineSync(connection) && !PQpipelineSync(connection) ) {
+		/* insert without sync not committed & its result can not be read:
+		   wait results of the previous records, then spool this record
+		   & reset connection, so no record written twice by replay of the spool */
+		logging("database thread[%ld]: PQpipelineSync() error: %s\n", syscall(SYS_gettid), PQerrorMessage(connection));
+		if( pipeline_results(connection, 1, spool) > 0 ) {
+			pipeline_spool(spool);
+			db_connect(1, &connection);
+		}
+		return 1;
+	}
+
+	// read ready results, not wait
+	pipeline_results(connection, pipeline.slots, spool);
+	return 1;
+}
+//------------------------------------------------------------------------------
+
+/*
+   flush_to_db:
+   write batch (db_batch) & wait inserts in flight (db_pipeline)
+   return 1 if success or -1 if database connection lost
+*/
+static int flush_to_db(PGconn *connection, char *sql_insert_point, ST_SPOOL *spool)
+{
+	if( copy_flush(connection, sql_insert_point, spool) < 0 )
+		return -1;
+	return pipeline_flush(connection, spool);
+}
+//------------------------------------------------------------------------------
+
+/*
+   write_message_to_db:
+   unpack records of the queue message (record.h) and write it to database
+   (by COPY if db_batch > 0, by pipeline if db_pipeline > 0, else by one)
+   msg - packed records
+   msg_size - size of the msg
+   spool - spool (db_spool) for records, if database connection lost, or NULL
+   return 1 if success, 0 if error or -1 if database connection lost
+*/
+static int write_message_to_db(PGconn *connection, char *msg, ssize_t msg_size, char *sql_insert_point, ST_SPOOL *spool)
+{
+	ST_RECORD record;
+	ssize_t pos = 0;
+	size_t packed_size;
+	int retval = 1;
+
+	while( pos < msg_size && (packed_size = record_unpack(&msg[pos], msg_size - pos, &record)) > 0 ) {
+		if( PQstatus(connection) != CONNECTION_OK ) {
+			spool_packed(spool, &msg[pos], msg_size - pos);
+			return -1;
+		}
+
+		if( copy.buf ) {
+			if( copy_add(connection, &record, &msg[pos], packed_size, sql_insert_point, spool) < 0 )
+				retval = -1;	// record spooled with batch
+		}
+		else if( pipeline.packed ) {
+			if( pipeline_send(connection, &record, &msg[pos], packed_size, sql_insert_point, spool) < 0 ) {
+				retval = -1;
+				continue;	// spool this record too
+			}
+		}
+		else if( !write_data_to_db(connection, (char *)&record, sql_insert_point) ) {
+			retval = 0;
+			if( PQstatus(connection) != CONNECTION_OK )
+				continue;	// spool this record too
+		}
+
+		pos += packed_size;
+	}
+
+	return retval;
+}
+//------------------------------------------------------------------------------
+
+/*
+   write_ring_to_db:
+   write messages from ring buffer (db_queue = ring) to database,
+   read not more than RING_BATCH messages & release it at once
+   if database connection lost, the rest of messages goes to spool (db_spool)
+   wait - max. time of waiting messages, if ring buffer is empty, milliseconds
+   return number of the read messages
+*/
+static unsigned int write_ring_to_db(PGconn *connection, char *sql_insert_point, int wait)
+{
+	char *msg;
+	size_t msg_size;
+	unsigned int count = 0;
+
+	while( count < RING_BATCH && (msg = ring_read(db_ring, &msg_size)) ) {
+		write_message_to_db(connection, msg, msg_size, sql_insert_point, db_spool);
+		count++;
+	}
+	ring_release(db_ring);
+
+	if( !count && wait )
+		ring_wait(db_ring, wait);
+
+	return count;
+}
+//------------------------------------------------------------------------------
+
+/*
+   write_spool_to_db:
+   replay not more than RING_BATCH messages of the spool (db_spool) to database,
+   message removed from spool only if database connection not lost,
+   so batch (db_batch) written for each message
+   return number of the written messages
+*/
+static unsigned int write_spool_to_db(PGconn *connection, char *sql_insert_point)
+{
+	char *msg;
+	size_t msg_size;
+	unsigned int count = 0;
+
+	// new records of the batch may be spooled, not replayed
+	if( flush_to_db(connection, sql_insert_point, db_spool) < 0 )
+		return 0;
+
+	while( count < RING_BATCH && (msg = spool_read(db_spool, &msg_size)) ) {
+		if( write_message_to_db(connection, msg, msg_size, sql_insert_point, NULL) < 0
+				|| flush_to_db(connection, sql_insert_point, NULL) < 0 )
+			break;	// replay this message after reconnect
+		spool_commit(db_spool);
+		count++;
+	}
+
+	return count;
+}
+//------------------------------------------------------------------------------
+
 
 
 /*
@@ -306,13 +1020,14 @@ static int write_data_to_db(PGconn *connection, char *msg, char *sql_insert_poin
    db_thread
    works in separate thread
    started from func. database_setup in glonassd.c
-   arg - pointer to main configuration structure (stConfigServer)
+   arg - pointer to ST_DB_SHARD structure (glonassd.h): number, ring buffer, spool
+   & connection parameters of the thread, spool replayed by the thread 0 only
 */
 void *db_thread(void *arg)
 {
+	ST_DB_SHARD *shard = (ST_DB_SHARD *)arg;
 	static __thread PGconn *db_connection = NULL;
 	static __thread char sql_insert_point[MAX_SQL_SIZE];	// text of inserting sql
-	static __thread char values[INSERT_PARAMS_COUNT * SIZE_TRACKER_FIELD];	// buffer for parameters values for sql
 	static __thread char msg_buf[SOCKET_BUF_SIZE];
 	static __thread mqd_t queue_workers = -1;	// Posix IPC queue of messages from workers
 	static __thread struct mq_attr queue_attr;
@@ -320,10 +1035,22 @@ void *db_thread(void *arg)
 	static __thread ssize_t msg_size;
 	static __thread size_t buf_size;
 	static __thread int i;
+	static __thread unsigned int replayed;
+	static __thread struct timespec timeout;
+	static __thread int wait;
+	static __thread time_t overflow_check;
+	static __thread unsigned long long overflows;
 
 	// error handler:
 	void exit_db(void * arg) {
 
+		// save messages from ring buffer
+		if( db_ring ) {
+			while( PQstatus(db_connection) == CONNECTION_OK && write_ring_to_db(db_connection, sql_insert_point, 0) );
+			flush_to_db(db_connection, sql_insert_point, db_spool);
+			spool_ring(db_spool, db_ring);	// database lost
+		}
+
 		// destroy queue
 		if( queue_workers != -1 ) {
 			// save messages from queue
@@ -332,10 +1059,11 @@ void *db_thread(void *arg)
 
 				while( (msg_size = mq_receive(queue_workers, msg_buf, buf_size, NULL)) > 0 ) {
 					if( PQstatus(db_connection) == CONNECTION_OK )
-						write_data_to_db(db_connection, msg_buf, sql_insert_point);
+						write_message_to_db(db_connection, msg_buf, msg_size, sql_insert_point, db_spool);
 					else
 						break;
 				}   // while
+				flush_to_db(db_connection, sql_insert_point, db_spool);
 			}	// if( mq_getattr
 
 			mq_close(queue_workers);
@@ -352,82 +1080,139 @@ void *db_thread(void *arg)
 		// disconnect from database
 		db_connect(0, &db_connection);
 
+		// free batch
+		free(copy.buf);
+		free(copy.packed);
+		copy.buf = copy.packed = NULL;
+		free(pipeline.packed);
+		pipeline.packed = NULL;
+		pipeline.count = pipeline.head = 0;
+
 		logging("database thread[%ld] destroyed\n", syscall(SYS_gettid));
 	}   // exit_db
 
+	db_ring = shard->ring;
+	db_spool = shard->spool;
+	db_sink = shard->sink;
+
 	// install error handler:
 	pthread_cleanup_push(exit_db, arg);
 
 	// load insert sql from file, temporary using msg_buf
 	memset(msg_buf, 0, SOCKET_BUF_SIZE);
-	snprintf(msg_buf, SOCKET_BUF_SIZE, "%.4075s/%.15s.sql", stParams.start_path, stConfigServer.db_type);
+	snprintf(msg_buf, SOCKET_BUF_SIZE, "%.4075s/%.15s.sql", stParams.start_path, db_sink->db_type);
 	if( !load_file(msg_buf, sql_insert_point, MAX_SQL_SIZE) || !strlen(sql_insert_point) ) {
 		exit_db(arg);
 		return NULL;
 	}
 
-	// create messages queue
-	memset(&queue_attr, 0, sizeof(struct mq_attr));
-
-	/* test system limit of the length of messages queue RLIMIT_MSGQUEUE
-	   by default 819200 bytes
-	   setup RLIMIT_MSGQUEUE size in /etc/security/limits.conf as:
-       ---
-       root       soft    msgqueue        1342177280
-       root       hard    msgqueue        1342177280
-       *       soft    msgqueue        1342177280
-       *       hard    msgqueue        1342177280
-       ---
-	   and reboot;
-	   see limits as:
-	   ulimit -a
-	   "POSIX message queues"
-	*/
-
-	/* Max. message size (bytes) */
-	queue_attr.mq_msgsize = sizeof(ST_RECORD);
-
-	// get RLIMIT_MSGQUEUE and calculate actual size of queue
-	if( getrlimit(RLIMIT_MSGQUEUE, &rlim) == 0 ) {
-		if( rlim.rlim_cur != rlim.rlim_max ) {	// increase RLIMIT_MSGQUEUE error
-			rlim.rlim_cur = rlim.rlim_max;
-			// calculate actual size of queue
-			if( setrlimit(RLIMIT_MSGQUEUE, &rlim) == 0 )
-				queue_attr.mq_maxmsg = (long)(rlim.rlim_max / queue_attr.mq_msgsize / 10);
-			else
-				queue_attr.mq_maxmsg = (long)(rlim.rlim_cur / queue_attr.mq_msgsize / 10);
-		} else
-			queue_attr.mq_maxmsg = (long)(rlim.rlim_cur / queue_attr.mq_msgsize / 10);
-	} else {
-		logging("database thread[%ld]: getrlimit() error %d: %s\n", syscall(SYS_gettid), errno, strerror(errno));
-		queue_attr.mq_maxmsg = (long)(819200 / queue_attr.mq_msgsize / 10);     /* Max. # of messages on queue */
-	}
+	// batch of the records for COPY, if COPY command not loaded - insert records by one
+	if( stConfigServer.db_batch > 0 ) {
+		if( stConfigServer.db_batch > COPY_BATCH_MAX )
+			stConfigServer.db_batch = COPY_BATCH_MAX;
+
+		snprintf(msg_buf, SOCKET_BUF_SIZE, "%.4070s/%.15s_copy.sql", stParams.start_path, db_sink->db_type);
+		if( load_file(msg_buf, copy_sql, MAX_SQL_SIZE) && strlen(copy_sql) ) {
+			copy.buf = (char *)malloc(COPY_HEADER_SIZE + stConfigServer.db_batch * COPY_ROW_MAX + sizeof(int16_t));
+			copy.packed = (char *)malloc(stConfigServer.db_batch * RECORD_PACKED_MAX);
+			if( copy.buf && copy.packed ) {
+				memcpy(copy.buf, COPY_HEADER, COPY_HEADER_SIZE);
+				copy_reset();
+			}
+			else {
+				logging("database thread[%ld]: malloc() error, records will be inserted by one\n", syscall(SYS_gettid));
+				free(copy.buf);
+				free(copy.packed);
+				copy.buf = copy.packed = NULL;
+			}
+		}
+		else {
+			logging("database thread[%ld]: %s not loaded, records will be inserted by one\n", syscall(SYS_gettid), msg_buf);
+		}
+	}	// if( stConfigServer.db_batch > 0 )
 
-	// calculate buffer size for messages
-	buf_size = queue_attr.mq_msgsize + 1;
+	// inserts in flight, if not COPY
+	if( !copy.buf && stConfigServer.db_pipeline > 0 ) {
+		if( stConfigServer.db_pipeline > PIPELINE_MAX )
+			stConfigServer.db_pipeline = PIPELINE_MAX;
 
-	queue_workers = mq_open(QUEUE_WORKER, O_RDONLY | O_CREAT, S_IRUSR | S_IWUSR, &queue_attr);
-	if( queue_workers < 0 ) {
-		logging("database thread[%ld]: mq_open() error %d: %s\n", syscall(SYS_gettid), errno, strerror(errno));
-		logging("Try this:\n");
-		logging("Setup 'POSIX message queues' size in /etc/security/limits.conf as:\n");
-		logging("*\thard\tmsgqueue\t%ld", (long)(65536 * queue_attr.mq_msgsize * 10));
-		logging("See 'POSIX message queues' size as: ulimit -a");
-		exit_db(arg);
-		return NULL;
+		pipeline.slots = stConfigServer.db_pipeline;
+		pipeline.packed = (char *)malloc(pipeline.slots * RECORD_PACKED_MAX);
+		if( !pipeline.packed )
+			logging("database thread[%ld]: malloc() error, records will be inserted by one\n", syscall(SYS_gettid));
 	}
 
-	// initialise sql-parameters pointers
+	// create messages queue, if ring buffer not used (db_queue = mq)
+	if( !db_ring ) {
+		memset(&queue_attr, 0, sizeof(struct mq_attr));
+
+		/* test system limit of the length of messages queue RLIMIT_MSGQUEUE
+		   by default 819200 bytes
+		   setup RLIMIT_MSGQUEUE size in /etc/security/limits.conf as:
+	       ---
+	       root       soft    msgqueue        1342177280
+	       root       hard    msgqueue        1342177280
+	       *       soft    msgqueue        1342177280
+	       *       hard    msgqueue        1342177280
+	       ---
+		   and reboot;
+		   see limits as:
+		   ulimit -a
+		   "POSIX message queues"
+		*/
+
+		/* Max. message size (bytes) */
+		queue_attr.mq_msgsize = RECORD_PACKED_MAX;	// packed records (record.h)
+
+		// get RLIMIT_MSGQUEUE and calculate actual size of queue
+		if( getrlimit(RLIMIT_MSGQUEUE, &rlim) == 0 ) {
+			if( rlim.rlim_cur != rlim.rlim_max ) {	// increase RLIMIT_MSGQUEUE error
+				rlim.rlim_cur = rlim.rlim_max;
+				// calculate actual size of queue
+				if( setrlimit(RLIMIT_MSGQUEUE, &rlim) == 0 )
+					queue_attr.mq_maxmsg = (long)(rlim.rlim_max / queue_attr.mq_msgsize / 10);
+				else
+					queue_attr.mq_maxmsg = (long)(rlim.rlim_cur / queue_attr.mq_msgsize / 10);
+			} else
+				queue_attr.mq_maxmsg = (long)(rlim.rlim_cur / queue_attr.mq_msgsize / 10);
+		} else {
+			logging("database thread[%ld]: getrlimit() error %d: %s\n", syscall(SYS_gettid), errno, strerror(errno));
+			queue_attr.mq_maxmsg = (long)(819200 / queue_attr.mq_msgsize / 10);     /* Max. # of messages on queue */
+		}
+
+		// calculate buffer size for messages
+		buf_size = queue_attr.mq_msgsize + 1;
+
+		queue_workers = mq_open(QUEUE_WORKER, O_RDONLY | O_CREAT, S_IRUSR | S_IWUSR, &queue_attr);
+		if( queue_workers < 0 ) {
+			logging("database thread[%ld]: mq_open() error %d: %s\n", syscall(SYS_gettid), errno, strerror(errno));
+			logging("Try this:\n");
+			logging("Setup 'POSIX message queues' size in /etc/security/limits.conf as:\n");
+			logging("*\thard\tmsgqueue\t%ld", (long)(65536 * queue_attr.mq_msgsize * 10));
+			logging("See 'POSIX message queues' size as: ulimit -a");
+			exit_db(arg);
+			return NULL;
+		}
+
+		// queue may exist with messages of the previous size, receive by actual size
+		if( mq_getattr(queue_workers, &queue_attr) == 0 && queue_attr.mq_msgsize < SOCKET_BUF_SIZE )
+			buf_size = queue_attr.mq_msgsize + 1;
+	}	// if( !db_ring )
+
+	// initialise sql-parameters formats
 	for(i = 0; i < INSERT_PARAMS_COUNT; i++)
-		paramValues[i] = values + (i * SIZE_TRACKER_FIELD);
+		paramFormats[i] = 1;	// binary
 
-	logging("database thread[%ld] started, queue size %ld msgs\n", syscall(SYS_gettid), (long)queue_attr.mq_maxmsg);
+	if( db_ring )
+		logging("database thread %u[%ld] started, ring buffer %lu bytes\n", shard->shard, syscall(SYS_gettid), (unsigned long)(db_ring->cells * RING_CELL_SIZE));
+	else
+		logging("database thread[%ld] started, queue size %ld msgs\n", syscall(SYS_gettid), (long)queue_attr.mq_maxmsg);
 
 	// try to connect to database
 	if( !db_connect(2, &db_connection) ) {
-		logging("database thread[%ld]: Can't connect to database %s on host %s:%d.", syscall(SYS_gettid), stConfigServer.db_name, stConfigServer.db_host, stConfigServer.db_port);
+		logging("database thread[%ld]: Can't connect to database %s on host %s:%d.", syscall(SYS_gettid), db_sink->db_name, db_sink->db_host, db_sink->db_port);
 	} else {
-		logging("database thread[%ld]: Connected to database %s on host %s:%d.", syscall(SYS_gettid), stConfigServer.db_name, stConfigServer.db_host, stConfigServer.db_port);
+		logging("database thread[%ld]: Connected to database %s on host %s:%d.", syscall(SYS_gettid), db_sink->db_name, db_sink->db_host, db_sink->db_port);
 	}
 
 	// wait messages
@@ -435,13 +1220,49 @@ void *db_thread(void *arg)
 		pthread_testcancel();
 
 		if( PQstatus(db_connection) == CONNECTION_OK ) {
-			msg_size = mq_receive(queue_workers, msg_buf, buf_size, NULL);
-			if( msg_size > 0 )
-				write_data_to_db(db_connection, msg_buf, sql_insert_point);	// write message to database
+			// messages of the spool first, not wait new messages while it replayed
+			replayed = (shard->shard == 0 && spool_pending(db_spool)) ? write_spool_to_db(db_connection, sql_insert_point) : 0;
+
+			// wait new messages not longer than the batch may wait
+			wait = replayed ? 0 : copy_wait(1000);
+
+			if( db_ring ) {
+				write_ring_to_db(db_connection, sql_insert_point, wait);	// write messages to database
+			}
+			else {
+				clock_gettime(CLOCK_REALTIME, &timeout);
+				timeout.tv_nsec += wait * 1000000L;
+				timeout.tv_sec += timeout.tv_nsec / 1000000000L;
+				timeout.tv_nsec %= 1000000000L;
+				msg_size = mq_timedreceive(queue_workers, msg_buf, buf_size, NULL, &timeout);
+				if( msg_size > 0 )
+					write_message_to_db(db_connection, msg_buf, msg_size, sql_insert_point, db_spool);	// write message to database
+			}
+
+			// batch is waiting too long
+			if( !copy_wait(1000) )
+				copy_flush(db_connection, sql_insert_point, db_spool);
+
+			// results of the inserts in flight, not wait
+			if( pipeline.count )
+				pipeline_results(db_connection, pipeline.slots, db_spool);
+
+			spool_sync(db_spool, 0);
+
+			// backpressure: workers not written into ring buffer, once per second
+			if( db_ring && overflow_check != time(NULL) ) {
+				overflow_check = time(NULL);
+				if( (overflows = ring_overflows(db_ring)) )
+					logging("database thread %u[%ld]: ring buffer full, %llu messages %s, used %zu bytes\n", shard->shard, syscall(SYS_gettid), overflows, db_spool ? "spooled" : "lost", ring_used(db_ring));
+			}
 		} else {
+			// keep messages in spool while database is down
+			flush_to_db(db_connection, sql_insert_point, db_spool);
+			spool_ring(db_spool, db_ring);
+			spool_sync(db_spool, 1);
 			sleep(3);	// wait
 			if( db_connect(2, &db_connection) )	// try again
-				logging("database thread[%ld]: Connect to database %s on host %s:%d.", syscall(SYS_gettid), stConfigServer.db_name, stConfigServer.db_host, stConfigServer.db_port);
+				logging("database thread[%ld]: Connect to database %s on host %s:%d.", syscall(SYS_gettid), db_sink->db_name, db_sink->db_host, db_sink->db_port);
 		}
 
 	}	// while( 1 )
@@ -485,6 +1306,9 @@ void *timer_function(void *ptr)
 		pthread_detach(pthread_self());
 	}	// exit_timerfunc
 
+	// timers use the first database library
+	db_sink = &stConfigServer.db_sink[0];
+
 	// install error handler:
 	pthread_cleanup_push(exit_timerfunc, ptr);
 
@@ -0,0 +1,36 @@
+COPY gps.tgpsdata (
+	ddata,          -- columns order & types as in pg.sql, see copy_row in pg.c
+	ntime,
+	cimei,
+	nstatus,
+	nlongitude,
+	cew,
+	nlatitude,
+	cns,
+	naltitude,
+	nspeed,
+	nheading,
+	nsat,
+	nvalid,
+	nnum,
+	nvbort,
+	nvbat,
+	ntmp,
+	nhdop,
+	nout,
+	ninp,
+	nin0,
+	nin1,
+	nin2,
+	nin3,
+	nin4,
+	nin5,
+	nin6,
+	nin7,
+	nfuel1,
+	nfuel2,
+	nprobeg,
+	nzaj,
+	nalarm,
+	cmessage
+) FROM STDIN (FORMAT binary)
\ No newline at end of file
@@ -55,12 +55,32 @@
 //#include <json-c/json.h>
 #include "glonassd.h"
 #include "de.h"
+#include "record.h"
+#include "ring.h"
+#include "spool.h"
 #include "logger.h"
 
 // Definitions
 #define MAX_SQL_SIZE 4096
+#define JSON_RECORD_MAX 2048            // max. size of the JSON of the record, see json_record
+#define PIPELINE_SIZE (SPOOL_MSG_MAX)   // max. size of the packed records in flight
 
 // Locals
+// ring buffer of the database thread (db_rings[sink][shard]), NULL if db_queue = mq
+static __thread ST_RING *db_ring;
+// spool of the database library (db_spools[sink]), NULL if db_spool not set
+static __thread ST_SPOOL *db_spool;
+// database library & connection parameters of the thread (one of db_type)
+static __thread ST_DB_SINK *db_sink;
+
+// commands in flight: SET, SADD, XADD (db_stream) & GEOADD (db_geo) for each record, see pipeline_flush
+static __thread struct {
+    char packed[PIPELINE_SIZE];     // packed records (record.h) in flight, for spool
+    size_t size;                    // size of the packed records
+    unsigned int count;             // number of the records in flight
+    unsigned int replies;           // number of the commands in flight
+} pipeline;
+
 /*
    Secondary functions
 */
@@ -124,17 +144,17 @@ static int db_connect(int connect, redisContext **rds_context)
 
     if(connect) {	// connecting to database
 
-        logging("database thread[%ld]: try to connect to database %s on host %s:%d", syscall(SYS_gettid), stConfigServer.db_name, stConfigServer.db_host, stConfigServer.db_port);
+        logging("database thread[%ld]: try to connect to database %s on host %s:%d", syscall(SYS_gettid), db_sink->db_name, db_sink->db_host, db_sink->db_port);
 
         if( *rds_context == NULL )
-            *rds_context = redisConnectWithTimeout(stConfigServer.db_host, stConfigServer.db_port, timeout);
+            *rds_context = redisConnectWithTimeout(db_sink->db_host, db_sink->db_port, timeout);
 
         if( *rds_context == NULL )
             logging("database thread[%ld]: db_connect: REDIS error: can't allocate redis context\n", syscall(SYS_gettid));
         else if ( (*rds_context)->err )
             logging("database thread[%ld]: db_connect: REDIS error: %s\n", syscall(SYS_gettid), (*rds_context)->errstr);
         else
-            logging("database thread[%ld]: Connected to database %s on host %s:%d", syscall(SYS_gettid), stConfigServer.db_name, stConfigServer.db_host, stConfigServer.db_port);
+            logging("database thread[%ld]: Connected to database %s on host %s:%d", syscall(SYS_gettid), db_sink->db_name, db_sink->db_host, db_sink->db_port);
 
     }	// if(connect)
     else {	// disconnect from database
@@ -142,7 +162,7 @@ static int db_connect(int connect, redisContext **rds_context)
         if( *rds_context ) {
             redisFree(*rds_context);
             *rds_context = NULL;
-            logging("database thread[%ld]: disconnect from database %s", syscall(SYS_gettid), stConfigServer.db_name);
+            logging("database thread[%ld]: disconnect from database %s", syscall(SYS_gettid), db_sink->db_name);
         }
 
     }
@@ -152,103 +172,332 @@ static int db_connect(int connect, redisContext **rds_context)
 //------------------------------------------------------------------------------
 
 /*
-   write_data_to_db:
-   record encoded gps/glonass terminal message to database
-   connection - database connection
-   msg - pointer to ST_RECORD structure
-   return 1 if success or 0 if error
+   JSON of the record (lastpoint), without allocations & printf:
+   { "imei": "1234567890", "datetime": 1500000000, "lon": 55.5400000, "lat": 65.6500000, ... }
+*/
+
+// string with escaping
+static inline char *json_str(char *p, const char *s)
+{
+    static const char hex[] = "0123456789abcdef";
+
+    *p++ = '"';
+    for(; *s; s++) {
+        if( *s == '"' || *s == '\\' ) {
+            *p++ = '\\';
+            *p++ = *s;
+        }
+        else if( (unsigned char)*s < ' ' ) {
+            memcpy(p, "\\u00", 4);
+            p[4] = hex[(unsigned char)*s >> 4];
+            p[5] = hex[*s & 0x0F];
+            p += 6;
+        }
+        else {
+            *p++ = *s;
+        }
+    }
+    *p++ = '"';
+    return p;
+}
+//------------------------------------------------------------------------------
+
+// unsigned integer
+static inline char *json_uint(char *p, unsigned long long v)
+{
+    char digits[20];
+    int n = 0;
+
+    do {
+        digits[n++] = '0' + v % 10;
+        v /= 10;
+    } while( v );
+
+    while( n )
+        *p++ = digits[--n];
+    return p;
+}
+//------------------------------------------------------------------------------
+
+// integer
+static inline char *json_int(char *p, long long v)
+{
+    if( v < 0 ) {
+        *p++ = '-';
+        return json_uint(p, -(unsigned long long)v);
+    }
+    return json_uint(p, v);
+}
+//------------------------------------------------------------------------------
+
+/*
+   number with fixed decimals (as "%.*lf"), by integer arithmetic,
+   not finite number written as 0
 */
-static int write_data_to_db(char *msg, redisContext *rds_context)
+static inline char *json_fixed(char *p, double v, int decimals)
+{
+    static const unsigned long long scale[] = { 1, 10, 100, 1000, 10000, 100000, 1000000, 10000000 };
+    unsigned long long n, frac;
+    int i;
+
+    if( v != v || v > 1e11 || v < -1e11 )   // NaN, inf or too big for the fixed point
+        v = 0;
+
+    if( v < 0 ) {
+        v = -v;
+        n = (unsigned long long)(v * scale[decimals] + 0.5);
+        if( n )
+            *p++ = '-';
+    }
+    else {
+        n = (unsigned long long)(v * scale[decimals] + 0.5);
+    }
+
+    p = json_uint(p, n / scale[decimals]);
+    if( decimals ) {
+        *p++ = '.';
+        frac = n % scale[decimals];
+        for(i = decimals - 1; i >= 0; i--) {
+            p[i] = '0' + frac % 10;
+            frac /= 10;
+        }
+        p += decimals;
+    }
+    return p;
+}
+//------------------------------------------------------------------------------
+
+// "name": prefix of the field
+#define JSON_FIELD(p, name) (memcpy((p), ", \"" name "\": ", sizeof(name) + 5), (p) + sizeof(name) + 5)
+
+/*
+   json_record:
+   write JSON of the record into buf, size of the buf must be not less than JSON_RECORD_MAX
+   return size of the JSON
+*/
+static size_t json_record(ST_RECORD *record, char *buf)
+{
+    char *p = buf;
+
+    memcpy(p, "{ \"imei\": ", 10);
+    p = json_str(p + 10, record->imei);
+    p = json_int(JSON_FIELD(p, "datetime"), (long long)record->data + record->time);
+    p = json_fixed(JSON_FIELD(p, "lon"), record->lon, 7);
+    p = json_fixed(JSON_FIELD(p, "lat"), record->lat, 7);
+    p = json_fixed(JSON_FIELD(p, "speed"), record->speed, 1);
+    p = json_int(JSON_FIELD(p, "curs"), record->curs);
+    p = json_int(JSON_FIELD(p, "satellites"), record->satellites);
+    p = json_int(JSON_FIELD(p, "height"), record->height);
+    p = json_int(JSON_FIELD(p, "valid"), record->valid);
+    p = json_fixed(JSON_FIELD(p, "vbort"), record->vbort, 1);
+    p = json_fixed(JSON_FIELD(p, "vbatt"), record->vbatt, 1);
+    p = json_int(JSON_FIELD(p, "temperature"), record->temperature);
+    p = json_int(JSON_FIELD(p, "hdop"), record->hdop);
+    p = json_int(JSON_FIELD(p, "outputs"), record->outputs);
+    p = json_int(JSON_FIELD(p, "inputs"), record->inputs);
+    p = json_int(JSON_FIELD(p, "fuel0"), record->fuel[0]);
+    p = json_int(JSON_FIELD(p, "fuel1"), record->fuel[1]);
+    p = json_fixed(JSON_FIELD(p, "probeg"), record->probeg, 3);
+    p = json_int(JSON_FIELD(p, "zaj"), record->zaj);
+    p = json_int(JSON_FIELD(p, "alarm"), record->alarm);
+    p = json_int(JSON_FIELD(p, "port"), record->port);
+    p = json_int(JSON_FIELD(p, "recnum"), record->recnum);
+    p = json_int(JSON_FIELD(p, "status"), record->status);
+    *p++ = '}';
+
+    return p - buf;
+}
+//------------------------------------------------------------------------------
+
+/*
+   pipeline_flush:
+   read replies of the commands in flight, one pass for all
+   spool - spool (db_spool) or NULL, if records in flight must not be kept
+   return 1 if success, 0 if REDIS returned error or -1 if database connection lost
+   (records in flight spooled, commands may be repeated, XADD duplicates record in stream)
+*/
+static int pipeline_flush(redisContext *rds_context, ST_SPOOL *spool)
 {
     redisReply *rds_reply;
-    ST_RECORD *record;
-    char json[MAX_SQL_SIZE];
-    int result = 0;
+    unsigned int replies = pipeline.replies, errors = 0;
+    int retval = 1;
+
+    while( replies ) {
+        if( redisGetReply(rds_context, (void **)&rds_reply) != REDIS_OK || !rds_reply ) {
+            logging("database thread[%ld]: redisGetReply() error: %s\n", syscall(SYS_gettid), rds_context->errstr);
+            spool_write(spool, pipeline.packed, pipeline.size);
+            retval = -1;
+            break;
+        }
 
-    if( !rds_context )
-        return result;
+        if( rds_reply->type == REDIS_REPLY_ERROR && !errors++ )
+            logging("database thread[%ld]: REDIS error: %s\n", syscall(SYS_gettid), rds_reply->str);
+        freeReplyObject(rds_reply);
+        replies--;
+    }
 
-    record = (ST_RECORD *)msg;
+    if( errors ) {
+        logging("database thread[%ld]: %u of %u commands failed\n", syscall(SYS_gettid), errors, pipeline.replies);
+        retval = 0;
+    }
 
-    /* create JSON string aka:
-    { "imei": "1234567890", "data": 0, "time": 50400, "lon": 55.5400, "lat": 65.6500, "speed": 20.0, "curs": 40, "port": 19005 }
-    */
+    pipeline.size = 0;
+    pipeline.count = 0;
+    pipeline.replies = 0;
+    return retval;
+}
+//------------------------------------------------------------------------------
+
+/*
+   pipeline_add:
+   append commands for the record to output buffer of the context,
+   not wait replies (see pipeline_flush)
+   packed - the same record in packed form (record.h)
+   return 1 if success or -1 if database connection lost (records in flight spooled)
+   or record not appended (commands in flight kept, record must be spooled by caller)
+*/
+static int pipeline_add(redisContext *rds_context, ST_RECORD *record, char *packed, size_t packed_size, ST_SPOOL *spool)
+{
+    char json[JSON_RECORD_MAX], lon[32], lat[32];
+    size_t json_size, lon_size, lat_size;
+    unsigned int replies = 0;   // commands of the record appended
+
+    // packed records of the commands in flight fit into one spool message
+    if( pipeline.size + packed_size > PIPELINE_SIZE && pipeline_flush(rds_context, spool) < 0 )
+        return -1;
+
+    json_size = json_record(record, json);
 
     /*
-    with json-c library:
-        https://linuxprograms.wordpress.com/2010/08/19/json_object_new_object/
-
-    json_object * jobj = json_object_new_object();
-    //                              key        value
-    json_object_object_add(jobj, "imei", json_object_new_string(record->imei));
-    json_object_object_add(jobj, "data", json_object_new_int64(record->data));
-    json_object_object_add(jobj, "time", json_object_new_int(record->time));
-    json_object_object_add(jobj, "lon", json_object_new_double(record->lon));
-    json_object_object_add(jobj, "lat", json_object_new_double(record->lat));
-    json_object_object_add(jobj, "speed", json_object_new_double(record->speed));
-    json_object_object_add(jobj, "curs", json_object_new_int(record->curs));
-    json_object_object_add(jobj, "port", json_object_new_int(record->port));
-
-    rds_reply = redisCommand(rds_context, "SET gd_%s %s", record->imei, json_object_to_json_string(jobj));
+    Set a REDIS key
+    https://redis.io/commands/set
+    https://redis.io/commands/sadd
     */
+    if( redisAppendCommand(rds_context, "SET gd__%s %b", record->imei, json, json_size) != REDIS_OK )
+        goto append_error;
+    replies++;
+    if( redisAppendCommand(rds_context, "SADD gd_port__%d gd__%s", record->port, record->imei) != REDIS_OK )
+        goto append_error;
+    replies++;
 
     /*
-    without json-c library
+    stream of the records for consumers (XREAD), trimmed by REDIS
+    https://redis.io/commands/xadd
     */
-    sprintf(json, "{ \"imei\": \"%s\", \"datetime\": %lld, \"lon\": %03.07lf, \"lat\": %03.07lf, "
-                    "\"speed\": %03.01lf, \"curs\": %d, \"satellites\": %d, "
-                    "\"height\": %d, \"valid\": %d, \"vbort\": %02.01lf, \"vbatt\": %02.01lf, "
-                    "\"temperature\": %d, \"hdop\": %d, \"outputs\": %d, \"inputs\": %d, "
-                    "\"fuel0\": %d, \"fuel1\": %d, \"probeg\": %04.03lf, \"zaj\": %d, \"alarm\": %d, "
-                    "\"port\": %d, \"recnum\": %d, \"status\": %d}",
-                record->imei,
-                (long long)record->data + record->time,
-                record->lon,
-                record->lat,
-                record->speed,
-                record->curs,
-                record->satellites,
-                record->height,
-                record->valid,
-                record->vbort,
-                record->vbatt,
-                record->temperature,
-                record->hdop,
-                record->outputs,
-                record->inputs,
-                record->fuel[0],
-                record->fuel[1],
-                record->probeg,
-                record->zaj,
-                record->alarm,
-                record->port,
-                record->recnum,
-                record->status);
-    //logging("write_data_to_db: %s", json);
+    if( stConfigServer.db_stream[0] ) {
+        if( redisAppendCommand(rds_context, "XADD %s MAXLEN ~ %d * imei %s json %b", stConfigServer.db_stream, stConfigServer.db_stream_maxlen, record->imei, json, json_size) != REDIS_OK )
+            goto append_error;
+        replies++;
+    }
 
     /*
-    Set a REDIS key
-    https://redis.io/commands/set
+    last position of the terminal, coordinates signed by hemisphere
+    https://redis.io/commands/geoadd
     */
-    rds_reply = redisCommand(rds_context, "SET gd__%s %s", record->imei, json);
-    result = rds_reply ? rds_reply->type != REDIS_REPLY_ERROR : 0;
+    if( stConfigServer.db_geo[0] && record->valid && record->lon <= 180.0 && record->lat <= 85.05112878 ) {
+        lon_size = json_fixed(lon, record->clon == 'W' ? -record->lon : record->lon, 7) - lon;
+        lat_size = json_fixed(lat, record->clat == 'S' ? -record->lat : record->lat, 7) - lat;
+        if( redisAppendCommand(rds_context, "GEOADD %s %b %b %s", stConfigServer.db_geo, lon, lon_size, lat, lat_size, record->imei) != REDIS_OK )
+            goto append_error;
+        replies++;
+    }
+
+    memcpy(&pipeline.packed[pipeline.size], packed, packed_size);
+    pipeline.size += packed_size;
+    pipeline.count++;
+    pipeline.replies += replies;
+    return 1;
+
+append_error:
+    /* commands of the record appended before error sent with others,
+       so their replies read by pipeline_flush too */
+    logging("database thread[%ld]: redisAppendCommand() error: %s\n", syscall(SYS_gettid), rds_context->errstr);
+    pipeline.replies += replies;
+    return -1;
+}
+//------------------------------------------------------------------------------
 
-    if( result ){
-        // https://redis.io/commands/sadd
-        rds_reply = redisCommand(rds_context, "SADD gd_port__%d gd__%s", record->port, record->imei);
-        result = result && rds_reply ? rds_reply->type != REDIS_REPLY_ERROR : 0;
+/*
+   write_message_to_db:
+   unpack records of the queue message (record.h) and append commands for it to pipeline,
+   replies read by pipeline_flush
+   msg - packed records
+   msg_size - size of the msg
+   spool - spool (db_spool) for records, if database connection lost, or NULL
+   return 1 if success or -1 if database connection lost
+*/
+static int write_message_to_db(char *msg, ssize_t msg_size, redisContext *rds_context, ST_SPOOL *spool)
+{
+    ST_RECORD record;
+    ssize_t pos = 0;
+    size_t packed_size;
+
+    while( pos < msg_size && (packed_size = record_unpack(&msg[pos], msg_size - pos, &record)) > 0 ) {
+        if( rds_context->err || pipeline_add(rds_context, &record, &msg[pos], packed_size, spool) < 0 ) {
+            spool_write(spool, &msg[pos], msg_size - pos);
+            return -1;
+        }
+        pos += packed_size;
     }
 
-    if( !result ){
-        if( rds_reply )
-            logging("database thread[%ld]: write_data_to_db: redisCommand() error: %s\n", syscall(SYS_gettid), rds_reply->str);
-        else
-            logging("database thread[%ld]: write_data_to_db: redisCommand() return NULL\n", syscall(SYS_gettid));
+    return 1;
+}
+//------------------------------------------------------------------------------
+
+/*
+   write_ring_to_db:
+   write messages from ring buffer (db_queue = ring) to database,
+   read not more than RING_BATCH messages & release it at once
+   if database connection lost, the rest of messages goes to spool (db_spool)
+   wait - wait messages, if ring buffer is empty
+   return number of the read messages
+*/
+static unsigned int write_ring_to_db(redisContext *rds_context, int wait)
+{
+    char *msg;
+    size_t msg_size;
+    unsigned int count = 0;
+
+    while( count < RING_BATCH && (msg = ring_read(db_ring, &msg_size)) ) {
+        write_message_to_db(msg, msg_size, rds_context, db_spool);
+        count++;
     }
 
-    freeReplyObject(rds_reply);
+    // replies of the all read messages
+    if( pipeline.replies )
+        pipeline_flush(rds_context, db_spool);
+    ring_release(db_ring);
+
+    if( !count && wait )
+        ring_wait(db_ring, 1000);
+
+    return count;
+}
+//------------------------------------------------------------------------------
+
+/*
+   write_spool_to_db:
+   replay not more than RING_BATCH messages of the spool (db_spool) to database,
+   message removed from spool only if database connection not lost
+   return number of the written messages
+*/
+static unsigned int write_spool_to_db(redisContext *rds_context)
+{
+    char *msg;
+    size_t msg_size;
+    unsigned int count = 0;
+    int written;
+
+    while( count < RING_BATCH && (msg = spool_read(db_spool, &msg_size)) ) {
+        // replies of the commands appended read anyway, message kept in spool
+        written = write_message_to_db(msg, msg_size, rds_context, NULL);
+        if( pipeline_flush(rds_context, NULL) < 0 || written < 0 )
+            break;	// replay this message after reconnect
+        spool_commit(db_spool);
+        count++;
+    }
 
-    return result;
+    return count;
 }
 //------------------------------------------------------------------------------
 
@@ -262,10 +511,12 @@ static int write_data_to_db(char *msg, redisContext *rds_context)
    db_thread
    works in separate thread
    started from func. database_setup in glonassd.c
-   arg - pointer to main configuration structure (stConfigServer)
+   arg - pointer to ST_DB_SHARD structure (glonassd.h): number, ring buffer, spool
+   & connection parameters of the thread, spool replayed by the thread 0 only
 */
 void *db_thread(void *arg)
 {
+    ST_DB_SHARD *shard = (ST_DB_SHARD *)arg;
     static __thread redisContext *rds_context = NULL;
     static __thread char msg_buf[SOCKET_BUF_SIZE];
     static __thread mqd_t queue_workers = -1;	// Posix IPC queue of messages from workers
@@ -273,10 +524,20 @@ void *db_thread(void *arg)
     static __thread struct rlimit rlim;
     static __thread ssize_t msg_size;
     static __thread size_t buf_size;
+    static __thread unsigned int replayed;
+    static __thread struct timespec timeout;
+    static __thread time_t overflow_check;
+    static __thread unsigned long long overflows;
 
     // error handler:
     void exit_db(void * arg) {
 
+        // save messages from ring buffer
+        if( db_ring ) {
+            while( rds_context && !rds_context->err && write_ring_to_db(rds_context, 0) );
+            spool_ring(db_spool, db_ring);	// database lost
+        }
+
         // destroy queue
         if( queue_workers != -1 ) {
             // save messages from queue
@@ -285,10 +546,12 @@ void *db_thread(void *arg)
 
                 while( (msg_size = mq_receive(queue_workers, msg_buf, buf_size, NULL)) > 0 ) {
                     if( rds_context )
-                        write_data_to_db(msg_buf, rds_context);
+                        write_message_to_db(msg_buf, msg_size, rds_context, db_spool);
                     else
                         break;
                 }   // while
+                if( rds_context && pipeline.count )
+                    pipeline_flush(rds_context, db_spool);
             }	// if( mq_getattr
 
             mq_close(queue_workers);
@@ -308,56 +571,69 @@ void *db_thread(void *arg)
         logging("database thread[%ld] destroyed\n", syscall(SYS_gettid));
     }   // exit_db
 
+    db_ring = shard->ring;
+    db_spool = shard->spool;
+    db_sink = shard->sink;
+
     // install error handler:
     pthread_cleanup_push(exit_db, arg);
 
-    // create messages queue
-    memset(&queue_attr, 0, sizeof(struct mq_attr));
-
-    /* test system limit of the length of messages queue RLIMIT_MSGQUEUE
-       by default 819200 bytes
-       setup RLIMIT_MSGQUEUE size in /etc/security/limits.conf as:
-        hard	msgqueue	1342177280
-       and reboot;
-       see limits as:
-       ulimit -a
-       "POSIX message queues"
-    */
+    // create messages queue, if ring buffer not used (db_queue = mq)
+    if( !db_ring ) {
+        memset(&queue_attr, 0, sizeof(struct mq_attr));
+
+        /* test system limit of the length of messages queue RLIMIT_MSGQUEUE
+           by default 819200 bytes
+           setup RLIMIT_MSGQUEUE size in /etc/security/limits.conf as:
+            hard	msgqueue	1342177280
+           and reboot;
+           see limits as:
+           ulimit -a
+           "POSIX message queues"
+        */
 
-    /* Max. message size (bytes) */
-    queue_attr.mq_msgsize = sizeof(ST_RECORD);
-
-    // get RLIMIT_MSGQUEUE and calculate actual size of queue
-    if( getrlimit(RLIMIT_MSGQUEUE, &rlim) == 0 ) {
-        if( rlim.rlim_cur != rlim.rlim_max ) {	// increase RLIMIT_MSGQUEUE error
-            rlim.rlim_cur = rlim.rlim_max;
-            // calculate actual size of queue
-            if( setrlimit(RLIMIT_MSGQUEUE, &rlim) == 0 )
-                queue_attr.mq_maxmsg = (long)(rlim.rlim_max / queue_attr.mq_msgsize / 10);
-            else
+        /* Max. message size (bytes) */
+        queue_attr.mq_msgsize = RECORD_PACKED_MAX;    // packed records (record.h)
+
+        // get RLIMIT_MSGQUEUE and calculate actual size of queue
+        if( getrlimit(RLIMIT_MSGQUEUE, &rlim) == 0 ) {
+            if( rlim.rlim_cur != rlim.rlim_max ) {	// increase RLIMIT_MSGQUEUE error
+                rlim.rlim_cur = rlim.rlim_max;
+                // calculate actual size of queue
+                if( setrlimit(RLIMIT_MSGQUEUE, &rlim) == 0 )
+                    queue_attr.mq_maxmsg = (long)(rlim.rlim_max / queue_attr.mq_msgsize / 10);
+                else
+                    queue_attr.mq_maxmsg = (long)(rlim.rlim_cur / queue_attr.mq_msgsize / 10);
+            } else
                 queue_attr.mq_maxmsg = (long)(rlim.rlim_cur / queue_attr.mq_msgsize / 10);
-        } else
-            queue_attr.mq_maxmsg = (long)(rlim.rlim_cur / queue_attr.mq_msgsize / 10);
-    } else {
-        logging("database thread[%ld]: getrlimit() error %d: %s\n", syscall(SYS_gettid), errno, strerror(errno));
-        queue_attr.mq_maxmsg = (long)(819200 / queue_attr.mq_msgsize / 10);     /* Max. # of messages on queue */
-    }
+        } else {
+            logging("database thread[%ld]: getrlimit() error %d: %s\n", syscall(SYS_gettid), errno, strerror(errno));
+            queue_attr.mq_maxmsg = (long)(819200 / queue_attr.mq_msgsize / 10);     /* Max. # of messages on queue */
+        }
 
-    // calculate buffer size for messages
-    buf_size = queue_attr.mq_msgsize + 1;
-
-    queue_workers = mq_open(QUEUE_WORKER, O_RDONLY | O_CREAT, S_IRUSR | S_IWUSR, &queue_attr);
-    if( queue_workers < 0 ) {
-        logging("database thread[%ld]: mq_open() error %d: %s\n", syscall(SYS_gettid), errno, strerror(errno));
-        logging("Try this:\n");
-        logging("Setup 'POSIX message queues' size in /etc/security/limits.conf as:\n");
-        logging("*\thard\tmsgqueue\t%ld", (long)(65536 * queue_attr.mq_msgsize * 10));
-        logging("See 'POSIX message queues' size as: ulimit -a");
-        exit_db(arg);
-        return NULL;
-    }
+        // calculate buffer size for messages
+        buf_size = queue_attr.mq_msgsize + 1;
+
+        queue_workers = mq_open(QUEUE_WORKER, O_RDONLY | O_CREAT, S_IRUSR | S_IWUSR, &queue_attr);
+        if( queue_workers < 0 ) {
+            logging("database thread[%ld]: mq_open() error %d: %s\n", syscall(SYS_gettid), errno, strerror(errno));
+            logging("Try this:\n");
+            logging("Setup 'POSIX message queues' size in /etc/security/limits.conf as:\n");
+            logging("*\thard\tmsgqueue\t%ld", (long)(65536 * queue_attr.mq_msgsize * 10));
+            logging("See 'POSIX message queues' size as: ulimit -a");
+            exit_db(arg);
+            return NULL;
+        }
+
+        // queue may exist with messages of the previous size, receive by actual size
+        if( mq_getattr(queue_workers, &queue_attr) == 0 && queue_attr.mq_msgsize < SOCKET_BUF_SIZE )
+            buf_size = queue_attr.mq_msgsize + 1;
+    }   // if( !db_ring )
 
-    logging("database thread[%ld] started, queue size %ld msgs\n", syscall(SYS_gettid), (long)queue_attr.mq_maxmsg);
+    if( db_ring )
+        logging("database thread %u[%ld] started, ring buffer %lu bytes\n", shard->shard, syscall(SYS_gettid), (unsigned long)(db_ring->cells * RING_CELL_SIZE));
+    else
+        logging("database thread[%ld] started, queue size %ld msgs\n", syscall(SYS_gettid), (long)queue_attr.mq_maxmsg);
 
     // try to connect to database
     db_connect(1, &rds_context);
@@ -367,14 +643,44 @@ void *db_thread(void *arg)
         pthread_testcancel();
 
         if( rds_context && !rds_context->err ) {
-            msg_size = mq_receive(queue_workers, msg_buf, buf_size, NULL);
-            if( msg_size > 0 ) {
-                write_data_to_db(msg_buf, rds_context);	// write message to database
-            }   // if( msg_size > 0 )
+            // messages of the spool first, not wait new messages while it replayed
+            replayed = (shard->shard == 0 && spool_pending(db_spool)) ? write_spool_to_db(rds_context) : 0;
+
+            if( db_ring ) {
+                write_ring_to_db(rds_context, !replayed);	// write messages to database
+            }
+            else {
+                clock_gettime(CLOCK_REALTIME, &timeout);
+                timeout.tv_sec += replayed ? 0 : 1;
+                msg_size = mq_timedreceive(queue_workers, msg_buf, buf_size, NULL, &timeout);
+                if( msg_size > 0 )
+                    write_message_to_db(msg_buf, msg_size, rds_context, db_spool);	// write message to database
+
+                // replies of the commands appended, even if message not written completely
+                if( pipeline.replies )
+                    pipeline_flush(rds_context, db_spool);
+            }
+
+            spool_sync(db_spool, 0);
+
+            // backpressure: workers not written into ring buffer, once per second
+            if( db_ring && overflow_check != time(NULL) ) {
+                overflow_check = time(NULL);
+                if( (overflows = ring_overflows(db_ring)) )
+                    logging("database thread %u[%ld]: ring buffer full, %llu messages %s, used %zu bytes\n", shard->shard, syscall(SYS_gettid), overflows, db_spool ? "spooled" : "lost", ring_used(db_ring));
+            }
         }   // if( rds_context && !rds_context->err )
         else {
-            if( rds_context )   // connected, but error
+            // keep messages in spool while database is down
+            spool_ring(db_spool, db_ring);
+            spool_sync(db_spool, 1);
+
+            if( rds_context ) {   // connected, but error
+                // records in flight spooled, replies not waited on next connection
+                if( pipeline.replies )
+                    pipeline_flush(rds_context, db_spool);
                 db_connect(0, &rds_context);
+            }
 
             sleep(3);	// wait
 
@@ -418,6 +724,9 @@ void *timer_function(void *ptr)
         pthread_detach(pthread_self());
     }	// exit_timerfunc
 
+    // timers use the first database library
+    db_sink = &stConfigServer.db_sink[0];
+
     // install error handler:
     pthread_cleanup_push(exit_timerfunc, ptr);
 
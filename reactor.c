@@ -0,0 +1,626 @@
+/*
+    reactor.c
+    serve gps/glonass terminals in the event loops (io_model = epoll):
+    a few threads, each waiting many terminal sockets with epoll,
+    instead of a thread per terminal (worker.c)
+    note:
+    1. Terminal distributed to the event loop by main thread after accept
+    and served by this event loop until disconnect or timeout.
+    2. Buffers for read & decode shared by all terminals of the event loop,
+    only last navigation data (lastpoint) kept in ST_WORKER.
+    3. If io_reuseport = 1, each event loop pinned to CPU and has own
+    listener socket for every listener (SO_REUSEPORT), so accept
+    distributed between CPUs by kernel, main thread not accept terminals.
+    4. Data read from the socket may contain a part of message or a few
+    messages, so only listeners which library exports terminal_frame_length
+    served here, others served by threads (listeners_start in glonassd.c).
+
+    help:
+    http://man7.org/linux/man-pages/man7/epoll.7.html
+    http://man7.org/linux/man-pages/man2/eventfd.2.html
+    https://lwn.net/Articles/542629/
+*/
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <sys/syscall.h>    /* syscall */
+#include <stdlib.h> /* malloc */
+#include <string.h> /* memset */
+#include <unistd.h> /* close, sysconf */
+#include <errno.h>  /* errno */
+#include <time.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <arpa/inet.h>    /* inet_ntop */
+#include <sched.h>        /* cpu_set_t */
+#include <fcntl.h>            /* mq_open, O_* constants */
+#include <mqueue.h>
+#include "glonassd.h"
+#include "worker.h"
+#include "reactor.h"
+#include "uring.h"
+#include "ring.h"
+#include "lib.h"
+#include "logger.h"
+
+static ST_REACTOR *reactors = NULL;     // event loops
+static unsigned int reactors_count = 0; // number of the event loops
+static unsigned int reactor_next = 0;   // next event loop for attach terminal
+
+/*
+    utilite functions
+*/
+
+// insert terminal into tail of the served terminals list (newest activity)
+void reactor_link(ST_REACTOR *reactor, ST_WORKER *worker)
+{
+    worker->next = NULL;
+    worker->prev = reactor->last;
+    if( reactor->last )
+        reactor->last->next = worker;
+    else
+        reactor->first = worker;
+    reactor->last = worker;
+}
+//------------------------------------------------------------------------------
+
+// remove terminal from the served terminals list
+void reactor_unlink(ST_REACTOR *reactor, ST_WORKER *worker)
+{
+    if( worker->prev )
+        worker->prev->next = worker->next;
+    else
+        reactor->first = worker->next;
+
+    if( worker->next )
+        worker->next->prev = worker->prev;
+    else
+        reactor->last = worker->prev;
+
+    worker->prev = worker->next = NULL;
+}
+//------------------------------------------------------------------------------
+
+// stop serve terminal & free his resources
+static void reactor_detach(ST_REACTOR *reactor, ST_WORKER *worker)
+{
+    reactor_unlink(reactor, worker);
+    epoll_ctl(reactor->epoll, EPOLL_CTL_DEL, worker->client_socket, NULL);
+    --reactor->count;
+    worker_release(worker);
+}
+//------------------------------------------------------------------------------
+
+// start serve terminal in the event loop
+static void reactor_serve(ST_REACTOR *reactor, ST_WORKER *worker)
+{
+    struct epoll_event ev;
+
+    memset(&ev, 0, sizeof(struct epoll_event));
+    ev.events = EPOLLIN | EPOLLRDHUP;
+    ev.data.ptr = worker;
+
+    if( epoll_ctl(reactor->epoll, EPOLL_CTL_ADD, worker->client_socket, &ev) < 0 ) {
+        logging("%s[%ld]: epoll_ctl(EPOLL_CTL_ADD) error %d: %s\n", worker->listener->name, syscall(SYS_gettid), errno, strerror(errno));
+        worker_release(worker);
+        return;
+    }
+
+    worker->last_activity = time(NULL);
+    reactor_link(reactor, worker);
+    ++reactor->count;
+
+    if( stConfigServer.log_enable > 1 && worker->listener->log_all )
+        logging("%s[%d:%ld]: terminal %s served by reactor %d\n", worker->listener->name, worker->listener->port, syscall(SYS_gettid), worker->ip, reactor->index);
+}
+//------------------------------------------------------------------------------
+
+// take terminals, attached by main thread (list linked by ST_WORKER.next)
+ST_WORKER *reactor_incoming(ST_REACTOR *reactor)
+{
+    ST_WORKER *worker;
+
+    pthread_mutex_lock(&reactor->lock);
+    worker = reactor->incoming;
+    reactor->incoming = NULL;
+    pthread_mutex_unlock(&reactor->lock);
+
+    return worker;
+}
+//------------------------------------------------------------------------------
+
+// get terminals, attached by main thread, and start serve them
+static void reactor_accept(ST_REACTOR *reactor)
+{
+    ST_WORKER *worker, *next;
+    uint64_t counter;
+
+    // reset event
+    if( read(reactor->event, &counter, sizeof(uint64_t)) < 0 && errno != EAGAIN )
+        logging("reactor[%d:%ld]: read(event) error %d: %s\n", reactor->index, syscall(SYS_gettid), errno, strerror(errno));
+
+    worker = reactor_incoming(reactor);
+    while( worker ) {
+        next = worker->next;
+        reactor_serve(reactor, worker);
+        worker = next;
+    }	// while( worker )
+}
+//------------------------------------------------------------------------------
+
+/*
+    create worker for terminal, accepted on own listener socket of the event loop
+    l - index of the listener in stListeners.listener
+    client_socket - accepted socket
+    client_addr - address of the terminal
+    return worker or NULL if error (socket closed)
+*/
+ST_WORKER *reactor_worker(ST_REACTOR *reactor, unsigned int l, int client_socket, struct sockaddr_in *client_addr)
+{
+    ST_WORKER *worker;
+
+    // create worker config structure: freed by worker_release
+    worker = (ST_WORKER *)calloc(1, sizeof(ST_WORKER));
+    if( !worker ) {
+        logging("reactor[%d:%ld]: calloc() error %d: %s\n", reactor->index, syscall(SYS_gettid), errno, strerror(errno));
+        close(client_socket);
+        return NULL;
+    }
+
+    // set settings for worker
+    worker->client_socket = client_socket;
+    memcpy(&worker->client_addr, client_addr, sizeof(struct sockaddr_in));
+    worker->listener = &stListeners.listener[l];
+    inet_ntop(AF_INET, &worker->client_addr.sin_addr, worker->ip, SIZE_TRACKER_FIELD);
+    worker->reactor = reactor;
+    worker->thread = reactor->thread;
+    worker->db_queue = BAD_OBJ;
+
+    if( !worker_prepare(worker) ) {
+        worker_release(worker);
+        return NULL;
+    }
+
+    return worker;
+}
+//------------------------------------------------------------------------------
+
+/*
+    accept terminals on own listener socket (io_reuseport = 1)
+    l - index of the listener in stListeners.listener
+*/
+static void reactor_listen(ST_REACTOR *reactor, unsigned int l)
+{
+    ST_WORKER *worker;
+    struct sockaddr_in client_addr;
+    socklen_t sockaddr_in_size;
+    int i, client_socket;
+
+    // accept not more then REACTOR_EVENTS terminals per time, others wait next epoll_wait
+    for(i = 0; i < REACTOR_EVENTS; i++) {
+
+        sockaddr_in_size = sizeof(struct sockaddr_in);
+        client_socket = accept(reactor->sockets[l], (struct sockaddr *)&client_addr, &sockaddr_in_size);
+        if( client_socket < 0 ) {
+            if( errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR )
+                logging("reactor[%d:%ld]: listener[%s] accept() error %d: %s\n", reactor->index, syscall(SYS_gettid), stListeners.listener[l].name, errno, strerror(errno));
+            break;
+        }
+
+        worker = reactor_worker(reactor, l, client_socket, &client_addr);
+        if( worker )
+            reactor_serve(reactor, worker);
+    }	// for(i = 0; i < REACTOR_EVENTS; i++)
+}
+//------------------------------------------------------------------------------
+
+/*
+    read & process terminal message
+    return 1 if success & 0 if terminal must be disconnected
+*/
+static int reactor_read(ST_REACTOR *reactor, ST_WORKER *worker)
+{
+    ssize_t bytes_read = 0, bytes_recv = 0;
+    int retval = 1;
+
+    // read all available data
+    while( bytes_read < SOCKET_BUF_SIZE ) {
+        bytes_recv = recv(worker->client_socket, &reactor->socket_buf[bytes_read], SOCKET_BUF_SIZE - bytes_read, 0);
+        if( bytes_recv > 0 ) {
+            bytes_read += bytes_recv;
+        }
+        else {
+            if( bytes_recv == 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) )
+                retval = 0; // terminal disconnect or socket error
+            break;
+        }
+    }	// while( bytes_read < SOCKET_BUF_SIZE )
+
+    if( bytes_read <= 0 ) {
+        if( !retval && stConfigServer.log_enable > 1 && worker->listener->log_all )
+            logging("%s[%d:%ld]: bytes_read (%zd) <= 0\n", worker->listener->name, worker->listener->port, syscall(SYS_gettid), bytes_read);
+        return retval;
+    }
+
+    if( !reactor_process(reactor, worker, reactor->socket_buf, bytes_read) )
+        retval = 0;
+
+    return retval;
+}
+//------------------------------------------------------------------------------
+
+/*
+    process terminal message, received by event loop
+    socket_buf - message, must have 1 byte after it (socket_buf[bytes_read])
+    bytes_read - size of the message
+    return 1 if success & 0 if terminal must be disconnected
+*/
+int reactor_process(ST_REACTOR *reactor, ST_WORKER *worker, char *socket_buf, ssize_t bytes_read)
+{
+    int retval = 1;
+
+    // connect to database queue, if not connected yet & ring buffer not used
+    if( reactor->db_queue == BAD_OBJ && !db_shards ) {
+        reactor->db_queue = mq_open(QUEUE_WORKER, O_WRONLY | O_NONBLOCK);
+        if( reactor->db_queue < 0 ) {
+            logging("reactor[%d:%ld]: mq_open(%s) error %d: %s\n", reactor->index, syscall(SYS_gettid), QUEUE_WORKER, errno, strerror(errno));
+            reactor->db_queue = BAD_OBJ;
+        }
+    }
+    worker->db_queue = reactor->db_queue;
+
+    // restore last navigation data of the terminal, answer cleared by worker_receive
+    memcpy(&reactor->answer->lastpoint, &worker->lastpoint, sizeof(ST_RECORD));
+
+    // split into frames, decode, save, forward & answer
+    if( !worker_receive(worker, socket_buf, bytes_read, reactor->answer) )
+        retval = 0;
+
+    // save last navigation data of the terminal
+    memcpy(&worker->lastpoint, &reactor->answer->lastpoint, sizeof(ST_RECORD));
+
+    // move terminal to tail of the served terminals list
+    worker->last_activity = time(NULL);
+    if( worker != reactor->last ) {
+        reactor_unlink(reactor, worker);
+        reactor_link(reactor, worker);
+    }
+
+    return retval;
+}
+//------------------------------------------------------------------------------
+
+/*
+    disconnect terminals, silent more then socket_timeout seconds
+    detach - function, that remove terminal from served terminals list & disconnect it
+*/
+void reactor_timeouts(ST_REACTOR *reactor, void (*detach)(ST_REACTOR *, ST_WORKER *))
+{
+    time_t expired = time(NULL) - stConfigServer.socket_timeout;
+
+    // list ordered by last_activity, so test from oldest until first not expired
+    while( reactor->first && reactor->first->last_activity <= expired ) {
+        if( reactor->first->listener->log_err || (stConfigServer.log_enable > 1 && reactor->first->listener->log_all) )
+            logging("%s[%d:%ld]: %s timeout\n", reactor->first->listener->name, reactor->first->listener->port, syscall(SYS_gettid), reactor->first->imei);
+
+        detach(reactor, reactor->first);
+    }
+}
+//------------------------------------------------------------------------------
+
+// pin event loop to CPU, terminals of his listener sockets served on this CPU
+void reactor_pin(ST_REACTOR *reactor)
+{
+    cpu_set_t cpuset;
+    int error;
+
+    if( reactor->cpu == BAD_OBJ )
+        return;
+
+    CPU_ZERO(&cpuset);
+    CPU_SET(reactor->cpu, &cpuset);
+    error = pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpuset);
+    if( error )
+        logging("reactor[%d:%ld]: pthread_setaffinity_np(%d) error %d: %s\n", reactor->index, syscall(SYS_gettid), reactor->cpu, error, strerror(error));
+}
+//------------------------------------------------------------------------------
+
+/*
+    event loop thread function, epoll backend
+    st_reactor - pointer to ST_REACTOR structure (reactor.h)
+*/
+void *reactor_thread(void *st_reactor)
+{
+    ST_REACTOR *reactor = (ST_REACTOR *)st_reactor;
+    struct epoll_event events[REACTOR_EVENTS];
+    int i, nfds;
+
+    // cancel only while waiting events, see reactors_stop
+    pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+
+    reactor_pin(reactor);
+
+    while( 1 ) {
+
+        pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);  // can disturb :)
+        nfds = epoll_wait(reactor->epoll, events, REACTOR_EVENTS, REACTOR_TICK);
+        pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);    // do not disturb :)
+
+        if( nfds < 0 ) {
+            if( errno == EINTR )
+                continue;
+
+            logging("reactor[%d:%ld]: epoll_wait() error %d: %s\n", reactor->index, syscall(SYS_gettid), errno, strerror(errno));
+            break;
+        }
+
+        for(i = 0; i < nfds; i++) {
+            if( !events[i].data.ptr ) {    // new terminals attached
+                reactor_accept(reactor);
+            }
+            else if( reactor->sockets
+                     && (int *)events[i].data.ptr >= reactor->sockets
+                     && (int *)events[i].data.ptr < reactor->sockets + stListeners.count ) {    // own listener socket
+                reactor_listen(reactor, (int *)events[i].data.ptr - reactor->sockets);
+            }
+            else if( !reactor_read(reactor, (ST_WORKER *)events[i].data.ptr) ) {
+                reactor_detach(reactor, (ST_WORKER *)events[i].data.ptr);
+            }
+        }	// for(i = 0; i < nfds; i++)
+
+        reactor_timeouts(reactor, reactor_detach);
+
+    }	// while( 1 )
+
+    return NULL;
+}
+//------------------------------------------------------------------------------
+
+// free resources of the event loop, thread must be stopped
+static void reactor_free(ST_REACTOR *reactor)
+{
+    ST_WORKER *worker, *next;
+    unsigned int l;
+
+    // served terminals
+    while( reactor->first )
+        reactor_detach(reactor, reactor->first);
+
+    // attached, but not served terminals
+    worker = reactor->incoming;
+    while( worker ) {
+        next = worker->next;
+        worker_release(worker);
+        worker = next;
+    }
+    reactor->incoming = NULL;
+
+    // own listener sockets
+    if( reactor->sockets ) {
+        for(l = 0; l < stListeners.count; l++) {
+            if( reactor->sockets[l] != BAD_OBJ ) {
+                shutdown(reactor->sockets[l], SHUT_RDWR);
+                close(reactor->sockets[l]);
+            }
+        }
+        free(reactor->sockets);
+        reactor->sockets = NULL;
+    }
+
+    if( reactor->epoll != BAD_OBJ )
+        close(reactor->epoll);
+    if( reactor->event != BAD_OBJ )
+        close(reactor->event);
+    if( reactor->db_queue != BAD_OBJ )
+        mq_close(reactor->db_queue);
+    if( reactor->answer )
+        free(reactor->answer);
+    if( reactor->socket_buf )
+        free(reactor->socket_buf);
+
+    pthread_mutex_destroy(&reactor->lock);
+}
+//------------------------------------------------------------------------------
+
+/*
+    start event loops, if configured (io_model = epoll)
+    return 1 if success & 0 if error
+*/
+int reactors_start(void)
+{
+    unsigned int i, l;
+    int thread_error;
+    long cpus;
+    struct epoll_event ev;
+    void *(*thread_func)(void *) = reactor_thread;
+
+    if( stConfigServer.io_model == IO_MODEL_THREAD )
+        return 1;
+
+    if( stConfigServer.io_model == IO_MODEL_URING ) {
+        if( uring_probe() )
+            thread_func = uring_thread;
+        else
+            logging("reactors_start: io_uring not supported by kernel, use epoll\n");
+    }
+
+    cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    if( cpus <= 0 )
+        cpus = 1;
+
+    reactors_count = stConfigServer.io_threads;
+    if( !reactors_count )
+        reactors_count = cpus;
+    reactors_count = MIN(reactors_count, MAX_REACTORS);
+    reactor_next = 0;
+
+    reactors = (ST_REACTOR *)calloc(reactors_count, sizeof(ST_REACTOR));
+    if( !reactors ) {
+        logging("reactors_start: calloc() error %d: %s\n", errno, strerror(errno));
+        reactors_count = 0;
+        return 0;
+    }
+
+    for(i = 0; i < reactors_count; i++) {
+        reactors[i].index = i;
+        reactors[i].cpu = (stConfigServer.io_reuseport ? (int)(i % cpus) : BAD_OBJ);
+        reactors[i].db_queue = BAD_OBJ;
+        pthread_mutex_init(&reactors[i].lock, NULL);
+
+        reactors[i].answer = (ST_ANSWER *)malloc(sizeof(ST_ANSWER));
+        reactors[i].socket_buf = (char *)malloc(SOCKET_BUF_SIZE + 1);
+
+        reactors[i].epoll = epoll_create1(EPOLL_CLOEXEC);
+        if( reactors[i].epoll < 0 )
+            logging("reactor[%d]: epoll_create1() error %d: %s\n", i, errno, strerror(errno));
+
+        reactors[i].event = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if( reactors[i].event < 0 )
+            logging("reactor[%d]: eventfd() error %d: %s\n", i, errno, strerror(errno));
+
+        if( !reactors[i].answer || !reactors[i].socket_buf || reactors[i].epoll < 0 || reactors[i].event < 0 ) {
+            reactors_count = i + 1;
+            reactors_stop();
+            return 0;
+        }
+
+        // event with data.ptr == NULL is "new terminals attached"
+        memset(&ev, 0, sizeof(struct epoll_event));
+        ev.events = EPOLLIN;
+        ev.data.ptr = NULL;
+        epoll_ctl(reactors[i].epoll, EPOLL_CTL_ADD, reactors[i].event, &ev);
+
+        // own listener sockets, event data.ptr is pointer to socket in array
+        if( stConfigServer.io_reuseport ) {
+            reactors[i].sockets = (int *)malloc(stListeners.count * sizeof(int));
+            if( !reactors[i].sockets ) {
+                reactors_count = i + 1;
+                reactors_stop();
+                return 0;
+            }
+
+            for(l = 0; l < stListeners.count; l++)
+                reactors[i].sockets[l] = BAD_OBJ;
+
+            for(l = 0; l < stListeners.count; l++) {
+                if( !stListeners.listener[l].enabled || !stListeners.listener[l].terminal_decode || stListeners.listener[l].protocol != SOCK_STREAM || stListeners.listener[l].io_model == IO_MODEL_THREAD )
+                    continue;
+
+                reactors[i].sockets[l] = listener_open(&stListeners.listener[l]);
+                if( reactors[i].sockets[l] == BAD_OBJ || fcntl(reactors[i].sockets[l], F_SETFL, O_NONBLOCK) < 0 ) {
+                    logging("reactor[%d]: listener[%s] not started\n", i, stListeners.listener[l].name);
+                    reactors_count = i + 1;
+                    reactors_stop();
+                    return 0;
+                }
+
+#ifdef SO_INCOMING_CPU
+                // prefer connections, processed by network stack on the same CPU
+                setsockopt(reactors[i].sockets[l], SOL_SOCKET, SO_INCOMING_CPU, &reactors[i].cpu, sizeof(int));
+#endif
+
+                memset(&ev, 0, sizeof(struct epoll_event));
+                ev.events = EPOLLIN;
+                ev.data.ptr = &reactors[i].sockets[l];
+                epoll_ctl(reactors[i].epoll, EPOLL_CTL_ADD, reactors[i].sockets[l], &ev);
+            }	// for(l = 0; l < stListeners.count; l++)
+        }	// if( stConfigServer.io_reuseport )
+
+        if( attr_init )
+            thread_error = pthread_create(&reactors[i].thread, &worker_thread_attr, thread_func, &reactors[i]);
+        else
+            thread_error = pthread_create(&reactors[i].thread, NULL, thread_func, &reactors[i]);
+
+        if( thread_error ) {
+            logging("reactor[%d]: pthread_create() error %d: %s\n", i, thread_error, strerror(thread_error));
+            reactors[i].thread = 0;
+            reactors_count = i + 1;
+            reactors_stop();
+            return 0;
+        }
+    }	// for(i = 0; i < reactors_count; i++)
+
+    logging("%u reactors started, backend %s%s\n", reactors_count,
+            (thread_func == reactor_thread ? "epoll" : "io_uring"),
+            (stConfigServer.io_reuseport ? ", listeners sockets per reactor" : ""));
+
+    return 1;
+}
+//------------------------------------------------------------------------------
+
+// stop event loops & disconnect served terminals
+int reactors_stop(void)
+{
+    unsigned int i;
+
+    if( !reactors )
+        return 1;
+
+    for(i = 0; i < reactors_count; i++) {
+        if( reactors[i].thread ) {
+            if( pthread_cancel(reactors[i].thread) )
+                logging("cancel reactor[%d] error %d: %s\n", i, errno, strerror(errno));
+
+            // wake up event loop, waiting not in cancellation point (io_uring)
+            eventfd_write(reactors[i].event, 1);
+
+            if( pthread_join(reactors[i].thread, NULL) )
+                logging("stop reactor[%d] error %d: %s\n", i, errno, strerror(errno));
+        }
+
+        reactor_free(&reactors[i]);
+    }	// for(i = 0; i < reactors_count; i++)
+
+    logging("%u reactors stopped\n", reactors_count);
+
+    free(reactors);
+    reactors = NULL;
+    reactors_count = 0;
+
+    return 1;
+}
+//------------------------------------------------------------------------------
+
+/*
+    pass accepted terminal to the event loop
+    worker - pointer to ST_WORKER structure (worker.h), freed by event loop
+    return 1 if success & 0 if error (worker freed)
+*/
+int reactor_attach(ST_WORKER *worker)
+{
+    ST_REACTOR *reactor;
+
+    if( !reactors_count ) {
+        worker_release(worker);
+        return 0;
+    }
+
+    // round-robin
+    reactor = &reactors[reactor_next];
+    reactor_next = (reactor_next + 1) % reactors_count;
+
+    worker->reactor = reactor;
+    worker->thread = reactor->thread;
+    worker->db_queue = BAD_OBJ;
+    if( !worker_prepare(worker) ) {
+        worker_release(worker);
+        return 0;
+    }
+
+    pthread_mutex_lock(&reactor->lock);
+    worker->prev = NULL;
+    worker->next = reactor->incoming;
+    reactor->incoming = worker;
+    pthread_mutex_unlock(&reactor->lock);
+
+    // wake up event loop
+    if( eventfd_write(reactor->event, 1) < 0 )
+        logging("reactor[%d]: eventfd_write() error %d: %s\n", reactor->index, errno, strerror(errno));
+
+    return 1;
+}
+//------------------------------------------------------------------------------
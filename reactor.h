@@ -0,0 +1,49 @@
+#ifndef __REACTOR__
+#define __REACTOR__
+
+#include <pthread.h>
+#include <mqueue.h>
+#include <netinet/in.h>
+#include "de.h"
+#include "worker.h"
+
+// max number of the event loops
+#define MAX_REACTORS (64)
+// max number of the epoll events, treated per one epoll_wait
+#define REACTOR_EVENTS (256)
+// interval of test for terminals timeout, milliseconds
+#define REACTOR_TICK (1000)
+
+// event loop, served many terminals in one thread
+typedef struct {
+    pthread_t thread;
+    int index;              // number of the event loop
+    int cpu;                // CPU, the event loop pinned to (io_reuseport = 1), or BAD_OBJ
+    int epoll;              // epoll descriptor
+    int event;              // eventfd, signaled when new terminal attached
+    pthread_mutex_t lock;   // protect incoming list
+    ST_WORKER *incoming;    // accepted terminals, not yet served by event loop
+    ST_WORKER *first, *last;    // served terminals, ordered by last_activity (first - oldest)
+    unsigned int count;     // number of the served terminals
+    mqd_t db_queue;         // Posix IPC queue, shared by all terminals of the event loop
+    ST_ANSWER *answer;      // decoded data, shared by all terminals of the event loop
+    char *socket_buf;       // client socket buffer, shared by all terminals of the event loop
+    int *sockets;           // own listener sockets (io_reuseport = 1), indexed as stListeners.listener
+    void *uring;            // io_uring of the event loop (io_model = uring), see uring.c
+} ST_REACTOR;
+
+int reactors_start(void);
+int reactors_stop(void);
+int reactor_attach(ST_WORKER *worker);
+
+// for event loops with another I/O backend (uring.c)
+void *reactor_thread(void *st_reactor);
+void reactor_pin(ST_REACTOR *reactor);
+void reactor_link(ST_REACTOR *reactor, ST_WORKER *worker);
+void reactor_unlink(ST_REACTOR *reactor, ST_WORKER *worker);
+ST_WORKER *reactor_incoming(ST_REACTOR *reactor);
+ST_WORKER *reactor_worker(ST_REACTOR *reactor, unsigned int l, int client_socket, struct sockaddr_in *client_addr);
+int reactor_process(ST_REACTOR *reactor, ST_WORKER *worker, char *socket_buf, ssize_t bytes_read);
+void reactor_timeouts(ST_REACTOR *reactor, void (*detach)(ST_REACTOR *, ST_WORKER *));
+
+#endif
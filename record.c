@@ -0,0 +1,193 @@
+/*
+    record.c
+    pack & unpack ST_RECORD (de.h) to/from variable length form (record.h):
+    numeric fields, then only used part of the strings,
+    sensors block only if not empty, so usual record takes ~150 bytes
+    instead of sizeof(ST_RECORD)
+    note:
+    packed record used only inside one process (glonassd & it's libraries),
+    so byte order & double format not converted
+*/
+
+#include <stdlib.h>
+#include <string.h> /* memcpy */
+#include "record.h"
+
+/*
+    utilite functions
+*/
+
+// strings of the record in packed order, return number of the strings
+static int record_strings(ST_RECORD *record, char **str, size_t *max)
+{
+    str[0] = record->imei;
+    str[1] = record->tracker;
+    str[2] = record->hard;
+    str[3] = record->soft;
+    str[4] = record->ip;
+    max[0] = max[1] = max[2] = max[3] = max[4] = SIZE_TRACKER_FIELD;
+    str[5] = record->message;
+    max[5] = SIZE_MESSAGE_FIELD;
+    return 6;
+}
+//------------------------------------------------------------------------------
+
+// size of the length prefix of the string: 1 byte for short strings, 2 for message
+#define PREFIX_SIZE(max) ((max) > 255 ? sizeof(uint16_t) : sizeof(uint8_t))
+
+/*
+    main functions
+*/
+
+/*
+    pack record
+    record - pointer to ST_RECORD structure (de.h)
+    buf - buffer for packed record
+    size - size of the buffer
+    return size of the packed record or 0 if buffer is small
+*/
+size_t record_pack(ST_RECORD *record, char *buf, size_t size)
+{
+    ST_RECORD_PACKED *packed = (ST_RECORD_PACKED *)buf;
+    char *str[6];
+    size_t max[6], len[6], need, pos, prefix;
+    int i, strings, sensors;
+
+    if( !record || !buf )
+        return 0;
+
+    // calculate size of the packed record
+    strings = record_strings(record, str, max);
+    need = sizeof(ST_RECORD_PACKED);
+    for(i = 0; i < strings; i++) {
+        len[i] = strnlen(str[i], max[i] - 1);
+        need += PREFIX_SIZE(max[i]) + len[i];
+    }
+
+    // sensors block, only if any sensor has value
+    for(i = 0; i < 8 && !record->ainputs[i]; i++);
+    sensors = (i < 8 || record->fuel[0] || record->fuel[1]);
+    if( sensors )
+        need += 10 * sizeof(int32_t);
+
+    if( need > size )
+        return 0;
+
+    packed->size = need;
+    packed->flags = sensors ? RECORD_PACKED_SENSORS : 0;
+    packed->clon = record->clon;
+    packed->clat = record->clat;
+    packed->data = record->data;
+    packed->status = record->status;
+    packed->recnum = record->recnum;
+    packed->time = record->time;
+    packed->valid = record->valid;
+    packed->satellites = record->satellites;
+    packed->curs = record->curs;
+    packed->height = record->height;
+    packed->hdop = record->hdop;
+    packed->outputs = record->outputs;
+    packed->inputs = record->inputs;
+    packed->temperature = record->temperature;
+    packed->zaj = record->zaj;
+    packed->alarm = record->alarm;
+    packed->port = record->port;
+    packed->lon = record->lon;
+    packed->lat = record->lat;
+    packed->speed = record->speed;
+    packed->vbort = record->vbort;
+    packed->vbatt = record->vbatt;
+    packed->probeg = record->probeg;
+    pos = sizeof(ST_RECORD_PACKED);
+
+    for(i = 0; i < strings; i++) {
+        prefix = PREFIX_SIZE(max[i]);
+        if( prefix == sizeof(uint8_t) )
+            buf[pos] = (uint8_t)len[i];
+        else
+            *(uint16_t *)&buf[pos] = (uint16_t)len[i];
+        memcpy(&buf[pos + prefix], str[i], len[i]);
+        pos += prefix + len[i];
+    }
+
+    if( sensors ) {
+        memcpy(&buf[pos], record->ainputs, 8 * sizeof(int32_t));
+        pos += 8 * sizeof(int32_t);
+        memcpy(&buf[pos], record->fuel, 2 * sizeof(int32_t));
+    }
+
+    return need;
+}
+//------------------------------------------------------------------------------
+
+/*
+    unpack record
+    buf - packed record (record_pack)
+    size - size of the data in buffer
+    record - pointer to ST_RECORD structure (de.h) for unpacked record
+    return size of the packed record or 0 if error
+*/
+size_t record_unpack(char *buf, size_t size, ST_RECORD *record)
+{
+    ST_RECORD_PACKED *packed = (ST_RECORD_PACKED *)buf;
+    char *str[6];
+    size_t max[6], len, pos, prefix;
+    int i, strings;
+
+    if( !buf || !record || size < sizeof(ST_RECORD_PACKED) || packed->size > size || packed->size < sizeof(ST_RECORD_PACKED) )
+        return 0;
+    size = packed->size;
+
+    record_reset(record);
+    record->clon = packed->clon;
+    record->clat = packed->clat;
+    record->data = packed->data;
+    record->status = packed->status;
+    record->recnum = packed->recnum;
+    record->time = packed->time;
+    record->valid = packed->valid;
+    record->satellites = packed->satellites;
+    record->curs = packed->curs;
+    record->height = packed->height;
+    record->hdop = packed->hdop;
+    record->outputs = packed->outputs;
+    record->inputs = packed->inputs;
+    record->temperature = packed->temperature;
+    record->zaj = packed->zaj;
+    record->alarm = packed->alarm;
+    record->port = packed->port;
+    record->lon = packed->lon;
+    record->lat = packed->lat;
+    record->speed = packed->speed;
+    record->vbort = packed->vbort;
+    record->vbatt = packed->vbatt;
+    record->probeg = packed->probeg;
+    pos = sizeof(ST_RECORD_PACKED);
+
+    strings = record_strings(record, str, max);
+    for(i = 0; i < strings; i++) {
+        prefix = PREFIX_SIZE(max[i]);
+        if( pos + prefix > size )
+            return 0;
+        if( prefix == sizeof(uint8_t) )
+            len = (uint8_t)buf[pos];
+        else
+            len = *(uint16_t *)&buf[pos];
+        if( len >= max[i] || pos + prefix + len > size )
+            return 0;
+        memcpy(str[i], &buf[pos + prefix], len);
+        str[i][len] = 0;
+        pos += prefix + len;
+    }
+
+    if( packed->flags & RECORD_PACKED_SENSORS ) {
+        if( pos + 10 * sizeof(int32_t) > size )
+            return 0;
+        memcpy(record->ainputs, &buf[pos], 8 * sizeof(int32_t));
+        pos += 8 * sizeof(int32_t);
+        memcpy(record->fuel, &buf[pos], 2 * sizeof(int32_t));
+    }
+
+    return size;
+}
+//------------------------------------------------------------------------------
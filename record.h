@@ -0,0 +1,59 @@
+/*
+    record.h
+    packed (variable length) form of the ST_RECORD,
+    used between pipeline stages: worker -> database queue, worker -> forwarder
+*/
+#ifndef __RECORD__
+#define __RECORD__
+
+#include <stdint.h>
+#include <sys/types.h>
+#include "de.h"
+
+// flags of the packed record (ST_RECORD_PACKED.flags)
+#define RECORD_PACKED_SENSORS (1)    // block of ainputs & fuel present
+
+/*
+    packed record:
+    ST_RECORD_PACKED, then strings imei, tracker, hard, soft, ip
+    as 1 byte length + characters, then message as 2 bytes length + characters,
+    then optional blocks, see flags:
+    RECORD_PACKED_SENSORS - int32_t ainputs[8], int32_t fuel[2]
+*/
+#pragma pack( push, 1 )
+typedef struct {
+    uint16_t size;          // size of the packed record, bytes
+    uint16_t flags;         // RECORD_PACKED_*
+    char clon;
+    char clat;
+    int64_t data;
+    uint32_t status;
+    uint32_t recnum;
+    uint32_t time;
+    uint32_t valid;
+    uint32_t satellites;
+    uint32_t curs;
+    int32_t height;
+    uint32_t hdop;
+    uint32_t outputs;
+    uint32_t inputs;
+    int32_t temperature;
+    int32_t zaj;
+    int32_t alarm;
+    uint32_t port;
+    double lon;
+    double lat;
+    double speed;
+    double vbort;
+    double vbatt;
+    double probeg;
+} ST_RECORD_PACKED;
+#pragma pack( pop )
+
+// max. size of the packed record, bytes
+#define RECORD_PACKED_MAX (sizeof(ST_RECORD_PACKED) + 5 * SIZE_TRACKER_FIELD + sizeof(uint16_t) + SIZE_MESSAGE_FIELD + 10 * sizeof(int32_t))
+
+size_t record_pack(ST_RECORD *record, char *buf, size_t size);
+size_t record_unpack(char *buf, size_t size, ST_RECORD *record);
+
+#endif
@@ -0,0 +1,308 @@
+/*
+    ring.c
+    in-process ring buffer of the messages, many producers & one consumer,
+    used instead of POSIX message queue /que_worker (db_queue = ring):
+    workers write packed records (record.h), database thread read it
+    note:
+    1. Ring divided into cells of RING_CELL_SIZE bytes, message takes
+    contiguous cells; if message not fit at the end of the ring, the rest
+    of the ring skipped (padding message) & message placed at begin.
+    2. Producer reserve cells by atomic increment of the head (CAS),
+    copy message & commit it by store of the message number into seq of
+    the first cell, so producers not wait each other.
+    3. Consumer read committed messages in order & release all read cells
+    at once (ring_release), so producers see free space after the batch.
+    4. Consumer sleep on semaphore if ring is empty, producer post it
+    only if consumer sleeping, so usually no system calls at all.
+    Consumer, which wait sockets too (forwarder), sleep in poll/select
+    on eventfd (ring_eventfd, ring_sleep, ring_awake) instead of semaphore.
+
+    help:
+    https://gcc.gnu.org/onlinedocs/gcc/_005f_005fatomic-Builtins.html
+    http://www.1024cores.net/home/lock-free-algorithms/queues/bounded-mpmc-queue
+*/
+
+#include <stdlib.h> /* malloc */
+#include <string.h> /* memcpy */
+#include <errno.h>  /* errno */
+#include <time.h>
+#include <unistd.h> /* read, write, close */
+#include <sys/eventfd.h>
+#include "ring.h"
+
+// flag of the padding message in ST_RING.len, the rest is number of the skipped cells
+#define RING_PAD (0x80000000u)
+
+/*
+    utilite functions
+*/
+
+// number of the cells for message
+static inline uint64_t ring_cells(size_t size)
+{
+    return size ? (size + RING_CELL_SIZE - 1) / RING_CELL_SIZE : 1;
+}
+//------------------------------------------------------------------------------
+
+/*
+    main functions
+*/
+
+/*
+    create ring
+    size - size of the ring in bytes, rounded up to power of 2 cells
+    return pointer to ring or NULL if error
+*/
+ST_RING *ring_create(size_t size)
+{
+    ST_RING *ring;
+    uint64_t cells = 1024;
+
+    while( cells * RING_CELL_SIZE < size )
+        cells <<= 1;
+
+    if( posix_memalign((void **)&ring, RING_CACHE_LINE, sizeof(ST_RING)) )
+        return NULL;
+    memset(ring, 0, sizeof(ST_RING));
+
+    ring->cells = cells;
+    ring->mask = cells - 1;
+    ring->notify = -1;
+    ring->seq = (volatile uint64_t *)calloc(cells, sizeof(uint64_t));
+    ring->len = (uint32_t *)calloc(cells, sizeof(uint32_t));
+    if( posix_memalign((void **)&ring->data, RING_CACHE_LINE, cells * RING_CELL_SIZE) )
+        ring->data = NULL;
+
+    if( !ring->seq || !ring->len || !ring->data || sem_init(&ring->wakeup, 0, 0) ) {
+        ring_destroy(ring);
+        return NULL;
+    }
+
+    return ring;
+}
+//------------------------------------------------------------------------------
+
+// free ring, no producers & consumer must use it
+void ring_destroy(ST_RING *ring)
+{
+    if( !ring )
+        return;
+
+    if( ring->seq )
+        sem_destroy(&ring->wakeup);
+    if( ring->notify >= 0 )
+        close(ring->notify);
+
+    free((void *)ring->seq);
+    free(ring->len);
+    free(ring->data);
+    free(ring);
+}
+//------------------------------------------------------------------------------
+
+/*
+    producer: reserve place for message
+    size - size of the message in bytes
+    ticket - number of the message, for ring_commit
+    return pointer to place for message or NULL if ring is full
+*/
+char *ring_reserve(ST_RING *ring, size_t size, uint64_t *ticket)
+{
+    uint64_t head, tail, idx, pad, cells = ring_cells(size);
+
+    if( cells > ring->cells ) {
+        __atomic_add_fetch(&ring->overflows, 1, __ATOMIC_RELAXED);
+        return NULL;
+    }
+
+    head = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+    do {
+        tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+        idx = head & ring->mask;
+        pad = (idx + cells > ring->cells) ? ring->cells - idx : 0;
+
+        if( head + pad + cells - tail > ring->cells ) {    // ring is full
+            __atomic_add_fetch(&ring->overflows, 1, __ATOMIC_RELAXED);
+            return NULL;
+        }
+    } while( !__atomic_compare_exchange_n(&ring->head, &head, head + pad + cells, 1, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED) );
+
+    if( pad ) {    // skip the end of the ring
+        ring->len[idx] = RING_PAD | pad;
+        __atomic_store_n(&ring->seq[idx], head + 1, __ATOMIC_RELEASE);
+        head += pad;
+        idx = 0;
+    }
+
+    ring->len[idx] = size;
+    *ticket = head;
+    return &ring->data[idx * RING_CELL_SIZE];
+}
+//------------------------------------------------------------------------------
+
+/*
+    producer: message written, pass it to consumer
+    ticket - number of the message from ring_reserve
+*/
+void ring_commit(ST_RING *ring, uint64_t ticket)
+{
+    __atomic_store_n(&ring->seq[ticket & ring->mask], ticket + 1, __ATOMIC_RELEASE);
+
+    // wake up consumer, if it sleeping
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if( __atomic_load_n(&ring->sleeping, __ATOMIC_RELAXED) && __atomic_exchange_n(&ring->sleeping, 0, __ATOMIC_ACQ_REL) ) {
+        if( ring->notify >= 0 ) {
+            if( write(ring->notify, &(uint64_t){1}, sizeof(uint64_t)) < 0 ) {}
+        }
+        else
+            sem_post(&ring->wakeup);
+    }
+}
+//------------------------------------------------------------------------------
+
+/*
+    producer: write message into ring
+    return 1 if success or 0 if ring is full
+*/
+int ring_write(ST_RING *ring, char *msg, size_t size)
+{
+    uint64_t ticket;
+    char *place = ring_reserve(ring, size, &ticket);
+
+    if( !place )
+        return 0;
+
+    memcpy(place, msg, size);
+    ring_commit(ring, ticket);
+    return 1;
+}
+//------------------------------------------------------------------------------
+
+/*
+    consumer: read next message
+    size - size of the message in bytes
+    return pointer to message or NULL if no committed messages,
+    message valid until ring_release
+*/
+char *ring_read(ST_RING *ring, size_t *size)
+{
+    uint64_t idx;
+    uint32_t len;
+
+    while( 1 ) {
+        idx = ring->read & ring->mask;
+        if( __atomic_load_n(&ring->seq[idx], __ATOMIC_ACQUIRE) != ring->read + 1 )
+            return NULL;
+
+        len = ring->len[idx];
+        if( len & RING_PAD ) {    // skip the end of the ring
+            ring->read += len & ~RING_PAD;
+            continue;
+        }
+
+        *size = len;
+        ring->read += ring_cells(len);
+        return &ring->data[idx * RING_CELL_SIZE];
+    }
+}
+//------------------------------------------------------------------------------
+
+// consumer: release all read messages, place of it may be reused by producers
+void ring_release(ST_RING *ring)
+{
+    __atomic_store_n(&ring->tail, ring->read, __ATOMIC_RELEASE);
+}
+//------------------------------------------------------------------------------
+
+/*
+    consumer: wait message, call ring_release before
+    timeout_ms - max. time of waiting, milliseconds
+    return 1 if ring has message or 0 if timeout
+*/
+int ring_wait(ST_RING *ring, int timeout_ms)
+{
+    struct timespec ts;
+    uint64_t idx = ring->read & ring->mask;
+
+    __atomic_store_n(&ring->sleeping, 1, __ATOMIC_SEQ_CST);
+
+    // message may be committed before sleeping flag set
+    if( __atomic_load_n(&ring->seq[idx], __ATOMIC_SEQ_CST) == ring->read + 1 ) {
+        __atomic_store_n(&ring->sleeping, 0, __ATOMIC_RELAXED);
+        return 1;
+    }
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ts.tv_sec += timeout_ms / 1000;
+    ts.tv_nsec += (timeout_ms % 1000) * 1000000L;
+    if( ts.tv_nsec >= 1000000000L ) {
+        ts.tv_sec++;
+        ts.tv_nsec -= 1000000000L;
+    }
+
+    while( sem_timedwait(&ring->wakeup, &ts) == -1 && errno == EINTR );
+
+    __atomic_store_n(&ring->sleeping, 0, __ATOMIC_RELAXED);
+
+    return __atomic_load_n(&ring->seq[idx], __ATOMIC_ACQUIRE) == ring->read + 1;
+}
+//------------------------------------------------------------------------------
+
+/*
+    consumer: create eventfd, posted by producers instead of semaphore,
+    before the first message written, ring_wait not used after it
+    return descriptor (closed by ring_destroy) or -1 if error
+*/
+int ring_eventfd(ST_RING *ring)
+{
+    if( ring->notify < 0 )
+        ring->notify = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    return ring->notify;
+}
+//------------------------------------------------------------------------------
+
+/*
+    consumer: going to wait eventfd, call ring_release before
+    return 1 if ring has message, so not wait, or 0 if wait
+*/
+int ring_sleep(ST_RING *ring)
+{
+    uint64_t idx = ring->read & ring->mask;
+
+    __atomic_store_n(&ring->sleeping, 1, __ATOMIC_SEQ_CST);
+
+    // message may be committed before sleeping flag set
+    if( __atomic_load_n(&ring->seq[idx], __ATOMIC_SEQ_CST) == ring->read + 1 ) {
+        __atomic_store_n(&ring->sleeping, 0, __ATOMIC_RELAXED);
+        return 1;
+    }
+    return 0;
+}
+//------------------------------------------------------------------------------
+
+// consumer: waiting of the eventfd done
+void ring_awake(ST_RING *ring)
+{
+    uint64_t value;
+
+    __atomic_store_n(&ring->sleeping, 0, __ATOMIC_RELAXED);
+    if( read(ring->notify, &value, sizeof(uint64_t)) < 0 ) {}
+}
+//------------------------------------------------------------------------------
+
+// bytes of the ring, reserved by producers & not released by consumer yet
+size_t ring_used(ST_RING *ring)
+{
+    uint64_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+    return (size_t)((__atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) - tail) * RING_CELL_SIZE);
+}
+//------------------------------------------------------------------------------
+
+// number of the messages not written because ring was full, since previous call
+uint64_t ring_overflows(ST_RING *ring)
+{
+    if( !__atomic_load_n(&ring->overflows, __ATOMIC_RELAXED) )
+        return 0;
+    return __atomic_exchange_n(&ring->overflows, 0, __ATOMIC_ACQ_REL);
+}
+//------------------------------------------------------------------------------
@@ -0,0 +1,65 @@
+/*
+    ring.h
+    in-process ring buffer of the messages, many producers & one consumer
+    (workers -> database thread), see ring.c
+*/
+#ifndef __RING__
+#define __RING__
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <semaphore.h>
+
+// size of the cell of the ring, message takes one or more cells
+#define RING_CELL_SIZE (64)
+#define RING_CACHE_LINE (64)
+// max. number of the messages, read by consumer before release
+#define RING_BATCH (256)
+
+typedef struct {
+    // producers
+    volatile uint64_t head __attribute__((aligned(RING_CACHE_LINE)));    // cells reserved by producers
+    // consumer
+    volatile uint64_t tail __attribute__((aligned(RING_CACHE_LINE)));    // cells released by consumer
+    uint64_t read;          // cells read by consumer, but not released yet
+    volatile int sleeping;  // consumer wait messages (ring_wait, ring_sleep)
+    sem_t wakeup;           // posted by producer, if consumer sleeping
+    int notify;             // eventfd of the consumer (ring_eventfd) instead of wakeup, -1 if not used
+    // shared, not changed
+    uint64_t cells __attribute__((aligned(RING_CACHE_LINE)));    // number of the cells, power of 2
+    uint64_t mask;          // cells - 1
+    volatile uint64_t *seq; // per cell: absolute number of the committed message + 1
+    uint32_t *len;          // per cell: size of the message, bytes
+    char *data;             // cells * RING_CELL_SIZE bytes
+    // statistics
+    volatile uint64_t overflows __attribute__((aligned(RING_CACHE_LINE)));  // messages not written, ring was full
+} ST_RING;
+
+// max. number of the database threads (db_threads)
+#define DB_THREADS_MAX (64)
+// max. number of the database libraries (db_type)
+#define DB_SINKS_MAX (4)
+
+extern ST_RING *db_rings[DB_SINKS_MAX][DB_THREADS_MAX]; // glonassd.c, ring buffer of each database library & thread, NULL if db_queue = mq
+extern unsigned int db_shards;              // glonassd.c, number of the ring buffers of the library, 0 if db_queue = mq
+extern unsigned int db_sinks;               // glonassd.c, number of the database libraries written by workers
+
+ST_RING *ring_create(size_t size);
+void ring_destroy(ST_RING *ring);
+// producers
+char *ring_reserve(ST_RING *ring, size_t size, uint64_t *ticket);
+void ring_commit(ST_RING *ring, uint64_t ticket);
+int ring_write(ST_RING *ring, char *msg, size_t size);
+// consumer
+char *ring_read(ST_RING *ring, size_t *size);
+void ring_release(ST_RING *ring);
+int ring_wait(ST_RING *ring, int timeout_ms);
+// consumer, waiting with poll/select of the other descriptors
+int ring_eventfd(ST_RING *ring);
+int ring_sleep(ST_RING *ring);
+void ring_awake(ST_RING *ring);
+// statistics, any thread
+size_t ring_used(ST_RING *ring);
+uint64_t ring_overflows(ST_RING *ring);
+
+#endif
@@ -0,0 +1,230 @@
+/*
+    route.c
+    hash index of the forwarding terminals (IMEI -> forwarders)
+    instead of scan of the stForwarders.terminals for each parcel
+    note:
+    1. Index built from list of the forwarding terminals (forward.list)
+    & forwarders by route_load, routes to unknown forwarders skipped.
+    Open addressing with linear probing, slots at least twice more than
+    routes, one IMEI may have some routes (one per forwarder).
+    2. Index not changed after build, so readers (workers, forwarders)
+    not locked; flag "terminal authentificated" (logged) is atomic.
+    3. Reload (SIGHUP) build new index & replace current by atomic
+    store of the pointer, old index freed after all readers left it:
+    reader registered in one of the two counters by epoch (route_enter),
+    writer switch epoch & wait the counter of the previous epoch twice,
+    so readers never wait & writer never wait new readers.
+
+    help:
+    https://en.wikipedia.org/wiki/Open_addressing
+    https://en.wikipedia.org/wiki/Read-copy-update
+*/
+
+#include <stdlib.h> /* malloc */
+#include <string.h> /* memcpy */
+#include <unistd.h> /* usleep */
+#include "glonassd.h"
+#include "forwarder.h"
+#include "route.h"
+#include "logger.h"
+
+static ST_ROUTES *route_current = NULL;     // published index
+static unsigned int route_epoch = 0;        // epoch of the new readers, 0 | 1
+static unsigned int route_readers[2];       // readers of the epoch
+
+/*
+    utilite functions
+*/
+
+// FNV-1a hash of IMEI
+static inline uint32_t route_hash(const char *imei)
+{
+    uint32_t hash = 2166136261u;
+    unsigned int i;
+
+    for(i = 0; i < SIZE_TRACKER_FIELD && imei[i]; i++) {
+        hash ^= (unsigned char)imei[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+//------------------------------------------------------------------------------
+
+static void route_free(ST_ROUTES *routes)
+{
+    if( !routes )
+        return;
+
+    free(routes->routes);
+    free(routes->slots);
+    free(routes->forwards);
+    free(routes);
+}
+//------------------------------------------------------------------------------
+
+/*
+    build index from stForwarders
+    return pointer to index or NULL if error
+*/
+static ST_ROUTES *route_build(void)
+{
+    ST_ROUTES *routes;
+    unsigned int i, j, slot, slots = 16;
+
+    routes = (ST_ROUTES *)calloc(1, sizeof(ST_ROUTES));
+    if( !routes )
+        return NULL;
+
+    while( slots < 2 * (unsigned int)stForwarders.listcount )
+        slots <<= 1;
+
+    routes->mask = slots - 1;
+    routes->slots = (uint32_t *)calloc(slots, sizeof(uint32_t));
+    routes->routes = (ST_ROUTE *)calloc(stForwarders.listcount + 1, sizeof(ST_ROUTE));
+    routes->forwards = (ST_ROUTE_FORWARD *)calloc(stForwarders.count + 1, sizeof(ST_ROUTE_FORWARD));
+    if( !routes->slots || !routes->routes || !routes->forwards ) {
+        route_free(routes);
+        return NULL;
+    }
+
+    routes->forwards_count = stForwarders.count;
+    for(j = 0; j < stForwarders.count; j++) {
+        memcpy(routes->forwards[j].name, stForwarders.forwarder[j].name, STRLEN);
+        memcpy(routes->forwards[j].app, stForwarders.forwarder[j].app, STRLEN);
+        routes->forwards[j].ring = stForwarders.forwarder[j].ring;
+        // coalesced records encoded by forwarder, packet of the session restamped
+        routes->forwards[j].shared = (stForwarders.forwarder[j].coalesce_records <= 0
+                                        && (!stForwarders.forwarder[j].terminal_session_create || stForwarders.forwarder[j].terminal_restamp));
+    }
+
+    for(i = 0; i < stForwarders.listcount; i++) {
+        if( !stForwarders.terminals[i].imei[0] )
+            continue;
+
+        // forwarder of the terminal
+        for(j = 0; j < stForwarders.count; j++) {
+            if( !strcmp(stForwarders.terminals[i].forward, stForwarders.forwarder[j].name) )
+                break;
+        }
+        if( j == stForwarders.count ) {
+            logging("route: forwarder %s of the terminal %s not found\n", stForwarders.terminals[i].forward, stForwarders.terminals[i].imei);
+            continue;
+        }
+
+        memcpy(routes->routes[routes->count].imei, stForwarders.terminals[i].imei, SIZE_TRACKER_FIELD);
+        routes->routes[routes->count].forward = j;
+
+        slot = route_hash(stForwarders.terminals[i].imei) & routes->mask;
+        while( routes->slots[slot] )
+            slot = (slot + 1) & routes->mask;
+        routes->slots[slot] = ++routes->count;
+    }   // for(i = 0; i < stForwarders.listcount; i++)
+
+    return routes;
+}
+//------------------------------------------------------------------------------
+
+/*
+    publish index, wait readers of the previous index & free it
+    routes - new index or NULL
+*/
+static void route_publish(ST_ROUTES *routes)
+{
+    ST_ROUTES *old;
+    unsigned int i, epoch;
+
+    old = __atomic_exchange_n(&route_current, routes, __ATOMIC_SEQ_CST);
+    if( !old )
+        return;
+
+    // readers of the old index registered in any of the counters
+    for(i = 0; i < 2; i++) {
+        epoch = __atomic_load_n(&route_epoch, __ATOMIC_SEQ_CST);
+        __atomic_store_n(&route_epoch, epoch ^ 1, __ATOMIC_SEQ_CST);
+        while( __atomic_load_n(&route_readers[epoch], __ATOMIC_SEQ_CST) )
+            usleep(100);
+    }
+
+    route_free(old);
+}
+//------------------------------------------------------------------------------
+
+/*
+    main functions
+*/
+
+/*
+    build index from list of the forwarding terminals & forwarders
+    & replace current index, called from forwarders_start
+    return number of the routes
+*/
+int route_load(void)
+{
+    ST_ROUTES *routes = route_build();
+
+    if( !routes ) {
+        logging("route: index of %d terminals not built, out of memory\n", stForwarders.listcount);
+        return 0;
+    }
+
+    route_publish(routes);
+    return routes->count;
+}
+//------------------------------------------------------------------------------
+
+// remove current index on exit
+void route_unload(void)
+{
+    route_publish(NULL);
+}
+//------------------------------------------------------------------------------
+
+/*
+    enter to read index, any thread, must be paired with route_leave
+    epoch - for route_leave
+    return pointer to index or NULL if not exists,
+    index valid until route_leave
+*/
+ST_ROUTES *route_enter(unsigned int *epoch)
+{
+    *epoch = __atomic_load_n(&route_epoch, __ATOMIC_SEQ_CST);
+    __atomic_add_fetch(&route_readers[*epoch], 1, __ATOMIC_SEQ_CST);
+    return __atomic_load_n(&route_current, __ATOMIC_SEQ_CST);
+}
+//------------------------------------------------------------------------------
+
+// leave index, epoch - from route_enter
+void route_leave(unsigned int epoch)
+{
+    __atomic_sub_fetch(&route_readers[epoch], 1, __ATOMIC_RELEASE);
+}
+//------------------------------------------------------------------------------
+
+/*
+    next route of the terminal
+    routes - index from route_enter
+    probe - position of the search, must be 0 before first call
+    return pointer to route or NULL if not more routes
+*/
+ST_ROUTE *route_next(ST_ROUTES *routes, const char *imei, unsigned int *probe)
+{
+    uint32_t hash, route;
+
+    if( !routes || !routes->count || !imei || !imei[0] )
+        return NULL;
+
+    hash = route_hash(imei);
+    while( *probe <= routes->mask ) {
+        route = routes->slots[(hash + *probe) & routes->mask];
+        (*probe)++;
+
+        if( !route )    // end of the chain
+            break;
+        if( !strncmp(routes->routes[route - 1].imei, imei, SIZE_TRACKER_FIELD) )
+            return &routes->routes[route - 1];
+    }
+
+    *probe = routes->mask + 1;
+    return NULL;
+}
+//------------------------------------------------------------------------------
@@ -0,0 +1,45 @@
+/*
+    route.h
+    hash index of the forwarding terminals (IMEI -> forwarders),
+    see route.c
+*/
+#ifndef __ROUTE__
+#define __ROUTE__
+
+#include <stdint.h>
+#include "glonassd.h"   /* STRLEN, ST_RING */
+#include "de.h"         /* SIZE_TRACKER_FIELD */
+
+// forwarder of the index, copy of the name & protocol from ST_FORWARDER
+typedef struct {
+    char name[STRLEN];      // name of the forwarder
+    char app[STRLEN];       // protocol of the forwarder
+    ST_RING *ring;          // ring buffer from workers to forwarder (forwarder_ring) or NULL
+    int shared;             // packet may be encoded once for forwarders of the same protocol (ST_FORWARD_SHARED)
+} ST_ROUTE_FORWARD;
+
+// terminal & forwarder pair from list of the forwarding terminals
+typedef struct {
+    char imei[SIZE_TRACKER_FIELD];
+    uint32_t forward;           // index in ST_ROUTES.forwards & stForwarders.forwarder
+    volatile uint32_t logged;   // connection number of the forwarder, when terminal authentificated on remote server
+} ST_ROUTE;
+
+typedef struct {
+    unsigned int count;         // number of the routes
+    ST_ROUTE *routes;
+    unsigned int mask;          // number of the slots - 1, power of 2
+    uint32_t *slots;            // index in routes + 1, 0 - empty slot
+    unsigned int forwards_count;
+    ST_ROUTE_FORWARD *forwards;
+} ST_ROUTES;
+
+// main thread
+int route_load(void);
+void route_unload(void);
+// any thread
+ST_ROUTES *route_enter(unsigned int *epoch);
+void route_leave(unsigned int epoch);
+ST_ROUTE *route_next(ST_ROUTES *routes, const char *imei, unsigned int *probe);
+
+#endif
@@ -20,10 +20,14 @@
 #include "lib.h"    // MIN, MAX, BETWEEN, CRC, etc...
 #include "logger.h"
 
+// состояние соединения (terminal_session_create)
+typedef struct {
+	time_t prevTime;	// prev. packet time
+} SATLITE_SESSION;
 
 // functions
 static void satlite_decode_txt(char *parcel, int parcel_size, ST_ANSWER *answer);
-static void satlite_decode_bin(char *parcel, int parcel_size, ST_ANSWER *answer);
+static void satlite_decode_bin(char *parcel, int parcel_size, ST_ANSWER *answer, SATLITE_SESSION *session);
 static uint16_t crc16(unsigned char *pcBlock, uint16_t len);
 
 /*
@@ -31,11 +35,12 @@ static uint16_t crc16(unsigned char *pcBlock, uint16_t len);
    parcel - the raw data from socket
    parcel_size - it length
    answer - pointer to ST_ANSWER structure
+   session - decoder state of the connection (see de.h)
 */
-void terminal_decode(char *parcel, int parcel_size, ST_ANSWER *answer, ST_WORKER *worker)
+void terminal_decode(char *parcel, int parcel_size, ST_ANSWER *answer, ST_WORKER *worker, void *session)
 {
 
-	if( !parcel || parcel_size <= 0 || !answer )
+	if( !parcel || parcel_size <= 0 || !answer || !session )
 		return;
 
 	//log2file("/var/www/locman.org/tmp/gcc/satlite_", parcel, parcel_size);
@@ -43,7 +48,7 @@ void terminal_decode(char *parcel, int parcel_size, ST_ANSWER *answer, ST_WORKER
 	if( (parcel[1] == 'A' && parcel[2] == 'V') || (parcel[1] == 'G' && parcel[2] == 'S') )
 		satlite_decode_txt(parcel, parcel_size, answer);
 	else
-		satlite_decode_bin(parcel, parcel_size, answer);
+		satlite_decode_bin(parcel, parcel_size, answer, (SATLITE_SESSION *)session);
 
 }   // terminal_decode
 //------------------------------------------------------------------------------
@@ -54,7 +59,7 @@ static void satlite_decode_txt(char *parcel, int parcel_size, ST_ANSWER *answer)
 	ST_RECORD *record = NULL;
 	char cVers[10], cImei[16], cArchive[10], cTime[10], cDate[10], cAltitude[10], cGeoidheight[10],
 		  cXCOORD[12], cYCOORD[12];
-	char *cRec;
+	char *cRec, *saveptr;
 	int iTemp, iFields;
 	int iLinesOK = 0;	// успешно обработанных строк
 	int iHard = 0;
@@ -65,7 +70,7 @@ static void satlite_decode_txt(char *parcel, int parcel_size, ST_ANSWER *answer)
 	time_t ulliTmp;
 
 
-	cRec = strtok(parcel, "\r\n");
+	cRec = strtok_r(parcel, "\r\n", &saveptr);
 	while( cRec ) {
 
         iFields = 0;
@@ -232,7 +237,7 @@ static void satlite_decode_txt(char *parcel, int parcel_size, ST_ANSWER *answer)
 
 			if( answer->count < MAX_RECORDS - 1 )
 				++answer->count;
-			record = &answer->records[answer->count - 1];
+			record = record_reset(&answer->records[answer->count - 1]);
 
 			snprintf(record->imei, SIZE_TRACKER_FIELD, "%s", cImei);
 			snprintf(record->tracker, SIZE_TRACKER_FIELD, "sat-lite2");
@@ -350,7 +355,7 @@ static void satlite_decode_txt(char *parcel, int parcel_size, ST_ANSWER *answer)
 			record->alarm = record->ainputs[0];
 		}	// if( iFields >= 19 && strlen(cDate) == 6 )
 
-		cRec = strtok(NULL, "\r\n");
+		cRec = strtok_r(NULL, "\r\n", &saveptr);
 	}	// while( cRec )
 	//----------------------------------------------------------------
 
@@ -362,7 +367,7 @@ static void satlite_decode_txt(char *parcel, int parcel_size, ST_ANSWER *answer)
 
 
 // бинарный протокол satlite/SAT-LITE2 (это НЕ EGTS!)
-static void satlite_decode_bin(char *parcel, int parcel_size, ST_ANSWER *answer)
+static void satlite_decode_bin(char *parcel, int parcel_size, ST_ANSWER *answer, SATLITE_SESSION *session)
 {
 	ST_RECORD *record = NULL;
 	//-----------------------------------------------------
@@ -575,7 +580,6 @@ static void satlite_decode_bin(char *parcel, int parcel_size, ST_ANSWER *answer)
 	   t_text_cmd_data *text_cmd_data;
 	*/
 
-	static time_t prevTime = 0;					// prev. packet time
 	int i, iBuffPosition;
 	struct tm tm_data;
 	time_t ulliTmp = 0;
@@ -598,7 +602,7 @@ static void satlite_decode_bin(char *parcel, int parcel_size, ST_ANSWER *answer)
 
 	while( iBuffPosition < binary_container->data_len ) {
 
-		record = &answer->records[answer->count];
+		record = record_reset(&answer->records[answer->count]);
 
 		snprintf(record->imei, SIZE_TRACKER_FIELD, "%d", binary_container->tracker_id);
 		snprintf(record->tracker, SIZE_TRACKER_FIELD, "sat-lite2");
@@ -641,7 +645,7 @@ static void satlite_decode_bin(char *parcel, int parcel_size, ST_ANSWER *answer)
 			record->clon = 'E';
 
 		if( answer->count < MAX_RECORDS - 1 ) {
-			if( prevTime != ulliTmp &&
+			if( session->prevTime != ulliTmp &&
 					(record->lat && record->lon) &&
 					common_data_header->packet_type != 0x0003 &&
 					common_data_header->packet_type != 0x000A &&
@@ -691,7 +695,7 @@ static void satlite_decode_bin(char *parcel, int parcel_size, ST_ANSWER *answer)
 			record->valid = (record->satellites > 2 && record->lat > 0 && record->lon > 0);
 
 			if( answer->count < MAX_RECORDS - 1 ) {
-				if( prevTime != ulliTmp )
+				if( session->prevTime != ulliTmp )
 					++answer->count;
 			}	// if( answer->count < MAX_RECORDS - 1 )
 
@@ -715,7 +719,7 @@ static void satlite_decode_bin(char *parcel, int parcel_size, ST_ANSWER *answer)
 			record->valid = (record->lat > 0 && record->lon > 0);
 
 			if( answer->count < MAX_RECORDS - 1 ) {
-				if( prevTime != ulliTmp )
+				if( session->prevTime != ulliTmp )
 					++answer->count;
 			}	// if( answer->count < MAX_RECORDS - 1 )
 
@@ -751,7 +755,7 @@ static void satlite_decode_bin(char *parcel, int parcel_size, ST_ANSWER *answer)
 			record->valid = (record->satellites > 2 && record->lat > 0 && record->lon > 0);
 
 			if( answer->count < MAX_RECORDS - 1 ) {
-				if( prevTime != ulliTmp )
+				if( session->prevTime != ulliTmp )
 					++answer->count;
 			}	// if( answer->count < MAX_RECORDS - 1 )
 
@@ -785,7 +789,7 @@ static void satlite_decode_bin(char *parcel, int parcel_size, ST_ANSWER *answer)
 		}	// switch( common_data_header->packet_type )
 
 		// store prev. packet time
-		prevTime = ulliTmp;
+		session->prevTime = ulliTmp;
 		// next packet
 		iBuffPosition += common_data_header->packet_len;
 
@@ -806,15 +810,61 @@ static void satlite_decode_bin(char *parcel, int parcel_size, ST_ANSWER *answer)
 //------------------------------------------------------------------------------
 
 
+/*
+   create decoder state of the connection (see de.h)
+   return pointer to SATLITE_SESSION structure or NULL if error
+*/
+void *terminal_session_create(void)
+{
+	return calloc(1, sizeof(SATLITE_SESSION));
+}
+//------------------------------------------------------------------------------
+
+// free decoder state of the connection
+void terminal_session_destroy(void *session)
+{
+	free(session);
+}
+//------------------------------------------------------------------------------
+
+/*
+   frame length function (see de.h)
+   buf - the raw data from socket
+   len - it length
+   return length of the frame, 0 if unknown yet or BAD_OBJ if not recognized
+*/
+int terminal_frame_length(char *buf, int len)
+{
+	char *cEnd;
+
+	if( !buf || len < 3 )
+		return 0;
+
+	if( (buf[1] == 'A' && buf[2] == 'V') || (buf[1] == 'G' && buf[2] == 'S') ) {	// text protocol: line ended by \r\n
+		cEnd = memchr(buf, '\n', len);
+		return (cEnd ? cEnd - buf + 1 : 0);
+	}
+
+	// binary container: crc(2), preamble(2), tracker_id(4), data_len(2), data
+	if( len < 10 )
+		return 0;
+	if( *(uint16_t *)&buf[2] != 0x8A2C )
+		return BAD_OBJ;
+
+	return 10 + *(uint16_t *)&buf[8];
+}
+//------------------------------------------------------------------------------
+
 /*
    encode function
    records - pointer to array of ST_RECORD struct.
    reccount - number of struct in array, and returning
    buffer - buffer for encoded data
    bufsize - size of buffer
+   session - encoder state of the connection (see de.h)
    return size of data in the buffer for encoded data
 */
-int terminal_encode(ST_RECORD *records, int reccount, char *buffer, int bufsize)
+int terminal_encode(ST_RECORD *records, int reccount, char *buffer, int bufsize, void *session)
 {
 	int top = 0;
 	return top;
@@ -21,11 +21,12 @@
    parcel - the raw data from socket
    parcel_size - the length of the data
    answer - a pointer to ST_ANSWER structure
+   session - decoder state of the connection (see de.h)
 */
-void terminal_decode(char *parcel, int parcel_size, ST_ANSWER *answer, ST_WORKER *worker)
+void terminal_decode(char *parcel, int parcel_size, ST_ANSWER *answer, ST_WORKER *worker, void *session)
 {
 	ST_RECORD *record = NULL;
-	char *cRec, cTime[25];
+	char *cRec, *saveptr, cTime[25];
 	int iTemp, rec_ok, i, iBufSize;
 	struct tm tm_data;
 	time_t ulliTmp;
@@ -45,7 +46,7 @@ void terminal_decode(char *parcel, int parcel_size, ST_ANSWER *answer, ST_WORKER
     }
 
 	rec_ok = 1;
-	cRec = strtok(parcel, "\r\n");
+	cRec = strtok_r(parcel, "\r\n", &saveptr);
 	while( cRec ) {
 
 		// <ObjectID>01326273</ObjectID>
@@ -53,7 +54,7 @@ void terminal_decode(char *parcel, int parcel_size, ST_ANSWER *answer, ST_WORKER
 			if( rec_ok ) {
 				if( answer->count < MAX_RECORDS - 1 )
 					answer->count++;
-				record = &answer->records[answer->count - 1];
+				record = record_reset(&answer->records[answer->count - 1]);
 				i = 0;
 			}	// if( rec_ok )
 
@@ -131,7 +132,7 @@ void terminal_decode(char *parcel, int parcel_size, ST_ANSWER *answer, ST_WORKER
 			i += sscanf(cRec, "<AnalogI num=\"%d\" />", &record->ainputs[i]);
 		}	// <AnalogI num
 
-		cRec = strtok(NULL, "\r\n");
+		cRec = strtok_r(NULL, "\r\n", &saveptr);
 	}	// while( cRec )
 
 
@@ -164,9 +165,10 @@ void terminal_decode(char *parcel, int parcel_size, ST_ANSWER *answer, ST_WORKER
    reccount - number of structs (records) in array (negative if authentificate required)
    buffer - buffer for encoded data
    bufsize - size of the buffer
+   session - encoder state of the connection (see de.h)
    return size of data in the buffer for encoded data in bytes
 */
-int terminal_encode(ST_RECORD *records, int reccount, char *buffer, int bufsize)
+int terminal_encode(ST_RECORD *records, int reccount, char *buffer, int bufsize, void *session)
 {
 	uint i, j, top, itemp, ContentLength, ContentLengthPosition;
 	struct tm tm_data;
@@ -0,0 +1,413 @@
+/*
+    spool.c
+    on-disk spool of the messages to database (db_spool = directory):
+    if queue to database thread is full or database is down,
+    messages (packed records, record.h) written to spool
+    and replayed by database thread in order when database returns
+    also used as journal of the parcels not sent by forwarder (forwarder.c)
+    note:
+    1. Spool is append-only set of the segment files <seq>.spool
+    (seq - 16 hex digits), each not more than segment_size bytes.
+    Message written as ST_SPOOL_ENTRY (magic, size, CRC32) + message
+    by one write call, segment never rewritten.
+    2. Writers call fdatasync not for each message, but after
+    SPOOL_SYNC_BYTES bytes or SPOOL_SYNC_TIME seconds (spool_sync).
+    3. Reader (database thread) return message by spool_read & advance
+    position by spool_commit only after message written to database,
+    so if database lost, message replayed again.
+    Replayed segment removed, position in current segment saved to
+    spool.pos from time to time, so after crash some messages may be
+    written to database twice, but not lost.
+    4. Damaged message (bad magic, size or CRC, e.g. not completely
+    written before crash) skipped with the rest of segment.
+*/
+
+#include <stdlib.h> /* malloc */
+#include <string.h> /* memcpy */
+#include <errno.h>  /* errno */
+#include <unistd.h> /* pread, fdatasync */
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/uio.h>    /* writev */
+#include "spool.h"
+#include "lib.h"
+#include "logger.h"
+
+#define SPOOL_MAGIC (0x4C4F5053)        // "SPOL"
+#define SPOOL_SAVE_COMMITS (256)        // save position after this number of the committed messages
+
+/*
+    utilite functions
+*/
+
+// file name of the segment
+static char *spool_segment_name(ST_SPOOL *spool, uint64_t seq, char *name, size_t size)
+{
+    snprintf(name, size, "%.4060s/%016llx.spool", spool->path, (unsigned long long)seq);
+    return name;
+}
+//------------------------------------------------------------------------------
+
+// save position of the reader into spool.pos
+static void spool_save_position(ST_SPOOL *spool)
+{
+    char name[FILENAME_MAX], buf[64];
+    int fd, len;
+
+    spool->committed = 0;
+
+    snprintf(name, FILENAME_MAX, "%.4060s/spool.pos", spool->path);
+    fd = open(name, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+    if( fd < 0 )
+        return;
+
+    len = snprintf(buf, sizeof(buf), "%llx %lld\n", (unsigned long long)spool->rseq, (long long)spool->rpos);
+    if( write(fd, buf, len) != len )
+        logging("spool: write(%s) error %d: %s\n", name, errno, strerror(errno));
+    close(fd);
+}
+//------------------------------------------------------------------------------
+
+// writer: create new segment, call under lock
+static int spool_segment_create(ST_SPOOL *spool)
+{
+    char name[FILENAME_MAX];
+    int dir;
+
+    spool->wfd = open(spool_segment_name(spool, spool->wseq, name, FILENAME_MAX), O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, S_IRUSR | S_IWUSR);
+    if( spool->wfd < 0 ) {
+        logging("spool: open(%s) error %d: %s\n", name, errno, strerror(errno));
+        return 0;
+    }
+    spool->wpos = 0;
+
+    // new file name must survive crash too
+    dir = open(spool->path, O_RDONLY | O_DIRECTORY);
+    if( dir >= 0 ) {
+        fsync(dir);
+        close(dir);
+    }
+
+    return 1;
+}
+//------------------------------------------------------------------------------
+
+// writer: close current segment, next message goes to the next segment, call under lock
+static void spool_segment_close(ST_SPOOL *spool)
+{
+    if( spool->wfd < 0 )
+        return;
+
+    fdatasync(spool->wfd);
+    close(spool->wfd);
+    spool->wfd = -1;
+    spool->unsynced = 0;
+    spool->synced = time(NULL);
+    spool->wseq++;
+    spool->wpos = 0;
+}
+//------------------------------------------------------------------------------
+
+// reader: segment replayed, remove it & go to the next segment
+static void spool_segment_done(ST_SPOOL *spool)
+{
+    char name[FILENAME_MAX];
+
+    if( spool->rfd >= 0 ) {
+        close(spool->rfd);
+        spool->rfd = -1;
+    }
+    unlink(spool_segment_name(spool, spool->rseq, name, FILENAME_MAX));
+
+    spool->rseq++;
+    spool->rpos = spool->rnext = 0;
+    spool_save_position(spool);
+}
+//------------------------------------------------------------------------------
+
+/*
+    main functions
+*/
+
+/*
+    open spool
+    path - directory of the segments, created if not exists
+    segment_size - max. size of the segment file, bytes
+    return pointer to spool or NULL if error
+*/
+ST_SPOOL *spool_open(char *path, size_t segment_size)
+{
+    ST_SPOOL *spool;
+    DIR *dir;
+    struct dirent *entry;
+    unsigned long long seq, min_seq = 0, max_seq = 0, pos_seq;
+    long long pos;
+    char name[FILENAME_MAX];
+    FILE *fpos;
+
+    if( !path || !*path )
+        return NULL;
+
+    if( mkdir(path, S_IRWXU) && errno != EEXIST ) {
+        logging("spool: mkdir(%s) error %d: %s\n", path, errno, strerror(errno));
+        return NULL;
+    }
+
+    dir = opendir(path);
+    if( !dir ) {
+        logging("spool: opendir(%s) error %d: %s\n", path, errno, strerror(errno));
+        return NULL;
+    }
+
+    spool = (ST_SPOOL *)calloc(1, sizeof(ST_SPOOL));
+    if( !spool ) {
+        closedir(dir);
+        return NULL;
+    }
+
+    snprintf(spool->path, FILENAME_MAX, "%s", path);
+    spool->segment_size = segment_size > sizeof(spool->rbuf) ? segment_size : SPOOL_SEGMENT_SIZE;
+    spool->wfd = spool->rfd = -1;
+    spool->synced = time(NULL);
+    pthread_mutex_init(&spool->lock, NULL);
+
+    // find first & last segments of the previous run
+    while( (entry = readdir(dir)) ) {
+        if( strlen(entry->d_name) != 22 || strcmp(&entry->d_name[16], ".spool") || sscanf(entry->d_name, "%16llx", &seq) != 1 )
+            continue;
+        if( !min_seq || seq < min_seq )
+            min_seq = seq;
+        if( seq > max_seq )
+            max_seq = seq;
+    }
+    closedir(dir);
+
+    // previous segments replayed first, new messages go to the new segment
+    spool->wseq = max_seq + 1;
+    spool->rseq = min_seq ? min_seq : spool->wseq;
+
+    // saved position of the reader
+    snprintf(name, FILENAME_MAX, "%.4060s/spool.pos", path);
+    fpos = fopen(name, "r");
+    if( fpos ) {
+        if( fscanf(fpos, "%llx %lld", &pos_seq, &pos) == 2 && pos_seq == spool->rseq && pos > 0 )
+            spool->rpos = pos;
+        fclose(fpos);
+    }
+
+    if( min_seq )
+        logging("spool: %s has %llu segments for replay\n", path, max_seq - min_seq + 1);
+
+    return spool;
+}
+//------------------------------------------------------------------------------
+
+// close spool, no writers & reader must use it
+void spool_close(ST_SPOOL *spool)
+{
+    if( !spool )
+        return;
+
+    pthread_mutex_lock(&spool->lock);
+    if( spool->wfd >= 0 ) {
+        fdatasync(spool->wfd);
+        close(spool->wfd);
+    }
+    pthread_mutex_unlock(&spool->lock);
+
+    if( spool->rfd >= 0 ) {
+        spool_save_position(spool);
+        close(spool->rfd);
+    }
+
+    pthread_mutex_destroy(&spool->lock);
+    free(spool);
+}
+//------------------------------------------------------------------------------
+
+/*
+    flush written messages to disk
+    force - 1: now, 0: if SPOOL_SYNC_TIME seconds passed after last fdatasync
+*/
+void spool_sync(ST_SPOOL *spool, int force)
+{
+    time_t now;
+
+    if( !spool || !spool->unsynced )
+        return;
+
+    now = time(NULL);
+    pthread_mutex_lock(&spool->lock);
+    if( spool->wfd >= 0 && spool->unsynced && (force || now - spool->synced >= SPOOL_SYNC_TIME) ) {
+        fdatasync(spool->wfd);
+        spool->unsynced = 0;
+        spool->synced = now;
+    }
+    pthread_mutex_unlock(&spool->lock);
+}
+//------------------------------------------------------------------------------
+
+/*
+    writer: append message to spool
+    msg - message, size - size of the message, bytes
+    return 1 if success or 0 if error
+*/
+int spool_write(ST_SPOOL *spool, char *msg, size_t size)
+{
+    ST_SPOOL_ENTRY entry;
+    struct iovec iov[2];
+    size_t need = sizeof(ST_SPOOL_ENTRY) + size;
+    ssize_t written;
+    time_t now;
+    int retval = 0;
+
+    if( !spool || !msg || !size || size > SPOOL_MSG_MAX )
+        return 0;
+
+    entry.magic = SPOOL_MAGIC;
+    entry.size = size;
+    entry.crc = CRC32(0, (unsigned char *)msg, size);
+    iov[0].iov_base = &entry;
+    iov[0].iov_len = sizeof(ST_SPOOL_ENTRY);
+    iov[1].iov_base = msg;
+    iov[1].iov_len = size;
+
+    pthread_mutex_lock(&spool->lock);
+
+    if( spool->wfd >= 0 && spool->wpos + need > spool->segment_size )
+        spool_segment_close(spool);
+
+    if( spool->wfd >= 0 || spool_segment_create(spool) ) {
+        written = writev(spool->wfd, iov, 2);
+        if( written == (ssize_t)need ) {
+            spool->unsynced += need;
+            spool->wpos += need;    // visible to reader after write
+            retval = 1;
+
+            now = time(NULL);
+            if( spool->unsynced >= SPOOL_SYNC_BYTES || now - spool->synced >= SPOOL_SYNC_TIME ) {
+                fdatasync(spool->wfd);
+                spool->unsynced = 0;
+                spool->synced = now;
+            }
+        }
+        else {
+            logging("spool: writev(%llx) error %d: %s\n", (unsigned long long)spool->wseq, errno, strerror(errno));
+            // remove partially written message
+            if( written > 0 && ftruncate(spool->wfd, spool->wpos) )
+                spool_segment_close(spool);
+        }
+    }
+
+    pthread_mutex_unlock(&spool->lock);
+
+    return retval;
+}
+//------------------------------------------------------------------------------
+
+/*
+    writer: move all messages of the ring buffer to spool,
+    call from consumer of the ring only (database thread)
+    return number of the moved messages
+*/
+unsigned int spool_ring(ST_SPOOL *spool, ST_RING *ring)
+{
+    char *msg;
+    size_t size;
+    unsigned int count = 0, lost = 0;
+
+    if( !spool || !ring )
+        return 0;
+
+    while( (msg = ring_read(ring, &size)) ) {
+        if( spool_write(spool, msg, size) )
+            count++;
+        else
+            lost++;
+    }
+    ring_release(ring);
+
+    if( lost )
+        logging("spool: %u messages lost\n", lost);
+
+    return count;
+}
+//------------------------------------------------------------------------------
+
+// reader: return 1 if spool has messages for replay
+int spool_pending(ST_SPOOL *spool)
+{
+    return spool && (spool->rseq < spool->wseq || spool->rpos < spool->wpos);
+}
+//------------------------------------------------------------------------------
+
+/*
+    reader: next message for replay
+    size - size of the message, bytes
+    return pointer to message or NULL if spool is empty,
+    message valid until next call, the same message returned until spool_commit
+*/
+char *spool_read(ST_SPOOL *spool, size_t *size)
+{
+    ST_SPOOL_ENTRY *entry = (ST_SPOOL_ENTRY *)spool->rbuf;
+    char name[FILENAME_MAX];
+    uint64_t wseq;
+    off_t wpos;
+    ssize_t n;
+
+    while( spool ) {
+        pthread_mutex_lock(&spool->lock);
+        wseq = spool->wseq;
+        wpos = spool->wpos;
+        pthread_mutex_unlock(&spool->lock);
+
+        if( spool->rseq > wseq || (spool->rseq == wseq && spool->rpos >= wpos) )
+            return NULL;    // all replayed
+
+        if( spool->rfd < 0 ) {
+            spool->rfd = open(spool_segment_name(spool, spool->rseq, name, FILENAME_MAX), O_RDONLY);
+            if( spool->rfd < 0 ) {
+                if( spool->rseq == wseq )
+                    return NULL;
+                spool_segment_done(spool);  // segment not exists
+                continue;
+            }
+        }
+
+        n = pread(spool->rfd, entry, sizeof(ST_SPOOL_ENTRY), spool->rpos);
+        if( n == 0 && spool->rseq < wseq ) {   // end of the segment
+            spool_segment_done(spool);
+            continue;
+        }
+
+        if( n == sizeof(ST_SPOOL_ENTRY) && entry->magic == SPOOL_MAGIC && entry->size && entry->size <= SPOOL_MSG_MAX
+                && pread(spool->rfd, &spool->rbuf[sizeof(ST_SPOOL_ENTRY)], entry->size, spool->rpos + sizeof(ST_SPOOL_ENTRY)) == entry->size
+                && CRC32(0, (unsigned char *)&spool->rbuf[sizeof(ST_SPOOL_ENTRY)], entry->size) == entry->crc ) {
+            spool->rnext = spool->rpos + sizeof(ST_SPOOL_ENTRY) + entry->size;
+            *size = entry->size;
+            return &spool->rbuf[sizeof(ST_SPOOL_ENTRY)];
+        }
+
+        if( spool->rseq == wseq )   // current segment written under lock, so never damaged
+            return NULL;
+
+        logging("spool: segment %llx damaged at %lld, rest of segment skipped\n", (unsigned long long)spool->rseq, (long long)spool->rpos);
+        spool_segment_done(spool);
+    }   // while( spool )
+
+    return NULL;
+}
+//------------------------------------------------------------------------------
+
+// reader: message from spool_read written to database, go to the next message
+void spool_commit(ST_SPOOL *spool)
+{
+    if( !spool || spool->rnext <= spool->rpos )
+        return;
+
+    spool->rpos = spool->rnext;
+    if( ++spool->committed >= SPOOL_SAVE_COMMITS )
+        spool_save_position(spool);
+}
+//------------------------------------------------------------------------------
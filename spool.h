@@ -0,0 +1,62 @@
+/*
+    spool.h
+    on-disk spool of the messages to database (db_spool),
+    absorbs overflow of the queue & database outages, see spool.c
+*/
+#ifndef __SPOOL__
+#define __SPOOL__
+
+#include <stdint.h>
+#include <stdio.h>      /* FILENAME_MAX */
+#include <time.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include "ring.h"
+
+#define SPOOL_SEGMENT_SIZE (16*1024*1024)   // default size of the segment file
+#define SPOOL_SYNC_BYTES (1024*1024)        // fdatasync after this number of the written bytes
+#define SPOOL_SYNC_TIME (1)                 // or after this number of seconds
+#define SPOOL_MSG_MAX (64*1024)             // max. size of the message
+
+// header of the message in segment file, then message
+#pragma pack( push, 1 )
+typedef struct {
+    uint32_t magic;     // SPOOL_MAGIC
+    uint32_t size;      // size of the message, bytes
+    uint32_t crc;       // CRC32 of the message
+} ST_SPOOL_ENTRY;
+#pragma pack( pop )
+
+typedef struct {
+    pthread_mutex_t lock;           // writers
+    char path[FILENAME_MAX];        // directory of the segments
+    size_t segment_size;
+    // writers (workers & database thread), under lock
+    int wfd;                        // current segment
+    volatile uint64_t wseq;         // number of the current segment
+    volatile off_t wpos;            // size of the current segment
+    size_t unsynced;                // bytes written after last fdatasync
+    time_t synced;                  // time of the last fdatasync
+    // reader (database thread only)
+    int rfd;                        // segment being replayed
+    uint64_t rseq;                  // number of the segment being replayed
+    off_t rpos;                     // offset of the next message in it
+    off_t rnext;                    // offset after message returned by spool_read
+    unsigned int committed;         // messages committed after last save of the position
+    char rbuf[sizeof(ST_SPOOL_ENTRY) + SPOOL_MSG_MAX];
+} ST_SPOOL;
+
+extern ST_SPOOL *db_spools[DB_SINKS_MAX];  // glonassd.c, spool of each database library, NULL if db_spool not set
+
+ST_SPOOL *spool_open(char *path, size_t segment_size);
+void spool_close(ST_SPOOL *spool);
+void spool_sync(ST_SPOOL *spool, int force);
+// writers, any thread
+int spool_write(ST_SPOOL *spool, char *msg, size_t size);
+unsigned int spool_ring(ST_SPOOL *spool, ST_RING *ring);
+// reader, database thread only
+int spool_pending(ST_SPOOL *spool);
+char *spool_read(ST_SPOOL *spool, size_t *size);
+void spool_commit(ST_SPOOL *spool);
+
+#endif
@@ -35,8 +35,9 @@ void logg(ST_WORKER *worker, int it_error, char *msg)
    parcel - the raw data from socket
    parcel_size - it length
    answer - pointer to ST_ANSWER structure
+   session - decoder state of the connection (see de.h)
 */
-void terminal_decode(char *parcel, int parcel_size, ST_ANSWER *answer, ST_WORKER *worker)
+void terminal_decode(char *parcel, int parcel_size, ST_ANSWER *answer, ST_WORKER *worker, void *session)
 {
 	ST_RECORD *record = NULL;
 	char cImei[16], cTime[10], cDate[10], cCmd[10], cStatus[10], cLon, cLat, cValid;
@@ -87,7 +88,7 @@ void terminal_decode(char *parcel, int parcel_size, ST_ANSWER *answer, ST_WORKER
 
 				if( answer->count < MAX_RECORDS - 1 )
 					answer->count++;
-				record = &answer->records[answer->count - 1];
+				record = record_reset(&answer->records[answer->count - 1]);
 
 				snprintf(record->tracker, SIZE_TRACKER_FIELD, "TQ");
 				snprintf(record->hard, SIZE_TRACKER_FIELD, "%d", 1);
@@ -147,9 +148,10 @@ void terminal_decode(char *parcel, int parcel_size, ST_ANSWER *answer, ST_WORKER
    reccount - number of struct in array, and returning (negative if authentificate required)
    buffer - buffer for encoded data
    bufsize - size of buffer
+   session - encoder state of the connection (see de.h)
    return size of data in the buffer for encoded data
 */
-int terminal_encode(ST_RECORD *records, int reccount, char *buffer, int bufsize)
+int terminal_encode(ST_RECORD *records, int reccount, char *buffer, int bufsize, void *session)
 {
 	int top = 0;
 	return top;
@@ -0,0 +1,803 @@
+/*
+    uring.c
+    io_uring backend for the event loops (io_model = uring), see reactor.c
+    note:
+    1. liburing not used, ring accessed through system calls & mmap directly.
+    2. Every operation identified by user_data: pointer to object + operation
+    type in low 2 bits (objects aligned at least to 4 bytes).
+    3. Terminal data received by multishot recv into provided buffers ring,
+    processed without copy, answers sent by IORING_OP_SEND, submitted
+    together with waiting next events (one system call per loop iteration).
+    4. Worker freed only after all its operations completed (pending == 0).
+    5. If kernel not support multishot recv (Linux < 6.0), event loops use epoll.
+    6. Recv completes with data as received, so terminals of the listeners
+    without terminal_frame_length never come here (listeners_start in glonassd.c).
+
+    help:
+    https://kernel.dk/io_uring.pdf
+    https://man7.org/linux/man-pages/man7/io_uring.7.html
+    https://man7.org/linux/man-pages/man3/io_uring_setup_buf_ring.3.html
+    https://man7.org/linux/man-pages/man3/io_uring_prep_recv_multishot.3.html
+*/
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <sys/syscall.h>    /* syscall */
+#include <stdlib.h> /* malloc */
+#include <string.h> /* memset */
+#include <unistd.h> /* close */
+#include <errno.h>  /* errno */
+#include <signal.h> /* _NSIG */
+#include <time.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/mman.h>
+#include "glonassd.h"
+#include "worker.h"
+#include "reactor.h"
+#include "uring.h"
+#include "lib.h"
+#include "logger.h"
+
+#ifdef __has_include
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#endif
+#endif
+
+#if defined(IORING_RECV_MULTISHOT) && defined(IORING_ACCEPT_MULTISHOT) && defined(IORING_ASYNC_CANCEL_ANY) && defined(__NR_io_uring_setup)
+#define HAVE_URING 1
+#endif
+
+#ifdef HAVE_URING
+
+// type of the operation in low bits of user_data
+#define URING_EVENT  (0)    // read eventfd, object - ST_REACTOR
+#define URING_ACCEPT (1)    // multishot accept, object - listener socket in ST_REACTOR.sockets
+#define URING_RECV   (2)    // multishot recv, object - ST_WORKER
+#define URING_SEND   (3)    // send answer, object - ST_WORKER
+#define URING_TYPE_MASK (3)
+
+// distance between provided buffers, +1 byte after data for terminating 0
+#define URING_BUFFER_STRIDE (URING_BUFFER_SIZE + 8)
+#define URING_BGID (0)
+
+// io_uring of the event loop
+typedef struct {
+    int fd;
+    unsigned int *sq_head, *sq_tail, *sq_mask, *sq_array;
+    unsigned int sq_entries;
+    unsigned int sq_local;      // tail of the prepared submissions
+    struct io_uring_sqe *sqes;
+    unsigned int *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_cqe *cqes;
+    void *sq_ring, *cq_ring;
+    size_t sq_ring_size, cq_ring_size, sqes_size;
+    struct io_uring_buf_ring *buf_ring;    // provided buffers for recv
+    size_t buf_ring_size;
+    unsigned short buf_tail;
+    char *buffers;
+    uint64_t event_value;       // value of the eventfd, read by URING_EVENT
+    ST_WORKER *closing;         // disconnected terminals, waiting for pending operations
+} ST_URING;
+
+// answer to terminal, waiting for send
+typedef struct ST_URING_TX {
+    struct ST_URING_TX *next;
+    size_t len;     // size of the answer
+    size_t sent;    // bytes already sent
+    char data[];
+} ST_URING_TX;
+
+/*
+    utilite functions
+*/
+
+// free io_uring
+static void uring_destroy(ST_URING *u)
+{
+    if( !u )
+        return;
+
+    if( u->fd != BAD_OBJ )
+        close(u->fd);   // kernel cancel all operations
+    if( u->sqes && u->sqes != MAP_FAILED )
+        munmap(u->sqes, u->sqes_size);
+    if( u->cq_ring && u->cq_ring != MAP_FAILED && u->cq_ring != u->sq_ring )
+        munmap(u->cq_ring, u->cq_ring_size);
+    if( u->sq_ring && u->sq_ring != MAP_FAILED )
+        munmap(u->sq_ring, u->sq_ring_size);
+    if( u->buf_ring && u->buf_ring != MAP_FAILED )
+        munmap(u->buf_ring, u->buf_ring_size);
+    if( u->buffers )
+        free(u->buffers);
+
+    free(u);
+}
+//------------------------------------------------------------------------------
+
+// return provided buffer to kernel, visible to kernel after uring_buffers_commit
+static void uring_buffer_add(ST_URING *u, unsigned short bid)
+{
+    struct io_uring_buf *buf = &u->buf_ring->bufs[u->buf_tail & (URING_BUFFERS - 1)];
+
+    buf->addr = (unsigned long)&u->buffers[bid * URING_BUFFER_STRIDE];
+    buf->len = URING_BUFFER_SIZE;
+    buf->bid = bid;
+    ++u->buf_tail;
+}
+//------------------------------------------------------------------------------
+
+static void uring_buffers_commit(ST_URING *u)
+{
+    __atomic_store_n(&u->buf_ring->tail, u->buf_tail, __ATOMIC_RELEASE);
+}
+//------------------------------------------------------------------------------
+
+// create io_uring with provided buffers ring
+static ST_URING *uring_create(void)
+{
+    ST_URING *u;
+    struct io_uring_params params;
+    struct io_uring_buf_reg reg;
+    unsigned int i;
+
+    u = (ST_URING *)calloc(1, sizeof(ST_URING));
+    if( !u )
+        return NULL;
+
+    memset(&params, 0, sizeof(struct io_uring_params));
+    params.flags = IORING_SETUP_CQSIZE;
+    params.cq_entries = URING_ENTRIES * URING_CQ_FACTOR;
+
+    u->fd = syscall(__NR_io_uring_setup, URING_ENTRIES, &params);
+    if( u->fd < 0 || !(params.features & IORING_FEAT_EXT_ARG) || !(params.features & IORING_FEAT_NODROP) ) {
+        if( u->fd < 0 )
+            u->fd = BAD_OBJ;
+        uring_destroy(u);
+        return NULL;
+    }
+
+    // map rings
+    u->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+    u->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if( params.features & IORING_FEAT_SINGLE_MMAP )
+        u->sq_ring_size = u->cq_ring_size = MAX(u->sq_ring_size, u->cq_ring_size);
+
+    u->sq_ring = mmap(NULL, u->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQ_RING);
+    if( u->sq_ring == MAP_FAILED ) {
+        uring_destroy(u);
+        return NULL;
+    }
+
+    if( params.features & IORING_FEAT_SINGLE_MMAP )
+        u->cq_ring = u->sq_ring;
+    else
+        u->cq_ring = mmap(NULL, u->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_CQ_RING);
+    if( u->cq_ring == MAP_FAILED ) {
+        uring_destroy(u);
+        return NULL;
+    }
+
+    u->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    u->sqes = mmap(NULL, u->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQES);
+    if( u->sqes == MAP_FAILED ) {
+        uring_destroy(u);
+        return NULL;
+    }
+
+    u->sq_head = (unsigned int *)((char *)u->sq_ring + params.sq_off.head);
+    u->sq_tail = (unsigned int *)((char *)u->sq_ring + params.sq_off.tail);
+    u->sq_mask = (unsigned int *)((char *)u->sq_ring + params.sq_off.ring_mask);
+    u->sq_array = (unsigned int *)((char *)u->sq_ring + params.sq_off.array);
+    u->sq_entries = params.sq_entries;
+    u->sq_local = *u->sq_tail;
+    u->cq_head = (unsigned int *)((char *)u->cq_ring + params.cq_off.head);
+    u->cq_tail = (unsigned int *)((char *)u->cq_ring + params.cq_off.tail);
+    u->cq_mask = (unsigned int *)((char *)u->cq_ring + params.cq_off.ring_mask);
+    u->cqes = (struct io_uring_cqe *)((char *)u->cq_ring + params.cq_off.cqes);
+
+    // submission queue entries used in order
+    for(i = 0; i < u->sq_entries; i++)
+        u->sq_array[i] = i;
+
+    // provided buffers ring
+    u->buf_ring_size = URING_BUFFERS * sizeof(struct io_uring_buf);
+    u->buf_ring = mmap(NULL, u->buf_ring_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    u->buffers = (char *)malloc(URING_BUFFERS * URING_BUFFER_STRIDE);
+    if( u->buf_ring == MAP_FAILED || !u->buffers ) {
+        uring_destroy(u);
+        return NULL;
+    }
+
+    memset(&reg, 0, sizeof(struct io_uring_buf_reg));
+    reg.ring_addr = (unsigned long)u->buf_ring;
+    reg.ring_entries = URING_BUFFERS;
+    reg.bgid = URING_BGID;
+    if( syscall(__NR_io_uring_register, u->fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0 ) {
+        uring_destroy(u);
+        return NULL;
+    }
+
+    for(i = 0; i < URING_BUFFERS; i++)
+        uring_buffer_add(u, i);
+    uring_buffers_commit(u);
+
+    return u;
+}
+//------------------------------------------------------------------------------
+
+/*
+    submit prepared operations & wait for completions
+    wait_nr - number of completions to wait, 0 - not wait
+    timeout - max. time of waiting, milliseconds
+    return number of submitted operations or -1 if error (see errno)
+*/
+static int uring_enter(ST_URING *u, unsigned int wait_nr, int timeout)
+{
+    struct io_uring_getevents_arg arg;
+    struct __kernel_timespec ts;
+    unsigned int to_submit, flags = 0;
+
+    __atomic_store_n(u->sq_tail, u->sq_local, __ATOMIC_RELEASE);
+    to_submit = u->sq_local - __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE);
+
+    if( !wait_nr )
+        return syscall(__NR_io_uring_enter, u->fd, to_submit, 0, 0, NULL, 0);
+
+    memset(&arg, 0, sizeof(struct io_uring_getevents_arg));
+    ts.tv_sec = timeout / 1000;
+    ts.tv_nsec = (timeout % 1000) * 1000000L;
+    arg.sigmask_sz = _NSIG / 8;
+    arg.ts = (unsigned long)&ts;
+    flags = IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG;
+
+    return syscall(__NR_io_uring_enter, u->fd, to_submit, wait_nr, flags, &arg, sizeof(struct io_uring_getevents_arg));
+}
+//------------------------------------------------------------------------------
+
+// get free submission queue entry, submit prepared if queue full
+static struct io_uring_sqe *uring_sqe(ST_URING *u)
+{
+    struct io_uring_sqe *sqe;
+
+    if( u->sq_local - __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE) >= u->sq_entries ) {
+        uring_enter(u, 0, 0);
+        if( u->sq_local - __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE) >= u->sq_entries )
+            return NULL;
+    }
+
+    sqe = &u->sqes[u->sq_local & *u->sq_mask];
+    memset(sqe, 0, sizeof(struct io_uring_sqe));
+    ++u->sq_local;
+
+    return sqe;
+}
+//------------------------------------------------------------------------------
+
+// read eventfd of the event loop: new terminals attached by main thread
+static int uring_prep_event(ST_URING *u, ST_REACTOR *reactor)
+{
+    struct io_uring_sqe *sqe = uring_sqe(u);
+
+    if( !sqe )
+        return 0;
+
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = reactor->event;
+    sqe->addr = (unsigned long)&u->event_value;
+    sqe->len = sizeof(uint64_t);
+    sqe->user_data = (unsigned long)reactor | URING_EVENT;
+
+    return 1;
+}
+//------------------------------------------------------------------------------
+
+// accept terminals on own listener socket of the event loop
+static int uring_prep_accept(ST_URING *u, int *psocket)
+{
+    struct io_uring_sqe *sqe = uring_sqe(u);
+
+    if( !sqe )
+        return 0;
+
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = *psocket;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+    sqe->user_data = (unsigned long)psocket | URING_ACCEPT;
+
+    return 1;
+}
+//------------------------------------------------------------------------------
+
+// receive terminal messages into provided buffers
+static int uring_prep_recv(ST_URING *u, ST_WORKER *worker)
+{
+    struct io_uring_sqe *sqe = uring_sqe(u);
+
+    if( !sqe )
+        return 0;
+
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = worker->client_socket;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = URING_BGID;
+    sqe->user_data = (unsigned long)worker | URING_RECV;
+    ++worker->pending;
+
+    return 1;
+}
+//------------------------------------------------------------------------------
+
+// send first answer from the queue of the answers to terminal
+static int uring_prep_send(ST_URING *u, ST_WORKER *worker)
+{
+    ST_URING_TX *tx = (ST_URING_TX *)worker->tx_first;
+    struct io_uring_sqe *sqe = uring_sqe(u);
+
+    if( !sqe )
+        return 0;
+
+    sqe->opcode = IORING_OP_SEND;
+    sqe->fd = worker->client_socket;
+    sqe->addr = (unsigned long)&tx->data[tx->sent];
+    sqe->len = tx->len - tx->sent;
+    sqe->msg_flags = MSG_NOSIGNAL;
+    sqe->user_data = (unsigned long)worker | URING_SEND;
+    ++worker->pending;
+
+    return 1;
+}
+//------------------------------------------------------------------------------
+
+// free queue of the answers to terminal
+static void uring_tx_free(ST_WORKER *worker)
+{
+    ST_URING_TX *tx, *next;
+
+    tx = (ST_URING_TX *)worker->tx_first;
+    while( tx ) {
+        next = tx->next;
+        free(tx);
+        tx = next;
+    }
+    worker->tx_first = worker->tx_last = NULL;
+}
+//------------------------------------------------------------------------------
+
+/*
+    send answer to terminal (ST_WORKER.answer_send, called from worker_process)
+    answer copied into the queue & sent asynchronously
+    return size of the answer or -1 if error
+*/
+static ssize_t uring_answer(ST_WORKER *worker, char *answer, size_t size)
+{
+    ST_REACTOR *reactor = (ST_REACTOR *)worker->reactor;
+    ST_URING_TX *tx;
+
+    tx = (ST_URING_TX *)malloc(sizeof(ST_URING_TX) + size);
+    if( !tx )
+        return -1;
+
+    tx->next = NULL;
+    tx->len = size;
+    tx->sent = 0;
+    memcpy(tx->data, answer, size);
+
+    if( worker->tx_last ) {    // previous answer not sent yet, send after it
+        ((ST_URING_TX *)worker->tx_last)->next = tx;
+        worker->tx_last = tx;
+        return size;
+    }
+
+    worker->tx_first = worker->tx_last = tx;
+    if( !uring_prep_send((ST_URING *)reactor->uring, worker) ) {
+        uring_tx_free(worker);
+        errno = EBUSY;
+        return -1;
+    }
+
+    return size;
+}
+//------------------------------------------------------------------------------
+
+// free terminal, all operations of it completed
+static void uring_release(ST_URING *u, ST_WORKER *worker)
+{
+    // remove from disconnected terminals list
+    if( worker->prev )
+        worker->prev->next = worker->next;
+    else
+        u->closing = worker->next;
+    if( worker->next )
+        worker->next->prev = worker->prev;
+
+    uring_tx_free(worker);
+    worker_release(worker);
+}
+//------------------------------------------------------------------------------
+
+/*
+    disconnect terminal: socket shutdown cause completion of all its operations,
+    worker freed after last completion
+*/
+static void uring_detach(ST_REACTOR *reactor, ST_WORKER *worker)
+{
+    ST_URING *u = (ST_URING *)reactor->uring;
+
+    if( !worker->closing ) {
+        worker->closing = 1;
+        reactor_unlink(reactor, worker);
+        --reactor->count;
+
+        // move to disconnected terminals list
+        worker->prev = NULL;
+        worker->next = u->closing;
+        if( u->closing )
+            u->closing->prev = worker;
+        u->closing = worker;
+
+        shutdown(worker->client_socket, SHUT_RDWR);
+    }
+
+    if( !worker->pending )
+        uring_release(u, worker);
+}
+//------------------------------------------------------------------------------
+
+// start serve terminal in the event loop
+static void uring_serve(ST_REACTOR *reactor, ST_WORKER *worker)
+{
+    worker->answer_send = uring_answer;
+    worker->last_activity = time(NULL);
+    reactor_link(reactor, worker);
+    ++reactor->count;
+
+    if( !uring_prep_recv((ST_URING *)reactor->uring, worker) ) {
+        logging("%s[%ld]: io_uring submission queue is full\n", worker->listener->name, syscall(SYS_gettid));
+        uring_detach(reactor, worker);
+        return;
+    }
+
+    if( stConfigServer.log_enable > 1 && worker->listener->log_all )
+        logging("%s[%d:%ld]: terminal %s served by reactor %d\n", worker->listener->name, worker->listener->port, syscall(SYS_gettid), worker->ip, reactor->index);
+}
+//------------------------------------------------------------------------------
+
+// treat completed operation
+static void uring_complete(ST_REACTOR *reactor, ST_URING *u, struct io_uring_cqe *cqe)
+{
+    ST_WORKER *worker, *next;
+    ST_URING_TX *tx;
+    struct sockaddr_in client_addr;
+    socklen_t sockaddr_in_size;
+    unsigned short bid;
+    char *buf;
+    int *psocket, disconnect = 0;
+
+    switch( cqe->user_data & URING_TYPE_MASK ) {
+    case URING_EVENT:    // new terminals attached
+
+        worker = reactor_incoming(reactor);
+        while( worker ) {
+            next = worker->next;
+            uring_serve(reactor, worker);
+            worker = next;
+        }
+
+        if( cqe->res >= 0 )
+            uring_prep_event(u, reactor);
+        else
+            logging("reactor[%d:%ld]: read(event) error %d: %s\n", reactor->index, syscall(SYS_gettid), -cqe->res, strerror(-cqe->res));
+
+        break;
+    case URING_ACCEPT:    // terminal connected to own listener socket
+
+        psocket = (int *)(unsigned long)(cqe->user_data & ~(uint64_t)URING_TYPE_MASK);
+
+        if( cqe->res >= 0 ) {
+            sockaddr_in_size = sizeof(struct sockaddr_in);
+            memset(&client_addr, 0, sizeof(struct sockaddr_in));
+            getpeername(cqe->res, (struct sockaddr *)&client_addr, &sockaddr_in_size);
+
+            worker = reactor_worker(reactor, psocket - reactor->sockets, cqe->res, &client_addr);
+            if( worker )
+                uring_serve(reactor, worker);
+        }
+        else if( cqe->res != -EAGAIN && cqe->res != -EINTR ) {
+            logging("reactor[%d:%ld]: listener[%s] accept() error %d: %s\n", reactor->index, syscall(SYS_gettid), stListeners.listener[psocket - reactor->sockets].name, -cqe->res, strerror(-cqe->res));
+        }
+
+        // multishot accept stopped, restart it
+        if( !(cqe->flags & IORING_CQE_F_MORE) && cqe->res != -EBADF && cqe->res != -EINVAL )
+            uring_prep_accept(u, psocket);
+
+        break;
+    case URING_RECV:    // terminal message received
+
+        worker = (ST_WORKER *)(unsigned long)(cqe->user_data & ~(uint64_t)URING_TYPE_MASK);
+
+        if( cqe->res > 0 && (cqe->flags & IORING_CQE_F_BUFFER) ) {
+            bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+            buf = &u->buffers[bid * URING_BUFFER_STRIDE];
+
+            if( !worker->closing && !reactor_process(reactor, worker, buf, cqe->res) )
+                disconnect = 1;
+
+            uring_buffer_add(u, bid);
+        }
+
+        if( !(cqe->flags & IORING_CQE_F_MORE) ) {    // multishot recv stopped
+            --worker->pending;
+
+            if( !disconnect && !worker->closing && (cqe->res > 0 || cqe->res == -ENOBUFS) ) {
+                // stopped by kernel, not by terminal: restart it
+                if( uring_prep_recv(u, worker) )
+                    break;
+            }
+            else if( cqe->res <= 0 && cqe->res != -ECANCELED && !worker->closing ) {
+                if( stConfigServer.log_enable > 1 && worker->listener->log_all )
+                    logging("%s[%d:%ld]: bytes_read (%d) <= 0\n", worker->listener->name, worker->listener->port, syscall(SYS_gettid), cqe->res);
+            }
+
+            disconnect = 1;
+        }
+
+        if( disconnect || (worker->closing && !worker->pending) )
+            uring_detach(reactor, worker);
+
+        break;
+    case URING_SEND:    // answer sent to terminal
+
+        worker = (ST_WORKER *)(unsigned long)(cqe->user_data & ~(uint64_t)URING_TYPE_MASK);
+        --worker->pending;
+
+        if( cqe->res < 0 ) {
+            if( !worker->closing && (worker->listener->log_err || (stConfigServer.log_enable > 1 && worker->listener->log_all)) )
+                logging("%s[%d:%ld]: sended to terminal error %d: %s\n", worker->listener->name, worker->listener->port, syscall(SYS_gettid), -cqe->res, strerror(-cqe->res));
+            disconnect = 1;
+        }
+        else if( !worker->closing ) {
+            tx = (ST_URING_TX *)worker->tx_first;
+            tx->sent += cqe->res;
+
+            if( tx->sent >= tx->len ) {    // answer sent, remove from queue
+                worker->tx_first = tx->next;
+                if( !worker->tx_first )
+                    worker->tx_last = NULL;
+                free(tx);
+            }
+
+            if( worker->tx_first && !uring_prep_send(u, worker) )
+                disconnect = 1;
+        }
+
+        if( disconnect || (worker->closing && !worker->pending) )
+            uring_detach(reactor, worker);
+
+        break;
+    }	// switch( cqe->user_data & URING_TYPE_MASK )
+}
+//------------------------------------------------------------------------------
+
+// number of not completed operations of the terminals
+static unsigned int uring_pending(ST_REACTOR *reactor, ST_URING *u)
+{
+    ST_WORKER *worker;
+    unsigned int pending = 0;
+
+    for(worker = reactor->first; worker; worker = worker->next)
+        pending += worker->pending;
+    for(worker = u->closing; worker; worker = worker->next)
+        pending += worker->pending;
+
+    return pending;
+}
+//------------------------------------------------------------------------------
+
+/*
+    cancel all operations & wait their completions, so kernel
+    not reads answers to terminals after they freed (see exit_uring)
+    return 1 if all operations of the terminals completed & 0 if not
+*/
+static int uring_cancel(ST_REACTOR *reactor, ST_URING *u)
+{
+    ST_WORKER *worker;
+    struct io_uring_cqe *cqe;
+    struct io_uring_sqe *sqe;
+    unsigned int head, tail;
+    int timeouts = 0;
+
+    sqe = uring_sqe(u);
+    if( !sqe )
+        return 0;
+
+    // completion of the cancel itself ignored: object is NULL
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->cancel_flags = IORING_ASYNC_CANCEL_ANY;
+    sqe->user_data = 0;
+
+    while( uring_pending(reactor, u) ) {
+        if( uring_enter(u, 1, REACTOR_TICK) < 0 ) {
+            if( (errno != ETIME && errno != EINTR && errno != EAGAIN && errno != EBUSY) || ++timeouts > 5 )
+                return 0;
+        }
+
+        head = *u->cq_head;
+        tail = __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE);
+        for(; head != tail; head++) {
+            cqe = &u->cqes[head & *u->cq_mask];
+            worker = (ST_WORKER *)(unsigned long)(cqe->user_data & ~(uint64_t)URING_TYPE_MASK);
+
+            switch( cqe->user_data & URING_TYPE_MASK ) {
+            case URING_RECV:
+                if( !(cqe->flags & IORING_CQE_F_MORE) )
+                    --worker->pending;
+                break;
+            case URING_SEND:
+                --worker->pending;
+                break;
+            }
+        }
+        __atomic_store_n(u->cq_head, head, __ATOMIC_RELEASE);
+    }
+
+    return 1;
+}
+//------------------------------------------------------------------------------
+
+/*
+    test kernel support of the used io_uring features:
+    multishot recv into provided buffers (multishot accept supported too)
+    return 1 if supported & 0 if not
+*/
+int uring_probe(void)
+{
+    ST_URING *u;
+    ST_WORKER worker;
+    struct io_uring_cqe *cqe;
+    int sv[2], retval = 0;
+
+    u = uring_create();
+    if( !u )
+        return 0;
+
+    if( socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0 ) {
+        uring_destroy(u);
+        return 0;
+    }
+
+    memset(&worker, 0, sizeof(ST_WORKER));
+    worker.client_socket = sv[0];
+    uring_prep_recv(u, &worker);
+
+    if( uring_enter(u, 0, 0) == 1 && write(sv[1], "?", 1) == 1 ) {
+        uring_enter(u, 1, 1000);
+
+        if( *u->cq_head != __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE) ) {
+            cqe = &u->cqes[*u->cq_head & *u->cq_mask];
+            retval = (cqe->res == 1 && (cqe->flags & IORING_CQE_F_BUFFER) && (cqe->flags & IORING_CQE_F_MORE));
+        }
+    }
+
+    close(sv[0]);
+    close(sv[1]);
+    uring_destroy(u);
+
+    return retval;
+}
+//------------------------------------------------------------------------------
+
+/*
+    event loop thread function, io_uring backend
+    st_reactor - pointer to ST_REACTOR structure (reactor.h)
+*/
+void *uring_thread(void *st_reactor)
+{
+    ST_REACTOR *reactor = (ST_REACTOR *)st_reactor;
+    ST_URING *u;
+    unsigned int head, tail, l;
+
+    // error handler:
+    void exit_uring(void *arg) {
+        ST_REACTOR *reactor = (ST_REACTOR *)arg;
+        ST_URING *u = (ST_URING *)reactor->uring;
+        ST_WORKER *worker;
+
+        // kernel must not send answers after they freed
+        if( !uring_cancel(reactor, u) )
+            logging("reactor[%d:%ld]: io_uring operations not completed, close ring\n", reactor->index, syscall(SYS_gettid));
+        close(u->fd);
+        u->fd = BAD_OBJ;
+
+        // answers of the served terminals
+        for(worker = reactor->first; worker; worker = worker->next)
+            uring_tx_free(worker);
+
+        // disconnected terminals, waiting for pending operations
+        while( u->closing ) {
+            u->closing->pending = 0;
+            uring_release(u, u->closing);
+        }
+
+        uring_destroy(u);
+        reactor->uring = NULL;
+    }
+    //------------------------------------------------------------------------------
+
+    // cancel only while waiting events, see reactors_stop
+    pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+
+    reactor_pin(reactor);
+
+    u = uring_create();
+    if( !u ) {
+        logging("reactor[%d:%ld]: io_uring create error %d: %s, use epoll\n", reactor->index, syscall(SYS_gettid), errno, strerror(errno));
+        return reactor_thread(st_reactor);
+    }
+    reactor->uring = u;
+
+    // install error handler:
+    pthread_cleanup_push(exit_uring, reactor);
+
+    // wait new terminals from main thread & on own listener sockets
+    uring_prep_event(u, reactor);
+    if( reactor->sockets ) {
+        for(l = 0; l < stListeners.count; l++) {
+            if( reactor->sockets[l] != BAD_OBJ )
+                uring_prep_accept(u, &reactor->sockets[l]);
+        }
+    }
+
+    while( 1 ) {
+
+        // submit prepared operations & wait completions
+        pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);  // can disturb :)
+        pthread_testcancel();
+        if( uring_enter(u, 1, REACTOR_TICK) < 0 && errno != ETIME && errno != EINTR && errno != EAGAIN && errno != EBUSY ) {
+            logging("reactor[%d:%ld]: io_uring_enter() error %d: %s\n", reactor->index, syscall(SYS_gettid), errno, strerror(errno));
+            break;
+        }
+        pthread_testcancel();
+        pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);    // do not disturb :)
+
+        // treat completions
+        head = *u->cq_head;
+        tail = __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE);
+        for(; head != tail; head++)
+            uring_complete(reactor, u, &u->cqes[head & *u->cq_mask]);
+        __atomic_store_n(u->cq_head, head, __ATOMIC_RELEASE);
+
+        // return processed buffers to kernel
+        uring_buffers_commit(u);
+
+        reactor_timeouts(reactor, uring_detach);
+
+    }	// while( 1 )
+
+    pthread_cleanup_pop(1);
+
+    return NULL;
+}
+//------------------------------------------------------------------------------
+
+#else   // HAVE_URING
+
+int uring_probe(void)
+{
+    return 0;
+}
+//------------------------------------------------------------------------------
+
+void *uring_thread(void *st_reactor)
+{
+    return reactor_thread(st_reactor);
+}
+//------------------------------------------------------------------------------
+
+#endif  // HAVE_URING
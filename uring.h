@@ -0,0 +1,16 @@
+#ifndef __URING__
+#define __URING__
+
+#include "reactor.h"
+
+// size of the submission queue, completion queue is URING_CQ_FACTOR times bigger
+#define URING_ENTRIES (1024)
+#define URING_CQ_FACTOR (4)
+// number of the provided buffers for recv (power of 2) & size of one buffer
+#define URING_BUFFERS (256)
+#define URING_BUFFER_SIZE (16384)
+
+int uring_probe(void);
+void *uring_thread(void *st_reactor);
+
+#endif
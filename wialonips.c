@@ -23,11 +23,12 @@
    parcel - the raw data from socket
    parcel_size - it length
    answer - pointer to ST_ANSWER structure
+   session - decoder state of the connection (see de.h)
 */
-void terminal_decode(char *parcel, int parcel_size, ST_ANSWER *answer, ST_WORKER *worker)
+void terminal_decode(char *parcel, int parcel_size, ST_ANSWER *answer, ST_WORKER *worker, void *session)
 {
 	ST_RECORD *record = NULL;
-	char cTime[10], cDate[10], cLon, cLat, *cRec, *cRec1;
+	char cTime[10], cDate[10], cLon, cLat, *cRec, *cRec1, *saveptr, *saveptr1;
 	struct tm tm_data;
 	time_t ulliTmp;
 	double dLon, dLat, dAltitude, dHDOP;
@@ -46,11 +47,11 @@ void terminal_decode(char *parcel, int parcel_size, ST_ANSWER *answer, ST_WORKER
 
 	answer->size = 0;	// :)
 
-    cRec = strtok(parcel, "\r\n");
+    cRec = strtok_r(parcel, "\r\n", &saveptr);
 	while( cRec ) {
 
         if( strlen(cRec) < 5 ){
-    		cRec = strtok(NULL, "\r\n");
+    		cRec = strtok_r(NULL, "\r\n", &saveptr);
             continue;
         }
 
@@ -121,7 +122,7 @@ void terminal_decode(char *parcel, int parcel_size, ST_ANSWER *answer, ST_WORKER
             if( iFields >= 8 ) {
 				if( answer->count < MAX_RECORDS - 1 )
 					answer->count++;
-				record = &answer->records[answer->count - 1];
+				record = record_reset(&answer->records[answer->count - 1]);
 
 				snprintf(record->tracker, SIZE_TRACKER_FIELD, "WIPS");
 				snprintf(record->hard, SIZE_TRACKER_FIELD, "%d", 1);
@@ -225,7 +226,7 @@ void terminal_decode(char *parcel, int parcel_size, ST_ANSWER *answer, ST_WORKER
             if( iFields >= 8 ) {
 				if( answer->count < MAX_RECORDS - 1 )
 					answer->count++;
-				record = &answer->records[answer->count - 1];
+				record = record_reset(&answer->records[answer->count - 1]);
 
 				snprintf(record->tracker, SIZE_TRACKER_FIELD, "WIPS");
 				snprintf(record->hard, SIZE_TRACKER_FIELD, "%d", 1);
@@ -323,7 +324,7 @@ void terminal_decode(char *parcel, int parcel_size, ST_ANSWER *answer, ST_WORKER
                 break;
             }
 
-			cRec1 = strtok(&cRec[3], "|");
+			cRec1 = strtok_r(&cRec[3], "|", &saveptr1);
 
 			while(cRec1) {
                 ++iReadedRecords;   // кол-во считанных сообщений
@@ -345,7 +346,7 @@ void terminal_decode(char *parcel, int parcel_size, ST_ANSWER *answer, ST_WORKER
 
 					if( answer->count < MAX_RECORDS - 1 )
 						answer->count++;
-					record = &answer->records[answer->count - 1];
+					record = record_reset(&answer->records[answer->count - 1]);
 
 					snprintf(record->tracker, SIZE_TRACKER_FIELD, "WIPS");
 					snprintf(record->hard, SIZE_TRACKER_FIELD, "%d", 1);
@@ -396,7 +397,7 @@ void terminal_decode(char *parcel, int parcel_size, ST_ANSWER *answer, ST_WORKER
                     }
                 }
 
-				cRec1 = strtok(NULL, "|");
+				cRec1 = strtok_r(NULL, "|", &saveptr1);
 			}	// while(cRec1)
 
 			iAnswerSize = 7;
@@ -444,22 +445,44 @@ void terminal_decode(char *parcel, int parcel_size, ST_ANSWER *answer, ST_WORKER
 
 		}	// switch( cRec[1] )
 
-		cRec = strtok(NULL, "\r\n");
+		cRec = strtok_r(NULL, "\r\n", &saveptr);
 	}	// while( cRec )
 
 }   // terminal_decode
 //------------------------------------------------------------------------------
 
 
+/*
+   frame length function (see de.h)
+   buf - the raw data from socket
+   len - it length
+   return length of the frame (#type#message\r\n), 0 if unknown yet or BAD_OBJ if not recognized
+*/
+int terminal_frame_length(char *buf, int len)
+{
+	char *cEnd;
+
+	if( !buf || len <= 0 )
+		return 0;
+
+	if( buf[0] != '#' )
+		return BAD_OBJ;
+
+	cEnd = memchr(buf, '\n', len);
+	return (cEnd ? cEnd - buf + 1 : 0);
+}
+//------------------------------------------------------------------------------
+
 /*
    encode Wialon IPS v.2.0 function
    records - pointer to array of ST_RECORD struct.
    reccount - number of struct in array, and returning (negative if authentificate required)
    buffer - buffer for encoded data
    bufsize - size of buffer
+   session - encoder state of the connection (see de.h)
    return size of data in the buffer for encoded data
 */
-int terminal_encode(ST_RECORD *records, int reccount, char *buffer, int bufsize)
+int terminal_encode(ST_RECORD *records, int reccount, char *buffer, int bufsize, void *session)
 {
 	int i, top = 0;
 	struct tm tm_data;
@@ -29,153 +29,141 @@
 #include <pthread.h>
 #include <sys/types.h>
 #include <sys/socket.h>
-#include <sys/un.h>
 #include <fcntl.h>            /* mq_open, O_* constants */
 #include <mqueue.h>
 #include "glonassd.h"
 #include "forwarder.h"
+#include "route.h"
 #include "worker.h"
+#include "record.h"
+#include "ring.h"
+#include "spool.h"
+#include "capture.h"
 #include "lib.h"
 #include "logger.h"
 
+// max. size of the message to database ring buffer (db_queue = ring), bytes
+#define DB_RING_MSG_SIZE (8 * RECORD_PACKED_MAX)
+
 /*
     utilite functions
 */
 
-// create/close forward socket
-static int set_forward_socket(ST_WORKER *config, char *socket_path, int *psocket)
-{
-    struct sockaddr_un addr_un;
-
-    if( socket_path ) {
-        // create and connect socket
-        *psocket = socket(AF_UNIX, SOCK_DGRAM, 0);
-        if( *psocket < 0 ) {
-            logging("%s[%ld]: socket(*psocket) error %d: %s\n", config->listener->name, syscall(SYS_gettid), errno, strerror(errno));
-            return 0;
-        }
-
-        // connect socket
-        memset(&addr_un, 0, sizeof(struct sockaddr_un));
-        addr_un.sun_family = AF_UNIX;
-        snprintf(addr_un.sun_path, sizeof(addr_un.sun_path), "/%s", socket_path);
-        if( connect(*psocket, (struct sockaddr *)&addr_un, sizeof(struct sockaddr_un)) < 0 ) {
-            logging("%s[%ld]: connect(*psocket, %s) error %d: %s\n", config->listener->name, syscall(SYS_gettid), addr_un.sun_path, errno, strerror(errno));
-            close(*psocket);
-            *psocket = BAD_OBJ;
-            return 0;
-        }
-
-        return 1;
-    }
-    else {
-        // disconnect and close socket
-        if( *psocket != BAD_OBJ ) {
-            shutdown(*psocket, SHUT_RDWR);
-            close(*psocket);
-            *psocket = BAD_OBJ;
-        }
-
-        return 0;
-    }
-}
-//------------------------------------------------------------------------------
-
 // test for imei retranslation needded
 unsigned int test_forward(ST_WORKER *config, char *imei, ST_FORWARD_ATTR *forward_attr)
 {
-    unsigned int i, j, retval = 0;
-
-    if( imei[0] && stForwarders.count ) {
-
-        // search imei of the terminal in forwarded terminals list
-        for(i = 0; i < stForwarders.listcount; ++i) {
-            if( !strcmp(imei, stForwarders.terminals[i].imei) ) {    // terminal exists in list
-
-                // search needded forwarder by name & get his protocol
-                for(j = 0; j < stForwarders.count; ++j) {
-                    if( !strcmp(stForwarders.terminals[i].forward, stForwarders.forwarder[j].name) ) {
-                        // forwarder exists
-
-                        // try to create forward socket
-                        if( set_forward_socket(config, stForwarders.terminals[i].forward, &forward_attr[retval].forward_socket) ) {
-                            // encode need?
-                            forward_attr[retval].forward_encode = (0 != strcmp(stForwarders.forwarder[j].app, config->listener->name));
-                            // forwarder index in forwarders list
-                            forward_attr[retval].forward_index = j;
-
-                            ++retval;
+    ST_ROUTES *routes;
+    ST_ROUTE *route;
+    unsigned int probe = 0, epoch, retval = 0, i;
+
+    if( imei[0] ) {
+        // routes of the terminal from hash index (route.c)
+        routes = route_enter(&epoch);
+        while( retval < MAX_FORWARDS && (route = route_next(routes, imei, &probe)) ) {
+            // ring buffer of the forwarder, not freed
+            forward_attr[retval].forward_ring = routes->forwards[route->forward].ring;
+            if( forward_attr[retval].forward_ring ) {
+                // encode need?
+                forward_attr[retval].forward_encode = (0 != strcmp(routes->forwards[route->forward].app, config->listener->name));
+                // forwarder index in forwarders list
+                forward_attr[retval].forward_index = route->forward;
+
+                // forwarders of the same protocol share one encoded packet, first of them is the group
+                forward_attr[retval].forward_group = -1;
+                if( forward_attr[retval].forward_encode && routes->forwards[route->forward].shared ) {
+                    for(i = 0; i < retval; i++) {
+                        if( forward_attr[i].forward_encode && routes->forwards[forward_attr[i].forward_index].shared
+                                && !strcmp(routes->forwards[forward_attr[i].forward_index].app, routes->forwards[route->forward].app) ) {
+                            if( forward_attr[i].forward_group < 0 )
+                                forward_attr[i].forward_group = i;
+                            forward_attr[retval].forward_group = forward_attr[i].forward_group;
+                            break;
                         }
-
-                        break;    // stop search forwarders
                     }
-                }    // for(j = 0;
+                }
 
-            }    // if( !strcmp(imei,
+                ++retval;
+            }
+        }    // while( retval < MAX_FORWARDS
+        route_leave(epoch);
+    }    // if( imei[0] )
 
-            if( retval >= MAX_FORWARDS )
-                break;    // maximum forwarder reached
-        }    // for(i = 0;
+    return retval;
+}
+//------------------------------------------------------------------------------
 
-    }    // if( imei && imei[0] && stForwarders.count )
+/*
+    pack records for forwarders with encode (record.h), once per message
+    records - decoded records, count - number of the records
+    buf - buffer of FORWARD_MSG_SIZE bytes
+    packed - number of the packed records, rest sent in the next message
+    return size of the packed records in bytes
+*/
+static size_t forward_pack(ST_RECORD *records, int count, char *buf, int *packed)
+{
+    size_t full_size = 0, packed_size;
+    int r;
+
+    for(r = 0; r < count && r < MAX_RECORDS; r++) {
+        packed_size = record_pack(&records[r], &buf[full_size], FORWARD_MSG_SIZE - full_size);
+        if( !packed_size )
+            break;
+        full_size += packed_size;
+    }
+    *packed = r;
 
-    return retval;
+    return full_size;
 }
 //------------------------------------------------------------------------------
 
 /*
     forward data to another server, encode in new terminal protocol
-    data - pointer to set of terminal records (ST_RECORD *) or raw terminal data (char *)
-    data_size - number of records (in ST_RECORD *) or size of char * in bytes
-    encode - encode flag (0 if raw data, not 0 if records)
+    data - packed records (forward_pack), raw terminal data or pointer to ST_FORWARD_SHARED
+    data_size - size of the data in bytes, not more than FORWARD_MSG_SIZE
+    len - number of the packed records or size of the raw data
+    encode - ST_FORWARD_MSG.encode
+    data copied into ring buffer of the forwarder after ST_FORWARD_MSG
+    return 1 if data sent or 0 if dropped
 */
-static void send_data_to_forward(ST_WORKER *config, void *data, int data_size, ST_FORWARD_ATTR *fa)
+static int send_data_to_forward(ST_WORKER *config, char *data, size_t data_size, int len, ST_FORWARD_ATTR *fa, int encode)
 {
-    char forward_buf[SOCKET_BUF_SIZE];    // buffer for forward messages
-    ST_FORWARD_MSG *msg = (ST_FORWARD_MSG *)forward_buf;
+    ST_FORWARD_MSG *msg;
     size_t full_size;
+    uint64_t ticket;
+    char *place;
+    int retval = 0;
 
-    if( data && data_size ) {
-
-        if( fa->forward_encode ) {    // data - array of ST_RECORD & data_size - number records in array
-            full_size = sizeof(ST_FORWARD_MSG) + sizeof(ST_RECORD) * data_size;
+    if( data && data_size && len ) {
 
-            if( full_size > SOCKET_BUF_SIZE ) {
-                // truncate records
-                data_size = ceil((SOCKET_BUF_SIZE - sizeof(ST_FORWARD_MSG)) / sizeof(ST_RECORD));
-                full_size = sizeof(ST_FORWARD_MSG) + sizeof(ST_RECORD) * data_size;
-            }
-        }
-        else {    // data - char* & data_size - length of the data
-            full_size = sizeof(ST_FORWARD_MSG) + data_size;
-        }
+        full_size = sizeof(ST_FORWARD_MSG) + data_size;
+        if( data_size <= FORWARD_MSG_SIZE ) {
 
-        memcpy(msg->imei, config->imei, SIZE_TRACKER_FIELD);
-        msg->encode = fa->forward_encode;
-        msg->len = data_size;
+            // ring buffer full: parcel dropped, counted by ring & logged by forwarder
+            place = ring_reserve(fa->forward_ring, full_size, &ticket);
+            if( place ) {
+                memcpy(&place[sizeof(ST_FORWARD_MSG)], data, data_size);
 
-        if( full_size <= SOCKET_BUF_SIZE ) {
-            memcpy(&forward_buf[sizeof(ST_FORWARD_MSG)], data, full_size - sizeof(ST_FORWARD_MSG));
+                msg = (ST_FORWARD_MSG *)place;
+                memcpy(msg->imei, config->imei, SIZE_TRACKER_FIELD);
+                msg->encode = encode;
+                msg->len = len;
+                ring_commit(fa->forward_ring, ticket);
+                retval = 1;
 
-            if( send(fa->forward_socket, forward_buf, full_size, 0) <= 0 ) {    // socket error
-                logging("%s[%ld]: send(forward_socket) error %d: %s\n", config->listener->name, syscall(SYS_gettid), errno, strerror(errno));
-                set_forward_socket(config, NULL, &fa->forward_socket);    // close socket
-            }    // if( send(
-            else {
                 if( stConfigServer.log_enable > 1 && config->listener->log_all ){
-                    if( msg->encode )
-                        logging("%s[%d:%ld]: %s: send to forward %d records, encode=%d\n", config->listener->name, config->listener->port, syscall(SYS_gettid), msg->imei, msg->len, msg->encode);
+                    if( encode )
+                        logging("%s[%d:%ld]: %s: send to forward %d records, encode=%d\n", config->listener->name, config->listener->port, syscall(SYS_gettid), config->imei, len, encode);
                     else
-                        logging("%s[%d:%ld]: %s: send to forward %d bytes, encode=%d\n", config->listener->name, config->listener->port, syscall(SYS_gettid), msg->imei, msg->len, msg->encode);
+                        logging("%s[%d:%ld]: %s: send to forward %d bytes, encode=%d\n", config->listener->name, config->listener->port, syscall(SYS_gettid), config->imei, len, encode);
                 }
-            }    // else if( send(
+            }    // if( place )
         }
         else {
             if( stConfigServer.log_enable )
-                logging("%s[%ld]: send_data_to_forward: %s full_size(%ld) > SOCKET_BUF_SIZE\n", config->listener->name, syscall(SYS_gettid), msg->imei, full_size);
-        }    // else if( full_size <= SOCKET_BUF_SIZE )
+                logging("%s[%ld]: send_data_to_forward: %s data_size(%zu) > FORWARD_MSG_SIZE\n", config->listener->name, syscall(SYS_gettid), config->imei, data_size);
+        }    // else if( data_size <= FORWARD_MSG_SIZE )
 
-    }    // if( data && data_size )
+    }    // if( data && data_size && len )
     else {
         if( stConfigServer.log_enable > 1 && config->listener->log_all ){
             if( data_size )
@@ -183,7 +171,94 @@ static void send_data_to_forward(ST_WORKER *config, void *data, int data_size, S
             else
                 logging("%s[%d:%ld]: send_data_to_forward: %s data_size <= 0\n", config->listener->name, config->listener->port, syscall(SYS_gettid), config->imei);
         }    // if( stConfigServer.log_enable > 1 && config->listener->log_all )
-    }    // else if( data && data_size )
+    }    // else if( data && data_size && len )
+
+    return retval;
+}
+//------------------------------------------------------------------------------
+
+/*
+    forward packed records to the group of forwarders of the same protocol,
+    records encoded once by first of them (ST_FORWARD_SHARED)
+    data - packed records (forward_pack)
+    data_size - size of the data in bytes
+    len - number of the packed records
+    group - index of the first forwarder of the group in config->forward_attr
+*/
+static void send_shared_to_forward(ST_WORKER *config, char *data, size_t data_size, int len, int group)
+{
+    ST_FORWARD_SHARED *shared;
+    unsigned int i;
+    int refs = 0;
+
+    for( i = group; i < config->forward_count; ++i) {
+        if( config->forward_attr[i].forward_ring && config->forward_attr[i].forward_group == group )
+            ++refs;
+    }
+
+    shared = forward_shared_create(data, data_size, refs);
+
+    for( i = group; i < config->forward_count; ++i) {
+        if( !config->forward_attr[i].forward_ring || config->forward_attr[i].forward_group != group )
+            continue;
+
+        if( !shared )    // not enough memory: each forwarder encodes records
+            send_data_to_forward(config, data, data_size, len, &config->forward_attr[i], config->forward_attr[i].forward_encode);
+        else if( !send_data_to_forward(config, (char *)&shared, sizeof(shared), len, &config->forward_attr[i], FORWARD_ENCODE_SHARED) )
+            forward_shared_release(shared);    // ring buffer full
+    }
+}
+//------------------------------------------------------------------------------
+
+/*
+    database thread of the terminal: FNV-1a hash of IMEI,
+    so records of one terminal always written in order by one thread
+    return number of the ring buffer (db_rings)
+*/
+static unsigned int db_shard_of(const char *imei)
+{
+    uint32_t hash = 2166136261u;
+
+    if( db_shards < 2 )
+        return 0;
+
+    while( *imei ) {
+        hash ^= (unsigned char)*imei++;
+        hash *= 16777619u;
+    }
+    return hash % db_shards;
+}
+//------------------------------------------------------------------------------
+
+/*
+    send packed records to ring buffers of all database libraries or queue,
+    if ring buffer is full - to spool of the library (db_spools)
+    shard - number of the ring buffer (db_shard_of)
+    msg - packed records (record.h)
+    size - size of the msg
+*/
+static void send_message_to_db(ST_WORKER *config, unsigned int shard, char *msg, size_t size)
+{
+    unsigned int sink;
+
+    if( db_shards ) {
+        for(sink = 0; sink < db_sinks; sink++) {
+            if( !ring_write(db_rings[sink][shard], msg, size) && !spool_write(db_spools[sink], msg, size) )
+                logging("%s[%ld]: ring_write(db_rings[%u][%u]) ring buffer is already full, used %zu bytes\n", config->listener->name, syscall(SYS_gettid), sink, shard, ring_used(db_rings[sink][shard]));
+        }
+        return;
+    }
+
+    if( mq_send(config->db_queue, msg, size, 0) < 0 ) {
+        switch(errno) {
+        case EAGAIN:
+            if( !spool_write(db_spools[0], msg, size) )
+                logging("%s[%ld]: mq_send(config->db_queue) message queue is already full\n", config->listener->name, syscall(SYS_gettid));
+            break;
+        default:
+            logging("%s[%ld]: mq_send(config->db_queue) error %d: %s\n", config->listener->name, syscall(SYS_gettid), errno, strerror(errno));
+        }    // switch(errno)
+    }    // if( mq_send(
 }
 //------------------------------------------------------------------------------
 
@@ -191,14 +266,21 @@ static void send_data_to_forward(ST_WORKER *config, void *data, int data_size, S
     write terminal data to DB function
     records - set of terminal records
     count - number of records
+    records packed (record.h), as many as fit into one message of the ring buffer or queue,
+    message contains records of one database thread (db_shard_of)
 */
 static void send_data_to_db(ST_WORKER *config, ST_RECORD *records, unsigned int count)
 {
-    unsigned int r;
+    char msg[DB_RING_MSG_SIZE];    // message to database
+    size_t size = 0, packed_size, msg_size;
+    unsigned int r, shard = 0, record_shard;
 
-    if( !records || count <= 0 || config->db_queue == BAD_OBJ )
+    if( !records || count <= 0 || (!db_shards && config->db_queue == BAD_OBJ) )
         return;
 
+    // message of the POSIX queue limited by mq_msgsize (see pg.c)
+    msg_size = db_shards ? DB_RING_MSG_SIZE : RECORD_PACKED_MAX;
+
     for(r = 0; r < count; r++) {    // for all decoded records
 
         if( records[r].imei[0] ) {    // if IMEI decoded
@@ -207,23 +289,354 @@ static void send_data_to_db(ST_WORKER *config, ST_RECORD *records, unsigned int
             // write IP-address of terminal to record
             strncpy(records[r].ip, config->ip, SIZE_TRACKER_FIELD);
 
-            // send message into database queue
-            if( mq_send(config->db_queue, (const char *)&records[r], sizeof(ST_RECORD), 0) < 0 ) {
-                switch(errno) {
-                case EAGAIN:
-                    logging("%s[%ld]: mq_send(config->db_queue) message queue is already full\n", config->listener->name, syscall(SYS_gettid));
-                    break;
-                default:
-                    logging("%s[%ld]: mq_send(config->db_queue) error %d: %s\n", config->listener->name, syscall(SYS_gettid), errno, strerror(errno));
-                }    // switch(errno)
-            }    // if( mq_send(
+            // record of the other database thread, send message
+            record_shard = db_shard_of(records[r].imei);
+            if( record_shard != shard && size ) {
+                send_message_to_db(config, shard, msg, size);
+                size = 0;
+            }
+            shard = record_shard;
+
+            packed_size = record_pack(&records[r], &msg[size], msg_size - size);
+            if( !packed_size && size ) {    // message is full, send it
+                send_message_to_db(config, shard, msg, size);
+                size = 0;
+                packed_size = record_pack(&records[r], msg, msg_size);
+            }
+            size += packed_size;
 
         }    // if( strlen(records[r].imei) )
 
     }    // for(r = 0; r < count; r++)
+
+    if( size )
+        send_message_to_db(config, shard, msg, size);
 }
 //------------------------------------------------------------------------------
 
+/*
+    prepare worker to serve terminal
+    config - pointer to ST_WORKER structure (worker.h)
+    return 1 if success & 0 if error
+*/
+int worker_prepare(ST_WORKER *config)
+{
+    // test exists decode functions
+    if( !config->listener ) {
+        logging("worker[%ld]: listener configuration not defined, exit\n", syscall(SYS_gettid));
+        return 0;
+    }
+    if( !config->listener->terminal_decode || !config->listener->terminal_encode ) {
+        logging("%s[%ld]: %s.so not loaded, exit\n", config->listener->name, syscall(SYS_gettid), config->listener->name);
+        return 0;
+    }
+
+    // set socket to non-blocking mode
+    if( fcntl(config->client_socket, F_SETFL, O_NONBLOCK) < 0 ) {
+        logging("%s[%ld]: fcntl(client_socket) error %d: %s\n", config->listener->name, syscall(SYS_gettid), errno, strerror(errno));
+        return 0;
+    }
+
+    // decoder state of the terminal, freed by worker_release
+    if( config->listener->terminal_session_create && !config->session ) {
+        config->session = config->listener->terminal_session_create();
+        if( !config->session ) {
+            logging("%s[%ld]: terminal_session_create() error, exit\n", config->listener->name, syscall(SYS_gettid));
+            return 0;
+        }
+    }
+
+    // reset forwarding attributes
+    config->forward_tested = 0;
+    config->forward_count = 0;
+    memset(config->forward_attr, 0, sizeof(ST_FORWARD_ATTR) * MAX_FORWARDS);
+
+    return 1;
+}
+//------------------------------------------------------------------------------
+
+/*
+    process parcel, received from terminal:
+    decode, save to database, forward & answer to terminal
+    config - pointer to ST_WORKER structure (worker.h)
+    socket_buf - parcel
+    bytes_read - size of the parcel
+    answer - decoded data, answer.lastpoint must be kept between calls
+    return 1 if success & 0 if terminal must be disconnected
+*/
+int worker_process(ST_WORKER *config, char *socket_buf, ssize_t bytes_read, ST_ANSWER *answer)
+{
+    static __thread unsigned int i;
+    static __thread ssize_t bytes_write;
+    static __thread char l2fname[FILENAME_MAX];        // terminal log file name
+    static __thread int capture;                        // flag: parcel & answer captured
+    static __thread char forward_buf[FORWARD_MSG_SIZE];  // records packed once for all forwarders with encode
+    static __thread size_t packed_size;
+    static __thread int packed_count, packed_first;
+    static __thread ssize_t raw_pos, raw_size;
+
+    if( stConfigServer.log_enable > 1 && config->listener->log_all )
+        logging("%s[%d:%ld]: socket read %zd bytes from %s\n", config->listener->name, config->listener->port, syscall(SYS_gettid), bytes_read, config->ip);
+
+    // decode terminal message
+    pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);    // do not disturb :)
+    config->listener->terminal_decode(socket_buf, bytes_read, answer, config, config->session);
+    pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);  // can disturb :)
+
+    // set config imei
+    if( strcmp(config->imei, answer->lastpoint.imei) ){
+        strcpy(config->imei, answer->lastpoint.imei);
+
+        if( stConfigServer.log_enable > 1 && config->listener->log_all )
+            logging("%s[%d:%ld]: assigned imei %s\n", config->listener->name, config->listener->port, syscall(SYS_gettid), answer->lastpoint.imei);
+    }
+
+    if( stConfigServer.log_enable > 1 && config->listener->log_all )
+        logging("%s[%d:%ld]: decoded %u records, answer.size %u bytes\n", config->listener->name, config->listener->port, syscall(SYS_gettid), answer->count, answer->size);
+
+    /* log error: parcel without decoded records */
+    if( config->listener->log_err && bytes_read > 16 && answer->count == 0 ){
+        snprintf(l2fname, FILENAME_MAX, "%s/logs/%s_len_%zu_norecords", stParams.start_path, config->listener->name, bytes_read);
+        log2file(l2fname, socket_buf, bytes_read);
+    }
+
+    // capture terminal message (capture.c)
+    capture = config->listener->log_all || (stConfigServer.log_imei[0] && !strcmp(stConfigServer.log_imei, answer->lastpoint.imei));
+    if( capture )
+        capture_write(CAPTURE_IN, config->listener->name, config->listener->port, answer->lastpoint.imei, &config->client_addr, socket_buf, bytes_read);
+
+    // save terminal data to DB
+    if( answer->count ) {
+        send_data_to_db(config, answer->records, answer->count);
+
+        if( stConfigServer.log_enable > 1 && config->listener->log_all )
+            logging("%s[%d:%ld]: %s saved %d records\n", config->listener->name, config->listener->port, syscall(SYS_gettid), answer->lastpoint.imei, answer->count);
+    }    // if( answer->count )
+
+    // test for retranslation
+    if( !config->forward_tested && config->imei[0] ) {    // before not tested & imey exists
+        ++config->forward_tested;    // set flag to test fired
+
+        // is forwarding need ?
+        config->forward_count = test_forward(config, config->imei, config->forward_attr);
+    }    // if( !config->forward_tested && config->imei[0] )
+
+    // forwarding
+    if( config->forward_count ) {
+        // records packed once for all forwarders with encode, in some messages if not fit into one
+        for( packed_first = 0; packed_first < answer->count; packed_first += packed_count ) {
+            packed_size = forward_pack(&answer->records[packed_first], answer->count - packed_first, forward_buf, &packed_count);
+            if( !packed_count )
+                break;
+
+            for( i = 0; i < config->forward_count; ++i) {
+                if( !config->forward_attr[i].forward_ring || !config->forward_attr[i].forward_encode )    // terminal & forward protocols equal
+                    continue;
+
+                if( config->forward_attr[i].forward_group < 0 )
+                    send_data_to_forward(config, forward_buf, packed_size, packed_count, &config->forward_attr[i], config->forward_attr[i].forward_encode);    // forward decoded records
+                else if( config->forward_attr[i].forward_group == (int)i )
+                    send_shared_to_forward(config, forward_buf, packed_size, packed_count, i);    // encoded once for the group
+            }
+        }    // for( packed_first = 0;
+
+        // raw data in some messages if not fit into one, forwarder sends it one after another
+        for( i = 0; i < config->forward_count; ++i) {
+            if( config->forward_attr[i].forward_ring && !config->forward_attr[i].forward_encode ) {    // terminal & forward protocols is equal
+                for( raw_pos = 0; raw_pos < bytes_read; raw_pos += raw_size ) {
+                    raw_size = bytes_read - raw_pos < (ssize_t)FORWARD_MSG_SIZE ? bytes_read - raw_pos : (ssize_t)FORWARD_MSG_SIZE;
+                    send_data_to_forward(config, &socket_buf[raw_pos], raw_size, raw_size, &config->forward_attr[i], config->forward_attr[i].forward_encode);    // forward raw data
+                }
+            }
+        }    // for( i = 0; i < config->forward_count; i++)
+    }    // config->forward_count
+
+    // answer to terminal
+    if( answer->size ) {
+        if( config->answer_send )
+            bytes_write = config->answer_send(config, answer->answer, answer->size);
+        else if(config->listener->protocol == SOCK_STREAM)
+            bytes_write = send(config->client_socket, answer->answer, answer->size, 0);
+        else
+            bytes_write = sendto(config->client_socket, answer->answer, answer->size, 0, (struct sockaddr *)&config->client_addr, sizeof(struct sockaddr_in));
+
+        if( bytes_write <= 0 ){    // socket write error
+            if( config->listener->log_err || (stConfigServer.log_enable > 1 && config->listener->log_all) )
+                logging("%s[%d:%ld]: sended to terminal error %d: %s\n", config->listener->name, config->listener->port, syscall(SYS_gettid), errno, strerror(errno));
+            return 0;
+        }
+        else if( stConfigServer.log_enable > 1 && config->listener->log_all )
+            logging("%s[%d:%ld]: sended to terminal %zu bytes\n", config->listener->name, config->listener->port, syscall(SYS_gettid), bytes_write);
+
+        // capture answer to terminal
+        if( capture )
+            capture_write(CAPTURE_OUT, config->listener->name, config->listener->port, answer->lastpoint.imei, &config->client_addr, answer->answer, answer->size);
+    }    // if( answer->size )
+
+    return 1;
+}
+//------------------------------------------------------------------------------
+
+/*
+    process one frame of the terminal
+    frame must have 1 byte after it: temporarily replaced by terminating 0 for text protocols
+    return 1 if success & 0 if terminal must be disconnected
+*/
+static int worker_frame(ST_WORKER *config, char *frame, ssize_t frame_size, ST_ANSWER *answer)
+{
+    char next = frame[frame_size];
+    int retval;
+
+    // clear answer counters, but save lastpoint; records cleared by decoder (de.h)
+    answer_reset(answer);
+
+    frame[frame_size] = 0;
+    retval = worker_process(config, frame, frame_size, answer);
+    frame[frame_size] = next;
+
+    return retval;
+}
+//------------------------------------------------------------------------------
+
+/*
+    process all whole frames in buffer
+    buf - data, begins with frame
+    size - size of the data
+    return number of the processed bytes (rest is incomplete frame) or -1 if terminal must be disconnected
+*/
+static ssize_t worker_frames(ST_WORKER *config, char *buf, ssize_t size, ST_ANSWER *answer)
+{
+    ssize_t used = 0;
+    int frame_size;
+
+    while( used < size ) {
+        frame_size = config->listener->terminal_frame_length(&buf[used], size - used);
+
+        if( frame_size < 0 || frame_size > SOCKET_BUF_SIZE ) {    // not recognized, decode as is
+            frame_size = size - used;
+        }
+        else if( frame_size == 0 || frame_size > size - used ) {    // incomplete frame
+            if( size - used < SOCKET_BUF_SIZE )
+                break;    // wait the rest
+
+            frame_size = size - used;    // buffer full, but frame not found
+        }
+
+        if( !worker_frame(config, &buf[used], frame_size, answer) )
+            return -1;
+
+        used += frame_size;
+    }    // while( used < size )
+
+    return used;
+}
+//------------------------------------------------------------------------------
+
+/*
+    process data, received from terminal:
+    if protocol library has terminal_frame_length (de.h), split data into frames
+    & keep incomplete frame until next data received,
+    else process data as is
+    config - pointer to ST_WORKER structure (worker.h)
+    socket_buf - data, must have 1 byte after data (socket_buf[bytes_read])
+    bytes_read - size of the data
+    answer - decoded data, answer.lastpoint must be kept between calls
+    return 1 if success & 0 if terminal must be disconnected
+*/
+int worker_receive(ST_WORKER *config, char *socket_buf, ssize_t bytes_read, ST_ANSWER *answer)
+{
+    ssize_t pos = 0, used, n;
+
+    if( !config->listener->terminal_frame_length || config->listener->protocol != SOCK_STREAM )
+        return worker_frame(config, socket_buf, bytes_read, answer);
+
+    while( pos < bytes_read ) {
+
+        if( config->frame_size ) {    // complete the frame, received before
+            n = MIN(bytes_read - pos, SOCKET_BUF_SIZE - config->frame_size);
+            memcpy(&config->frame_buf[config->frame_size], &socket_buf[pos], n);
+            config->frame_size += n;
+            pos += n;
+
+            used = worker_frames(config, config->frame_buf, config->frame_size, answer);
+            if( used < 0 )
+                return 0;
+
+            config->frame_size -= used;
+            if( config->frame_size && used )
+                memmove(config->frame_buf, &config->frame_buf[used], config->frame_size);
+        }
+        else {    // frames directly from socket buffer
+            used = worker_frames(config, &socket_buf[pos], bytes_read - pos, answer);
+            if( used < 0 )
+                return 0;
+            pos += used;
+
+            if( pos < bytes_read ) {    // save incomplete frame
+                if( !config->frame_buf ) {
+                    config->frame_buf = (char *)malloc(SOCKET_BUF_SIZE + 1);
+                    if( !config->frame_buf ) {
+                        logging("%s[%ld]: malloc(frame_buf) error %d: %s\n", config->listener->name, syscall(SYS_gettid), errno, strerror(errno));
+                        return 0;
+                    }
+                }
+
+                config->frame_size = bytes_read - pos;
+                memcpy(config->frame_buf, &socket_buf[pos], config->frame_size);
+                pos = bytes_read;
+            }
+        }    // else if( config->frame_size )
+
+    }    // while( pos < bytes_read )
+
+    if( config->frame_size && stConfigServer.log_enable > 1 && config->listener->log_all )
+        logging("%s[%d:%ld]: wait the rest of the frame, %u bytes received\n", config->listener->name, config->listener->port, syscall(SYS_gettid), config->frame_size);
+
+    return 1;
+}
+//------------------------------------------------------------------------------
+
+/*
+    free resources of the worker
+    config - pointer to ST_WORKER structure (worker.h), freed here
+*/
+void worker_release(ST_WORKER *config)
+{
+    if( !config )
+        return;
+
+    // close terminal socket
+    if( config->client_socket != BAD_OBJ ) {
+        shutdown(config->client_socket, SHUT_RDWR); // gracefully
+        close(config->client_socket);
+    }
+
+    // incomplete frame
+    if( config->frame_buf ) {
+        free(config->frame_buf);
+    }
+
+    // decoder state
+    if( config->session && config->listener && config->listener->terminal_session_destroy ) {
+        config->listener->terminal_session_destroy(config->session);
+    }
+
+    // close database queue, event loop's queue closed by event loop
+    if( !config->reactor && config->db_queue != BAD_OBJ ) {
+        mq_close(config->db_queue);
+    }
+
+    // log, if required
+    if( config->listener && stConfigServer.log_enable > 1 && config->listener->log_all ) {
+        if( config->imei[0] )   // imei exists
+            logging("%s[%d:%ld]: %s shutdown\n", config->listener->name, config->listener->port, syscall(SYS_gettid), config->imei);
+        else
+            logging("%s[%d:%ld]: shutdown\n", config->listener->name, config->listener->port, syscall(SYS_gettid));
+    }    // if( stConfigServer.log_enable )
+
+    free(config);
+}
+//------------------------------------------------------------------------------
 
 /*
     main thread function
@@ -232,16 +645,11 @@ static void send_data_to_db(ST_WORKER *config, ST_RECORD *records, unsigned int
 void *worker_thread(void *st_worker)
 {
     static __thread ST_WORKER *config;    // configuration of the worker
-    static __thread unsigned int i;
-    static __thread unsigned int forward_tested = 0;    // flag: 0 - test for forwarding not fired, 1 - fired
-    static __thread unsigned int forward_count = 0;    // flag & count of forwarders's sockets
-    static __thread ST_FORWARD_ATTR forward_attr[MAX_FORWARDS];
-    static __thread char socket_buf[SOCKET_BUF_SIZE];        // client socket buffer
+    static __thread char socket_buf[SOCKET_BUF_SIZE + 1];        // client socket buffer, +1 byte for terminating 0
     static __thread ssize_t bytes_read = 0, bytes_write = 0;    // for socket read/write operations
     static __thread ST_ANSWER answer;    // de.h
     static __thread fd_set rfds;
     static __thread struct timeval tv;
-    static __thread char l2fname[FILENAME_MAX];        // terminal log file name
 
     // error handler:
     void exit_worker(void * arg) {
@@ -249,36 +657,10 @@ void *worker_thread(void *st_worker)
 
         // free recources
         if( config ) {
-            // close terminal socket
-            if( config->client_socket != BAD_OBJ ) {
-                shutdown(config->client_socket, SHUT_RDWR); // gracefully
-                close(config->client_socket);
-            }
-
-            // close forwarding sockets
-            if( forward_count ) {
-                for( i = 0; i < forward_count; i++) {
-                    set_forward_socket(config, NULL, &forward_attr[i].forward_socket);
-                }
-            }
-
-            // close database queue
-            if( config->db_queue != BAD_OBJ ) {
-                mq_close(config->db_queue);
-            }
-
-            // log, if required
-            if( stConfigServer.log_enable > 1 && config->listener->log_all ) {
-                if( config->imei[0] )   // imei exists
-                    logging("%s[%d:%ld]: %s shutdown\n", config->listener->name, config->listener->port, syscall(SYS_gettid), config->imei);
-                else
-                    logging("%s[%d:%ld]: shutdown\n", config->listener->name, config->listener->port, syscall(SYS_gettid));
-            }    // if( stConfigServer.log_enable )
-
-            free(config);
+            worker_release(config);
         }    // if( config )
         else {
-            logging("%s[%d:%ld]: imei %s: exit_worker(config=NULL)\n", config->listener->name, config->listener->port, syscall(SYS_gettid), config->imei);
+            logging("worker[%ld]: exit_worker(config=NULL)\n", syscall(SYS_gettid));
         }
     }
     //------------------------------------------------------------------------------
@@ -297,37 +679,25 @@ void *worker_thread(void *st_worker)
         return NULL;
     }
 
-    // test exists decode functions
-    if( !config->listener ) {
-        logging("worker[%ld]: listener configuration not defined, exit\n", syscall(SYS_gettid));
-        exit_worker(config);
-        return NULL;
-    }
-    if( !config->listener->terminal_decode || !config->listener->terminal_encode ) {
-        logging("%s[%ld]: %s.so not loaded, exit\n", config->listener->name, syscall(SYS_gettid), config->listener->name);
-        exit_worker(config);
-        return NULL;
-    }
-
-    // set socket to non-blocking mode
-    if( fcntl(config->client_socket, F_SETFL, O_NONBLOCK) < 0 ) {
-        logging("%s[%ld]: fcntl(client_socket) error %d: %s\n", config->listener->name, syscall(SYS_gettid), errno, strerror(errno));
+    config->db_queue = BAD_OBJ;
+    if( !worker_prepare(config) ) {
         exit_worker(config);
         return NULL;
     }
 
-    // prepare queue of messages (connect to existing queue)
-    config->db_queue = mq_open(QUEUE_WORKER, O_WRONLY | O_NONBLOCK);
-    if( config->db_queue < 0 ) {
-        logging("%s[%ld]: mq_open(%s) error %d: %s\n", config->listener->name, syscall(SYS_gettid), QUEUE_WORKER, errno, strerror(errno));
-        exit_worker(config);
-        return NULL;
+    // prepare queue of messages (connect to existing queue), if ring buffer not used
+    if( !db_shards ) {
+        config->db_queue = mq_open(QUEUE_WORKER, O_WRONLY | O_NONBLOCK);
+        if( config->db_queue < 0 ) {
+            logging("%s[%ld]: mq_open(%s) error %d: %s\n", config->listener->name, syscall(SYS_gettid), QUEUE_WORKER, errno, strerror(errno));
+            exit_worker(config);
+            return NULL;
+        }
     }
 
-    // first clear all
-    memset(&answer, 0, sizeof(ST_ANSWER));
-    // reset forwarding attributes
-    memset(forward_attr, 0, sizeof(ST_FORWARD_ATTR) * MAX_FORWARDS);
+    // first clear all, answer cleared before every frame by worker_receive
+    answer_reset(&answer);
+    memset(&answer.lastpoint, 0, sizeof(ST_RECORD));
 
     /*
         main cycle - terminal dialog
@@ -336,9 +706,6 @@ void *worker_thread(void *st_worker)
 
         pthread_testcancel();
 
-        // second - save lastpoint
-        memset(&answer, 0, sizeof(ST_ANSWER) - sizeof(ST_RECORD));
-
         // wait terminal message
         FD_ZERO(&rfds);
         FD_SET(config->client_socket, &rfds);
@@ -361,9 +728,14 @@ void *worker_thread(void *st_worker)
         }    // switch( select
 
         // read terminal message
-        memset(socket_buf, 0, SOCKET_BUF_SIZE);
-        if(config->listener->protocol == SOCK_STREAM){
+        if( config->listener->protocol == SOCK_STREAM && config->listener->terminal_frame_length ) {
+            // frames assembled by worker_receive, take only available data
+            bytes_read = recv(config->client_socket, socket_buf, SOCKET_BUF_SIZE, 0);
+        }
+        else if(config->listener->protocol == SOCK_STREAM){
 
+            // protocol library not split frames: wait the rest of the parcel
+            // (buffer not cleared, data terminated by worker_receive)
             bytes_read = 0;
             while( bytes_read < SOCKET_BUF_SIZE && (bytes_write = recv(config->client_socket, &socket_buf[bytes_read], SOCKET_BUF_SIZE-bytes_read, 0)) > 0 ){
                 bytes_read += bytes_write;
@@ -385,106 +757,12 @@ void *worker_thread(void *st_worker)
 
         }
 
-        if( stConfigServer.log_enable > 1 && config->listener->log_all )
-            logging("%s[%d:%ld]: socket read %zd bytes from %s\n", config->listener->name, config->listener->port, syscall(SYS_gettid), bytes_read, config->ip);
-
-        // decode terminal message
-        pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);    // do not disturb :)
-        config->listener->terminal_decode(socket_buf, bytes_read, &answer, config);
-        pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);  // can disturb :)
-
-        // set config imei
-        if( strcmp(config->imei, answer.lastpoint.imei) ){
-            strcpy(config->imei, answer.lastpoint.imei);
-
-            if( stConfigServer.log_enable > 1 && config->listener->log_all )
-                logging("%s[%d:%ld]: assigned imei %s\n", config->listener->name, config->listener->port, syscall(SYS_gettid), answer.lastpoint.imei);
-        }
-
-        if( stConfigServer.log_enable > 1 && config->listener->log_all )
-            logging("%s[%d:%ld]: decoded %u records, answer.size %u bytes\n", config->listener->name, config->listener->port, syscall(SYS_gettid), answer.count, answer.size);
-
-        /* log error: parcel without decoded records */
-        if( config->listener->log_err && bytes_read > 16 && answer.count == 0 ){
-            snprintf(l2fname, FILENAME_MAX, "%s/logs/%s_len_%zu_norecords", stParams.start_path, config->listener->name, bytes_read);
-            log2file(l2fname, socket_buf, bytes_read);
-        }
-
-        // logging all
-        if( config->listener->log_all ) {
-            if( answer.lastpoint.imei[0] )
-                snprintf(l2fname, FILENAME_MAX, "%s/logs/%s_%s", stParams.start_path, config->listener->name, answer.lastpoint.imei);
-            else
-                snprintf(l2fname, FILENAME_MAX, "%s/logs/%s_noimei", stParams.start_path, config->listener->name);
-
-            log2file(l2fname, socket_buf, bytes_read);
-        }    // if( config->listener->log_all )
-        else if( stConfigServer.log_imei[0] && stConfigServer.log_imei[0] == answer.lastpoint.imei[0] ){
-            // log terminal message
-            if( !strcmp(stConfigServer.log_imei, answer.lastpoint.imei) ){
-                snprintf(l2fname, FILENAME_MAX, "%s/logs/%s_parcel", stParams.start_path, answer.lastpoint.imei);
-                log2file(l2fname, socket_buf, bytes_read);
-            }
+        // decode, save, forward & answer
+        if( !worker_receive(config, socket_buf, bytes_read, &answer) ) {
+            exit_worker(config);
+            return NULL;
         }
 
-        // save terminal data to DB
-        if( answer.count ) {
-            send_data_to_db(config, answer.records, answer.count);
-
-            if( stConfigServer.log_enable > 1 && config->listener->log_all )
-                logging("%s[%d:%ld]: %s saved %d records\n", config->listener->name, config->listener->port, syscall(SYS_gettid), answer.lastpoint.imei, answer.count);
-        }    // if( answer.count )
-
-        // test for retranslation
-        if( !forward_tested && config->imei[0] ) {    // before not tested & imey exists
-            ++forward_tested;    // set flag to test fired
-
-            // is forwarding need ?
-            forward_count = test_forward(config, config->imei, forward_attr);
-        }    // if( !forward_tested && config->imei[0] )
-
-        // forwarding
-        if( forward_count ) {
-            for( i = 0; i < forward_count; ++i) {
-
-                if( forward_attr[i].forward_socket != BAD_OBJ ) {
-
-                    if( forward_attr[i].forward_encode ) {    // terminal & forward protocols not equal
-                        send_data_to_forward(config, answer.records, answer.count, &forward_attr[i]);    // forward decoded records
-                    }
-                    else { // terminal & forward protocols is equal
-                        send_data_to_forward(config, socket_buf, bytes_read, &forward_attr[i]);    // forward raw data
-                    }
-                }    // if( forward_attr[i].forward_socket != BAD_OBJ )
-
-            }    // for( i = 0; i < forward_count; i++)
-        }    // forward_count
-
-        // answer to terminal
-        if( answer.size ) {
-            if(config->listener->protocol == SOCK_STREAM)
-                bytes_write = send(config->client_socket, answer.answer, answer.size, 0);
-            else
-                bytes_write = sendto(config->client_socket, answer.answer, answer.size, 0, (struct sockaddr *)&config->client_addr, sizeof(struct sockaddr_in));
-
-            if( bytes_write <= 0 ){    // socket write error
-                if( config->listener->log_err || (stConfigServer.log_enable > 1 && config->listener->log_all) )
-                    logging("%s[%d:%ld]: sended to terminal error %d: %s\n", config->listener->name, config->listener->port, syscall(SYS_gettid), errno, strerror(errno));
-                exit_worker(config);
-                return NULL;
-            }
-            else if( stConfigServer.log_enable > 1 && config->listener->log_all )
-                logging("%s[%d:%ld]: sended to terminal %zu bytes\n", config->listener->name, config->listener->port, syscall(SYS_gettid), bytes_write);
-
-            // log answer to terminal
-            if( stConfigServer.log_imei[0] && stConfigServer.log_imei[0] == answer.lastpoint.imei[0] ){
-                if( !strcmp(stConfigServer.log_imei, answer.lastpoint.imei) ){
-                    snprintf(l2fname, FILENAME_MAX, "%s/logs/%s_answer", stParams.start_path, answer.lastpoint.imei);
-                    log2file(l2fname, answer.answer, answer.size);
-                }
-            }
-        }    // if( answer.size )
-
     }    // while( 1 )
 
     /*
@@ -10,13 +10,14 @@
 
 // forwarder's attributes structure
 typedef struct {
-	int forward_socket; // socket for forwarding
+	ST_RING *forward_ring;	// ring buffer of the forwarder (forwarder_ring), not freed
 	int forward_encode;	// flag for encode data into another protocol for forward
 	int forward_index;	// index of forwarder in forwarders list
+	int forward_group;	// index of the first forward_attr of the same protocol, encoded once (ST_FORWARD_SHARED), or -1
 } ST_FORWARD_ATTR;
 
 // worker structure
-typedef struct {
+typedef struct ST_WORKER {
 	pthread_t thread;	// thread ID
 	int client_socket;	// client (gps/glonass terminal) socket
 	struct sockaddr_in client_addr;
@@ -24,8 +25,28 @@ typedef struct {
 	char imei[SIZE_TRACKER_FIELD];	// may be volatile!!!
 	ST_LISTENER *listener;	// pointer to listener structure
 	mqd_t db_queue;		// Posix IPC queue, created in database module (e.g. pg.c for PostgreSQL)
+	unsigned int forward_tested;	// flag: 0 - test for forwarding not fired, 1 - fired
+	unsigned int forward_count;		// flag & count of forwarders's sockets
+	ST_FORWARD_ATTR forward_attr[MAX_FORWARDS];
+	char *frame_buf;	// incomplete frame of the terminal (see terminal_frame_length in de.h), SOCKET_BUF_SIZE + 1 bytes
+	unsigned int frame_size;	// size of the incomplete frame
+	void *session;		// decoder state of the terminal (see terminal_session_create in de.h) or NULL
+	/* event loop mode only (see reactor.c) */
+	void *reactor;		// event loop, served this terminal, NULL in thread mode
+	time_t last_activity;	// time of the last parcel from terminal
+	struct ST_WORKER *prev, *next;	// list of the terminals, ordered by last_activity
+	ST_RECORD lastpoint;	// last navigation data, kept between parcels
+	/* io_uring event loop only (see uring.c) */
+	unsigned int pending;	// number of the io_uring operations in progress
+	int closing;		// flag: terminal disconnected, wait for pending operations
+	void *tx_first, *tx_last;	// queue of the answers to terminal, waiting for send
+	ssize_t (*answer_send)(struct ST_WORKER *, char *, size_t);	// send answer to terminal, NULL - send()
 } ST_WORKER;
 
 void *worker_thread(void *st_worker);
+int worker_prepare(ST_WORKER *config);
+int worker_process(ST_WORKER *config, char *socket_buf, ssize_t bytes_read, ST_ANSWER *answer);
+int worker_receive(ST_WORKER *config, char *socket_buf, ssize_t bytes_read, ST_ANSWER *answer);
+void worker_release(ST_WORKER *config);
 
 #endif